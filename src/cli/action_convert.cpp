@@ -16,10 +16,15 @@
 #include "VTFLib.h"
 
 #include "action_convert.hpp"
+#include "batch.hpp"
 #include "common/enums.hpp"
+#include "common/hash.hpp"
 #include "common/image.hpp"
 #include "common/util.hpp"
+#include "common/vtfheader.hpp"
+#include "common/vtfio.hpp"
 #include "common/vtftools.hpp"
+#include "common/vtex2_version.h"
 
 // Windows garbage!!
 #undef min
@@ -48,9 +53,19 @@ namespace opts
 	static int toDX;
 	static int quiet;
 	static int swizzle;
+	static int jobs;
+	static int readahead;
+	static int maxmemory;
+	static int cache;
+	static int bcquality;
+	static int mipfilter;
+	static int stream;
 } // namespace opts
 
 static bool get_version_from_str(const std::string& str, int& major, int& minor);
+static std::uint64_t options_hash(const OptionList& opts);
+static double estimate_cost(const OptionList& opts, const std::filesystem::path& path);
+static std::uint64_t estimate_memory(const OptionList& opts, const std::filesystem::path& path);
 
 std::string ActionConvert::get_help() const {
 	return "Convert a generic image file to VTF";
@@ -244,6 +259,63 @@ const OptionList& ActionConvert::get_options() const {
 				.type(OptType::String)
 				.help("Perform an in-place swizzle on the image data")
 		);
+
+		opts::jobs = opts.add(
+			ActionOption()
+				.short_opt("-j")
+				.long_opt("--jobs")
+				.type(OptType::Int)
+				.value(1)
+				.help("Number of files to convert at once when processing a directory. 0 = one per hardware thread"));
+
+		opts::readahead = opts.add(
+			ActionOption()
+				.long_opt("--read-ahead")
+				.type(OptType::Int)
+				.value(4)
+				.help(
+					"Number of files to load ahead of, and queue for writing behind, the ones being converted when "
+					"processing a directory. 0 = read and write every file in line"));
+
+		opts::maxmemory = opts.add(
+			ActionOption()
+				.long_opt("--max-memory")
+				.type(OptType::Int)
+				.value(0)
+				.help(
+					"Rough limit in MiB on the memory used by files converted at once when processing a directory. "
+					"0 = no limit"));
+
+		opts::cache = opts.add(
+			ActionOption()
+				.long_opt("--cache")
+				.type(OptType::String)
+				.value("")
+				.help("Manifest file used to skip files whose source and options haven't changed since the last run"));
+
+		opts::bcquality = opts.add(
+			ActionOption()
+				.long_opt("--bc-quality")
+				.type(OptType::String)
+				.value("normal")
+				.choices({"fast", "normal", "high"})
+				.help("Speed/quality tradeoff of the DXT1, DXT3, DXT5, ATI1N, ATI2N and BC7 encoder"));
+
+		opts::mipfilter = opts.add(
+			ActionOption()
+				.long_opt("--mip-filter")
+				.type(OptType::String)
+				.value("catrom")
+				.choices({"box", "kaiser", "catrom"})
+				.help("Filter used to generate each mip from the one above it"));
+
+		opts::stream = opts.add(
+			ActionOption()
+				.long_opt("--stream")
+				.type(OptType::Bool)
+				.value(false)
+				.help("Resize, mip and compress images a strip at a time, using far less memory on large images. "
+					  "Ignored for VTF input"));
 	};
 	return opts;
 }
@@ -253,36 +325,78 @@ int ActionConvert::exec(const OptionList& opts) {
 	auto recursive = opts.get<bool>(opts::recursive);
 	auto file = opts.get<std::string>(opts::file);
 
+	// Load the conversion cache, if requested
+	if (opts.has(opts::cache)) {
+		const auto manifest = opts.get<std::string>(opts::cache);
+		m_cache = std::make_unique<ConvertCache>();
+		if (!m_cache->load(manifest)) {
+			std::cerr << fmt::format("Could not read cache manifest '{}'\n", manifest);
+			return 1;
+		}
+		m_optionsHash = options_hash(opts);
+	}
+
+	bool ok = true;
 	if (std::filesystem::is_directory(file)) {
-		if (recursive) {
-			auto it = std::filesystem::recursive_directory_iterator(file);
-			for (auto& dirent : it) {
-				if (dirent.is_directory())
-					continue;
-				// check that we're actually a convertable file
-				if (imglib::image_get_format_from_file(dirent.path().string().c_str()) == imglib::FileFormat::None)
-					continue;
-				if (!process_file(opts, dirent, ""))
-					return 1;
-			}
+		// Only pick up files that we're actually able to convert
+		auto files = collect_files(
+			file, recursive,
+			[](const std::filesystem::path& path)
+			{
+				return imglib::image_get_format_from_file(path.string().c_str()) != imglib::FileFormat::None;
+			});
+
+		// Serial batches keep the old behavior of stopping at the first failure
+		Batch batch(opts.get<int>(opts::jobs), !opts.has(opts::jobs));
+		batch.set_cost_estimate(
+			[&opts](const std::filesystem::path& path)
+			{
+				return estimate_cost(opts, path);
+			});
+
+		// Smaller files are started in between the big ones for as long as they fit the budget
+		if (opts.get<int>(opts::maxmemory) > 0) {
+			batch.set_memory_budget(
+				std::uint64_t(opts.get<int>(opts::maxmemory)) * 1024 * 1024,
+				[&opts](const std::filesystem::path& path)
+				{
+					return estimate_memory(opts, path);
+				});
 		}
-		else {
-			auto it = std::filesystem::directory_iterator(file);
-			for (auto& dirent : it) {
-				if (dirent.is_directory())
-					continue;
-				// check that we're actually a convertable file
-				if (imglib::image_get_format_from_file(dirent.path().string().c_str()) == imglib::FileFormat::None)
-					continue;
-				if (!process_file(opts, dirent, ""))
-					return 1;
-			}
+
+		// Reading the next files and writing the last ones overlaps with converting the current ones
+		const auto readAhead = std::max(opts.get<int>(opts::readahead), 0);
+		batch.set_read_ahead(readAhead);
+		if (readAhead > 0)
+			m_writer = std::make_unique<WriteBehind>(readAhead);
+
+		ok = batch.run(
+			files,
+			[this, &opts](const std::filesystem::path& path)
+			{
+				return process_file(opts, path, "");
+			});
+
+		if (m_writer) {
+			m_writer->finish();
+			for (auto& failed : m_writer->failed())
+				batch.mark_failed(failed);
+			ok = ok && m_writer->failed().empty();
+			m_writer.reset();
 		}
-		return 0;
+
+		if (batch.parallel() && !opts.get<bool>(opts::quiet))
+			batch.print_summary("Converted");
 	}
 	else {
-		return process_file(opts, file, outfile) ? 0 : 1;
+		ok = process_file(opts, file, outfile);
 	}
+
+	// Persist whatever we managed to convert, even if some files failed
+	if (m_cache && !m_cache->save())
+		std::cerr << fmt::format("Could not write cache manifest '{}'\n", opts.get<std::string>(opts::cache));
+
+	return ok ? 0 : 1;
 }
 
 void ActionConvert::cleanup() {
@@ -291,7 +405,8 @@ void ActionConvert::cleanup() {
 bool ActionConvert::process_file(
 	const OptionList& opts, const std::filesystem::path& srcFile, const std::filesystem::path& userOutputFile) {
 
-	m_opts = &opts;
+	ConvertState state;
+	state.opts = &opts;
 
 	const auto formatStr = opts.get<std::string>(opts::format);
 	const auto srgb = opts.get<bool>(opts::srgb);
@@ -300,16 +415,38 @@ bool ActionConvert::process_file(
 	const auto isNormal = opts.get<bool>(opts::normal);
 
 	auto nomips = opts.get<bool>(opts::nomips);
-	m_mips = nomips ? 1 : std::max(opts.get<int>(opts::mips), 1);
+	state.mips = nomips ? 1 : std::max(opts.get<int>(opts::mips), 1);
 	// If mips is not provided, we'll use a default later on
 	if (!opts.has(opts::mips) && !nomips)
-		m_mips = -1;
+		state.mips = -1;
+
+	state.width = opts.get<int>(opts::width);
+	state.height = opts.get<int>(opts::height);
+	state.stream = opts.get<bool>(opts::stream);
+
+	if (isNormal && opts.get<bool>(opts::toDX))
+		state.procFlags |= imglib::PROC_GL_TO_DX_NORM;
 
-	m_width = opts.get<int>(opts::width);
-	m_height = opts.get<int>(opts::height);
+	if (!bcn::parse_quality(opts.get<std::string>(opts::bcquality).c_str(), state.bcQuality)) {
+		std::cerr << fmt::format("Invalid block compression quality '{}'\n", opts.get<std::string>(opts::bcquality));
+		return false;
+	}
+
+	if (!imglib::parse_mip_filter(opts.get<std::string>(opts::mipfilter).c_str(), state.mipFilter)) {
+		std::cerr << fmt::format("Invalid mip filter '{}'\n", opts.get<std::string>(opts::mipfilter));
+		return false;
+	}
+
+	if (opts.has(opts::swizzle)) {
+		state.swizzle = imglib::swizzle_from_str(opts.get<std::string>(opts::swizzle).data());
+		if (state.swizzle == 0xFFFFFFFF) {
+			std::cerr << fmt::format("Invalid swizzle '{}'\n", opts.get<std::string>(opts::swizzle));
+			return false;
+		}
+	}
 
 	if (!std::filesystem::exists(srcFile)) {
-		std::cerr << "Could not open " << srcFile << ": file does not exist\n";
+		std::cerr << fmt::format("Could not open {}: file does not exist\n", srcFile.string());
 		return false;
 	}
 
@@ -324,6 +461,14 @@ bool ActionConvert::process_file(
 		outFile = userOutputFile;
 	}
 
+	// Skip the file entirely if neither the source nor the options changed since the last run
+	std::uint64_t sourceHash = 0;
+	if (m_cache && m_cache->is_up_to_date(srcFile, outFile, m_optionsHash, sourceHash)) {
+		if (!opts.get<bool>(opts::quiet))
+			fmt::print("{} -> {} (up to date)\n", srcFile.string(), outFile.string());
+		return true;
+	}
+
 	auto format = ImageFormatFromUserString(formatStr.c_str());
 	auto vtfFile = std::make_unique<CVTFFile>();
 
@@ -352,8 +497,10 @@ bool ActionConvert::process_file(
 
 	// If we're processing a VTF, let's add that VTF image data
 	size_t initialSize = 0;
+	std::shared_ptr<imglib::Image> streamImage;
+	bool reusedMips = false;
 	if (isvtf) {
-		auto* srcVtf = init_from_file(srcFile, vtfFile.get(), procFormat);
+		auto srcVtf = load_vtf(srcFile);
 		if (!srcVtf) {
 			std::cerr << fmt::format("Could not open {}\n", srcFile.string());
 			return false;
@@ -361,70 +508,145 @@ bool ActionConvert::process_file(
 
 		initialSize = srcVtf->GetSize();
 
-		if (!add_vtf_image_data(srcVtf, vtfFile.get(), procFormat)) {
-			delete srcVtf;
-			std::cerr << "Could not add image data\n";
+		// When the image itself doesn't change, or it shrinks to the size of one of its mips, the source's mips are
+		// re-encoded as they are instead of being rebuilt from mip 0
+		int firstMip, mipCount;
+		if (can_reuse_mips(state, srcVtf.get(), firstMip, mipCount)) {
+			if (!vtf::transcode(srcVtf.get(), format, state.bcQuality, firstMip, mipCount, vtfFile.get())) {
+				std::cerr << fmt::format(
+					"Could not convert image data to {}: {}\n", formatStr, util::get_last_vtflib_error());
+				return false;
+			}
+			reusedMips = true;
+		}
+		else {
+			init_from_file(state, srcVtf.get(), vtfFile.get(), procFormat);
+			if (!add_vtf_image_data(state, srcVtf.get(), vtfFile.get(), procFormat)) {
+				std::cerr << fmt::format("Could not add image data from file {}\n", srcFile.string());
+				return false;
+			}
+		}
+	}
+	// When streaming, the image is only loaded here. It goes into the VTF strip by strip once the properties are set
+	else if (state.stream) {
+		streamImage = load_image(state, srcFile, false);
+		if (!streamImage) {
+			std::cerr << fmt::format("Could not add image data from file {}\n", srcFile.string());
+			return false;
+		}
+
+		const int w = (state.width != -1 && state.height != -1) ? state.width : streamImage->width();
+		const int h = (state.width != -1 && state.height != -1) ? state.height : streamImage->height();
+		const int mips = state.mips <= 0 ? CVTFFile::ComputeMipmapCount(w, h, 1) : state.mips;
+		if (!vtfFile->Init(w, h, 1, 1, 1, format, vlTrue, mips)) {
+			std::cerr << "Could not create VTF: " << util::get_last_vtflib_error() << "\n";
 			return false;
 		}
-		delete srcVtf;
 	}
 	// Add standard image data
-	else if (!add_image_data(srcFile, vtfFile.get(), procFormat, true)) {
-		std::cerr << "Could not add image data from file " << srcFile << "\n";
+	else if (!add_image_data(state, srcFile, vtfFile.get(), procFormat, true)) {
+		std::cerr << fmt::format("Could not add image data from file {}\n", srcFile.string());
 		return false;
 	}
 
-	// Process the image if necessary
-	if (isNormal && opts.get<bool>(opts::toDX)) {
+	// Process the image if necessary. Images are processed on load, see add_image_data
+	if (isvtf && state.procFlags) {
 		auto image = std::make_shared<imglib::Image>(
 			vtfFile->GetData(0, 0, 0, 0), procChanType, 4, vtfFile->GetWidth(), vtfFile->GetHeight(), true);
-		if (!image->process(imglib::PROC_GL_TO_DX_NORM)) {
+		if (!image->process(state.procFlags)) {
 			std::cerr << "Could not process vtf\n";
 			return false;
 		}
 	}
 
-	// Swizzle the image if requested
-	if (opts.has(opts::swizzle)) {
-		uint32_t mask = imglib::swizzle_from_str(opts.get<std::string>(opts::swizzle).data());
-		if (mask != lwiconv::NO_SWIZZLE) {
-			auto image = std::make_shared<imglib::Image>(
-				vtfFile->GetData(0, 0, 0, 0), procChanType, 4, vtfFile->GetWidth(), vtfFile->GetHeight(), true);
-			if (!image->swizzle(mask)) {
-				std::cerr << "Could not swizzle vtf\n";
-				return false;
-			}
+	// Swizzle the image if requested. Images are swizzled on load, see add_image_data
+	if (isvtf && state.swizzle != lwiconv::NO_SWIZZLE) {
+		auto image = std::make_shared<imglib::Image>(
+			vtfFile->GetData(0, 0, 0, 0), procChanType, 4, vtfFile->GetWidth(), vtfFile->GetHeight(), true);
+		if (!image->swizzle(state.swizzle)) {
+			std::cerr << "Could not swizzle vtf\n";
+			return false;
 		}
 	}
 
 	// Set the properties based on user input
-	if (!set_properties(vtfFile.get())) {
+	if (!set_properties(state, vtfFile.get())) {
 		std::cerr << "Could not set properties on VTF\n";
 		return false;
 	}
 
-	// Generate thumbnail
-	if (thumbnail && !vtfFile->GenerateThumbnail(srgb)) {
-		std::cerr << fmt::format("Could not generate thumbnail: {}\n", util::get_last_vtflib_error());
-		return false;
+	// Streamed images are resized, mipped and converted in a single pass
+	if (streamImage) {
+		if (!vtf::stream_image(
+				*streamImage, procChanType, state.mipFilter, srgb, state.bcQuality, thumbnail, vtfFile.get())) {
+			std::cerr << fmt::format(
+				"Could not convert image data to {}: {}\n", formatStr, util::get_last_vtflib_error());
+			return false;
+		}
+		streamImage.reset();
+
+		// There was no image data yet when the properties were set
+		vtfFile->ComputeReflectivity();
 	}
+	else {
+		// Generate thumbnail
+		if (thumbnail && !vtfFile->GenerateThumbnail(srgb)) {
+			std::cerr << fmt::format("Could not generate thumbnail: {}\n", util::get_last_vtflib_error());
+			return false;
+		}
 
-	// Generate mips
-	if (!vtfFile->GenerateMipmaps(MIPMAP_FILTER_CATROM, srgb)) {
-		std::cerr << "Could not generate mipmaps!\n";
-		return false;
+		// Mips carried over from a source VTF are already in the target format, see vtf::transcode
+		if (!reusedMips) {
+			// Generate mips
+			if (!vtf::generate_mipmaps(vtfFile.get(), state.mipFilter, srgb)) {
+				std::cerr << "Could not generate mipmaps!\n";
+				return false;
+			}
+
+			// Convert to desired image format. Block compressed formats we have an encoder for skip VTFLib entirely, and
+			// are compressed across the thread pool
+			bcn::Format bcFormat;
+			if (vtf::bcn_format(format, bcFormat) && vtfFile->GetFormat() == IMAGE_FORMAT_RGBA8888) {
+				auto compressed = std::make_unique<CVTFFile>();
+				if (!vtf::compress(vtfFile.get(), format, state.bcQuality, compressed.get())) {
+					std::cerr << fmt::format(
+						"Could not compress image data to {}: {}\n", formatStr, util::get_last_vtflib_error());
+					return false;
+				}
+				vtfFile = std::move(compressed);
+			}
+			else if (vtfFile->GetFormat() != format && !vtfFile->ConvertInPlace(format)) {
+				std::cerr << fmt::format(
+					"Could not convert image data to {}: {}\n", formatStr, util::get_last_vtflib_error());
+				return false;
+			}
+		}
 	}
 
-	// Convert to desired image format
-	if (vtfFile->GetFormat() != format && !vtfFile->ConvertInPlace(format)) {
-		std::cerr << fmt::format("Could not convert image data to {}: {}\n", formatStr, util::get_last_vtflib_error());
-		return false;
+	// Save to disk finally. In a batch the file is handed to the write-behind thread, and the cache only learns about
+	// it once it's actually on disk
+	if (m_writer) {
+		std::vector<std::uint8_t> data;
+		if (!vtf::save(vtfFile.get(), data)) {
+			std::cerr << fmt::format("Could not save file {}: {}\n", outFile.string(), util::get_last_vtflib_error());
+			return false;
+		}
+		m_writer->write(
+			outFile, std::move(data), srcFile,
+			[this, srcFile, outFile, sourceHash]
+			{
+				if (m_cache)
+					m_cache->update(srcFile, outFile, m_optionsHash, sourceHash);
+			});
 	}
+	else {
+		if (!vtf::save(vtfFile.get(), outFile.string())) {
+			std::cerr << fmt::format("Could not save file {}: {}\n", outFile.string(), util::get_last_vtflib_error());
+			return false;
+		}
 
-	// Save to disk finally
-	if (!vtfFile->Save(outFile.string().c_str())) {
-		std::cerr << fmt::format("Could not save file {}: {}\n", outFile.string(), util::get_last_vtflib_error());
-		return false;
+		if (m_cache)
+			m_cache->update(srcFile, outFile, m_optionsHash, sourceHash);
 	}
 
 	// Report file sizes
@@ -442,30 +664,71 @@ bool ActionConvert::process_file(
 }
 
 //
-// Loads a VTF from file, copies over flags and other properties to `file`
-// and then returns the newly loaded file
+// Loads a VTF from file
 // If load failed, we'll return nullptr
 //
-VTFLib::CVTFFile*
-ActionConvert::init_from_file(const std::filesystem::path& src, VTFLib::CVTFFile* file, VTFImageFormat newFormat) {
-	auto srcFile = new CVTFFile();
-	if (!srcFile->Load(src.string().c_str(), false))
+std::unique_ptr<CVTFFile> ActionConvert::load_vtf(const std::filesystem::path& src) {
+	util::MappedFile data;
+	if (!data.open(src.string()) || !data.size())
 		return nullptr;
 
+	auto srcFile = std::make_unique<CVTFFile>();
+	if (!vtf::load(srcFile.get(), data.data(), data.size()))
+		return nullptr;
+	return srcFile;
+}
+
+//
+// Determine if the mips of a VTF can be carried over as they are, which is the case as long as the image isn't
+// processed, and isn't resized to anything but the size of one of its mips. The mips above that one are dropped, as
+// are the smallest ones if fewer mips are asked for
+//
+bool ActionConvert::can_reuse_mips(
+	const ConvertState& state, const CVTFFile* srcFile, int& outFirstMip, int& outMipCount) {
+	if (state.procFlags || state.swizzle != lwiconv::NO_SWIZZLE)
+		return false;
+
+	const vlUInt width = state.width != -1 ? state.width : srcFile->GetWidth();
+	const vlUInt height = state.height != -1 ? state.height : srcFile->GetHeight();
+	const int srcMips = static_cast<int>(srcFile->GetMipmapCount());
+
+	for (outFirstMip = 0; outFirstMip < srcMips; ++outFirstMip) {
+		vlUInt mipWidth, mipHeight, mipDepth;
+		CVTFFile::ComputeMipmapDimensions(
+			srcFile->GetWidth(), srcFile->GetHeight(), 1, outFirstMip, mipWidth, mipHeight, mipDepth);
+		if (mipWidth == width && mipHeight == height)
+			break;
+	}
+
+	// The slices of volume textures shrink along with the mips, which a resize shouldn't do
+	if (outFirstMip > 0 && srcFile->GetDepth() > 1)
+		return false;
+
+	const int availableMips = srcMips - outFirstMip;
+	outMipCount = state.opts->has(opts::mips) || state.opts->has(opts::nomips) ? state.mips : availableMips;
+	return outMipCount >= 1 && outMipCount <= availableMips;
+}
+
+//
+// Converts a loaded VTF to the processing format, then sets up `file` to match its size, copying over flags and
+// other properties
+//
+void ActionConvert::init_from_file(
+	const ConvertState& state, VTFLib::CVTFFile* srcFile, VTFLib::CVTFFile* file, VTFImageFormat newFormat) {
 	// Convert immediately to the processing format, so we can match between src and dest
 	srcFile->ConvertInPlace(newFormat);
 
 	// Determine buffer sizes
-	const auto width = (m_width == -1) ? srcFile->GetWidth() : m_width;
-	const auto height = (m_height == -1) ? srcFile->GetHeight() : m_height;
+	const auto width = (state.width == -1) ? srcFile->GetWidth() : state.width;
+	const auto height = (state.height == -1) ? srcFile->GetHeight() : state.height;
 
 	// If the width/height have been changed, we can't just pull the mip count from the source VTF
 	const bool bNeedsNewMips = width != srcFile->GetWidth() || height != srcFile->GetHeight();
 	const int nDefaultMips = CVTFFile::ComputeMipmapCount(width, height, 1);
 
 	// Use the mip count from the source file if the user hasn't specified it yet
-	auto mipCount = m_opts->has(opts::mips) || m_opts->has(opts::nomips) 
-		? m_mips 
+	auto mipCount = state.opts->has(opts::mips) || state.opts->has(opts::nomips) 
+		? state.mips 
 		: (bNeedsNewMips ? nDefaultMips : srcFile->GetMipmapCount());
 
 	// Init image with the desired parameters and processing format
@@ -478,19 +741,20 @@ ActionConvert::init_from_file(const std::filesystem::path& src, VTFLib::CVTFFile
 
 	if (srcFile->GetHasThumbnail())
 		file->SetThumbnailData(srcFile->GetThumbnailData());
-
-	return srcFile;
 }
 
 //
 // Set properties for a VTF based on the user's input
 //
-bool ActionConvert::set_properties(VTFLib::CVTFFile* vtfFile) {
-	auto compressionLevel = m_opts->get<int>(opts::compress);
+bool ActionConvert::set_properties(const ConvertState& state, VTFLib::CVTFFile* vtfFile) {
+	const auto& opts = *state.opts;
+	auto compressionLevel = opts.get<int>(opts::compress);
 
-	// Set version if provided, or if we need it specifically to be 7.6
-	if (m_opts->has(opts::version) || compressionLevel > 0 || vtfFile->GetFormat() == IMAGE_FORMAT_BC7) {
-		auto verStr = m_opts->get<std::string>(opts::version);
+	// Set version if provided, or if we need it specifically to be 7.6. The image data isn't converted yet, so check
+	// the target format rather than the file's
+	const auto format = ImageFormatFromUserString(opts.get<std::string>(opts::format).c_str());
+	if (opts.has(opts::version) || compressionLevel > 0 || format == IMAGE_FORMAT_BC7) {
+		auto verStr = opts.get<std::string>(opts::version);
 
 		int majorVer, minorVer;
 		if (!get_version_from_str(verStr, majorVer, minorVer)) {
@@ -510,19 +774,19 @@ bool ActionConvert::set_properties(VTFLib::CVTFFile* vtfFile) {
 
 	// These should be defaulted to off
 	// we're not going to set them explicitly to the value of the opts because we may have gotten them from another vtf
-	if (m_opts->get<bool>(opts::normal))
+	if (opts.get<bool>(opts::normal))
 		vtfFile->SetFlag(TEXTUREFLAGS_NORMAL, true);
-	if (m_opts->get<bool>(opts::clamps))
+	if (opts.get<bool>(opts::clamps))
 		vtfFile->SetFlag(TEXTUREFLAGS_CLAMPS, true);
-	if (m_opts->get<bool>(opts::clamps))
+	if (opts.get<bool>(opts::clamps))
 		vtfFile->SetFlag(TEXTUREFLAGS_CLAMPT, true);
-	if (m_opts->get<bool>(opts::clampt))
+	if (opts.get<bool>(opts::clampt))
 		vtfFile->SetFlag(TEXTUREFLAGS_CLAMPU, true);
-	if (m_opts->get<bool>(opts::trilinear))
+	if (opts.get<bool>(opts::trilinear))
 		vtfFile->SetFlag(TEXTUREFLAGS_TRILINEAR, true);
-	if (m_opts->get<bool>(opts::pointsample))
+	if (opts.get<bool>(opts::pointsample))
 		vtfFile->SetFlag(TEXTUREFLAGS_POINTSAMPLE, true);
-	if (m_opts->get<bool>(opts::srgb))
+	if (opts.get<bool>(opts::srgb))
 		vtfFile->SetFlag(TEXTUREFLAGS_SRGB, true);
 
 	// Mip count gets set earlier by user input
@@ -530,35 +794,61 @@ bool ActionConvert::set_properties(VTFLib::CVTFFile* vtfFile) {
 		vtfFile->SetFlag(TEXTUREFLAGS_NOMIP, true);
 
 	// Same deal for the below issues- only override default if specified
-	if (m_opts->has(opts::startframe))
-		vtfFile->SetStartFrame(m_opts->get<int>(opts::startframe));
+	if (opts.has(opts::startframe))
+		vtfFile->SetStartFrame(opts.get<int>(opts::startframe));
 
 	vtfFile->ComputeReflectivity();
 
-	if (m_opts->has(opts::bumpscale))
-		vtfFile->SetBumpmapScale(m_opts->get<float>(opts::bumpscale));
+	if (opts.has(opts::bumpscale))
+		vtfFile->SetBumpmapScale(opts.get<float>(opts::bumpscale));
 
 	return true;
 }
 
+//
+// Load an image, and apply the resize, processing and swizzle options to it
+//
+std::shared_ptr<imglib::Image>
+ActionConvert::load_image(const ConvertState& state, const std::filesystem::path& imageSrc, bool resize) {
+	auto image = imglib::Image::load(imageSrc);
+	if (!image)
+		return nullptr;
+
+	// If width and height are specified, resize in place
+	if (resize && state.height != -1 && state.width != -1) {
+		if (!image->resize(state.width, state.height))
+			return nullptr;
+	}
+
+	// Processing needs to happen before the swizzle
+	if (state.procFlags && !image->process(state.procFlags)) {
+		std::cerr << fmt::format("Could not process {}\n", imageSrc.string());
+		return nullptr;
+	}
+
+	// Swizzle if requested. This always produces RGBA, so masks can pull from alpha (defaulted to 1) like they
+	// could when this was done on the VTF data
+	if (state.swizzle != lwiconv::NO_SWIZZLE) {
+		if (!image->swizzle(state.swizzle, 4)) {
+			std::cerr << fmt::format("Could not swizzle {}\n", imageSrc.string());
+			return nullptr;
+		}
+	}
+	return image;
+}
+
 //
 // Add base image data to the VTF's lowest mip level
 // imageSrc is a path to a imglib-compatible image
 //
 bool ActionConvert::add_image_data(
-	const std::filesystem::path& imageSrc, VTFLib::CVTFFile* file, VTFImageFormat format, bool create) {
+	const ConvertState& state, const std::filesystem::path& imageSrc, VTFLib::CVTFFile* file, VTFImageFormat format,
+	bool create) {
 
-	// Load the image
-	auto image = imglib::Image::load(imageSrc);
+	auto image = load_image(state, imageSrc, true);
 	if (!image)
 		return false;
 
-	// If width and height are specified, resize in place
-	if (m_height != -1 && m_width != -1) {
-		if (!image->resize(m_width, m_height))
-			return false;
-	}
-
 	// Hack for VTFLib; Ensure we have an alpha channel because that's well supported in that horrible code
 	if (image->channels() < 4 && image->type() != imglib::ChannelType::UInt8) {
 		if (!image->convert(image->type(), 4)) {
@@ -569,7 +859,7 @@ bool ActionConvert::add_image_data(
 
 	// Add the raw image data
 	return add_image_data_raw(
-		file, image->data(), format, image->vtf_format(), image->width(), image->height(), create);
+		state, file, image->data(), format, image->vtf_format(), image->width(), image->height(), create);
 }
 
 //
@@ -578,7 +868,8 @@ bool ActionConvert::add_image_data(
 //  file: Destination VTF
 //  format: Dest format of the data, file->GetFormat() will return this when this returns true
 //
-bool ActionConvert::add_vtf_image_data(CVTFFile* srcFile, VTFLib::CVTFFile* file, VTFImageFormat format) {
+bool ActionConvert::add_vtf_image_data(
+	const ConvertState& state, CVTFFile* srcFile, VTFLib::CVTFFile* file, VTFImageFormat format) {
 	const auto frameCount = srcFile->GetFrameCount();
 	const auto faceCount = srcFile->GetFaceCount();
 	const auto sliceCount = srcFile->GetDepth();
@@ -589,8 +880,8 @@ bool ActionConvert::add_vtf_image_data(CVTFFile* srcFile, VTFLib::CVTFFile* file
 	assert(srcFile->GetFormat() == format);
 
 	// Resize VTF only if necessary (This is expensive and kinda crap)
-	if (m_width != -1 && m_height != -1 && (srcWidth != m_width || srcHeight != m_height)) {
-		return vtf::resize(srcFile, m_width, m_height, file);
+	if (state.width != -1 && state.height != -1 && (srcWidth != state.width || srcHeight != state.height)) {
+		return vtf::resize(srcFile, state.width, state.height, file);
 	}
 	else {
 		// Load all image data normally
@@ -612,8 +903,8 @@ bool ActionConvert::add_vtf_image_data(CVTFFile* srcFile, VTFLib::CVTFFile* file
 //  format is the desired format of the VTF- If set to NONE, we'll use the data format
 //
 bool ActionConvert::add_image_data_raw(
-	VTFLib::CVTFFile* file, const void* data, VTFImageFormat format, VTFImageFormat dataFormat, int w, int h,
-	bool create) {
+	const ConvertState& state, VTFLib::CVTFFile* file, const void* data, VTFImageFormat format,
+	VTFImageFormat dataFormat, int w, int h, bool create) {
 	vlByte* dest = nullptr;
 
 	// Convert to requested format, if necessary
@@ -637,7 +928,7 @@ bool ActionConvert::add_image_data_raw(
 	// Create the file if we're told to do so
 	// This is done here because we don't actually know w/h until now
 	if (create) {
-		if (!file->Init(w, h, 1, 1, 1, format, vlTrue, m_mips <= 0 ? CVTFFile::ComputeMipmapCount(w, h, 1) : m_mips)) {
+		if (!file->Init(w, h, 1, 1, 1, format, vlTrue, state.mips <= 0 ? CVTFFile::ComputeMipmapCount(w, h, 1) : state.mips)) {
 			std::cerr << "Could not create VTF: " << util::get_last_vtflib_error() << "\n";
 			free(dest);
 			return false;
@@ -657,3 +948,121 @@ static bool get_version_from_str(const std::string& str, int& major, int& minor)
 	auto minorVer = str.substr(pos + 1);
 	return util::strtoint(majorVer, major) && util::strtoint(minorVer, minor);
 }
+
+//
+// Hash every option that affects the output file, used as part of the conversion cache key.
+// The vtex2 version is included too, so that upgrading invalidates the cache
+//
+static std::uint64_t options_hash(const OptionList& opts) {
+	const auto key = fmt::format(
+		"{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}", VTEX2_VERSION,
+		opts.get<std::string>(opts::format), opts.has(opts::mips) ? opts.get<int>(opts::mips) : -1,
+		opts.get<bool>(opts::nomips), opts.get<bool>(opts::srgb), opts.get<bool>(opts::clamps),
+		opts.get<bool>(opts::clampt), opts.get<bool>(opts::clampu), opts.get<bool>(opts::pointsample),
+		opts.get<bool>(opts::trilinear), opts.get<bool>(opts::normal), opts.get<bool>(opts::toDX),
+		opts.get<bool>(opts::thumbnail), opts.has(opts::version) ? opts.get<std::string>(opts::version) : "",
+		opts.get<int>(opts::compress), opts.get<int>(opts::width), opts.get<int>(opts::height),
+		opts.has(opts::startframe) ? opts.get<int>(opts::startframe) : -1,
+		opts.has(opts::bumpscale) ? opts.get<float>(opts::bumpscale) : -1.f, opts.get<std::string>(opts::swizzle),
+		opts.get<std::string>(opts::bcquality), opts.get<std::string>(opts::mipfilter), opts.get<bool>(opts::stream));
+	return util::hash64(key);
+}
+
+//
+// Read the size of a source file without loading it. Layers counts frames and faces, but not slices
+//
+static bool source_size(
+	const std::filesystem::path& path, std::uint64_t& width, std::uint64_t& height, std::uint64_t& depth,
+	std::uint64_t& layers) {
+	if (path.extension() == ".vtf") {
+		vtf::Header header;
+		std::string error;
+		if (!vtf::read_header(path.string(), header, error))
+			return false;
+		width = header.width;
+		height = header.height;
+		depth = header.depth;
+		layers = std::uint64_t(header.frameCount) * header.faceCount;
+		return true;
+	}
+
+	imglib::ImageInfo_t info;
+	if (!imglib::image_info(path.string().c_str(), info))
+		return false;
+	width = info.w;
+	height = info.h;
+	depth = 1;
+	layers = 1;
+	return true;
+}
+
+//
+// Rough relative cost of converting a file, used to start the biggest files of a batch first. Loading scales with the
+// source's pixels, encoding with the output's pixels times how slow the target format is to encode. Only the header
+// of each file is read
+//
+static double estimate_cost(const OptionList& opts, const std::filesystem::path& path) {
+	std::uint64_t width, height, depth, layers;
+	if (!source_size(path, width, height, depth, layers))
+		return 0;
+	layers *= depth;
+
+	const auto srcPixels = width * height * layers;
+	const auto dstPixels = opts.get<int>(opts::width) > 0 && opts.get<int>(opts::height) > 0
+							   ? std::uint64_t(opts.get<int>(opts::width)) * opts.get<int>(opts::height) * layers
+							   : srcPixels;
+
+	// Ballpark encode cost per pixel, relative to loading one
+	double encodeCost = 1;
+	bcn::Format bcFormat;
+	if (vtf::bcn_format(ImageFormatFromUserString(opts.get<std::string>(opts::format).c_str()), bcFormat)) {
+		encodeCost = 4;
+		if (bcFormat == bcn::Format::BC7) {
+			bcn::Quality quality = bcn::Quality::Normal;
+			bcn::parse_quality(opts.get<std::string>(opts::bcquality).c_str(), quality);
+			encodeCost = quality == bcn::Quality::Fast ? 8 : quality == bcn::Quality::Normal ? 32 : 128;
+		}
+	}
+	return double(srcPixels) + double(dstPixels) * encodeCost;
+}
+
+//
+// Rough peak memory use of converting a file, in bytes, used to keep a batch under --max-memory. Follows
+// process_file: the decoded source, the mip chain in the processing format, which VTFLib copies once more while
+// converting, and the mip chain in the target format, which is copied again when it's saved. Only the header of each
+// file is read, files that can't be read count as nothing and fail once converted
+//
+static std::uint64_t estimate_memory(const OptionList& opts, const std::filesystem::path& path) {
+	std::uint64_t width, height, depth, layers;
+	if (!source_size(path, width, height, depth, layers))
+		return 0;
+
+	const auto format = ImageFormatFromUserString(opts.get<std::string>(opts::format).c_str());
+	const auto formatInfo = CVTFFile::GetImageFormatInfo(format);
+	const auto maxBpp = std::max(
+		std::max(formatInfo.uiRedBitsPerPixel, formatInfo.uiGreenBitsPerPixel),
+		std::max(formatInfo.uiBlueBitsPerPixel, formatInfo.uiAlphaBitsPerPixel));
+	const auto procFormat =
+		maxBpp > 16 ? IMAGE_FORMAT_RGBA32323232F : maxBpp > 8 ? IMAGE_FORMAT_RGBA16161616 : IMAGE_FORMAT_RGBA8888;
+
+	const std::uint64_t dstWidth = opts.get<int>(opts::width) > 0 ? opts.get<int>(opts::width) : width;
+	const std::uint64_t dstHeight = opts.get<int>(opts::height) > 0 ? opts.get<int>(opts::height) : height;
+	int mips = CVTFFile::ComputeMipmapCount(dstWidth, dstHeight, depth);
+	if (opts.get<bool>(opts::nomips))
+		mips = 1;
+	else if (opts.has(opts::mips))
+		mips = std::clamp(opts.get<int>(opts::mips), 1, mips);
+
+	const auto chain_size = [&](VTFImageFormat fmt)
+	{
+		return std::uint64_t(CVTFFile::ComputeImageSize(dstWidth, dstHeight, depth, mips, fmt)) * layers;
+	};
+
+	const auto source = width * height * depth * layers * CVTFFile::ComputeImageSize(1, 1, 1, procFormat);
+	const auto target = chain_size(format) * 2;
+
+	// Streamed images never hold more than a strip of the processing format
+	if (opts.get<bool>(opts::stream) && path.extension() != ".vtf")
+		return source + target;
+	return source + chain_size(procFormat) * 2 + target;
+}
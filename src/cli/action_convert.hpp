@@ -1,7 +1,13 @@
 
 #include <filesystem>
+#include <memory>
 
 #include "action.hpp"
+#include "batch.hpp"
+#include "convert_cache.hpp"
+#include "common/bcn.hpp"
+#include "common/image.hpp"
+#include "common/mipmap.hpp"
 #include "VTFLib.h"
 
 namespace VTFLib
@@ -12,6 +18,22 @@ namespace VTFLib
 namespace vtex2
 {
 
+	/**
+	 * Per-file conversion state
+	 * Every file being converted gets its own copy of this, so multiple files may be processed at once
+	 */
+	struct ConvertState {
+		const OptionList* opts = nullptr;
+		int mips = 10;
+		int width = -1;
+		int height = -1;
+		imglib::ProcFlags procFlags = 0;
+		uint32_t swizzle = lwiconv::NO_SWIZZLE;
+		bcn::Quality bcQuality = bcn::Quality::Normal;
+		imglib::MipFilter mipFilter = imglib::MipFilter::CatmullRom;
+		bool stream = false;
+	};
+
 	/**
 	 * Extract image data from a VTF and put it in a
 	 * generic image file
@@ -26,28 +48,37 @@ namespace vtex2
 		int exec(const OptionList& opts) override;
 		void cleanup() override;
 
-		bool set_properties(VTFLib::CVTFFile* file);
+		bool set_properties(const ConvertState& state, VTFLib::CVTFFile* file);
 
 		bool process_file(
 			const OptionList& opts, const std::filesystem::path& srcFile, const std::filesystem::path& outPath);
 
+		std::shared_ptr<imglib::Image>
+		load_image(const ConvertState& state, const std::filesystem::path& imageSrc, bool resize);
+
 		bool add_image_data(
-			const std::filesystem::path& imageSrc, VTFLib::CVTFFile* file, VTFImageFormat format, bool create);
+			const ConvertState& state, const std::filesystem::path& imageSrc, VTFLib::CVTFFile* file,
+			VTFImageFormat format, bool create);
 
 		bool add_image_data_raw(
-			VTFLib::CVTFFile* file, const void* data, VTFImageFormat format, VTFImageFormat dataFormat, int w, int h,
-			bool create);
+			const ConvertState& state, VTFLib::CVTFFile* file, const void* data, VTFImageFormat format,
+			VTFImageFormat dataFormat, int w, int h, bool create);
+
+		bool add_vtf_image_data(
+			const ConvertState& state, VTFLib::CVTFFile* srcImage, VTFLib::CVTFFile* file, VTFImageFormat format);
+
+		std::unique_ptr<VTFLib::CVTFFile> load_vtf(const std::filesystem::path& src);
 
-		bool add_vtf_image_data(VTFLib::CVTFFile* srcImage, VTFLib::CVTFFile* file, VTFImageFormat format);
+		bool can_reuse_mips(
+			const ConvertState& state, const VTFLib::CVTFFile* srcFile, int& outFirstMip, int& outMipCount);
 
-		VTFLib::CVTFFile*
-		init_from_file(const std::filesystem::path& src, VTFLib::CVTFFile* file, VTFImageFormat newFormat);
+		void init_from_file(
+			const ConvertState& state, VTFLib::CVTFFile* srcFile, VTFLib::CVTFFile* file, VTFImageFormat newFormat);
 
 	private:
-		int m_mips = 10;
-		int m_width = -1;
-		int m_height = -1;
-		const OptionList* m_opts = nullptr;
+		std::unique_ptr<ConvertCache> m_cache; // Only set when --cache is passed
+		std::uint64_t m_optionsHash = 0;
+		std::unique_ptr<WriteBehind> m_writer; // Only set while converting a directory with --read-ahead
 	};
 
 } // namespace vtex2
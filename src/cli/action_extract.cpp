@@ -2,15 +2,22 @@
 #include <filesystem>
 #include <iostream>
 #include <functional>
+#include <vector>
+#include <atomic>
 
 #include "nameof.hpp"
 #include "fmt/format.h"
 
 #include "action_extract.hpp"
+#include "batch.hpp"
+#include "common/threadpool.hpp"
 #include "common/util.hpp"
 #include "common/enums.hpp"
 #include "common/strtools.hpp"
 #include "common/image.hpp"
+#include "common/vtfheader.hpp"
+#include "common/vtfio.hpp"
+#include "common/vtftools.hpp"
 
 #include "VTFLib.h"
 
@@ -25,6 +32,9 @@ namespace opts
 	static int recursive;
 	static int noalpha;
 	static int quiet;
+	static int all;
+	static int jobs;
+	static int readahead;
 } // namespace opts
 
 std::string ActionExtract::get_help() const {
@@ -92,6 +102,31 @@ const OptionList& ActionExtract::get_options() const {
 				.value(false)
 				.help("Silence output messages that aren't errors")
 		);
+
+		opts::all = opts.add(
+			ActionOption()
+				.short_opt("-a")
+				.long_opt("--all")
+				.type(OptType::Bool)
+				.value(false)
+				.help("Extract every frame, face, slice and mipmap into separate images"));
+
+		opts::jobs = opts.add(
+			ActionOption()
+				.short_opt("-j")
+				.long_opt("--jobs")
+				.type(OptType::Int)
+				.value(1)
+				.help("Number of files to extract at once when processing a directory. 0 = one per hardware thread"));
+
+		opts::readahead = opts.add(
+			ActionOption()
+				.long_opt("--read-ahead")
+				.type(OptType::Int)
+				.value(4)
+				.help(
+					"Number of files to load ahead of, and images to queue for writing behind, the ones being extracted "
+					"when processing a directory. 0 = read and write every file in line"));
 	};
 	return opts;
 }
@@ -103,25 +138,48 @@ int ActionExtract::exec(const OptionList& opts) {
 	const bool recursive = opts.get<bool>(opts::recursive);
 
 	if (std::filesystem::is_directory(file)) {
-		if (recursive) {
-			auto it = std::filesystem::recursive_directory_iterator(file);
-			for (auto& dirent : it) {
-				if (dirent.is_directory() || dirent.path().extension() != ".vtf")
-					continue;
-				if (!extract_file(opts, dirent, ""))
-					return 1;
-			}
-		}
-		else {
-			auto it = std::filesystem::directory_iterator(file);
-			for (auto& dirent : it) {
-				if (dirent.is_directory() || dirent.path().extension() != ".vtf")
-					continue;
-				if (!extract_file(opts, dirent, ""))
-					return 1;
-			}
+		auto files = collect_files(
+			file, recursive,
+			[](const std::filesystem::path& path)
+			{
+				return path.extension() == ".vtf";
+			});
+
+		// Serial batches keep the old behavior of stopping at the first failure
+		Batch batch(opts.get<int>(opts::jobs), !opts.has(opts::jobs));
+		batch.set_cost_estimate(
+			[](const std::filesystem::path& path)
+			{
+				// Decoding and encoding scale with the size of the image data
+				vtf::Header header;
+				std::string error;
+				return vtf::read_header(path.string(), header, error) ? double(header.image_size()) : 0.0;
+			});
+
+		// Reading the next VTFs and writing the last images overlaps with decoding the current ones
+		const auto readAhead = std::max(opts.get<int>(opts::readahead), 0);
+		batch.set_read_ahead(readAhead);
+		if (readAhead > 0)
+			m_writer = std::make_unique<WriteBehind>(readAhead);
+
+		bool ok = batch.run(
+			files,
+			[this, &opts](const std::filesystem::path& path)
+			{
+				return extract_file(opts, path, "");
+			});
+
+		if (m_writer) {
+			m_writer->finish();
+			for (auto& failed : m_writer->failed())
+				batch.mark_failed(failed);
+			ok = ok && m_writer->failed().empty();
+			m_writer.reset();
 		}
-		return 0;
+
+		if (batch.parallel() && !opts.get<bool>(opts::quiet))
+			batch.print_summary("Extracted");
+		return ok ? 0 : 1;
 	}
 	else {
 		return extract_file(opts, file, output) ? 0 : 1;
@@ -131,17 +189,18 @@ int ActionExtract::exec(const OptionList& opts) {
 }
 
 void ActionExtract::cleanup() {
-	delete file_;
 }
 
 bool ActionExtract::extract_file(
 	const OptionList& opts, const std::filesystem::path& vtfPath, const std::filesystem::path& userOutputFile) {
-	if (!load_vtf(vtfPath))
+	auto file = load_vtf(vtfPath);
+	if (!file)
 		return false;
 
 	auto format = opts.get<std::string>(opts::format);
 	auto mip = opts.get<int>(opts::mip);
 	const bool noalpha = opts.get<bool>(opts::noalpha);
+	const bool all = opts.get<bool>(opts::all);
 
 	// If the user provided output file is empty, we'll determine a default
 	auto outFile = userOutputFile;
@@ -162,13 +221,10 @@ bool ActionExtract::extract_file(
 		outFile = vtfPath.parent_path() / vtfPath.filename().replace_extension(ext);
 	}
 
-	if (!opts.get<bool>(opts::quiet))
-		fmt::print("{} -> {}\n", vtfPath.string(), outFile.string());
-
 	// Validate mipmap selection
-	if (mip > file_->GetMipmapCount()) {
+	if (!all && (mip < 0 || mip >= file->GetMipmapCount())) {
 		std::cerr << fmt::format(
-			"Selected mip {} exceeds the total mip count of the image: {}\n", mip, file_->GetMipmapCount());
+			"Selected mip {} exceeds the total mip count of the image: {}\n", mip, file->GetMipmapCount());
 		return false;
 	}
 
@@ -186,50 +242,107 @@ bool ActionExtract::extract_file(
 		return false;
 	}
 
+	if (!all) {
+		if (!opts.get<bool>(opts::quiet))
+			fmt::print("{} -> {}\n", vtfPath.string(), outFile.string());
+		return extract_image(vtfPath, file.get(), 0, 0, 0, mip, noalpha, outFile, targetFmt);
+	}
+
+	// Build the list of every subresource in the image, and name each output after it.
+	// Volume textures get an extra slice suffix, since each mip has its own number of slices
+	struct Subresource {
+		int frame, face, slice, mip;
+		std::filesystem::path out;
+	};
+	std::vector<Subresource> subresources;
+
+	const auto stem = outFile.stem().string();
+	const auto ext = outFile.extension().string();
+	const bool isVolume = file->GetDepth() > 1;
+	for (int iMip = 0; iMip < file->GetMipmapCount(); ++iMip) {
+		vlUInt w, h, d;
+		VTFLib::CVTFFile::ComputeMipmapDimensions(
+			file->GetWidth(), file->GetHeight(), file->GetDepth(), iMip, w, h, d);
+		for (int iFrame = 0; iFrame < file->GetFrameCount(); ++iFrame) {
+			for (int iFace = 0; iFace < file->GetFaceCount(); ++iFace) {
+				for (int iSlice = 0; iSlice < d; ++iSlice) {
+					auto name = isVolume ? fmt::format("{}_f{}_c{}_s{}_m{}{}", stem, iFrame, iFace, iSlice, iMip, ext)
+										 : fmt::format("{}_f{}_c{}_m{}{}", stem, iFrame, iFace, iMip, ext);
+					subresources.push_back({iFrame, iFace, iSlice, iMip, outFile.parent_path() / name});
+				}
+			}
+		}
+	}
+
+	if (!opts.get<bool>(opts::quiet))
+		fmt::print(
+			"{} -> {} ({} images)\n", vtfPath.string(), (outFile.parent_path() / (stem + "_*" + ext)).string(),
+			subresources.size());
+
+	// Decode and encode every subresource across all cores
+	std::atomic<bool> ok = true;
+	util::parallel_for(
+		subresources.size(),
+		[&](std::size_t i)
+		{
+			auto& sub = subresources[i];
+			if (!extract_image(
+					vtfPath, file.get(), sub.frame, sub.face, sub.slice, sub.mip, noalpha, sub.out, targetFmt))
+				ok = false;
+		});
+	return ok;
+}
+
+//
+// Decode a single frame/face/slice/mip and save it to outFile. In a batch, the encoded image is written by the
+// write-behind thread instead
+//
+bool ActionExtract::extract_image(
+	const std::filesystem::path& vtfPath, const VTFLib::CVTFFile* file, int frame, int face, int slice, int mip,
+	bool noalpha, const std::filesystem::path& outFile, imglib::FileFormat targetFmt) {
+
 	vlUInt w, h, d;
-	file_->ComputeMipmapDimensions(file_->GetWidth(), file_->GetHeight(), file_->GetDepth(), mip, w, h, d);
+	file->ComputeMipmapDimensions(file->GetWidth(), file->GetHeight(), file->GetDepth(), mip, w, h, d);
 
-	auto formatInfo = file_->GetImageFormatInfo(file_->GetFormat());
+	auto formatInfo = file->GetImageFormatInfo(file->GetFormat());
 	int comps = formatInfo.uiAlphaBitsPerPixel > 0 ? 4 : 3;
 
 	// Do we want to exclude alpha channel??
 	if (noalpha)
 		comps = 3;
 
-	// Allocate buffer for image data
-	vlByte* imageData = nullptr;
-	auto imageDataClean = util::cleanup(
-		[imageData]
-		{
-			free(imageData);
-		});
-
 	// Only supported format for Hdr is 32-bit RGBA - everything else will be squashed down into 32 or 24bpp RGB/RGBA
-	bool destIsFloat = (targetFmt == imglib::Hdr);
-	bool ok = false;
-	if (destIsFloat) {
-		imageData = static_cast<vlByte*>(malloc(w * h * comps * sizeof(float)));
-		ok = VTFLib::CVTFFile::Convert(
-			file_->GetData(0, 0, 0, mip), imageData, w, h, file_->GetFormat(),
-			comps == 3 ? IMAGE_FORMAT_RGB323232F : IMAGE_FORMAT_RGBA32323232F);
-	}
-	else {
-		// comps = 3;
-		imageData = static_cast<vlByte*>(malloc(w * h * comps * sizeof(uint8_t)));
-		ok = VTFLib::CVTFFile::Convert(
-			file_->GetData(0, 0, 0, mip), imageData, w, h, file_->GetFormat(),
-			comps == 3 ? IMAGE_FORMAT_RGB888 : IMAGE_FORMAT_RGBA8888);
-	}
+	const bool destIsFloat = (targetFmt == imglib::Hdr);
+	const auto destFormat = destIsFloat ? (comps == 3 ? IMAGE_FORMAT_RGB323232F : IMAGE_FORMAT_RGBA32323232F)
+										: (comps == 3 ? IMAGE_FORMAT_RGB888 : IMAGE_FORMAT_RGBA8888);
+
+	// Decode into a per-thread scratch buffer. This is reused for every image this thread extracts,
+	// and the first (largest) mip we see sizes it for the rest of the file
+	thread_local std::vector<vlByte> scratch;
+	const auto size = VTFLib::CVTFFile::ComputeImageSize(w, h, 1, destFormat);
+	if (scratch.size() < size)
+		scratch.resize(size);
+
+	bool ok = vtf::decode(file->GetData(frame, face, slice, mip), scratch.data(), w, h, file->GetFormat(), destFormat);
 
 	if (!ok) {
 		std::cerr << fmt::format(
-			"Could not convert image format '{}' -> '{}': {}\n", NAMEOF_ENUM(file_->GetFormat()),
-			destIsFloat ? "RGBA32323232F" : "RGBA8888", util::get_last_vtflib_error());
+			"Could not convert image format '{}' -> '{}': {}\n", NAMEOF_ENUM(file->GetFormat()),
+			NAMEOF_ENUM(destFormat), util::get_last_vtflib_error());
 		return false;
 	}
 
-	imglib::Image image(imageData, destIsFloat ? imglib::ChannelType::Float : imglib::ChannelType::UInt8, comps, w, h, true);
-	if (!image.save(outFile.string().c_str(), targetFmt)) {
+	imglib::Image image(
+		scratch.data(), destIsFloat ? imglib::ChannelType::Float : imglib::ChannelType::UInt8, comps, w, h, true);
+	if (m_writer) {
+		std::vector<std::uint8_t> data;
+		if (!image.save(targetFmt, data)) {
+			std::cerr << fmt::format("Could not encode image for '{}'!\n", outFile.string());
+			return false;
+		}
+		m_writer->write(outFile, std::move(data), vtfPath);
+	}
+	else if (!image.save(outFile.string().c_str(), targetFmt)) {
 		std::cerr << fmt::format("Could not save image to '{}'!\n", outFile.string());
 		return false;
 	}
@@ -237,32 +350,20 @@ bool ActionExtract::extract_file(
 	return true;
 }
 
-bool ActionExtract::load_vtf(const std::filesystem::path& vtfFile) {
-	// Cleanup any existing files
-	if (file_)
-		delete file_;
-
+std::unique_ptr<VTFLib::CVTFFile> ActionExtract::load_vtf(const std::filesystem::path& vtfFile) {
 	// Load off disk
-	std::uint8_t* buf = nullptr;
-	auto numBytes = util::read_file(vtfFile.string(), buf);
-	auto bufCleanup = util::cleanup(
-		[&buf]
-		{
-			delete[] buf;
-		});
-
-	if (numBytes == 0 || !buf) {
+	util::MappedFile data;
+	if (!data.open(vtfFile.string()) || !data.size()) {
 		std::cerr << fmt::format("Could not open file '{}'!\n", vtfFile.string());
-		delete[] buf;
-		return false;
+		return nullptr;
 	}
 
 	// Create new file & load it with vtflib
-	file_ = new VTFLib::CVTFFile();
-	if (!file_->Load(buf, numBytes, false)) {
+	auto file = std::make_unique<VTFLib::CVTFFile>();
+	if (!vtf::load(file.get(), data.data(), data.size())) {
 		std::cerr << fmt::format("Failed to load VTF '{}': {}\n", vtfFile.string(), util::get_last_vtflib_error());
-		return false;
+		return nullptr;
 	}
 
-	return true;
+	return file;
 }
@@ -1,7 +1,10 @@
 
 #include <filesystem>
+#include <memory>
 
 #include "action.hpp"
+#include "batch.hpp"
+#include "common/image.hpp"
 
 namespace VTFLib
 {
@@ -27,10 +30,14 @@ namespace vtex2
 
 		bool extract_file(
 			const OptionList& opts, const std::filesystem::path& vtfFile, const std::filesystem::path& outFile);
-		bool load_vtf(const std::filesystem::path& vtfFile);
+		std::unique_ptr<VTFLib::CVTFFile> load_vtf(const std::filesystem::path& vtfFile);
 
 	private:
-		VTFLib::CVTFFile* file_ = nullptr;
+		bool extract_image(
+			const std::filesystem::path& vtfPath, const VTFLib::CVTFFile* file, int frame, int face, int slice, int mip,
+			bool noalpha, const std::filesystem::path& outFile, imglib::FileFormat targetFmt);
+
+		std::unique_ptr<WriteBehind> m_writer; // Only set while extracting a directory with --read-ahead
 	};
 
 } // namespace vtex2
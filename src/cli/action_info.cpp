@@ -1,9 +1,16 @@
 
 #include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <mutex>
 
 #include "action_info.hpp"
+#include "batch.hpp"
 #include "common/util.hpp"
 #include "common/enums.hpp"
+#include "common/vtfheader.hpp"
+#include "common/vtfio.hpp"
 
 #include "VTFLib.h"
 
@@ -17,6 +24,10 @@ namespace opts
 	static int all;
 	static int file;
 	static int resources;
+	static int recursive;
+	static int format;
+	static int jobs;
+	static int top;
 } // namespace opts
 
 std::string ActionInfo::get_help() const {
@@ -42,12 +53,43 @@ const OptionList& ActionInfo::get_options() const {
 				.value(false)
 				.help("List all resource entries in the VTF"));
 
+		opts::recursive = opts.add(
+			ActionOption()
+				.long_opt("--recursive")
+				.short_opt("-R")
+				.type(OptType::Bool)
+				.value(false)
+				.help("Recursively scan directories"));
+
+		opts::format = opts.add(
+			ActionOption()
+				.long_opt("--format")
+				.type(OptType::String)
+				.value("text")
+				.choices({"text", "ndjson", "csv"})
+				.help("Output format when scanning. ndjson and csv write one record per file"));
+
+		opts::jobs = opts.add(
+			ActionOption()
+				.short_opt("-j")
+				.long_opt("--jobs")
+				.type(OptType::Int)
+				.value(0)
+				.help("Number of files to scan at once when processing a directory. 0 = one per hardware thread"));
+
+		opts::top = opts.add(
+			ActionOption()
+				.long_opt("--top")
+				.type(OptType::Int)
+				.value(10)
+				.help("Number of largest files listed in the summary of a directory scan"));
+
 		opts::file = opts.add(
 			ActionOption()
 				.metavar("file")
 				.type(OptType::String)
 				.value("")
-				.help("VTF file to process")
+				.help("VTF file or directory to process")
 				.end_of_line(true)
 				.required(true));
 	};
@@ -60,77 +102,75 @@ int ActionInfo::exec(const OptionList& opts) {
 	const auto details = opts.get<bool>(opts::all);
 	const auto resources = opts.get<bool>(opts::resources) || details;
 
-	// Load off disk
-	std::uint8_t* buf = nullptr;
-	auto numBytes = util::read_file(file, buf);
-	auto bufCleanup = util::cleanup(
-		[&]
-		{
-			delete[] buf;
-		});
+	// Directories, and anything bound for another program, get one record per file instead
+	if (std::filesystem::is_directory(file) || opts.get<std::string>(opts::format) != "text")
+		return scan(opts);
 
-	if (numBytes == 0 || !buf) {
-		std::cerr << fmt::format(FMT_STRING("Could not open file '{}'!\n"), file);
+	// Everything but the detailed mode can be answered from the header alone, without touching the image data
+	vtf::Header header;
+	std::string error;
+	if (!vtf::read_header(file, header, error)) {
+		std::cerr << fmt::format(FMT_STRING("Failed to load VTF '{}': {}\n"), file, error);
 		return 1;
 	}
 
-	// Load VTF with vtflib
-	file_ = new VTFLib::CVTFFile();
-	if (!file_->Load(buf, numBytes, false)) {
-		std::cerr << fmt::format(FMT_STRING("Failed to load VTF '{}': {}\n"), file, util::get_last_vtflib_error());
-		return 1;
+	// Basic compact info mode
+	if (!details && !resources) {
+		fmt::print("{}\n", compact_info(header));
+		return 0;
 	}
 
-	auto fmt = file_->GetFormat();
+	// Load the whole VTF with vtflib, so the detailed mode also tells you if the image data is broken
+	if (details) {
+		util::MappedFile data;
+		if (!data.open(file) || !data.size()) {
+			std::cerr << fmt::format(FMT_STRING("Could not open file '{}'!\n"), file);
+			return 1;
+		}
 
-	// Basic compact info mode
-	if (!details) {
-		compact_info();
-		return 0;
+		file_ = new VTFLib::CVTFFile();
+		if (!vtf::load(file_, data.data(), data.size())) {
+			std::cerr << fmt::format(
+				FMT_STRING("Failed to load VTF '{}': {}\n"), file, util::get_last_vtflib_error());
+			return 1;
+		}
 	}
 
-	fmt::print(FMT_STRING("VTF Version {}.{}\n"), file_->GetMajorVersion(), file_->GetMinorVersion());
-	fmt::print(FMT_STRING("Image format: {}\n"), NAMEOF_ENUM(fmt));
+	fmt::print(FMT_STRING("VTF Version {}.{}\n"), header.majorVersion, header.minorVersion);
+	fmt::print(FMT_STRING("Image format: {}\n"), NAMEOF_ENUM(header.format));
+	fmt::print(FMT_STRING("Dimensions (WxHxD): {} x {} x {}\n"), header.width, header.height, header.depth);
 	fmt::print(
-		FMT_STRING("Dimensions (WxHxD): {} x {} x {}\n"), file_->GetWidth(), file_->GetHeight(), file_->GetDepth());
-	fmt::print(
-		FMT_STRING("{} frame(s), {} face(s), {} mipmaps\n"), file_->GetFrameCount(), file_->GetFaceCount(),
-		file_->GetMipmapCount());
+		FMT_STRING("{} frame(s), {} face(s), {} mipmaps\n"), header.frameCount, header.faceCount, header.mipCount);
 
-	if (file_->GetMajorVersion() >= 7 && file_->GetMinorVersion() >= 6) {
-		fmt::print(FMT_STRING("DEFLATE compression level {}\n"), file_->GetAuxCompressionLevel());
+	if (header.majorVersion >= 7 && header.minorVersion >= 6) {
+		fmt::print(FMT_STRING("DEFLATE compression level {}\n"), header.auxCompressionLevel);
 	}
 
 	if (details) {
-		vlUInt dataSize;
-		if (auto* crcPtr = file_->GetResourceData(VTF_RSRC_CRC, dataSize)) {
-			auto crc = *static_cast<std::uint32_t*>(crcPtr);
-			fmt::print(FMT_STRING("Source CRC: 0x{:X}\n"), crc);
-		}
+		if (auto* crc = header.find_resource(VTF_RSRC_CRC))
+			fmt::print(FMT_STRING("Source CRC: 0x{:X}\n"), crc->data);
 		else
 			fmt::print("Source CRC: None\n");
 
 		// Display list of texture flags
-		auto flags = TextureFlagsToStringVector(file_->GetFlags());
-		fmt::print(FMT_STRING("Flags: 0x{:X}\n"), file_->GetFlags());
+		auto flags = TextureFlagsToStringVector(header.flags);
+		fmt::print(FMT_STRING("Flags: 0x{:X}\n"), header.flags);
 		for (auto& fl : flags) {
 			fmt::print(FMT_STRING("    {}\n"), fl);
 		}
 
-		fmt::print(FMT_STRING("Bumpscale: {}\n"), file_->GetBumpmapScale());
-		vlSingle x, y, z;
-		file_->GetReflectivity(x, y, z);
-		fmt::print(FMT_STRING("Reflectivity: ({} {} {})\n"), x, y, z);
+		fmt::print(FMT_STRING("Bumpscale: {}\n"), header.bumpScale);
+		fmt::print(
+			FMT_STRING("Reflectivity: ({} {} {})\n"), header.reflectivity[0], header.reflectivity[1],
+			header.reflectivity[2]);
 	}
 
 	if (resources) {
-		const auto rsrcCount = file_->GetResourceCount();
-		rsrcCount > 0 ? fmt::print("Resource entries:\n") : fmt::print("No resource entries\n");
+		header.resources.size() > 0 ? fmt::print("Resource entries:\n") : fmt::print("No resource entries\n");
 
-		for (auto i = 0; i < rsrcCount; ++i) {
-			auto type = file_->GetResourceType(i);
-			vlUInt sz = 0;
-			file_->GetResourceData(type, sz);
+		for (auto& resource : header.resources) {
+			const auto type = resource.type;
+			const auto sz = resource.size;
 			fmt::print(
 				FMT_STRING("    0x{:X} ({:c}{:c}{:c}) - {} bytes ({:1f} KiB)\n"), type, type & 0xFF, (type >> 8) & 0xFF,
 				(type >> 16) & 0xFF, sz, sz / 1024.f);
@@ -138,8 +178,8 @@ int ActionInfo::exec(const OptionList& opts) {
 	}
 
 	fmt::print(
-		FMT_STRING("{:2f} KiB image data ({:2f} MiB)\n"), file_->GetSize() / 1024.f,
-		file_->GetSize() / (1024.f * 1024.f));
+		FMT_STRING("{:2f} KiB image data ({:2f} MiB)\n"), header.image_size() / 1024.f,
+		header.image_size() / (1024.f * 1024.f));
 
 	return 0;
 }
@@ -148,13 +188,205 @@ void ActionInfo::cleanup() {
 	delete file_;
 }
 
-void ActionInfo::compact_info() {
+std::string ActionInfo::compact_info(const vtf::Header& header) {
+	auto info = fmt::format(
+		FMT_STRING("VTF {}.{}, {} x {} x {}, {} frames, {} mipmaps, {} faces, image format {}"), header.majorVersion,
+		header.minorVersion, header.width, header.height, header.depth, header.frameCount, header.mipCount,
+		header.faceCount, NAMEOF_ENUM(header.format));
+	if (header.majorVersion >= 7 && header.minorVersion >= 6)
+		info += fmt::format(FMT_STRING(", DEFLATE compression level {}"), header.auxCompressionLevel);
+	return info;
+}
+
+//
+// Escape a string for use inside a JSON string literal
+//
+static std::string json_escape(const std::string& str) {
+	std::string out;
+	out.reserve(str.size());
+	for (char c : str) {
+		switch (c) {
+			case '"':
+				out += "\\\"";
+				break;
+			case '\\':
+				out += "\\\\";
+				break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20)
+					out += fmt::format("\\u{:04x}", static_cast<int>(c));
+				else
+					out += c;
+		}
+	}
+	return out;
+}
+
+//
+// Quote a CSV field if it contains anything that would break the row up
+//
+static std::string csv_escape(const std::string& str) {
+	if (str.find_first_of(",\"\r\n") == std::string::npos)
+		return str;
+	std::string out = "\"";
+	for (char c : str) {
+		if (c == '"')
+			out += '"';
+		out += c;
+	}
+	return out + "\"";
+}
+
+static std::string format_bytes(std::uint64_t bytes) {
+	if (bytes >= 1024ull * 1024 * 1024)
+		return fmt::format(FMT_STRING("{:.2f} GiB"), bytes / (1024.0 * 1024 * 1024));
+	if (bytes >= 1024ull * 1024)
+		return fmt::format(FMT_STRING("{:.2f} MiB"), bytes / (1024.0 * 1024));
+	return fmt::format(FMT_STRING("{:.2f} KiB"), bytes / 1024.0);
+}
+
+//
+// Read the header of every VTF in a directory (or of a single file) in parallel, writing a record for each one as
+// it's read, then summarize the image data by format, resolution and flag.
+// The summary goes to stderr when the records are meant for another program, so stdout stays machine readable
+//
+int ActionInfo::scan(const OptionList& opts) {
+	const std::filesystem::path file = opts.get<std::string>(opts::file);
+	const auto format = opts.get<std::string>(opts::format);
+	const bool directory = std::filesystem::is_directory(file);
+
+	std::vector<std::filesystem::path> files;
+	if (directory) {
+		files = collect_files(
+			file, opts.get<bool>(opts::recursive),
+			[](const std::filesystem::path& path)
+			{
+				return path.extension() == ".vtf";
+			});
+	}
+	else {
+		files.push_back(file);
+	}
+
+	if (format == "csv")
+		fmt::print(
+			"path,version,width,height,depth,frames,faces,mipmaps,format,flags,compression,image_bytes,file_bytes\n");
+
+	// Only what the summary needs, so scanning a huge tree doesn't hold on to every resource list
+	struct Entry {
+		std::string path;
+		VTFImageFormat format;
+		std::uint32_t width, height;
+		std::uint32_t flags;
+		std::uint64_t imageSize;
+	};
+	std::vector<Entry> entries;
+	std::mutex mutex;
+
+	Batch batch(opts.get<int>(opts::jobs), false);
+	batch.run(
+		files,
+		[&](const std::filesystem::path& path)
+		{
+			vtf::Header header;
+			std::string error;
+			if (!vtf::read_header(path.string(), header, error)) {
+				std::cerr << fmt::format(FMT_STRING("Failed to load VTF '{}': {}\n"), path.string(), error);
+				return false;
+			}
+
+			std::string record;
+			if (format == "ndjson") {
+				record = fmt::format(
+					FMT_STRING("{{\"path\":\"{}\",\"version\":\"{}.{}\",\"width\":{},\"height\":{},\"depth\":{},"
+							   "\"frames\":{},\"faces\":{},\"mipmaps\":{},\"format\":\"{}\",\"flags\":{},"
+							   "\"compression\":{},\"image_bytes\":{},\"file_bytes\":{}}}\n"),
+					json_escape(path.string()), header.majorVersion, header.minorVersion, header.width, header.height,
+					header.depth, header.frameCount, header.faceCount, header.mipCount, NAMEOF_ENUM(header.format),
+					header.flags, header.auxCompressionLevel, header.image_size(), header.fileSize);
+			}
+			else if (format == "csv") {
+				record = fmt::format(
+					FMT_STRING("{},{}.{},{},{},{},{},{},{},{},{},{},{},{}\n"), csv_escape(path.string()),
+					header.majorVersion, header.minorVersion, header.width, header.height, header.depth,
+					header.frameCount, header.faceCount, header.mipCount, NAMEOF_ENUM(header.format), header.flags,
+					header.auxCompressionLevel, header.image_size(), header.fileSize);
+			}
+			else {
+				record = fmt::format(FMT_STRING("{}: {}\n"), path.string(), compact_info(header));
+			}
+
+			std::lock_guard lock(mutex);
+			std::cout << record;
+			entries.push_back({path.string(), header.format, header.width, header.height, header.flags,
+							   header.image_size()});
+			return true;
+		});
+	std::cout.flush();
+
+	if (!directory)
+		return batch.failed().empty() ? 0 : 1;
+
+	// Totals per category, largest first
+	struct Total {
+		std::size_t files = 0;
+		std::uint64_t bytes = 0;
+	};
+	auto print_totals = [](std::FILE* out, const char* title, const std::map<std::string, Total>& totals)
+	{
+		std::vector<std::pair<std::string, Total>> sorted(totals.begin(), totals.end());
+		std::stable_sort(
+			sorted.begin(), sorted.end(),
+			[](const auto& a, const auto& b)
+			{
+				return a.second.bytes > b.second.bytes;
+			});
+
+		fmt::print(out, "{}:\n", title);
+		for (auto& [name, total] : sorted)
+			fmt::print(
+				out, FMT_STRING("    {:<40} {:>8} file(s) {:>12}\n"), name, total.files, format_bytes(total.bytes));
+	};
+
+	std::map<std::string, Total> byFormat, byResolution, byFlag;
+	std::uint64_t totalBytes = 0;
+	for (auto& entry : entries) {
+		auto add = [&entry](Total& total)
+		{
+			total.files++;
+			total.bytes += entry.imageSize;
+		};
+		add(byFormat[std::string(NAMEOF_ENUM(entry.format))]);
+		add(byResolution[fmt::format(FMT_STRING("{} x {}"), entry.width, entry.height)]);
+		for (std::uint32_t bit = 0; bit < 32; ++bit) {
+			if (entry.flags & (1u << bit)) {
+				auto names = TextureFlagsToStringVector(1u << bit);
+				add(byFlag[names.empty() ? fmt::format(FMT_STRING("0x{:X}"), 1u << bit) : names[0]]);
+			}
+		}
+		totalBytes += entry.imageSize;
+	}
+
+	std::FILE* out = format == "text" ? stdout : stderr;
 	fmt::print(
-		FMT_STRING("VTF {}.{}, {} x {} x {}, {} frames, {} mipmaps, {} faces, image format {}"),
-		file_->GetMajorVersion(), file_->GetMinorVersion(), file_->GetWidth(), file_->GetHeight(), file_->GetDepth(),
-		file_->GetFrameCount(), file_->GetMipmapCount(), file_->GetFaceCount(), NAMEOF_ENUM(file_->GetFormat()));
-	if (file_->GetMajorVersion() >= 7 && file_->GetMinorVersion() >= 6)
-		fmt::print(FMT_STRING(", DEFLATE compression level {}\n"), file_->GetAuxCompressionLevel());
-	else
-		std::cout << "\n";
+		out, FMT_STRING("\nScanned {} of {} file(s), {} failed, {} of image data\n"), entries.size(), files.size(),
+		batch.failed().size(), format_bytes(totalBytes));
+	print_totals(out, "By format", byFormat);
+	print_totals(out, "By resolution", byResolution);
+	print_totals(out, "By flag", byFlag);
+
+	// Largest files, ties broken by path so the list doesn't depend on scheduling order
+	const auto top = std::min<std::size_t>(std::max(opts.get<int>(opts::top), 0), entries.size());
+	std::partial_sort(
+		entries.begin(), entries.begin() + top, entries.end(),
+		[](const Entry& a, const Entry& b)
+		{
+			return a.imageSize != b.imageSize ? a.imageSize > b.imageSize : a.path < b.path;
+		});
+	if (top > 0)
+		fmt::print(out, "Largest {} file(s):\n", top);
+	for (std::size_t i = 0; i < top; ++i)
+		fmt::print(out, FMT_STRING("    {:>12} {}\n"), format_bytes(entries[i].imageSize), entries[i].path);
+
+	return batch.failed().empty() ? 0 : 1;
 }
@@ -6,6 +6,11 @@ namespace VTFLib
 	class CVTFFile;
 }
 
+namespace vtf
+{
+	struct Header;
+}
+
 namespace vtex2
 {
 
@@ -23,7 +28,9 @@ namespace vtex2
 		void cleanup() override;
 
 	private:
-		void compact_info();
+		int scan(const OptionList& opts);
+
+		static std::string compact_info(const vtf::Header& header);
 
 		VTFLib::CVTFFile* file_ = nullptr;
 	};
@@ -0,0 +1,315 @@
+#include <iostream>
+#include <filesystem>
+
+#include "action_modify.hpp"
+#include "batch.hpp"
+#include "common/util.hpp"
+#include "common/vtfheader.hpp"
+#include "common/vtfio.hpp"
+
+#include "VTFLib.h"
+
+#include "fmt/format.h"
+
+using namespace vtex2;
+using namespace VTFLib;
+
+namespace opts
+{
+	static int file;
+	static int output;
+	static int recursive;
+	static int normal;
+	static int clamps, clampt, clampu;
+	static int pointsample, trilinear;
+	static int srgb;
+	static int startframe, bumpscale;
+	static int version;
+	static int removeResource;
+	static int jobs;
+	static int quiet;
+} // namespace opts
+
+// Flag options, named like the ones convert has. Passing them as --opt=false clears the flag instead
+static const struct {
+	int* opt;
+	VTFImageFlag flag;
+} s_flagOpts[] = {
+	{&opts::normal, TEXTUREFLAGS_NORMAL},
+	{&opts::clamps, TEXTUREFLAGS_CLAMPS},
+	{&opts::clampt, TEXTUREFLAGS_CLAMPT},
+	{&opts::clampu, TEXTUREFLAGS_CLAMPU},
+	{&opts::pointsample, TEXTUREFLAGS_POINTSAMPLE},
+	{&opts::trilinear, TEXTUREFLAGS_TRILINEAR},
+	{&opts::srgb, TEXTUREFLAGS_SRGB},
+};
+
+static vlUInt resource_from_str(const std::string& str);
+
+std::string ActionModify::get_help() const {
+	return "Change the flags and properties of VTFs without re-encoding them";
+}
+
+const OptionList& ActionModify::get_options() const {
+	static OptionList opts;
+	if (opts.empty()) {
+		opts::output = opts.add(
+			ActionOption()
+				.short_opt("-o")
+				.long_opt("--output")
+				.type(OptType::String)
+				.value("")
+				.help("Write the modified VTF here instead of changing the file in place"));
+
+		opts::file = opts.add(
+			ActionOption()
+				.metavar("file")
+				.type(OptType::String)
+				.value("")
+				.help("VTF to modify or directory to process")
+				.required(true)
+				.end_of_line(true));
+
+		opts::recursive = opts.add(
+			ActionOption()
+				.short_opt("-r")
+				.long_opt("--recursive")
+				.type(OptType::Bool)
+				.value(false)
+				.help("Recursively process directories"));
+
+		opts::normal = opts.add(
+			ActionOption()
+				.short_opt("-n")
+				.long_opt("--normal")
+				.type(OptType::Bool)
+				.value(false)
+				.help("Mark as a normal map"));
+
+		opts::clamps =
+			opts.add(ActionOption().long_opt("--clamps").type(OptType::Bool).value(false).help("Clamp on S axis"));
+
+		opts::clampt =
+			opts.add(ActionOption().long_opt("--clampt").type(OptType::Bool).value(false).help("Clamp on T axis"));
+
+		opts::clampu =
+			opts.add(ActionOption().long_opt("--clampu").type(OptType::Bool).value(false).help("Clamp on U axis"));
+
+		opts::pointsample = opts.add(
+			ActionOption()
+				.long_opt("--pointsample")
+				.type(OptType::Bool)
+				.value(false)
+				.help("Set point sampling method"));
+
+		opts::trilinear = opts.add(
+			ActionOption()
+				.long_opt("--trilinear")
+				.type(OptType::Bool)
+				.value(false)
+				.help("Set trilinear sampling method"));
+
+		opts::srgb = opts.add(
+			ActionOption()
+				.long_opt("--srgb")
+				.type(OptType::Bool)
+				.value(false)
+				.help("Mark as sRGB. Like every flag option, pass --srgb=false to clear it"));
+
+		opts::startframe = opts.add(
+			ActionOption().long_opt("--start-frame").type(OptType::Int).value(0).help("Animation frame to start on"));
+
+		opts::bumpscale =
+			opts.add(ActionOption().long_opt("--bumpscale").type(OptType::Float).value(0).help("Bumpscale"));
+
+		opts::version = opts.add(
+			ActionOption()
+				.long_opt("--version")
+				.type(OptType::String)
+				.value("7.5")
+				.choices({"7.1", "7.2", "7.3", "7.4", "7.5", "7.6"})
+				.help("Change the VTF version. Rewrites the file"));
+
+		opts::removeResource = opts.add(
+			ActionOption()
+				.long_opt("--remove-resource")
+				.type(OptType::String)
+				.value("")
+				.choices({"crc", "lod", "tso", "kvd", "sheet"})
+				.help("Remove a resource from the VTF. Rewrites the file"));
+
+		opts::jobs = opts.add(
+			ActionOption()
+				.short_opt("-j")
+				.long_opt("--jobs")
+				.type(OptType::Int)
+				.value(0)
+				.help("Number of files to modify at once when processing a directory. 0 = one per hardware thread"));
+
+		opts::quiet = opts.add(
+			ActionOption()
+				.long_opt("--quiet")
+				.short_opt("-q")
+				.value(false)
+				.type(OptType::Bool)
+				.help("Silence output messages that aren't errors"));
+	};
+	return opts;
+}
+
+int ActionModify::exec(const OptionList& opts) {
+	const auto file = opts.get<std::string>(opts::file);
+	const auto output = opts.get<std::string>(opts::output);
+
+	if (!std::filesystem::is_directory(file))
+		return modify_file(opts, file, output) ? 0 : 1;
+
+	if (!output.empty()) {
+		std::cerr << "--output can't be used when modifying a directory\n";
+		return 1;
+	}
+
+	auto files = collect_files(
+		file, opts.get<bool>(opts::recursive),
+		[](const std::filesystem::path& path)
+		{
+			return path.extension() == ".vtf";
+		});
+
+	// Modifying is almost entirely I/O, so there's nothing to gain from stopping at the first failure
+	Batch batch(opts.get<int>(opts::jobs), false);
+	const bool ok = batch.run(
+		files,
+		[this, &opts](const std::filesystem::path& path)
+		{
+			return modify_file(opts, path, "");
+		});
+
+	if (batch.parallel() && !opts.get<bool>(opts::quiet))
+		batch.print_summary("Modified");
+	return ok ? 0 : 1;
+}
+
+void ActionModify::cleanup() {
+}
+
+//
+// Apply the options to a single VTF. Flags, start frame and bump scale are patched straight into the header.
+// Changing the version or removing a resource moves data around, so the file is loaded and saved again with VTFLib,
+// which still copies the image data over byte for byte
+//
+bool ActionModify::modify_file(
+	const OptionList& opts, const std::filesystem::path& srcFile, const std::filesystem::path& outFile) {
+	const auto out = outFile.empty() ? srcFile : outFile;
+	const auto quiet = opts.get<bool>(opts::quiet);
+
+	vtf::Header header;
+	std::string error;
+	if (!vtf::read_header(srcFile.string(), header, error)) {
+		std::cerr << fmt::format("Could not read {}: {}\n", srcFile.string(), error);
+		return false;
+	}
+
+	auto patched = header;
+	for (auto& flagOpt : s_flagOpts) {
+		if (!opts.has(*flagOpt.opt))
+			continue;
+		if (opts.get<bool>(*flagOpt.opt))
+			patched.flags |= flagOpt.flag;
+		else
+			patched.flags &= ~std::uint32_t(flagOpt.flag);
+	}
+	if (opts.has(opts::startframe))
+		patched.startFrame = opts.get<int>(opts::startframe);
+	if (opts.has(opts::bumpscale))
+		patched.bumpScale = opts.get<float>(opts::bumpscale);
+
+	int minorVersion = header.minorVersion;
+	if (opts.has(opts::version) && !util::strtoint(opts.get<std::string>(opts::version).substr(2), minorVersion)) {
+		std::cerr << fmt::format("Invalid version '{}'\n", opts.get<std::string>(opts::version));
+		return false;
+	}
+
+	const vlUInt removeType =
+		opts.has(opts::removeResource) ? resource_from_str(opts.get<std::string>(opts::removeResource)) : 0;
+	const bool removeResource = removeType && header.find_resource(removeType);
+
+	const bool patch = patched.flags != header.flags || patched.startFrame != header.startFrame ||
+					   patched.bumpScale != header.bumpScale;
+	const bool rebuild = std::uint32_t(minorVersion) != header.minorVersion || removeResource;
+
+	if (!rebuild) {
+		if (!patch && out == srcFile) {
+			if (!quiet)
+				fmt::print("{} (unchanged)\n", srcFile.string());
+			return true;
+		}
+
+		std::error_code ec;
+		if (out != srcFile &&
+			!std::filesystem::copy_file(srcFile, out, std::filesystem::copy_options::overwrite_existing, ec)) {
+			std::cerr << fmt::format("Could not copy {} to {}: {}\n", srcFile.string(), out.string(), ec.message());
+			return false;
+		}
+
+		if (patch && !vtf::write_header(out.string(), patched, error)) {
+			std::cerr << fmt::format("Could not modify {}: {}\n", out.string(), error);
+			return false;
+		}
+	}
+	else {
+		auto vtfFile = std::make_unique<CVTFFile>();
+		{
+			util::MappedFile data;
+			if (!data.open(srcFile.string()) || !data.size() ||
+				!vtf::load(vtfFile.get(), data.data(), data.size())) {
+				std::cerr << fmt::format("Could not load {}: {}\n", srcFile.string(), util::get_last_vtflib_error());
+				return false;
+			}
+		}
+
+		vtfFile->SetFlags(patched.flags);
+		vtfFile->SetStartFrame(patched.startFrame);
+		vtfFile->SetBumpmapScale(patched.bumpScale);
+
+		if (!vtfFile->SetVersion(header.majorVersion, minorVersion)) {
+			std::cerr << fmt::format(
+				"Could not change the version of {}: {}\n", srcFile.string(), util::get_last_vtflib_error());
+			return false;
+		}
+
+		// Resources are removed by setting them to nothing
+		if (removeResource)
+			vtfFile->SetResourceData(removeType, 0, nullptr);
+
+		if (!vtf::save(vtfFile.get(), out.string())) {
+			std::cerr << fmt::format("Could not save file {}: {}\n", out.string(), util::get_last_vtflib_error());
+			return false;
+		}
+	}
+
+	if (!quiet) {
+		if (out != srcFile)
+			fmt::print("{} -> {}\n", srcFile.string(), out.string());
+		else
+			fmt::print("Modified {}\n", srcFile.string());
+	}
+	return true;
+}
+
+//
+// Map a --remove-resource choice to its resource type
+//
+static vlUInt resource_from_str(const std::string& str) {
+	if (str == "crc")
+		return VTF_RSRC_CRC;
+	if (str == "lod")
+		return VTF_RSRC_TEXTURE_LOD_SETTINGS;
+	if (str == "tso")
+		return VTF_RSRC_TEXTURE_SETTINGS_EX;
+	if (str == "kvd")
+		return VTF_RSRC_KEY_VALUE_DATA;
+	if (str == "sheet")
+		return VTF_RSRC_SHEET;
+	return 0;
+}
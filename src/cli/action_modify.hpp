@@ -0,0 +1,26 @@
+#include <filesystem>
+
+#include "action.hpp"
+
+namespace vtex2
+{
+
+	/**
+	 * Changes the flags and other properties of existing VTFs, without touching their image data
+	 */
+	class ActionModify : public BaseAction {
+	public:
+		std::string get_name() const override {
+			return "modify";
+		}
+		std::string get_help() const override;
+		const OptionList& get_options() const override;
+		int exec(const OptionList& opts) override;
+		void cleanup() override;
+
+	private:
+		bool modify_file(
+			const OptionList& opts, const std::filesystem::path& srcFile, const std::filesystem::path& outFile);
+	};
+
+} // namespace vtex2
@@ -7,6 +7,7 @@
 #include "common/util.hpp"
 #include "common/enums.hpp"
 #include "common/pack.hpp"
+#include "common/vtftools.hpp"
 
 #include "VTFLib.h"
 
@@ -511,7 +512,7 @@ bool ActionPack::save_vtf(
 	file_->SetData(0, 0, 0, 0, image->data<vlByte>());
 	file_->SetFlag(TEXTUREFLAGS_NORMAL, normal);
 
-	file_->GenerateMipmaps(MIPMAP_FILTER_CATROM, false);
+	vtf::generate_mipmaps(file_, imglib::MipFilter::CatmullRom, false);
 	return file_->Save(out.string().c_str());
 }
 
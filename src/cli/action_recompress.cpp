@@ -0,0 +1,185 @@
+#include <iostream>
+#include <filesystem>
+
+#include "action_recompress.hpp"
+#include "batch.hpp"
+#include "common/util.hpp"
+#include "common/vtfio.hpp"
+
+#include "VTFLib.h"
+
+#include "fmt/format.h"
+
+using namespace vtex2;
+using namespace VTFLib;
+
+namespace opts
+{
+	static int file;
+	static int level;
+	static int recursive;
+	static int jobs;
+	static int quiet;
+} // namespace opts
+
+std::string ActionRecompress::get_help() const {
+	return "Re-deflate the image data of VTFs, upgrading them to 7.6 if needed";
+}
+
+const OptionList& ActionRecompress::get_options() const {
+	static OptionList opts;
+	if (opts.empty()) {
+		opts::file = opts.add(
+			ActionOption()
+				.metavar("file")
+				.type(OptType::String)
+				.value("")
+				.help("VTF to recompress or directory to process")
+				.required(true)
+				.end_of_line(true));
+
+		opts::level = opts.add(
+			ActionOption()
+				.short_opt("-l")
+				.long_opt("--level")
+				.type(OptType::Int)
+				.value(9)
+				.choices({"1", "2", "3", "4", "5", "6", "7", "8", "9"})
+				.help("DEFLATE compression level to use. 9=max"));
+
+		opts::recursive = opts.add(
+			ActionOption()
+				.short_opt("-r")
+				.long_opt("--recursive")
+				.type(OptType::Bool)
+				.value(false)
+				.help("Recursively process directories"));
+
+		opts::jobs = opts.add(
+			ActionOption()
+				.short_opt("-j")
+				.long_opt("--jobs")
+				.type(OptType::Int)
+				.value(0)
+				.help(
+					"Number of files to recompress at once when processing a directory. "
+					"0 = one per hardware thread"));
+
+		opts::quiet = opts.add(
+			ActionOption()
+				.long_opt("--quiet")
+				.short_opt("-q")
+				.value(false)
+				.type(OptType::Bool)
+				.help("Silence output messages that aren't errors"));
+	};
+	return opts;
+}
+
+int ActionRecompress::exec(const OptionList& opts) {
+	const auto file = opts.get<std::string>(opts::file);
+	const auto quiet = opts.get<bool>(opts::quiet);
+
+	m_bytesBefore = 0;
+	m_bytesAfter = 0;
+	m_skipped = 0;
+
+	if (!std::filesystem::is_directory(file))
+		return recompress_file(opts, file) ? 0 : 1;
+
+	auto files = collect_files(
+		file, opts.get<bool>(opts::recursive),
+		[](const std::filesystem::path& path)
+		{
+			return path.extension() == ".vtf";
+		});
+
+	// Like modify, a bad file shouldn't stop the rest of the tree from being processed
+	Batch batch(opts.get<int>(opts::jobs), false);
+	batch.set_cost_estimate(
+		[](const std::filesystem::path& path)
+		{
+			// Inflating and deflating scale with the size of the file
+			std::error_code ec;
+			const auto size = std::filesystem::file_size(path, ec);
+			return ec ? 0.0 : double(size);
+		});
+	const bool ok = batch.run(
+		files,
+		[this, &opts](const std::filesystem::path& path)
+		{
+			return recompress_file(opts, path);
+		});
+
+	if (!quiet) {
+		if (batch.parallel())
+			batch.print_summary("Recompressed");
+		// Skipped files count as unchanged, so the total never goes negative
+		fmt::print(
+			"{} -> {} bytes, saved {} ({:.2f} MiB). {} file(s) skipped as they would not shrink\n",
+			m_bytesBefore.load(), m_bytesAfter.load(), m_bytesBefore - m_bytesAfter,
+			(m_bytesBefore - m_bytesAfter) / (1024.0 * 1024), m_skipped.load());
+	}
+	return ok ? 0 : 1;
+}
+
+void ActionRecompress::cleanup() {
+}
+
+//
+// Recompress a single VTF in place. VTFLib loads it and lays it out again, copying the image data byte for byte, and
+// vtf::save deflates it across the thread pool. The result only replaces the file if it's smaller
+//
+bool ActionRecompress::recompress_file(const OptionList& opts, const std::filesystem::path& path) {
+	const auto level = opts.get<int>(opts::level);
+	const auto quiet = opts.get<bool>(opts::quiet);
+
+	std::size_t before = 0;
+	auto vtfFile = std::make_unique<CVTFFile>();
+	{
+		util::MappedFile data;
+		if (!data.open(path.string()) || !data.size() || !vtf::load(vtfFile.get(), data.data(), data.size())) {
+			std::cerr << fmt::format("Could not load {}: {}\n", path.string(), util::get_last_vtflib_error());
+			return false;
+		}
+		before = data.size();
+	}
+
+	// DEFLATE is only supported by 7.6
+	if (vtfFile->GetMinorVersion() < 6 && !vtfFile->SetVersion(vtfFile->GetMajorVersion(), 6)) {
+		std::cerr << fmt::format(
+			"Could not change the version of {}: {}\n", path.string(), util::get_last_vtflib_error());
+		return false;
+	}
+	if (!vtfFile->SetAuxCompressionLevel(level)) {
+		std::cerr << fmt::format("Could not set compression level of {} to {}\n", path.string(), level);
+		return false;
+	}
+
+	std::vector<std::uint8_t> out;
+	if (!vtf::save(vtfFile.get(), out)) {
+		std::cerr << fmt::format("Could not recompress {}: {}\n", path.string(), util::get_last_vtflib_error());
+		return false;
+	}
+
+	if (out.size() >= before) {
+		m_bytesBefore += before;
+		m_bytesAfter += before;
+		++m_skipped;
+		if (!quiet)
+			fmt::print("{} ({} bytes, would not shrink)\n", path.string(), before);
+		return true;
+	}
+
+	// Written under a temp name first so an interrupted run can't leave a truncated VTF behind
+	if (!util::write_file(path.string(), out.data(), out.size())) {
+		std::cerr << fmt::format("Could not write {}\n", path.string());
+		return false;
+	}
+
+	m_bytesBefore += before;
+	m_bytesAfter += out.size();
+	if (!quiet)
+		fmt::print("{} ({} -> {} bytes, saved {})\n", path.string(), before, out.size(), before - out.size());
+	return true;
+}
@@ -0,0 +1,31 @@
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+
+#include "action.hpp"
+
+namespace vtex2
+{
+
+	/**
+	 * Re-deflates the image data of existing VTFs at another compression level, without decoding any of it
+	 */
+	class ActionRecompress : public BaseAction {
+	public:
+		std::string get_name() const override {
+			return "recompress";
+		}
+		std::string get_help() const override;
+		const OptionList& get_options() const override;
+		int exec(const OptionList& opts) override;
+		void cleanup() override;
+
+	private:
+		bool recompress_file(const OptionList& opts, const std::filesystem::path& path);
+
+		std::atomic<std::uint64_t> m_bytesBefore{0};
+		std::atomic<std::uint64_t> m_bytesAfter{0};
+		std::atomic<std::size_t> m_skipped{0};
+	};
+
+} // namespace vtex2
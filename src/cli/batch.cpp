@@ -0,0 +1,405 @@
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <unordered_map>
+
+#include "fmt/format.h"
+
+#include "batch.hpp"
+#include "common/threadpool.hpp"
+#include "common/uring.hpp"
+#include "common/util.hpp"
+
+using namespace vtex2;
+
+namespace
+{
+	//
+	// Loads the files a batch is about to process on a background thread. Each one is mapped and has every page
+	// touched, which leaves it in the OS file cache until its job has opened it for real. Only files up to depth past
+	// the last job started are loaded, so memory use stays bounded no matter how many files there are
+	//
+	class ReadAhead {
+	public:
+		ReadAhead(const std::vector<std::filesystem::path>& files, std::size_t depth)
+			: m_files(files),
+			  m_depth(depth),
+			  m_limit(std::min(depth, files.size())),
+			  m_loaded(files.size()),
+			  m_started(files.size(), false),
+			  m_thread(&ReadAhead::run, this) {
+		}
+
+		~ReadAhead() {
+			{
+				std::lock_guard lock(m_mutex);
+				m_stop = true;
+			}
+			m_cv.notify_all();
+			m_thread.join();
+		}
+
+		void started(std::size_t index) {
+			{
+				std::lock_guard lock(m_mutex);
+				m_started[index] = true;
+				m_limit = std::max(m_limit, std::min(index + 1 + m_depth, m_files.size()));
+			}
+			m_cv.notify_all();
+		}
+
+		void finished(std::size_t index) {
+			// Declared before the lock, so the file is unmapped after it's released
+			std::unique_ptr<util::MappedFile> file;
+			std::lock_guard lock(m_mutex);
+			file = std::move(m_loaded[index]);
+		}
+
+	private:
+		void run() {
+			std::unique_lock lock(m_mutex);
+			while (true) {
+				m_cv.wait(
+					lock,
+					[this]
+					{
+						return m_stop || m_next < m_limit;
+					});
+				if (m_stop)
+					return;
+
+				// No point in loading a file its job is already reading
+				const auto index = m_next++;
+				if (m_started[index])
+					continue;
+
+				lock.unlock();
+				auto file = std::make_unique<util::MappedFile>();
+				if (file->open(m_files[index].string()))
+					touch(*file);
+				lock.lock();
+
+				if (!m_started[index])
+					m_loaded[index] = std::move(file);
+			}
+		}
+
+		static void touch(const util::MappedFile& file) {
+			// A byte from every page is enough to fault the whole file in
+			volatile std::uint8_t sink = 0;
+			for (std::size_t i = 0; i < file.size(); i += 4096)
+				sink = sink + file.data()[i];
+		}
+
+		const std::vector<std::filesystem::path>& m_files;
+		const std::size_t m_depth;
+		std::size_t m_limit;
+		std::size_t m_next = 0;
+		std::vector<std::unique_ptr<util::MappedFile>> m_loaded;
+		std::vector<bool> m_started;
+		bool m_stop = false;
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		std::thread m_thread;
+	};
+} // namespace
+
+std::vector<std::filesystem::path> vtex2::collect_files(
+	const std::filesystem::path& dir, bool recursive, const std::function<bool(const std::filesystem::path&)>& filter) {
+	std::vector<std::filesystem::path> files;
+
+	auto add = [&](const std::filesystem::directory_entry& dirent)
+	{
+		if (dirent.is_directory())
+			return;
+		if (filter(dirent.path()))
+			files.push_back(dirent.path());
+	};
+
+	if (recursive) {
+		for (auto& dirent : std::filesystem::recursive_directory_iterator(dir))
+			add(dirent);
+	}
+	else {
+		for (auto& dirent : std::filesystem::directory_iterator(dir))
+			add(dirent);
+	}
+	return files;
+}
+
+Batch::Batch(int jobs, bool stopOnError)
+	: m_jobs(jobs <= 0 ? util::ThreadPool::hardware_threads() : jobs),
+	  m_stopOnError(stopOnError) {
+}
+
+bool Batch::run(const std::vector<std::filesystem::path>& files, const Job& job) {
+	const auto start = std::chrono::steady_clock::now();
+
+	m_succeeded = 0;
+	m_total = files.size();
+	m_failed.clear();
+
+	// Estimating is usually a header read, so it's spread over the pool as well
+	const bool budgeted = m_memoryBudget > 0 && m_memory && parallel() && files.size() > 1;
+	std::vector<double> costs(m_cost && parallel() && files.size() > 1 ? files.size() : 0);
+	std::vector<std::uint64_t> memory(budgeted ? files.size() : 0);
+	if (!costs.empty() || !memory.empty()) {
+		util::parallel_for(
+			files.size(),
+			[&](std::size_t i)
+			{
+				if (!costs.empty())
+					costs[i] = m_cost(files[i]);
+				if (!memory.empty())
+					memory[i] = m_memory(files[i]);
+			});
+	}
+
+	// Longest jobs first
+	std::vector<std::size_t> order(files.size());
+	std::iota(order.begin(), order.end(), 0);
+	if (!costs.empty()) {
+		std::stable_sort(
+			order.begin(), order.end(),
+			[&](std::size_t a, std::size_t b)
+			{
+				return costs[a] > costs[b];
+			});
+	}
+
+	std::vector<std::filesystem::path> ordered;
+	ordered.reserve(files.size());
+	for (auto i : order)
+		ordered.push_back(files[i]);
+	const auto& queue = ordered;
+
+	std::optional<ReadAhead> readAhead;
+	if (m_readAhead > 0 && queue.size() > 1)
+		readAhead.emplace(queue, m_readAhead);
+
+	auto runJob = [&](std::size_t i)
+	{
+		if (readAhead)
+			readAhead->started(i);
+		const bool ok = job(queue[i]);
+		if (readAhead)
+			readAhead->finished(i);
+		record(queue[i], ok);
+		return ok;
+	};
+
+	if (!parallel() || queue.size() <= 1) {
+		for (std::size_t i = 0; i < queue.size(); ++i) {
+			if (!runJob(i) && m_stopOnError)
+				break;
+		}
+	}
+	else if (!budgeted) {
+		util::ThreadPool pool(std::min<int>(m_jobs, queue.size()));
+		for (std::size_t i = 0; i < queue.size(); ++i) {
+			pool.submit(
+				[&runJob, i]
+				{
+					runJob(i);
+				});
+		}
+		pool.wait();
+	}
+	else {
+		// Jobs are only started while the estimated memory of everything running fits the budget. When the next job
+		// doesn't fit, the first smaller one further down the queue that does takes its place. Anything goes when
+		// nothing else is running, so a job bigger than the budget still runs, on its own
+		util::ThreadPool pool(std::min<int>(m_jobs, queue.size()));
+		std::mutex mutex;
+		std::condition_variable finished;
+		std::uint64_t inUse = 0;
+		int running = 0;
+		std::vector<bool> started(queue.size(), false);
+		std::size_t first = 0; // No job before this one is waiting
+
+		std::unique_lock lock(mutex);
+		for (std::size_t remaining = queue.size(); remaining > 0;) {
+			std::size_t next = queue.size();
+			for (std::size_t i = first; running < m_jobs && i < queue.size(); ++i) {
+				if (!started[i] && (running == 0 || inUse + memory[order[i]] <= m_memoryBudget)) {
+					next = i;
+					break;
+				}
+			}
+			if (next == queue.size()) {
+				finished.wait(lock);
+				continue;
+			}
+
+			started[next] = true;
+			--remaining;
+			while (first < queue.size() && started[first])
+				++first;
+
+			const auto need = memory[order[next]];
+			inUse += need;
+			++running;
+			pool.submit(
+				[&, next, need]
+				{
+					runJob(next);
+					{
+						std::lock_guard jobLock(mutex);
+						inUse -= need;
+						--running;
+					}
+					finished.notify_all();
+				});
+		}
+		lock.unlock();
+		pool.wait();
+	}
+
+	m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return m_failed.empty();
+}
+
+void Batch::record(const std::filesystem::path& file, bool ok) {
+	if (ok) {
+		++m_succeeded;
+		return;
+	}
+	std::lock_guard lock(m_mutex);
+	m_failed.push_back(file);
+}
+
+void Batch::mark_failed(const std::filesystem::path& file) {
+	std::lock_guard lock(m_mutex);
+	--m_succeeded;
+	m_failed.push_back(file);
+}
+
+void Batch::print_summary(const char* verb) const {
+	std::lock_guard lock(m_mutex);
+
+	fmt::print(
+		"{} {} of {} file(s) in {:.2f}s using {} job(s), {} failed\n", verb, m_succeeded.load(), m_total, m_seconds,
+		m_jobs, m_failed.size());
+
+	if (m_failed.empty())
+		return;
+
+	// Sort so the list doesn't depend on scheduling order
+	auto failed = m_failed;
+	std::sort(failed.begin(), failed.end());
+
+	std::string list = "Failed files:\n";
+	for (auto& file : failed)
+		list += fmt::format("    {}\n", file.string());
+	std::cerr << list;
+}
+
+WriteBehind::WriteBehind(std::size_t depth)
+	: m_depth(std::max<std::size_t>(depth, 1)),
+	  m_thread(&WriteBehind::run, this) {
+}
+
+WriteBehind::~WriteBehind() {
+	finish();
+	{
+		std::lock_guard lock(m_mutex);
+		m_stop = true;
+	}
+	m_cv.notify_all();
+	m_thread.join();
+}
+
+void WriteBehind::write(
+	const std::filesystem::path& path, std::vector<std::uint8_t> data, const std::filesystem::path& source,
+	std::function<void()> onWritten) {
+	std::unique_lock lock(m_mutex);
+	m_cv.wait(
+		lock,
+		[this]
+		{
+			return m_queue.size() < m_depth;
+		});
+	m_queue.push_back({path, std::move(data), source, std::move(onWritten)});
+	m_cv.notify_all();
+}
+
+void WriteBehind::finish() {
+	std::unique_lock lock(m_mutex);
+	m_cv.wait(
+		lock,
+		[this]
+		{
+			return m_queue.empty() && m_writing == 0;
+		});
+}
+
+//
+// Writes everything queued until stopped. With io_uring, whatever is queued is handed to the kernel in one go, and
+// the thread only wakes up again once a file is done. Files io_uring won't take, and everything on systems without it,
+// are written here one at a time
+//
+void WriteBehind::run() {
+	util::RingWriter ring;
+	const bool useRing = ring.init(static_cast<unsigned>(m_depth));
+	std::unordered_map<std::uint64_t, Pending> inFlight;
+	std::uint64_t nextTag = 0;
+
+	std::unique_lock lock(m_mutex);
+	while (true) {
+		m_cv.wait(
+			lock,
+			[this, &ring]
+			{
+				return m_stop || !m_queue.empty() || ring.in_flight() > 0;
+			});
+		if (m_queue.empty() && ring.in_flight() == 0)
+			return;
+
+		std::vector<Pending> taken;
+		const std::size_t room = useRing ? ring.capacity() - ring.in_flight() : 1;
+		while (!m_queue.empty() && taken.size() < room) {
+			taken.push_back(std::move(m_queue.front()));
+			m_queue.pop_front();
+		}
+		m_writing += taken.size();
+		m_cv.notify_all();
+		lock.unlock();
+
+		std::vector<std::pair<Pending, bool>> done;
+		for (auto& pending : taken) {
+			const auto tag = nextTag++;
+			if (useRing && ring.write(pending.path.string(), pending.data.data(), pending.data.size(), tag)) {
+				inFlight.emplace(tag, std::move(pending));
+				continue;
+			}
+			const bool ok = util::write_file(pending.path.string(), pending.data.data(), pending.data.size());
+			done.emplace_back(std::move(pending), ok);
+		}
+		ring.wait(
+			[&](std::uint64_t tag, bool ok)
+			{
+				auto it = inFlight.find(tag);
+				done.emplace_back(std::move(it->second), ok);
+				inFlight.erase(it);
+			});
+
+		for (auto& [pending, ok] : done) {
+			if (!ok)
+				std::cerr << fmt::format("Could not write {}\n", pending.path.string());
+			else if (pending.onWritten)
+				pending.onWritten();
+		}
+
+		// A source may have several outputs, but it only fails once
+		lock.lock();
+		for (auto& [pending, ok] : done) {
+			if (!ok && std::find(m_failed.begin(), m_failed.end(), pending.source) == m_failed.end())
+				m_failed.push_back(pending.source);
+		}
+		m_writing -= done.size();
+		m_cv.notify_all();
+	}
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <thread>
+
+namespace vtex2
+{
+
+	/**
+	 * Gathers all files in a directory that pass the filter
+	 * @param dir Directory to search
+	 * @param recursive If true, descend into subdirectories too
+	 * @param filter Returns true if the file should be included
+	 */
+	std::vector<std::filesystem::path> collect_files(
+		const std::filesystem::path& dir, bool recursive,
+		const std::function<bool(const std::filesystem::path&)>& filter);
+
+	/**
+	 * Runs a job over a list of files, optionally spread over a thread pool,
+	 * and keeps track of which files failed.
+	 * Jobs must not share any mutable state when run in parallel!
+	 */
+	class Batch {
+	public:
+		using Job = std::function<bool(const std::filesystem::path&)>;
+		using CostFn = std::function<double(const std::filesystem::path&)>;
+		using MemoryFn = std::function<std::uint64_t(const std::filesystem::path&)>;
+
+		/**
+		 * @param jobs Number of files to process at once. 1 processes everything on the calling thread,
+		 * and <= 0 uses one worker per hardware thread
+		 * @param stopOnError Stop after the first failure. Only applies to serial batches, parallel
+		 * batches always run every file
+		 */
+		Batch(int jobs, bool stopOnError);
+
+		/**
+		 * Load up to this many files ahead of the ones being processed on a background thread, so reading them
+		 * overlaps with the jobs. The files are only pulled into the OS file cache, jobs still open them as usual.
+		 * 0, the default, disables read-ahead
+		 */
+		void set_read_ahead(int files) {
+			m_readAhead = files;
+		}
+
+		/**
+		 * Estimate how long each file's job takes, in any unit. Parallel batches then start with the most expensive
+		 * files, so a huge file found last doesn't leave every other worker idle at the end. Serial batches always
+		 * run in the order they were given
+		 */
+		void set_cost_estimate(CostFn cost) {
+			m_cost = std::move(cost);
+		}
+
+		/**
+		 * Limit the memory used by jobs running at the same time. Only applies to parallel batches
+		 * @param budget Maximum bytes in use at once, 0 for no limit
+		 * @param memory Estimates the peak memory use of a file's job in bytes. A job only starts if its estimate
+		 * and those of the running jobs fit the budget. Jobs that don't fit even on their own run alone
+		 */
+		void set_memory_budget(std::uint64_t budget, MemoryFn memory) {
+			m_memoryBudget = budget;
+			m_memory = std::move(memory);
+		}
+
+		/**
+		 * Run job over every file
+		 * @return true if every file succeeded
+		 */
+		bool run(const std::vector<std::filesystem::path>& files, const Job& job);
+
+		/**
+		 * Mark a file as failed after its job succeeded, ie because its output couldn't be written afterwards
+		 */
+		void mark_failed(const std::filesystem::path& file);
+
+		/**
+		 * Print a summary of the last run, including the list of failed files
+		 * @param verb What the job did to each file, ie "Converted"
+		 */
+		void print_summary(const char* verb) const;
+
+		bool parallel() const {
+			return m_jobs != 1;
+		}
+
+		std::size_t succeeded() const {
+			return m_succeeded;
+		}
+
+		const std::vector<std::filesystem::path>& failed() const {
+			return m_failed;
+		}
+
+	private:
+		void record(const std::filesystem::path& file, bool ok);
+
+		int m_jobs = 1;
+		bool m_stopOnError = true;
+		int m_readAhead = 0;
+		CostFn m_cost;
+		std::uint64_t m_memoryBudget = 0;
+		MemoryFn m_memory;
+		double m_seconds = 0;
+
+		std::atomic<std::size_t> m_succeeded{0};
+		std::size_t m_total = 0;
+		std::vector<std::filesystem::path> m_failed;
+		mutable std::mutex m_mutex;
+	};
+
+	/**
+	 * Writes files on a background thread, so jobs can move on to their next file while the last one is written.
+	 * Only a limited number of files are queued at once, after which write blocks until there's room again. Files are
+	 * written under a temp name and renamed into place. On Linux they go through io_uring when the kernel supports it
+	 */
+	class WriteBehind {
+	public:
+		/**
+		 * @param depth Number of files that may be waiting to be written
+		 */
+		explicit WriteBehind(std::size_t depth);
+		~WriteBehind();
+
+		WriteBehind(const WriteBehind&) = delete;
+		WriteBehind& operator=(const WriteBehind&) = delete;
+
+		/**
+		 * Queue data to be written to path. Safe to call from several threads at once
+		 * @param source File the data was made from, reported by failed() if the write fails
+		 * @param onWritten Called on the writer thread once the file was written successfully
+		 */
+		void write(
+			const std::filesystem::path& path, std::vector<std::uint8_t> data, const std::filesystem::path& source,
+			std::function<void()> onWritten = nullptr);
+
+		/**
+		 * Wait for every queued file to be written
+		 */
+		void finish();
+
+		/**
+		 * Sources of every file that couldn't be written. Only valid after finish
+		 */
+		const std::vector<std::filesystem::path>& failed() const {
+			return m_failed;
+		}
+
+	private:
+		struct Pending {
+			std::filesystem::path path;
+			std::vector<std::uint8_t> data;
+			std::filesystem::path source;
+			std::function<void()> onWritten;
+		};
+
+		void run();
+
+		std::size_t m_depth;
+		std::deque<Pending> m_queue;
+		std::size_t m_writing = 0; // Taken off the queue, but not written yet
+		bool m_stop = false;
+		std::vector<std::filesystem::path> m_failed;
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		std::thread m_thread;
+	};
+
+} // namespace vtex2
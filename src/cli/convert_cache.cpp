@@ -0,0 +1,172 @@
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <charconv>
+
+#include "fmt/format.h"
+
+#include "convert_cache.hpp"
+#include "common/hash.hpp"
+
+using namespace vtex2;
+
+// Bump this whenever the manifest layout changes
+static constexpr const char* MANIFEST_HEADER = "# vtex2 convert cache v1";
+
+template <typename T>
+static bool parse_num(const std::string& str, T& out, int base = 10) {
+	auto [p, err] = std::from_chars(str.data(), str.data() + str.size(), out, base);
+	return err == std::errc() && p == str.data() + str.size();
+}
+
+bool ConvertCache::load(const std::filesystem::path& manifest) {
+	std::lock_guard lock(m_mutex);
+	m_path = manifest;
+	m_entries.clear();
+
+	std::error_code ec;
+	if (!std::filesystem::exists(manifest, ec))
+		return true;
+
+	std::ifstream stream(manifest);
+	if (!stream.good())
+		return false;
+
+	std::string line;
+	if (!std::getline(stream, line) || line != MANIFEST_HEADER)
+		return true; // Unknown or outdated manifest, start from scratch
+
+	while (std::getline(stream, line)) {
+		// src, src size, src time, src hash, options hash, output, output size, output time, output hash
+		std::vector<std::string> fields;
+		std::stringstream ss(line);
+		for (std::string field; std::getline(ss, field, '\t');)
+			fields.push_back(field);
+		if (fields.size() != 9)
+			continue;
+
+		Entry entry;
+		const bool ok = parse_num(fields[1], entry.source.size) && parse_num(fields[2], entry.source.time) &&
+						parse_num(fields[3], entry.source.hash, 16) && parse_num(fields[4], entry.options, 16) &&
+						parse_num(fields[6], entry.outputStamp.size) && parse_num(fields[7], entry.outputStamp.time) &&
+						parse_num(fields[8], entry.outputStamp.hash, 16);
+		if (!ok)
+			continue; // Skip malformed lines
+		entry.output = fields[5];
+		m_entries[fields[0]] = entry;
+	}
+	return true;
+}
+
+bool ConvertCache::save() const {
+	std::lock_guard lock(m_mutex);
+	if (m_path.empty())
+		return false;
+
+	// Sort so the manifest diffs nicely between runs
+	std::vector<const std::pair<const std::string, Entry>*> sorted;
+	for (auto& entry : m_entries)
+		sorted.push_back(&entry);
+	std::sort(
+		sorted.begin(), sorted.end(),
+		[](auto* a, auto* b)
+		{
+			return a->first < b->first;
+		});
+
+	// Write to a temp file first so an interrupted run can't leave a truncated manifest behind
+	auto tmpPath = m_path;
+	tmpPath += ".tmp";
+	{
+		std::ofstream stream(tmpPath, std::ios::out | std::ios::trunc);
+		if (!stream.good())
+			return false;
+
+		stream << MANIFEST_HEADER << "\n";
+		for (auto* entry : sorted) {
+			auto& e = entry->second;
+			stream << fmt::format(
+				"{}\t{}\t{}\t{:016x}\t{:016x}\t{}\t{}\t{}\t{:016x}\n", entry->first, e.source.size, e.source.time,
+				e.source.hash, e.options, e.output, e.outputStamp.size, e.outputStamp.time, e.outputStamp.hash);
+		}
+		if (!stream.good())
+			return false;
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(tmpPath, m_path, ec);
+	return !ec;
+}
+
+bool ConvertCache::is_up_to_date(
+	const std::filesystem::path& src, const std::filesystem::path& out, std::uint64_t optionsHash,
+	std::uint64_t& outSourceHash) {
+	const auto key = key_for(src);
+
+	FileStamp srcStamp;
+	if (!stat_file(src, srcStamp))
+		return false;
+
+	Entry entry;
+	bool known = false;
+	{
+		std::lock_guard lock(m_mutex);
+		auto it = m_entries.find(key);
+		if (it != m_entries.end()) {
+			entry = it->second;
+			known = true;
+		}
+	}
+
+	// Only re-read the source if it looks like it changed
+	if (known && entry.source.size == srcStamp.size && entry.source.time == srcStamp.time)
+		srcStamp.hash = entry.source.hash;
+	else if (!util::hash_file(src.string(), srcStamp.hash))
+		return false;
+	outSourceHash = srcStamp.hash;
+
+	if (!known || entry.source.hash != srcStamp.hash || entry.options != optionsHash || entry.output != key_for(out))
+		return false;
+
+	// Output must still be the one we produced last time
+	FileStamp outStamp;
+	if (!stat_file(out, outStamp) || outStamp.size != entry.outputStamp.size)
+		return false;
+	if (outStamp.time == entry.outputStamp.time)
+		return true;
+	return util::hash_file(out.string(), outStamp.hash) && outStamp.hash == entry.outputStamp.hash;
+}
+
+void ConvertCache::update(
+	const std::filesystem::path& src, const std::filesystem::path& out, std::uint64_t optionsHash,
+	std::uint64_t sourceHash) {
+	Entry entry;
+	if (!stat_file(src, entry.source) || !stat_file(out, entry.outputStamp) ||
+		!util::hash_file(out.string(), entry.outputStamp.hash))
+		return;
+	entry.source.hash = sourceHash;
+	entry.options = optionsHash;
+	entry.output = key_for(out);
+
+	std::lock_guard lock(m_mutex);
+	m_entries[key_for(src)] = entry;
+}
+
+bool ConvertCache::stat_file(const std::filesystem::path& path, FileStamp& stamp) {
+	std::error_code ec;
+	stamp.size = std::filesystem::file_size(path, ec);
+	if (ec)
+		return false;
+	auto time = std::filesystem::last_write_time(path, ec);
+	if (ec)
+		return false;
+	stamp.time = time.time_since_epoch().count();
+	return true;
+}
+
+std::string ConvertCache::key_for(const std::filesystem::path& path) {
+	std::error_code ec;
+	auto abs = std::filesystem::absolute(path, ec);
+	return (ec ? path : abs).lexically_normal().generic_string();
+}
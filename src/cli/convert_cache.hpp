@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+
+namespace vtex2
+{
+
+	/**
+	 * Persistent record of previous conversions
+	 *
+	 * Each source file is mapped to the hash of its contents, the hash of the options it was converted with and
+	 * the hash of the resulting output. A file whose source, options and output are all unchanged since the last
+	 * run can be skipped entirely. Size and modification time are recorded alongside each hash, so files that
+	 * haven't been touched don't need to be re-read.
+	 *
+	 * The manifest is a plain text file with one tab separated line per source file.
+	 * All methods are safe to call from multiple threads.
+	 */
+	class ConvertCache {
+	public:
+		/**
+		 * Load the manifest. A missing manifest is not an error, it just starts out empty
+		 * @return false if the manifest exists but could not be read
+		 */
+		bool load(const std::filesystem::path& manifest);
+
+		/**
+		 * Write the manifest back to the path it was loaded from
+		 */
+		bool save() const;
+
+		/**
+		 * Check if the output for src is still up to date
+		 * @param optionsHash Hash of all options that affect the output
+		 * @param outSourceHash Receives the source content hash, so it can be passed to update() afterwards
+		 */
+		bool is_up_to_date(
+			const std::filesystem::path& src, const std::filesystem::path& out, std::uint64_t optionsHash,
+			std::uint64_t& outSourceHash);
+
+		/**
+		 * Record a successful conversion
+		 * @param sourceHash Source hash as returned by is_up_to_date
+		 */
+		void update(
+			const std::filesystem::path& src, const std::filesystem::path& out, std::uint64_t optionsHash,
+			std::uint64_t sourceHash);
+
+	private:
+		struct FileStamp {
+			std::uint64_t size = 0;
+			std::int64_t time = 0;
+			std::uint64_t hash = 0;
+		};
+
+		struct Entry {
+			FileStamp source;
+			std::uint64_t options = 0;
+			std::string output;
+			FileStamp outputStamp;
+		};
+
+		static bool stat_file(const std::filesystem::path& path, FileStamp& stamp);
+		static std::string key_for(const std::filesystem::path& path);
+
+		std::filesystem::path m_path;
+		std::unordered_map<std::string, Entry> m_entries;
+		mutable std::mutex m_mutex;
+	};
+
+} // namespace vtex2
@@ -14,7 +14,10 @@
 #include "action_extract.hpp"
 #include "action_convert.hpp"
 #include "action_pack.hpp"
+#include "action_modify.hpp"
+#include "action_recompress.hpp"
 #include "common/util.hpp"
+#include "common/cpu.hpp"
 
 using namespace vtex2;
 
@@ -25,10 +28,12 @@ namespace vtex2
 }
 
 // Global list of actions
-static BaseAction* s_actions[] = {new ActionInfo(), new ActionExtract(), new ActionConvert(), new ActionPack()};
+static BaseAction* s_actions[] = {new ActionInfo(), new ActionExtract(), new ActionConvert(), new ActionPack(),
+								  new ActionModify(), new ActionRecompress()};
 
 static bool handle_option(int argc, int& argIndex, char** argv, ActionOption& opt);
 static bool arg_compare(const char* arg, const char* argname);
+static bool handle_cpu_features(int argc, int& argIndex, char** argv);
 
 [[noreturn]] static void show_help(int exitCode = 0);
 [[noreturn]] static void show_action_help(BaseAction* action, int exitCode = 0);
@@ -108,14 +113,21 @@ int main(int argc, char** argv) {
 			}
 
 			// Handle this argument as a part of the action args
+			bool matched = false;
 			for (auto& o : opts.opts()) {
-				if (!std::strcmp(o.m_name[0].c_str(), arg) || !std::strcmp(o.m_name[1].c_str(), arg)) {
+				if (arg_compare(arg, o.m_name[0].c_str()) || arg_compare(arg, o.m_name[1].c_str())) {
 					if (!handle_option(argc, i, argv, o)) {
 						show_help(1);
 					}
+					matched = true;
 					break;
 				}
 			}
+
+			if (!matched) {
+				std::cerr << fmt::format("Unknown option '{}'!\n", arg);
+				show_action_help(action, 1);
+			}
 		}
 		// Handle args to the global vtex2
 		else {
@@ -123,6 +135,10 @@ int main(int argc, char** argv) {
 				show_help(0);
 			else if (!std::strcmp(arg, "--version"))
 				show_version();
+			else if (!std::strcmp(arg, "--cpu-features") || !std::strncmp(arg, "--cpu-features=", 15)) {
+				if (!handle_cpu_features(argc, i, argv))
+					exit(1);
+			}
 		}
 	}
 
@@ -149,13 +165,13 @@ int main(int argc, char** argv) {
  * Splits an arg by the contained =
  * --opt=something
  * -o=bruh
- * Returns true if there was separating =.
+ * Returns true if there was separating =, and sets value to everything after it.
  * If false, value is not modified at all
  */
 static bool split_arg(const char* arg, std::string& value) {
 	auto* s = strpbrk(arg, "=");
 	if (s)
-		value = s;
+		value = s + 1;
 	return !!s;
 }
 
@@ -275,13 +291,36 @@ bool handle_option(int argc, int& argIndex, char** argv, ActionOption& opt) {
  *  somearg and somearg
  */
 static bool arg_compare(const char* arg, const char* argname) {
-	for (const char *a = arg, *b = argname; *a && *b; ++a, ++b) {
-		if (*a == *b)
-			continue;
-		else if (*a == '=')
-			return true;
+	const auto len = std::strlen(argname);
+	return len && !std::strncmp(arg, argname, len) && (arg[len] == '\0' || arg[len] == '=');
+}
+
+/**
+ * Handle --cpu-features, which forces the image kernels down to a specific instruction set
+ *  --cpu-features=avx2
+ *  --cpu-features avx2
+ */
+static bool handle_cpu_features(int argc, int& argIndex, char** argv) {
+	std::string value;
+	if (!split_arg(argv[argIndex], value) && argIndex + 1 < argc)
+		value = argv[++argIndex];
+
+	cpu::Level level;
+	if (!cpu::parse_level(value.c_str(), level)) {
+		std::cerr << fmt::format("Bad value '{}' for --cpu-features\nValid values are: ", value);
+		for (int i = 0; i <= static_cast<int>(cpu::Level::AVX512); ++i)
+			std::cerr << fmt::format("{} ", cpu::level_name(static_cast<cpu::Level>(i)));
+		std::cerr << "\n";
+		return false;
 	}
-	return false;
+
+	if (!cpu::set_level(level)) {
+		std::cerr << fmt::format(
+			"This CPU does not support {} (best supported is {})\n", cpu::level_name(level),
+			cpu::level_name(cpu::detected()));
+		return false;
+	}
+	return true;
 }
 
 static void show_help(int exitCode) {
@@ -291,6 +330,10 @@ static void show_help(int exitCode) {
 		<< "\nOptions:\n";
 	fmt::print("  {:<32} - Display this help text\n", "-?,--help");
 	fmt::print("  {:<32} - Display version info\n", "--version");
+	fmt::print(
+		"  {:<32} - Limit image kernels to an instruction set, for benchmarking and debugging. Defaults to the best "
+		"one available ({})\n",
+		"--cpu-features=LEVEL", cpu::level_name(cpu::detected()));
 	std::cout << "\nCommands:\n";
 	for (auto& a : s_actions) {
 		fmt::print("  {} - {}\n", a->get_name().c_str(), a->get_help().c_str());
@@ -301,6 +344,7 @@ static void show_help(int exitCode) {
 
 static void show_version() {
 	fmt::print("vtex2 version {}\n", VTEX2_VERSION);
+	fmt::print("Image kernels: {} (best supported: {})\n", cpu::level_name(cpu::active()), cpu::level_name(cpu::detected()));
 	exit(0);
 }
 
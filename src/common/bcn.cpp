@@ -0,0 +1,815 @@
+#include "bcn.hpp"
+#include "strtools.hpp"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <cstring>
+
+using namespace bcn;
+
+static const char* s_qualityNames[] = {"fast", "normal", "high"};
+
+// Images smaller than this are decoded on the calling thread
+static constexpr size_t DECODE_PARALLEL_TEXELS = 256 * 256;
+
+bool bcn::parse_quality(const char* str, Quality& outQuality) {
+	for (int i = 0; i < static_cast<int>(sizeof(s_qualityNames) / sizeof(s_qualityNames[0])); ++i) {
+		if (!str::strcasecmp(str, s_qualityNames[i])) {
+			outQuality = static_cast<Quality>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* bcn::quality_name(Quality quality) {
+	return s_qualityNames[static_cast<int>(quality)];
+}
+
+//
+// BC1 color blocks
+//
+
+namespace
+{
+	struct Endpoint {
+		int c[3]; // Quantized to 5:6:5
+	};
+
+	constexpr int s_bits[3] = {5, 6, 5};
+
+	inline int expand_bits(int v, int bits) {
+		return (v << (8 - bits)) | (v >> (2 * bits - 8));
+	}
+
+	inline int quantize(float v, int bits) {
+		const int maxv = (1 << bits) - 1;
+		return std::clamp(static_cast<int>(v * maxv / 255.f + 0.5f), 0, maxv);
+	}
+
+	inline uint16_t pack565(const Endpoint& e) {
+		return static_cast<uint16_t>((e.c[0] << 11) | (e.c[1] << 5) | e.c[2]);
+	}
+
+	//
+	// Table of endpoint pairs that reproduce an 8-bit value as closely as possible at the 1/3 interpolant.
+	// Used for solid color blocks, where the exact color is very often not representable as an endpoint
+	//
+	struct SolidTable {
+		uint8_t e[256][2];
+
+		explicit SolidTable(int bits) {
+			const int count = 1 << bits;
+			for (int v = 0; v < 256; ++v) {
+				int bestErr = INT_MAX;
+				for (int a = 0; a < count; ++a) {
+					for (int b = 0; b < count; ++b) {
+						const int ea = expand_bits(a, bits), eb = expand_bits(b, bits);
+						const int err = std::abs((2 * ea + eb + 1) / 3 - v) * 256 + std::abs(ea - eb);
+						if (err < bestErr) {
+							bestErr = err;
+							e[v][0] = static_cast<uint8_t>(a);
+							e[v][1] = static_cast<uint8_t>(b);
+						}
+					}
+				}
+			}
+		}
+	};
+
+	const SolidTable& solid_table(int bits) {
+		static const SolidTable s_table5(5), s_table6(6);
+		return bits == 5 ? s_table5 : s_table6;
+	}
+
+	//
+	// Input to the color block encoder. Transparent texels (one bit alpha only) are left out of the fit and
+	// always use index 3 in 3 color mode
+	//
+	struct ColorBlock {
+		int px[16][3];
+		bool transparent[16];
+		bool anyTransparent;
+	};
+
+	//
+	// Build the palette for a pair of endpoints. In 3 color mode, the 4th entry is transparent black
+	//
+	void color_palette(const Endpoint& e0, const Endpoint& e1, bool fourColor, int (&pal)[4][3]) {
+		for (int c = 0; c < 3; ++c) {
+			const int a = expand_bits(e0.c[c], s_bits[c]);
+			const int b = expand_bits(e1.c[c], s_bits[c]);
+			pal[0][c] = a;
+			pal[1][c] = b;
+			if (fourColor) {
+				pal[2][c] = (2 * a + b + 1) / 3;
+				pal[3][c] = (a + 2 * b + 1) / 3;
+			}
+			else {
+				pal[2][c] = (a + b) / 2;
+				pal[3][c] = 0;
+			}
+		}
+	}
+
+	//
+	// Pick the closest palette entry for every texel, returns the total squared error
+	//
+	int color_indices(const ColorBlock& blk, const Endpoint& e0, const Endpoint& e1, bool fourColor, uint8_t (&idx)[16]) {
+		int pal[4][3];
+		color_palette(e0, e1, fourColor, pal);
+		const int entries = fourColor ? 4 : 3;
+
+		int total = 0;
+		for (int i = 0; i < 16; ++i) {
+			if (blk.transparent[i]) {
+				idx[i] = 3;
+				continue;
+			}
+			int best = INT_MAX;
+			for (int p = 0; p < entries; ++p) {
+				const int dr = blk.px[i][0] - pal[p][0];
+				const int dg = blk.px[i][1] - pal[p][1];
+				const int db = blk.px[i][2] - pal[p][2];
+				const int err = dr * dr + dg * dg + db * db;
+				if (err < best) {
+					best = err;
+					idx[i] = static_cast<uint8_t>(p);
+				}
+			}
+			total += best;
+		}
+		return total;
+	}
+
+	//
+	// Least squares fit of the endpoints to the current index assignment
+	// Returns false if the system is degenerate (ie every texel uses the same index)
+	//
+	bool color_least_squares(const ColorBlock& blk, const uint8_t (&idx)[16], bool fourColor, Endpoint& e0, Endpoint& e1) {
+		static constexpr float s_weights4[4] = {0.f, 1.f, 1.f / 3.f, 2.f / 3.f};
+		static constexpr float s_weights3[4] = {0.f, 1.f, 0.5f, 0.f};
+		const float* weights = fourColor ? s_weights4 : s_weights3;
+
+		float aa = 0, bb = 0, ab = 0;
+		float ax[3] = {}, bx[3] = {};
+		for (int i = 0; i < 16; ++i) {
+			if (blk.transparent[i])
+				continue;
+			const float t = weights[idx[i]];
+			const float s = 1.f - t;
+			aa += s * s;
+			bb += t * t;
+			ab += s * t;
+			for (int c = 0; c < 3; ++c) {
+				ax[c] += s * blk.px[i][c];
+				bx[c] += t * blk.px[i][c];
+			}
+		}
+
+		const float det = aa * bb - ab * ab;
+		if (std::fabs(det) < 1e-6f)
+			return false;
+
+		const float inv = 1.f / det;
+		for (int c = 0; c < 3; ++c) {
+			e0.c[c] = quantize((ax[c] * bb - bx[c] * ab) * inv, s_bits[c]);
+			e1.c[c] = quantize((bx[c] * aa - ax[c] * ab) * inv, s_bits[c]);
+		}
+		return true;
+	}
+
+	//
+	// Initial endpoints from the bounding box of the block, inset slightly and flipped onto the diagonal that
+	// best matches the color distribution
+	//
+	void color_endpoints_box(const ColorBlock& blk, Endpoint& e0, Endpoint& e1) {
+		int mn[3] = {255, 255, 255}, mx[3] = {0, 0, 0};
+		float mean[3] = {};
+		int count = 0;
+		for (int i = 0; i < 16; ++i) {
+			if (blk.transparent[i])
+				continue;
+			for (int c = 0; c < 3; ++c) {
+				mn[c] = std::min(mn[c], blk.px[i][c]);
+				mx[c] = std::max(mx[c], blk.px[i][c]);
+				mean[c] += blk.px[i][c];
+			}
+			++count;
+		}
+		for (int c = 0; c < 3; ++c)
+			mean[c] /= count;
+
+		// Flip green and blue if they're anti-correlated with red. Uses green as the reference if red is flat
+		const int ref = (mx[0] != mn[0]) ? 0 : 1;
+		float cov[3] = {};
+		for (int i = 0; i < 16; ++i) {
+			if (blk.transparent[i])
+				continue;
+			for (int c = 0; c < 3; ++c)
+				cov[c] += (blk.px[i][ref] - mean[ref]) * (blk.px[i][c] - mean[c]);
+		}
+
+		for (int c = 0; c < 3; ++c) {
+			const int inset = (mx[c] - mn[c]) / 16;
+			int hi = mx[c] - inset, lo = mn[c] + inset;
+			if (c != ref && cov[c] < 0)
+				std::swap(hi, lo);
+			e0.c[c] = quantize(static_cast<float>(hi), s_bits[c]);
+			e1.c[c] = quantize(static_cast<float>(lo), s_bits[c]);
+		}
+	}
+
+	//
+	// Initial endpoints from the principal axis of the block, which handles gradients that don't lie on a diagonal
+	// of the bounding box
+	//
+	void color_endpoints_pca(const ColorBlock& blk, Endpoint& e0, Endpoint& e1) {
+		float mean[3] = {};
+		int count = 0;
+		for (int i = 0; i < 16; ++i) {
+			if (blk.transparent[i])
+				continue;
+			for (int c = 0; c < 3; ++c)
+				mean[c] += blk.px[i][c];
+			++count;
+		}
+		for (int c = 0; c < 3; ++c)
+			mean[c] /= count;
+
+		float cov[6] = {};
+		for (int i = 0; i < 16; ++i) {
+			if (blk.transparent[i])
+				continue;
+			const float r = blk.px[i][0] - mean[0];
+			const float g = blk.px[i][1] - mean[1];
+			const float b = blk.px[i][2] - mean[2];
+			cov[0] += r * r;
+			cov[1] += r * g;
+			cov[2] += r * b;
+			cov[3] += g * g;
+			cov[4] += g * b;
+			cov[5] += b * b;
+		}
+
+		// Power iteration, seeded with the covariance of the channel that varies most. The bounding box diagonal
+		// would be a worse seed, it's perpendicular to the axis when two channels are anticorrelated
+		static constexpr int s_columns[3][3] = {{0, 1, 2}, {1, 3, 4}, {2, 4, 5}};
+		const int seed = (cov[0] >= cov[3] && cov[0] >= cov[5]) ? 0 : (cov[3] >= cov[5] ? 1 : 2);
+		float axis[3] = {cov[s_columns[seed][0]], cov[s_columns[seed][1]], cov[s_columns[seed][2]]};
+		for (int iter = 0; iter < 8; ++iter) {
+			const float x = axis[0] * cov[0] + axis[1] * cov[1] + axis[2] * cov[2];
+			const float y = axis[0] * cov[1] + axis[1] * cov[3] + axis[2] * cov[4];
+			const float z = axis[0] * cov[2] + axis[1] * cov[4] + axis[2] * cov[5];
+			const float len = std::max(std::fabs(x), std::max(std::fabs(y), std::fabs(z)));
+			if (len < 1e-6f)
+				break;
+			axis[0] = x / len;
+			axis[1] = y / len;
+			axis[2] = z / len;
+		}
+
+		// Endpoints are the texels furthest along the axis in either direction
+		float minDot = 1e30f, maxDot = -1e30f;
+		int minIdx = 0, maxIdx = 0;
+		for (int i = 0; i < 16; ++i) {
+			if (blk.transparent[i])
+				continue;
+			const float d = blk.px[i][0] * axis[0] + blk.px[i][1] * axis[1] + blk.px[i][2] * axis[2];
+			if (d < minDot) {
+				minDot = d;
+				minIdx = i;
+			}
+			if (d > maxDot) {
+				maxDot = d;
+				maxIdx = i;
+			}
+		}
+
+		for (int c = 0; c < 3; ++c) {
+			e0.c[c] = quantize(static_cast<float>(blk.px[maxIdx][c]), s_bits[c]);
+			e1.c[c] = quantize(static_cast<float>(blk.px[minIdx][c]), s_bits[c]);
+		}
+	}
+
+	//
+	// Write out a color block, putting the endpoints in the order that selects the mode we encoded for
+	//
+	void write_color_block(Endpoint e0, Endpoint e1, uint8_t (&idx)[16], bool fourColor, uint8_t* out) {
+		uint16_t c0 = pack565(e0), c1 = pack565(e1);
+
+		if (fourColor) {
+			// 4 color mode needs c0 > c1. Swapping the endpoints swaps index 0 <-> 1 and 2 <-> 3
+			if (c0 < c1) {
+				std::swap(c0, c1);
+				for (auto& i : idx)
+					i ^= 1;
+			}
+			// Identical endpoints decode as 3 color mode, but index 0 is still correct
+			else if (c0 == c1) {
+				for (auto& i : idx)
+					i = 0;
+			}
+		}
+		else if (c0 > c1) {
+			// 3 color mode needs c0 <= c1. Index 2 is the midpoint, so only 0 <-> 1 changes
+			std::swap(c0, c1);
+			for (auto& i : idx)
+				if (i < 2)
+					i ^= 1;
+		}
+
+		uint32_t bits = 0;
+		for (int i = 0; i < 16; ++i)
+			bits |= static_cast<uint32_t>(idx[i]) << (i * 2);
+
+		out[0] = c0 & 0xFF;
+		out[1] = c0 >> 8;
+		out[2] = c1 & 0xFF;
+		out[3] = c1 >> 8;
+		out[4] = bits & 0xFF;
+		out[5] = (bits >> 8) & 0xFF;
+		out[6] = (bits >> 16) & 0xFF;
+		out[7] = bits >> 24;
+	}
+
+	//
+	// Fit endpoints for one mode, returns the error
+	//
+	int fit_color(const ColorBlock& blk, Quality quality, bool fourColor, Endpoint& e0, Endpoint& e1, uint8_t (&idx)[16]) {
+		if (quality == Quality::Fast)
+			color_endpoints_box(blk, e0, e1);
+		else
+			color_endpoints_pca(blk, e0, e1);
+
+		int err = color_indices(blk, e0, e1, fourColor, idx);
+		if (quality == Quality::Fast)
+			return err;
+
+		// Refine the endpoints against the index assignment until it stops improving
+		const int iterations = quality == Quality::High ? 8 : 2;
+		for (int iter = 0; iter < iterations && err > 0; ++iter) {
+			Endpoint n0, n1;
+			if (!color_least_squares(blk, idx, fourColor, n0, n1))
+				break;
+			uint8_t nidx[16];
+			const int nerr = color_indices(blk, n0, n1, fourColor, nidx);
+			if (nerr >= err)
+				break;
+			err = nerr;
+			e0 = n0;
+			e1 = n1;
+			std::memcpy(idx, nidx, sizeof(idx));
+		}
+
+		if (quality != Quality::High)
+			return err;
+
+		// Nudge each quantized endpoint component by one step, keeping anything that helps
+		bool improved = true;
+		for (int pass = 0; pass < 4 && improved && err > 0; ++pass) {
+			improved = false;
+			for (int e = 0; e < 2; ++e) {
+				for (int c = 0; c < 3; ++c) {
+					for (int delta = -1; delta <= 1; delta += 2) {
+						Endpoint n0 = e0, n1 = e1;
+						Endpoint& n = e ? n1 : n0;
+						n.c[c] += delta;
+						if (n.c[c] < 0 || n.c[c] >= (1 << s_bits[c]))
+							continue;
+						uint8_t nidx[16];
+						const int nerr = color_indices(blk, n0, n1, fourColor, nidx);
+						if (nerr < err) {
+							err = nerr;
+							e0 = n0;
+							e1 = n1;
+							std::memcpy(idx, nidx, sizeof(idx));
+							improved = true;
+						}
+					}
+				}
+			}
+		}
+		return err;
+	}
+
+	//
+	// Encode the color part of a BC1 or BC3 block
+	//  oneBitAlpha: Texels with alpha < 128 are encoded as transparent black
+	//  allowThreeColor: Whether 3 color mode may be used on opaque blocks. Never true for BC3, whose color
+	//                   block is always decoded in 4 color mode
+	//
+	void encode_color(const uint8_t* rgba, uint8_t* out, Quality quality, bool oneBitAlpha, bool allowThreeColor) {
+		ColorBlock blk;
+		blk.anyTransparent = false;
+		bool solid = true;
+		int first = -1;
+		for (int i = 0; i < 16; ++i) {
+			for (int c = 0; c < 3; ++c)
+				blk.px[i][c] = rgba[i * 4 + c];
+			blk.transparent[i] = oneBitAlpha && rgba[i * 4 + 3] < 128;
+			blk.anyTransparent |= blk.transparent[i];
+			if (blk.transparent[i])
+				continue;
+			if (first < 0)
+				first = i;
+			else if (std::memcmp(blk.px[i], blk.px[first], sizeof(blk.px[i])) != 0)
+				solid = false;
+		}
+
+		uint8_t idx[16];
+		Endpoint e0, e1;
+
+		// Fully transparent
+		if (first < 0) {
+			e0 = e1 = Endpoint{{0, 0, 0}};
+			std::fill(std::begin(idx), std::end(idx), uint8_t(3));
+			write_color_block(e0, e1, idx, false, out);
+			return;
+		}
+
+		// Single color, use the 1/3 interpolant for the closest match
+		if (solid && !blk.anyTransparent) {
+			for (int c = 0; c < 3; ++c) {
+				const auto& table = solid_table(s_bits[c]);
+				e0.c[c] = table.e[blk.px[first][c]][0];
+				e1.c[c] = table.e[blk.px[first][c]][1];
+			}
+			std::fill(std::begin(idx), std::end(idx), uint8_t(2));
+			write_color_block(e0, e1, idx, true, out);
+			return;
+		}
+
+		// Transparent texels force 3 color mode
+		bool fourColor = !blk.anyTransparent;
+		int err = fit_color(blk, quality, fourColor, e0, e1, idx);
+
+		if (fourColor && allowThreeColor && quality != Quality::Fast && err > 0) {
+			Endpoint t0, t1;
+			uint8_t tidx[16];
+			if (fit_color(blk, quality, false, t0, t1, tidx) < err) {
+				fourColor = false;
+				e0 = t0;
+				e1 = t1;
+				std::memcpy(idx, tidx, sizeof(idx));
+			}
+		}
+
+		write_color_block(e0, e1, idx, fourColor, out);
+	}
+
+	//
+	// BC4 single channel blocks, also used for BC3 alpha and both BC5 channels
+	//
+
+	//
+	// Palette for a pair of endpoints. a0 > a1 selects 8 value mode, otherwise 6 values plus 0 and 255
+	//
+	void single_palette(int a0, int a1, int (&pal)[8]) {
+		pal[0] = a0;
+		pal[1] = a1;
+		if (a0 > a1) {
+			for (int i = 1; i < 7; ++i)
+				pal[i + 1] = ((7 - i) * a0 + i * a1 + 3) / 7;
+		}
+		else {
+			for (int i = 1; i < 5; ++i)
+				pal[i + 1] = ((5 - i) * a0 + i * a1 + 2) / 5;
+			pal[6] = 0;
+			pal[7] = 255;
+		}
+	}
+
+	int single_indices(const uint8_t (&v)[16], int a0, int a1, uint8_t (&idx)[16]) {
+		int pal[8];
+		single_palette(a0, a1, pal);
+
+		int total = 0;
+		for (int i = 0; i < 16; ++i) {
+			int best = INT_MAX;
+			for (int p = 0; p < 8; ++p) {
+				const int d = v[i] - pal[p];
+				if (d * d < best) {
+					best = d * d;
+					idx[i] = static_cast<uint8_t>(p);
+				}
+			}
+			total += best;
+		}
+		return total;
+	}
+
+	//
+	// Coordinate descent on the endpoints of one mode, keeping a0 > a1 (8 values) or a0 <= a1 (6 values)
+	//
+	int refine_single(const uint8_t (&v)[16], bool eightValue, int& a0, int& a1, int err, uint8_t (&idx)[16]) {
+		bool improved = true;
+		for (int pass = 0; pass < 8 && improved && err > 0; ++pass) {
+			improved = false;
+			for (int e = 0; e < 2; ++e) {
+				for (int delta = -1; delta <= 1; delta += 2) {
+					int n0 = a0, n1 = a1;
+					(e ? n1 : n0) += delta;
+					if (n0 < 0 || n0 > 255 || n1 < 0 || n1 > 255 || (n0 > n1) != eightValue)
+						continue;
+					uint8_t nidx[16];
+					const int nerr = single_indices(v, n0, n1, nidx);
+					if (nerr < err) {
+						err = nerr;
+						a0 = n0;
+						a1 = n1;
+						std::memcpy(idx, nidx, sizeof(idx));
+						improved = true;
+					}
+				}
+			}
+		}
+		return err;
+	}
+
+	void encode_single(const uint8_t (&v)[16], uint8_t* out, Quality quality) {
+		int mn = 255, mx = 0;
+		int mnInner = 255, mxInner = 0; // Ignoring 0 and 255, which 6 value mode gets for free
+		for (int i = 0; i < 16; ++i) {
+			mn = std::min<int>(mn, v[i]);
+			mx = std::max<int>(mx, v[i]);
+			if (v[i] != 0 && v[i] != 255) {
+				mnInner = std::min<int>(mnInner, v[i]);
+				mxInner = std::max<int>(mxInner, v[i]);
+			}
+		}
+
+		uint8_t idx[16] = {};
+		int a0 = mx, a1 = mn;
+		if (mn != mx) {
+			int err = single_indices(v, a0, a1, idx);
+			if (quality == Quality::High)
+				err = refine_single(v, true, a0, a1, err, idx);
+
+			if (quality != Quality::Fast && err > 0 && mnInner <= mxInner && (mn == 0 || mx == 255)) {
+				int b0 = mnInner, b1 = mxInner;
+				uint8_t bidx[16];
+				int berr = single_indices(v, b0, b1, bidx);
+				if (quality == Quality::High)
+					berr = refine_single(v, false, b0, b1, berr, bidx);
+				if (berr < err) {
+					a0 = b0;
+					a1 = b1;
+					std::memcpy(idx, bidx, sizeof(idx));
+				}
+			}
+		}
+
+		out[0] = static_cast<uint8_t>(a0);
+		out[1] = static_cast<uint8_t>(a1);
+		uint64_t bits = 0;
+		for (int i = 0; i < 16; ++i)
+			bits |= static_cast<uint64_t>(idx[i]) << (i * 3);
+		for (int i = 0; i < 6; ++i)
+			out[2 + i] = static_cast<uint8_t>(bits >> (i * 8));
+	}
+
+	void encode_channel(const uint8_t* rgba, int channel, uint8_t* out, Quality quality) {
+		uint8_t v[16];
+		for (int i = 0; i < 16; ++i)
+			v[i] = rgba[i * 4 + channel];
+		encode_single(v, out, quality);
+	}
+
+	//
+	// BC2 alpha, 4 bits per texel with no interpolation
+	//
+	void encode_explicit_alpha(const uint8_t* rgba, uint8_t* out) {
+		for (int i = 0; i < 8; ++i) {
+			const int a0 = (rgba[(i * 2) * 4 + 3] * 15 + 127) / 255;
+			const int a1 = (rgba[(i * 2 + 1) * 4 + 3] * 15 + 127) / 255;
+			out[i] = static_cast<uint8_t>(a0 | (a1 << 4));
+		}
+	}
+
+	//
+	// Decoding
+	//
+
+	//
+	// Decode a color block into the RGB of 16 RGBA texels. BC1 blocks with c0 <= c1 are in 3 color mode, where
+	// index 3 is transparent black. BC2 and BC3 always use 4 colors, and leave alpha alone
+	//
+	void decode_color(const uint8_t* in, uint8_t* rgba, bool alwaysFourColor) {
+		const uint16_t c0 = in[0] | (in[1] << 8);
+		const uint16_t c1 = in[2] | (in[3] << 8);
+		const Endpoint e0{{c0 >> 11, (c0 >> 5) & 63, c0 & 31}};
+		const Endpoint e1{{c1 >> 11, (c1 >> 5) & 63, c1 & 31}};
+		const bool fourColor = alwaysFourColor || c0 > c1;
+
+		int pal[4][3];
+		color_palette(e0, e1, fourColor, pal);
+
+		const uint32_t bits = in[4] | (in[5] << 8) | (in[6] << 16) | (uint32_t(in[7]) << 24);
+		for (int i = 0; i < 16; ++i) {
+			const int idx = (bits >> (i * 2)) & 3;
+			uint8_t* px = rgba + i * 4;
+			px[0] = static_cast<uint8_t>(pal[idx][0]);
+			px[1] = static_cast<uint8_t>(pal[idx][1]);
+			px[2] = static_cast<uint8_t>(pal[idx][2]);
+			if (!alwaysFourColor)
+				px[3] = (!fourColor && idx == 3) ? 0 : 255;
+		}
+	}
+
+	//
+	// Decode a single channel block into one channel of 16 RGBA texels
+	//
+	void decode_single(const uint8_t* in, uint8_t* rgba, int channel) {
+		int pal[8];
+		single_palette(in[0], in[1], pal);
+
+		uint64_t bits = 0;
+		for (int i = 0; i < 6; ++i)
+			bits |= static_cast<uint64_t>(in[2 + i]) << (i * 8);
+		for (int i = 0; i < 16; ++i)
+			rgba[i * 4 + channel] = static_cast<uint8_t>(pal[(bits >> (i * 3)) & 7]);
+	}
+
+	void decode_explicit_alpha(const uint8_t* in, uint8_t* rgba) {
+		for (int i = 0; i < 16; ++i)
+			rgba[i * 4 + 3] = static_cast<uint8_t>(((in[i / 2] >> ((i & 1) * 4)) & 15) * 17);
+	}
+
+	//
+	// Rebuild Z of a unit length normal from the X and Y stored in a BC5 block
+	//
+	void reconstruct_z(uint8_t* rgba) {
+		for (int i = 0; i < 16; ++i) {
+			uint8_t* px = rgba + i * 4;
+			const float x = px[0] / 127.5f - 1.f;
+			const float y = px[1] / 127.5f - 1.f;
+			const float z = std::sqrt(std::max(0.f, 1.f - x * x - y * y));
+			px[2] = static_cast<uint8_t>(z * 127.5f + 127.5f + 0.5f);
+		}
+	}
+
+} // namespace
+
+//
+// Public interface
+//
+
+void bcn::encode_block(Format format, const uint8_t* rgba, uint8_t* out, Quality quality, const Bc7Stats* hint) {
+	int mode, partition;
+	switch (format) {
+		case Format::BC1:
+			encode_color(rgba, out, quality, false, false);
+			break;
+		case Format::BC1A:
+			encode_color(rgba, out, quality, true, true);
+			break;
+		case Format::BC2:
+			encode_explicit_alpha(rgba, out);
+			encode_color(rgba, out + 8, quality, false, false);
+			break;
+		case Format::BC3:
+			encode_channel(rgba, 3, out, quality);
+			encode_color(rgba, out + 8, quality, false, false);
+			break;
+		case Format::BC4:
+			encode_channel(rgba, 0, out, quality);
+			break;
+		case Format::BC5:
+			encode_channel(rgba, 0, out, quality);
+			encode_channel(rgba, 1, out + 8, quality);
+			break;
+		case Format::BC7:
+			detail::encode_bc7(rgba, out, quality, hint, mode, partition);
+			break;
+	}
+}
+
+void bcn::encode_row(
+	Format format, const uint8_t* rgba, int w, int h, int blockRow, uint8_t* out, Quality quality, const Bc7Stats* hint,
+	Bc7Stats* stats) {
+	const int blocksX = (w + 3) / 4;
+	const int bs = block_size(format);
+
+	// Tally BC7 choices locally, so the shared counters are only touched once per row
+	uint32_t modes[8] = {};
+	uint16_t partitions[8][64] = {};
+
+	uint8_t block[64];
+	for (int bx = 0; bx < blocksX; ++bx) {
+		// Gather the block, clamping to the edges of the image
+		for (int y = 0; y < 4; ++y) {
+			const int sy = std::min(blockRow * 4 + y, h - 1);
+			for (int x = 0; x < 4; ++x) {
+				const int sx = std::min(bx * 4 + x, w - 1);
+				std::memcpy(block + (y * 4 + x) * 4, rgba + (size_t(sy) * w + sx) * 4, 4);
+			}
+		}
+		if (format == Format::BC7) {
+			int mode, partition;
+			detail::encode_bc7(block, out + size_t(bx) * bs, quality, hint, mode, partition);
+			++modes[mode];
+			++partitions[mode][partition];
+		}
+		else {
+			encode_block(format, block, out + size_t(bx) * bs, quality);
+		}
+	}
+
+	if (stats && format == Format::BC7) {
+		stats->blocks += blocksX;
+		for (int m = 0; m < 8; ++m) {
+			if (!modes[m])
+				continue;
+			stats->modes[m] += modes[m];
+			for (int p = 0; p < 64; ++p)
+				if (partitions[m][p])
+					stats->partitions[m][p] += partitions[m][p];
+		}
+	}
+}
+
+void bcn::encode_image(Format format, const uint8_t* rgba, int w, int h, uint8_t* out, Quality quality) {
+	const size_t rowSize = size_t((w + 3) / 4) * block_size(format);
+	util::parallel_for(
+		(h + 3) / 4, [&](size_t row)
+		{ encode_row(format, rgba, w, h, static_cast<int>(row), out + row * rowSize, quality); });
+}
+
+void bcn::decode_block(Format format, const uint8_t* in, uint8_t* rgba) {
+	switch (format) {
+		case Format::BC1:
+		case Format::BC1A:
+			decode_color(in, rgba, false);
+			break;
+		case Format::BC2:
+			decode_explicit_alpha(in, rgba);
+			decode_color(in + 8, rgba, true);
+			break;
+		case Format::BC3:
+			decode_single(in, rgba, 3);
+			decode_color(in + 8, rgba, true);
+			break;
+		case Format::BC4:
+			decode_single(in, rgba, 0);
+			for (int i = 0; i < 16; ++i) {
+				rgba[i * 4 + 1] = rgba[i * 4 + 2] = rgba[i * 4];
+				rgba[i * 4 + 3] = 255;
+			}
+			break;
+		case Format::BC5:
+			decode_single(in, rgba, 0);
+			decode_single(in + 8, rgba, 1);
+			reconstruct_z(rgba);
+			for (int i = 0; i < 16; ++i)
+				rgba[i * 4 + 3] = 255;
+			break;
+		case Format::BC7:
+			detail::decode_bc7(in, rgba);
+			break;
+	}
+}
+
+void bcn::decode_row(
+	Format format, const uint8_t* in, int w, int h, int blockRow, uint8_t* dst, size_t stride, int channels) {
+	const int blocksX = (w + 3) / 4;
+	const int bs = block_size(format);
+	const int rows = std::min(4, h - blockRow * 4);
+
+	uint8_t block[64];
+	for (int bx = 0; bx < blocksX; ++bx) {
+		decode_block(format, in + size_t(bx) * bs, block);
+
+		// Scatter the block into the image, dropping texels past the edges
+		const int cols = std::min(4, w - bx * 4);
+		for (int y = 0; y < rows; ++y) {
+			uint8_t* out = dst + size_t(blockRow * 4 + y) * stride + size_t(bx) * 4 * channels;
+			const uint8_t* src = block + y * 16;
+			if (channels == 4) {
+				std::memcpy(out, src, cols * 4);
+			}
+			else {
+				for (int x = 0; x < cols; ++x)
+					std::memcpy(out + x * channels, src + x * 4, channels);
+			}
+		}
+	}
+}
+
+void bcn::decode_image(Format format, const uint8_t* in, int w, int h, uint8_t* dst, size_t stride, int channels) {
+	const size_t rowSize = size_t((w + 3) / 4) * block_size(format);
+	const size_t blockRows = (h + 3) / 4;
+
+	// Small mips decode faster than the pool can hand them out
+	if (size_t(w) * h < DECODE_PARALLEL_TEXELS) {
+		for (size_t row = 0; row < blockRows; ++row)
+			decode_row(format, in + row * rowSize, w, h, static_cast<int>(row), dst, stride, channels);
+		return;
+	}
+
+	util::parallel_for(
+		blockRows, [&](size_t row)
+		{ decode_row(format, in + row * rowSize, w, h, static_cast<int>(row), dst, stride, channels); });
+}
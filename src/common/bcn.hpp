@@ -0,0 +1,151 @@
+/**
+ * bcn.hpp - Block compression (BC1-BC5, BC7) encoders and decoders
+ *
+ * Everything here works on 8-bit RGBA input and writes raw blocks in the layout D3D/VTF expect, so the output can be
+ * written straight into VTF image data. The decoders go the other way, and write straight into an image.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+namespace bcn
+{
+
+	/**
+	 * Block formats we can encode
+	 */
+	enum class Format {
+		BC1,  // DXT1, opaque 4 color blocks only
+		BC1A, // DXT1 with one bit alpha, texels with alpha < 128 become transparent
+		BC2,  // DXT3, explicit 4-bit alpha
+		BC3,  // DXT5
+		BC4,  // ATI1N, red channel only
+		BC5,  // ATI2N, red and green channels
+		BC7,  // BPTC, RGBA
+	};
+
+	/**
+	 * Speed/quality tradeoff
+	 *  Fast: Bounding box endpoints. BC7 only tries mode 6
+	 *  Normal: Principal axis endpoints, refined with least squares. BC7 tries three modes and the 4 most
+	 *          promising partitions
+	 *  High: Normal, plus a local search over the quantized endpoints. BC7 tries every mode, the 8 most promising
+	 *        partitions and every channel rotation
+	 */
+	enum class Quality {
+		Fast = 0,
+		Normal,
+		High,
+	};
+
+	/**
+	 * Parse a quality name, ie "fast". Returns false if the name isn't recognized
+	 */
+	bool parse_quality(const char* str, Quality& outQuality);
+
+	/**
+	 * Name of a quality preset, as accepted by parse_quality
+	 */
+	const char* quality_name(Quality quality);
+
+	/**
+	 * Which BC7 modes and partitions won over a set of blocks. Gathered while encoding one mip and handed to the
+	 * smaller ones as a hint, so they can skip modes and partitions that didn't pay off on the larger image
+	 */
+	struct Bc7Stats {
+		std::atomic<uint32_t> blocks{0};
+		std::atomic<uint32_t> modes[8]{};
+		std::atomic<uint32_t> partitions[8][64]{};
+	};
+
+	/**
+	 * Size of a single 4x4 block in bytes
+	 */
+	inline constexpr int block_size(Format format) {
+		return (format == Format::BC1 || format == Format::BC1A || format == Format::BC4) ? 8 : 16;
+	}
+
+	/**
+	 * Size of an encoded w x h image, in bytes. Partial blocks on the right and bottom edges are rounded up
+	 */
+	inline constexpr size_t image_size(Format format, int w, int h) {
+		return size_t((w + 3) / 4) * size_t((h + 3) / 4) * block_size(format);
+	}
+
+	/**
+	 * Encode a single block
+	 * @param rgba 16 RGBA8 texels, row major
+	 * @param out block_size(format) bytes of output
+	 * @param hint BC7 only, optional statistics to narrow the mode and partition search with
+	 */
+	void encode_block(
+		Format format, const uint8_t* rgba, uint8_t* out, Quality quality, const Bc7Stats* hint = nullptr);
+
+	/**
+	 * Encode a row of blocks
+	 * @param rgba Packed RGBA8 image data
+	 * @param w Width of the image
+	 * @param h Height of the image
+	 * @param blockRow Index of the block row to encode, ie pixel rows blockRow*4 through blockRow*4+3
+	 * @param out ((w + 3) / 4) * block_size(format) bytes of output
+	 * @param hint BC7 only, optional statistics to narrow the mode and partition search with
+	 * @param stats BC7 only, optional statistics to add this row's choices to
+	 * Texels past the right or bottom edge are clamped to the edge
+	 */
+	void encode_row(
+		Format format, const uint8_t* rgba, int w, int h, int blockRow, uint8_t* out, Quality quality,
+		const Bc7Stats* hint = nullptr, Bc7Stats* stats = nullptr);
+
+	/**
+	 * Encode an entire image. Block rows are spread across the thread pool, see util::parallel_for
+	 * @param out image_size(format, w, h) bytes of output
+	 */
+	void encode_image(Format format, const uint8_t* rgba, int w, int h, uint8_t* out, Quality quality);
+
+	/**
+	 * Decode a single block
+	 * @param in block_size(format) bytes of input
+	 * @param rgba 16 RGBA8 texels of output, row major
+	 * BC1 texels using the transparent 3 color mode entry decode to transparent black. BC4 decodes to grey, and
+	 * BC5 to a normal, with Z rebuilt from the stored X and Y
+	 */
+	void decode_block(Format format, const uint8_t* in, uint8_t* rgba);
+
+	/**
+	 * Decode a row of blocks straight into an image
+	 * @param in ((w + 3) / 4) * block_size(format) bytes of input
+	 * @param w Width of the image
+	 * @param h Height of the image
+	 * @param blockRow Index of the block row to decode, ie pixel rows blockRow*4 through blockRow*4+3
+	 * @param dst Start of the image
+	 * @param stride Distance between rows of dst, in bytes
+	 * @param channels 3 to write RGB8 texels, 4 to write RGBA8
+	 * Texels past the right or bottom edge are dropped
+	 */
+	void decode_row(
+		Format format, const uint8_t* in, int w, int h, int blockRow, uint8_t* dst, size_t stride, int channels);
+
+	/**
+	 * Decode an entire image. Block rows of large images are spread across the thread pool, see
+	 * util::parallel_for
+	 * @param in image_size(format, w, h) bytes of input
+	 */
+	void decode_image(Format format, const uint8_t* in, int w, int h, uint8_t* dst, size_t stride, int channels);
+
+	namespace detail
+	{
+		/**
+		 * Encode a BC7 block, also returning the mode and partition it picked. See bcn_bc7.cpp
+		 */
+		void encode_bc7(
+			const uint8_t* rgba, uint8_t* out, Quality quality, const Bc7Stats* hint, int& outMode, int& outPartition);
+
+		/**
+		 * Decode a BC7 block into 16 RGBA8 texels. See bcn_bc7.cpp
+		 */
+		void decode_bc7(const uint8_t* in, uint8_t* rgba);
+	} // namespace detail
+
+} // namespace bcn
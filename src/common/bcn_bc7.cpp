@@ -0,0 +1,874 @@
+/**
+ * BC7 encoder and decoder, see bcn.hpp
+ */
+#include "bcn.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <cstring>
+
+using namespace bcn;
+
+namespace
+{
+	struct ModeInfo {
+		int subsets;
+		int partitionBits;
+		int rotationBits;
+		int indexSelectionBits;
+		int colorBits;
+		int alphaBits;
+		int pbits;		// 0 = none, 1 = shared by both endpoints of a subset, 2 = one per endpoint
+		int indexBits;
+		int index2Bits; // Second index set, modes 4 and 5 only
+	};
+
+	constexpr ModeInfo s_modes[8] = {
+		{3, 4, 0, 0, 4, 0, 2, 3, 0}, {2, 6, 0, 0, 6, 0, 1, 3, 0}, {3, 6, 0, 0, 5, 0, 0, 2, 0},
+		{2, 6, 0, 0, 7, 0, 2, 2, 0}, {1, 0, 2, 1, 5, 6, 0, 2, 3}, {1, 0, 2, 0, 7, 8, 0, 2, 2},
+		{1, 0, 0, 0, 7, 7, 2, 4, 0}, {2, 6, 0, 0, 5, 5, 2, 2, 0},
+	};
+
+	// Subset of each texel for the 2 subset partitions, one bit per texel
+	constexpr uint16_t s_partitions2[64] = {
+		0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80, 0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8,
+		0xFF00, 0xFFF0, 0xF000, 0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE, 0x088C, 0x3110,
+		0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C, 0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696,
+		0xA55A, 0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660, 0x0272, 0x04E4, 0x4E40, 0x2720,
+		0xC936, 0x936C, 0x39C6, 0x639C, 0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22,
+	};
+
+	// Subset of each texel for the 3 subset partitions, two bits per texel
+	constexpr uint32_t s_partitions3[64] = {
+		0xAA685050, 0x6A5A5040, 0x5A5A4200, 0x5450A0A8, 0xA5A50000, 0xA0A05050, 0x5555A0A0, 0x5A5A5050,
+		0xAA550000, 0xAA555500, 0xAAAA5500, 0x90909090, 0x94949494, 0xA4A4A4A4, 0xA9A59450, 0x2A0A4250,
+		0xA5945040, 0x0A425054, 0xA5A5A500, 0x55A0A0A0, 0xA8A85454, 0x6A6A4040, 0xA4A45000, 0x1A1A0500,
+		0x0050A4A4, 0xAAA59090, 0x14696914, 0x69691400, 0xA08585A0, 0xAA821414, 0x50A4A450, 0x6A5A0200,
+		0xA9A58000, 0x5090A0A8, 0xA8A09050, 0x24242424, 0x00AA5500, 0x24924924, 0x24499224, 0x50A50A50,
+		0x500AA550, 0xAAAA4444, 0x66660000, 0xA5A0A5A0, 0x50A050A0, 0x69286928, 0x44AAAA44, 0x66666600,
+		0xAA444444, 0x54A854A8, 0x95809580, 0x96969600, 0xA85454A8, 0x80959580, 0xAA141414, 0x96960000,
+		0xAAAA1414, 0xA05050A0, 0xA0A5A5A0, 0x96000000, 0x40804080, 0xA9A8A9A8, 0xAAAAAA44, 0x2A4A5254,
+	};
+
+	// Anchor texel of the second subset, 2 subset partitions
+	constexpr uint8_t s_anchors2[64] = {
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 2,	8, 2,  2, 8,  8,  15, 2, 8, 2, 2,
+		8,	8,	2,	2,	15, 15, 6,	8,	2,	8,	15, 15, 2,	8,	2,	2,	2,	15, 15, 6, 6, 2, 6, 8, 15, 15, 2, 2,
+		15, 15, 15, 15, 15, 2,	2,	15,
+	};
+
+	// Anchor texels of the second and third subsets, 3 subset partitions
+	constexpr uint8_t s_anchors3a[64] = {
+		3,	3, 15, 15, 8, 3,  15, 15, 8,  8, 6, 6,	6,	5,	3, 3, 3, 3,	 8, 15, 3,	3, 6, 10, 5,  8, 8, 6,	8, 5, 15, 15,
+		8, 15, 3,  5,  6, 10, 8,  15, 15, 3, 15, 5, 15, 15, 15, 15, 3, 15, 5, 5, 5, 8, 5,  10, 5, 10, 8, 13, 15, 12, 3, 3,
+	};
+	constexpr uint8_t s_anchors3b[64] = {
+		15, 8, 8,  3,  15, 15, 3,  8,  15, 15, 15, 15, 15, 15, 15, 8,  15, 8, 15, 3,  15, 8,  15, 8,  3,	 15, 6,	 10, 15, 15, 10, 8,
+		15, 3, 15, 10, 10, 8,  9,  10, 6,  15, 8,  15, 3,  6,  6,  8,  15, 3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 3, 15, 15, 8,
+	};
+
+	constexpr int s_weights2[4] = {0, 21, 43, 64};
+	constexpr int s_weights3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+	constexpr int s_weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+	inline const int* weights(int bits) {
+		return bits == 2 ? s_weights2 : (bits == 3 ? s_weights3 : s_weights4);
+	}
+
+	inline int subset_of(int subsets, int partition, int texel) {
+		if (subsets == 2)
+			return (s_partitions2[partition] >> texel) & 1;
+		if (subsets == 3)
+			return (s_partitions3[partition] >> (texel * 2)) & 3;
+		return 0;
+	}
+
+	inline int anchor_of(int subsets, int partition, int subset) {
+		if (subset == 0)
+			return 0;
+		if (subsets == 2)
+			return s_anchors2[partition];
+		return subset == 1 ? s_anchors3a[partition] : s_anchors3b[partition];
+	}
+
+	inline int interpolate(int a, int b, int w) {
+		return ((64 - w) * a + w * b + 32) >> 6;
+	}
+
+	// Expand a quantized endpoint component (with its p-bit, if any) to 8 bits
+	inline int dequantize(int q, int p, int bits, bool hasPbit) {
+		const int n = hasPbit ? bits + 1 : bits;
+		const int v = (hasPbit ? (q << 1) | p : q) << (8 - n);
+		return v | (v >> n);
+	}
+
+	inline int quantize(float v, int p, int bits, bool hasPbit) {
+		const int maxq = (1 << bits) - 1;
+		const float scaled = hasPbit ? (v * ((2 << bits) - 1) / 255.f - p) * 0.5f : v * maxq / 255.f;
+		return std::clamp(static_cast<int>(scaled + 0.5f), 0, maxq);
+	}
+
+	struct Block {
+		int px[16][4];
+	};
+
+	//
+	// Swap alpha with one of the color channels, as modes 4 and 5 store it. Rotation 0 leaves the block alone
+	//
+	Block rotate(const Block& blk, int rotation) {
+		Block rotated = blk;
+		if (rotation)
+			for (int t = 0; t < 16; ++t)
+				std::swap(rotated.px[t][rotation - 1], rotated.px[t][3]);
+		return rotated;
+	}
+
+	//
+	// What's being fit for one subset: a run of channels, their precision and the index set they use
+	//
+	struct SubsetParams {
+		int ch0, nch;
+		int bits;
+		int pbitMode;
+		int indexBits;
+	};
+
+	struct Fit {
+		int q[2][4] = {};
+		int p[2] = {};
+		int err = INT_MAX;
+	};
+
+	//
+	// Pick the closest palette entry for each member texel, returns the squared error over the subset's channels.
+	// The palette lies on a line, so the closest entry is next to the texel's projection onto it
+	//
+	int assign_indices(
+		const Block& blk, const uint8_t* members, int count, const SubsetParams& sp, const Fit& fit, uint8_t* idx) {
+		const bool hasPbit = sp.pbitMode != 0;
+		const int n = 1 << sp.indexBits;
+		const int* w = weights(sp.indexBits);
+
+		int pal[16][4];
+		int dir[4];
+		int len2 = 0;
+		for (int c = 0; c < sp.nch; ++c) {
+			const int a = dequantize(fit.q[0][c], fit.p[0], sp.bits, hasPbit);
+			const int b = dequantize(fit.q[1][c], fit.p[1], sp.bits, hasPbit);
+			for (int k = 0; k < n; ++k)
+				pal[k][c] = interpolate(a, b, w[k]);
+			dir[c] = b - a;
+			len2 += dir[c] * dir[c];
+		}
+		const float scale = len2 ? float(n - 1) / len2 : 0.f;
+
+		int total = 0;
+		for (int m = 0; m < count; ++m) {
+			const int* px = blk.px[members[m]] + sp.ch0;
+			int dot = 0;
+			for (int c = 0; c < sp.nch; ++c)
+				dot += (px[c] - pal[0][c]) * dir[c];
+			const int guess = std::clamp(static_cast<int>(dot * scale + 0.5f), 0, n - 1);
+
+			int best = INT_MAX;
+			for (int k = std::max(guess - 1, 0); k <= std::min(guess + 1, n - 1); ++k) {
+				int err = 0;
+				for (int c = 0; c < sp.nch; ++c) {
+					const int d = px[c] - pal[k][c];
+					err += d * d;
+				}
+				if (err < best) {
+					best = err;
+					idx[members[m]] = static_cast<uint8_t>(k);
+				}
+			}
+			total += best;
+		}
+		return total;
+	}
+
+	//
+	// Quantize a pair of float endpoints and keep the result if it beats fit.
+	// Each endpoint takes the p-bit that quantizes it best, polish tries the others
+	//
+	void try_endpoints(
+		const Block& blk, const uint8_t* members, int count, const SubsetParams& sp, const float (&e)[2][4], Fit& fit,
+		uint8_t* idx) {
+		const bool hasPbit = sp.pbitMode != 0;
+
+		Fit cand;
+		if (hasPbit) {
+			// Quantization error of each endpoint with either p-bit
+			float qerr[2][2] = {};
+			for (int ep = 0; ep < 2; ++ep) {
+				for (int p = 0; p < 2; ++p) {
+					for (int c = 0; c < sp.nch; ++c) {
+						const float d = dequantize(quantize(e[ep][c], p, sp.bits, true), p, sp.bits, true) - e[ep][c];
+						qerr[ep][p] += d * d;
+					}
+				}
+			}
+
+			if (sp.pbitMode == 1)
+				cand.p[0] = cand.p[1] = (qerr[0][1] + qerr[1][1] < qerr[0][0] + qerr[1][0]) ? 1 : 0;
+			else {
+				cand.p[0] = qerr[0][1] < qerr[0][0];
+				cand.p[1] = qerr[1][1] < qerr[1][0];
+			}
+		}
+
+		for (int ep = 0; ep < 2; ++ep)
+			for (int c = 0; c < sp.nch; ++c)
+				cand.q[ep][c] = quantize(e[ep][c], cand.p[ep], sp.bits, hasPbit);
+
+		uint8_t cidx[16];
+		cand.err = assign_indices(blk, members, count, sp, cand, cidx);
+		if (cand.err < fit.err) {
+			fit = cand;
+			for (int m = 0; m < count; ++m)
+				idx[members[m]] = cidx[members[m]];
+		}
+	}
+
+	//
+	// Principal axis of a covariance matrix, by power iteration. Returns the variance not explained by the axis,
+	// which is how well a single line fits the texels
+	//
+	float principal_axis(float (&cov)[4][4], int nch, int iterations, float (&axis)[4]) {
+		float trace = 0;
+		int seed = 0;
+		for (int c = 0; c < 4; ++c)
+			axis[c] = 0;
+		for (int c = 0; c < nch; ++c) {
+			trace += cov[c][c];
+			if (cov[c][c] > cov[seed][seed])
+				seed = c;
+		}
+		if (trace < 1e-3f)
+			return 0;
+
+		// Seeded with the channel of highest variance
+		axis[seed] = 1;
+		for (int iter = 0; iter < iterations; ++iter) {
+			float next[4] = {};
+			for (int i = 0; i < nch; ++i)
+				for (int j = 0; j < nch; ++j)
+					next[i] += cov[i][j] * axis[j];
+			float len = 0;
+			for (int c = 0; c < nch; ++c)
+				len += next[c] * next[c];
+			if (len < 1e-12f)
+				break;
+			len = 1.f / std::sqrt(len);
+			for (int c = 0; c < nch; ++c)
+				axis[c] = next[c] * len;
+		}
+
+		float lambda = 0;
+		for (int i = 0; i < nch; ++i)
+			for (int j = 0; j < nch; ++j)
+				lambda += axis[i] * cov[i][j] * axis[j];
+		return std::max(trace - lambda, 0.f);
+	}
+
+	//
+	// Mean and principal axis of a set of texels
+	//
+	void fit_line(
+		const Block& blk, const uint8_t* members, int count, int ch0, int nch, float (&mean)[4], float (&axis)[4]) {
+		for (int c = 0; c < 4; ++c)
+			mean[c] = 0;
+		for (int m = 0; m < count; ++m)
+			for (int c = 0; c < nch; ++c)
+				mean[c] += blk.px[members[m]][ch0 + c];
+		for (int c = 0; c < nch; ++c)
+			mean[c] /= count;
+
+		float cov[4][4] = {};
+		for (int m = 0; m < count; ++m) {
+			float d[4];
+			for (int c = 0; c < nch; ++c)
+				d[c] = blk.px[members[m]][ch0 + c] - mean[c];
+			for (int i = 0; i < nch; ++i)
+				for (int j = 0; j < nch; ++j)
+					cov[i][j] += d[i] * d[j];
+		}
+		principal_axis(cov, nch, 4, axis);
+	}
+
+	//
+	// Score every partition by how badly its subsets fit a line, lower is better.
+	// Sums of each texel's moments are gathered per subset, so no partition has to revisit the texels' colors
+	//
+	void score_partitions(const Block& blk, int subsets, int nch, float (&scores)[64]) {
+		struct Moments {
+			int n;
+			int sum[4];
+			int sq[4][4];
+
+			void add(const int* px, int nch) {
+				++n;
+				for (int a = 0; a < nch; ++a) {
+					sum[a] += px[a];
+					for (int b = a; b < nch; ++b)
+						sq[a][b] += px[a] * px[b];
+				}
+			}
+		};
+
+		Moments total = {};
+		for (int i = 0; i < 16; ++i)
+			total.add(blk.px[i], nch);
+
+		for (int p = 0; p < 64; ++p) {
+			// Subset 0 is whatever the others leave over
+			Moments sub[3] = {};
+			for (int i = 0; i < 16; ++i)
+				if (const int s = subset_of(subsets, p, i))
+					sub[s].add(blk.px[i], nch);
+			sub[0].n = total.n - sub[1].n - sub[2].n;
+			for (int a = 0; a < nch; ++a) {
+				sub[0].sum[a] = total.sum[a] - sub[1].sum[a] - sub[2].sum[a];
+				for (int b = a; b < nch; ++b)
+					sub[0].sq[a][b] = total.sq[a][b] - sub[1].sq[a][b] - sub[2].sq[a][b];
+			}
+
+			scores[p] = 0;
+			for (int s = 0; s < subsets; ++s) {
+				if (sub[s].n == 0)
+					continue;
+				float cov[4][4];
+				const float inv = 1.f / sub[s].n;
+				for (int a = 0; a < nch; ++a)
+					for (int b = a; b < nch; ++b)
+						cov[a][b] = cov[b][a] = sub[s].sq[a][b] - sub[s].sum[a] * sub[s].sum[b] * inv;
+				float axis[4];
+				scores[p] += principal_axis(cov, nch, 3, axis);
+			}
+		}
+	}
+
+	//
+	// Fit the endpoints of one subset
+	//
+	void fit_subset(
+		const Block& blk, const uint8_t* members, int count, const SubsetParams& sp, Quality quality, Fit& fit,
+		uint8_t* idx) {
+		fit = Fit();
+		if (count == 0) {
+			fit.err = 0;
+			return;
+		}
+
+		float mean[4], axis[4];
+		fit_line(blk, members, count, sp.ch0, sp.nch, mean, axis);
+
+		// Initial endpoints are the extents of the texels along the axis
+		float tmin = 0, tmax = 0;
+		for (int m = 0; m < count; ++m) {
+			float t = 0;
+			for (int c = 0; c < sp.nch; ++c)
+				t += (blk.px[members[m]][sp.ch0 + c] - mean[c]) * axis[c];
+			tmin = std::min(tmin, t);
+			tmax = std::max(tmax, t);
+		}
+
+		float e[2][4] = {};
+		for (int c = 0; c < sp.nch; ++c) {
+			e[0][c] = std::clamp(mean[c] + tmin * axis[c], 0.f, 255.f);
+			e[1][c] = std::clamp(mean[c] + tmax * axis[c], 0.f, 255.f);
+		}
+		try_endpoints(blk, members, count, sp, e, fit, idx);
+
+		// Least squares refinement against the current indices
+		const int* w = weights(sp.indexBits);
+		const int iterations = quality == Quality::Fast ? 0 : (quality == Quality::Normal ? 1 : 2);
+		for (int iter = 0; iter < iterations && fit.err > 0; ++iter) {
+			float aa = 0, bb = 0, ab = 0, ax[4] = {}, bx[4] = {};
+			for (int m = 0; m < count; ++m) {
+				const float t = w[idx[members[m]]] / 64.f;
+				const float s = 1.f - t;
+				aa += s * s;
+				bb += t * t;
+				ab += s * t;
+				for (int c = 0; c < sp.nch; ++c) {
+					ax[c] += s * blk.px[members[m]][sp.ch0 + c];
+					bx[c] += t * blk.px[members[m]][sp.ch0 + c];
+				}
+			}
+			const float det = aa * bb - ab * ab;
+			if (std::fabs(det) < 1e-6f)
+				break;
+
+			const int prevErr = fit.err;
+			for (int c = 0; c < sp.nch; ++c) {
+				e[0][c] = std::clamp((ax[c] * bb - bx[c] * ab) / det, 0.f, 255.f);
+				e[1][c] = std::clamp((bx[c] * aa - ax[c] * ab) / det, 0.f, 255.f);
+			}
+			try_endpoints(blk, members, count, sp, e, fit, idx);
+			if (fit.err >= prevErr)
+				break;
+		}
+	}
+
+	//
+	// Nudge each quantized endpoint component and p-bit of a subset by one step, keeping anything that helps
+	//
+	void nudge_endpoints(
+		const Block& blk, const uint8_t* members, int count, const SubsetParams& sp, Fit& fit, uint8_t* idx) {
+		const auto keep_if_better = [&](Fit& cand)
+		{
+			uint8_t cidx[16];
+			cand.err = assign_indices(blk, members, count, sp, cand, cidx);
+			if (cand.err < fit.err) {
+				fit = cand;
+				for (int m = 0; m < count; ++m)
+					idx[members[m]] = cidx[members[m]];
+			}
+		};
+
+		if (sp.pbitMode == 1) {
+			Fit cand = fit;
+			cand.p[0] = cand.p[1] = !fit.p[0];
+			keep_if_better(cand);
+		}
+		else if (sp.pbitMode == 2) {
+			for (int ep = 0; ep < 2; ++ep) {
+				Fit cand = fit;
+				cand.p[ep] = !fit.p[ep];
+				keep_if_better(cand);
+			}
+		}
+
+		const int maxq = (1 << sp.bits) - 1;
+		for (int ep = 0; ep < 2; ++ep) {
+			for (int c = 0; c < sp.nch; ++c) {
+				for (int delta = -1; delta <= 1; delta += 2) {
+					Fit cand = fit;
+					cand.q[ep][c] += delta;
+					if (cand.q[ep][c] >= 0 && cand.q[ep][c] <= maxq)
+						keep_if_better(cand);
+				}
+			}
+		}
+	}
+
+	struct Candidate {
+		int mode = 6;
+		int partition = 0;
+		int rotation = 0;
+		int isb = 0;
+		Fit fits[3]; // One per subset, or just the color part for modes 4 and 5
+		Fit alpha;	 // Modes 4 and 5 only
+		uint8_t idx[16] = {};
+		uint8_t idx2[16] = {};
+		int err = INT_MAX;
+	};
+
+	//
+	// Call fn(members, count, params, fit, idx) for every subset, or for the color and alpha parts of modes 4 and 5
+	//
+	template <typename F>
+	void for_each_subset(Candidate& c, F&& fn) {
+		static constexpr uint8_t s_all[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+		const auto& mi = s_modes[c.mode];
+
+		if (mi.index2Bits == 0) {
+			const SubsetParams sp = {0, mi.alphaBits ? 4 : 3, mi.colorBits, mi.pbits, mi.indexBits};
+			for (int s = 0; s < mi.subsets; ++s) {
+				uint8_t members[16];
+				int count = 0;
+				for (int i = 0; i < 16; ++i)
+					if (subset_of(mi.subsets, c.partition, i) == s)
+						members[count++] = static_cast<uint8_t>(i);
+				fn(members, count, sp, c.fits[s], c.idx);
+			}
+		}
+		else {
+			const int colorIndexBits = c.isb ? mi.index2Bits : mi.indexBits;
+			const int alphaIndexBits = c.isb ? mi.indexBits : mi.index2Bits;
+			fn(s_all, 16, SubsetParams{0, 3, mi.colorBits, 0, colorIndexBits}, c.fits[0], c.idx);
+			fn(s_all, 16, SubsetParams{3, 1, mi.alphaBits, 0, alphaIndexBits}, c.alpha, c.idx2);
+		}
+	}
+
+	int candidate_error(const Block& blk, const Candidate& c) {
+		const auto& mi = s_modes[c.mode];
+		if (mi.index2Bits)
+			return c.fits[0].err + c.alpha.err;
+
+		int err = 0;
+		for (int s = 0; s < mi.subsets; ++s)
+			err += c.fits[s].err;
+
+		// Modes without alpha decode it as fully opaque
+		if (!mi.alphaBits) {
+			for (int i = 0; i < 16; ++i)
+				err += (255 - blk.px[i][3]) * (255 - blk.px[i][3]);
+		}
+		return err;
+	}
+
+	//
+	// Encode the block with a specific mode and partition. The block is already rotated for modes 4 and 5
+	//
+	void encode_mode(const Block& blk, int mode, int partition, int rotation, int isb, Quality quality, Candidate& c) {
+		c.mode = mode;
+		c.partition = partition;
+		c.rotation = rotation;
+		c.isb = isb;
+		for_each_subset(
+			c, [&](const uint8_t* members, int count, const SubsetParams& sp, Fit& fit, uint8_t* idx)
+			{ fit_subset(blk, members, count, sp, quality, fit, idx); });
+		c.err = candidate_error(blk, c);
+	}
+
+	//
+	// Final endpoint search on the winning candidate, too slow to do for all of them
+	//
+	void polish(const Block& blk, Candidate& c) {
+		for_each_subset(
+			c,
+			[&](const uint8_t* members, int count, const SubsetParams& sp, Fit& fit, uint8_t* idx)
+			{
+				if (count && fit.err > 0)
+					nudge_endpoints(blk, members, count, sp, fit, idx);
+			});
+		c.err = candidate_error(blk, c);
+	}
+
+	//
+	// Pick the best scoring partitions of a mode, best first
+	//
+	int rank_partitions(const float (&scores)[64], int partitionCount, const Bc7Stats* hint, int mode, int* out, int maxOut) {
+		std::pair<float, int> ranked[64];
+		int count = 0;
+		for (int p = 0; p < partitionCount; ++p)
+			if (!hint || hint->partitions[mode][p])
+				ranked[count++] = {scores[p], p};
+
+		const int n = std::min(count, maxOut);
+		std::partial_sort(ranked, ranked + n, ranked + count);
+		for (int i = 0; i < n; ++i)
+			out[i] = ranked[i].second;
+		return n;
+	}
+
+	class BitWriter {
+	public:
+		explicit BitWriter(uint8_t* out)
+			: m_out(out) {
+			std::memset(out, 0, 16);
+		}
+
+		void put(uint32_t value, int bits) {
+			for (int i = 0; i < bits; ++i, ++m_pos)
+				m_out[m_pos >> 3] |= static_cast<uint8_t>(((value >> i) & 1) << (m_pos & 7));
+		}
+
+	private:
+		uint8_t* m_out;
+		int m_pos = 0;
+	};
+
+	//
+	// Swap a subset's endpoints where needed so every anchor index has its top bit clear
+	//
+	void fix_anchors(Fit& fit, uint8_t* idx, int indexBits, int subsets, int partition, int subset) {
+		const int anchor = anchor_of(subsets, partition, subset);
+		const int maxIdx = (1 << indexBits) - 1;
+		if (!(idx[anchor] >> (indexBits - 1)))
+			return;
+
+		std::swap(fit.q[0], fit.q[1]);
+		std::swap(fit.p[0], fit.p[1]);
+		for (int i = 0; i < 16; ++i)
+			if (subset_of(subsets, partition, i) == subset)
+				idx[i] = static_cast<uint8_t>(maxIdx - idx[i]);
+	}
+
+	void write_indices(BitWriter& bw, const uint8_t* idx, int bits, int subsets, int partition) {
+		for (int i = 0; i < 16; ++i) {
+			bool anchor = false;
+			for (int s = 0; s < subsets; ++s)
+				anchor |= anchor_of(subsets, partition, s) == i;
+			bw.put(idx[i], anchor ? bits - 1 : bits);
+		}
+	}
+
+	void write_block(Candidate c, uint8_t* out) {
+		const auto& mi = s_modes[c.mode];
+		const bool separateAlpha = mi.index2Bits != 0;
+		const int colorIndexBits = c.isb ? mi.index2Bits : mi.indexBits;
+		const int alphaIndexBits = c.isb ? mi.indexBits : mi.index2Bits;
+
+		if (separateAlpha) {
+			fix_anchors(c.fits[0], c.idx, colorIndexBits, 1, 0, 0);
+			fix_anchors(c.alpha, c.idx2, alphaIndexBits, 1, 0, 0);
+		}
+		else {
+			for (int s = 0; s < mi.subsets; ++s)
+				fix_anchors(c.fits[s], c.idx, mi.indexBits, mi.subsets, c.partition, s);
+		}
+
+		BitWriter bw(out);
+		bw.put(1u << c.mode, c.mode + 1);
+		bw.put(c.partition, mi.partitionBits);
+		bw.put(c.rotation, mi.rotationBits);
+		bw.put(c.isb, mi.indexSelectionBits);
+
+		for (int ch = 0; ch < 3; ++ch)
+			for (int s = 0; s < mi.subsets; ++s)
+				for (int ep = 0; ep < 2; ++ep)
+					bw.put(c.fits[s].q[ep][ch], mi.colorBits);
+
+		if (mi.alphaBits) {
+			for (int s = 0; s < mi.subsets; ++s)
+				for (int ep = 0; ep < 2; ++ep)
+					bw.put(separateAlpha ? c.alpha.q[ep][0] : c.fits[s].q[ep][3], mi.alphaBits);
+		}
+
+		if (mi.pbits == 2) {
+			for (int s = 0; s < mi.subsets; ++s)
+				for (int ep = 0; ep < 2; ++ep)
+					bw.put(c.fits[s].p[ep], 1);
+		}
+		else if (mi.pbits == 1) {
+			for (int s = 0; s < mi.subsets; ++s)
+				bw.put(c.fits[s].p[0], 1);
+		}
+
+		if (separateAlpha) {
+			// The narrower index set always comes first, index selection decides which one is color
+			write_indices(bw, c.isb ? c.idx2 : c.idx, mi.indexBits, 1, 0);
+			write_indices(bw, c.isb ? c.idx : c.idx2, mi.index2Bits, 1, 0);
+		}
+		else {
+			write_indices(bw, c.idx, mi.indexBits, mi.subsets, c.partition);
+		}
+	}
+
+	inline void keep_best(Candidate& best, const Candidate& c) {
+		if (c.err < best.err)
+			best = c;
+	}
+
+	//
+	// Decoding
+	//
+
+	//
+	// Reads fields off the bottom of a block, which is kept as a 128-bit little endian shift register
+	//
+	class BitReader {
+	public:
+		explicit BitReader(const uint8_t* in) {
+			for (int i = 0; i < 8; ++i) {
+				m_lo |= uint64_t(in[i]) << (i * 8);
+				m_hi |= uint64_t(in[i + 8]) << (i * 8);
+			}
+		}
+
+		int get(int bits) {
+			if (!bits)
+				return 0;
+			const int value = static_cast<int>(m_lo & ((1ull << bits) - 1));
+			m_lo = (m_lo >> bits) | (m_hi << (64 - bits));
+			m_hi >>= bits;
+			return value;
+		}
+
+	private:
+		uint64_t m_lo = 0, m_hi = 0;
+	};
+
+	void read_indices(BitReader& br, uint8_t* idx, int bits, int subsets, int partition) {
+		for (int i = 0; i < 16; ++i) {
+			bool anchor = false;
+			for (int s = 0; s < subsets; ++s)
+				anchor |= anchor_of(subsets, partition, s) == i;
+			idx[i] = static_cast<uint8_t>(br.get(anchor ? bits - 1 : bits));
+		}
+	}
+
+} // namespace
+
+void bcn::detail::encode_bc7(const uint8_t* rgba, uint8_t* out, Quality quality, const Bc7Stats* hint, int& outMode,
+	int& outPartition) {
+	Block blk;
+	bool opaque = true;
+	for (int i = 0; i < 16; ++i) {
+		for (int c = 0; c < 4; ++c)
+			blk.px[i][c] = rgba[i * 4 + c];
+		opaque &= rgba[i * 4 + 3] == 255;
+	}
+
+	// Statistics from a larger mip are only worth trusting with enough blocks behind them
+	const bool useHint = hint && hint->blocks >= 64;
+	const auto modeAllowed = [&](int mode)
+	{ return mode == 6 || !useHint || uint64_t(hint->modes[mode]) * 64 >= hint->blocks; };
+
+	// Modes to try, most generally useful first. Modes 0-3 can't store alpha
+	static constexpr int s_fastModes[] = {6};
+	static constexpr int s_normalModes[2][3] = {{6, 5, 7}, {6, 1, 3}};
+	static constexpr int s_highAlphaModes[] = {6, 5, 4, 7};
+	static constexpr int s_highOpaqueModes[] = {6, 1, 3, 0, 2, 5, 4};
+
+	const int* modes = s_fastModes;
+	int modeCount = 1;
+	int maxPartitions = 1;
+	int maxRotation = 0;
+	int goodEnough = 0; // Stop searching once the error is at or below this
+	switch (quality) {
+		case Quality::Fast:
+			break;
+		case Quality::Normal:
+			modes = s_normalModes[opaque];
+			modeCount = 3;
+			maxPartitions = 4;
+			goodEnough = 16 * 6;
+			break;
+		case Quality::High:
+			modes = opaque ? s_highOpaqueModes : s_highAlphaModes;
+			modeCount = opaque ? 7 : 4;
+			maxPartitions = 8;
+			maxRotation = 3;
+			break;
+	}
+
+	Candidate best, cand;
+	int ranked[64];
+	float scores[4][64];
+	bool scored[4] = {};
+	for (int i = 0; i < modeCount; ++i) {
+		const int mode = modes[i];
+		if (!modeAllowed(mode))
+			continue;
+
+		const auto& mi = s_modes[mode];
+		if (mi.subsets > 1) {
+			// Partitions are scored once per block for each subset and channel count, modes 1 and 3 share theirs
+			const int nch = mi.alphaBits ? 4 : 3;
+			const int key = (mi.subsets - 2) * 2 + (nch - 3);
+			if (!scored[key]) {
+				score_partitions(blk, mi.subsets, nch, scores[key]);
+				scored[key] = true;
+			}
+
+			const int n = rank_partitions(
+				scores[key], 1 << mi.partitionBits, useHint ? hint : nullptr, mode, ranked, maxPartitions);
+			for (int p = 0; p < n; ++p) {
+				encode_mode(blk, mode, ranked[p], 0, 0, quality, cand);
+				keep_best(best, cand);
+			}
+		}
+		else if (mi.rotationBits) {
+			for (int rot = 0; rot <= maxRotation; ++rot) {
+				// Rotation gives the channel that varies independently of the others its own index set
+				const Block rotated = rotate(blk, rot);
+				for (int isb = 0; isb <= (quality == Quality::High ? mi.indexSelectionBits : 0); ++isb) {
+					encode_mode(rotated, mode, 0, rot, isb, quality, cand);
+					keep_best(best, cand);
+				}
+			}
+		}
+		else {
+			encode_mode(blk, mode, 0, 0, 0, quality, cand);
+			keep_best(best, cand);
+		}
+
+		if (best.err <= goodEnough)
+			break;
+	}
+
+	if (quality == Quality::High && best.err > 0)
+		polish(rotate(blk, best.rotation), best);
+
+	write_block(best, out);
+	outMode = best.mode;
+	outPartition = best.partition;
+}
+
+//
+// Decode a block, the exact reverse of write_block. Reserved modes decode to transparent black
+//
+void bcn::detail::decode_bc7(const uint8_t* block, uint8_t* rgba) {
+	int mode = 0;
+	while (mode < 8 && !((block[0] >> mode) & 1))
+		++mode;
+	if (mode == 8) {
+		std::memset(rgba, 0, 64);
+		return;
+	}
+
+	const auto& mi = s_modes[mode];
+	BitReader br(block);
+	br.get(mode + 1);
+	const int partition = br.get(mi.partitionBits);
+	const int rotation = br.get(mi.rotationBits);
+	const int isb = br.get(mi.indexSelectionBits);
+
+	int q[3][2][4] = {};
+	for (int ch = 0; ch < 3; ++ch)
+		for (int s = 0; s < mi.subsets; ++s)
+			for (int ep = 0; ep < 2; ++ep)
+				q[s][ep][ch] = br.get(mi.colorBits);
+
+	if (mi.alphaBits) {
+		for (int s = 0; s < mi.subsets; ++s)
+			for (int ep = 0; ep < 2; ++ep)
+				q[s][ep][3] = br.get(mi.alphaBits);
+	}
+
+	int p[3][2] = {};
+	if (mi.pbits == 2) {
+		for (int s = 0; s < mi.subsets; ++s)
+			for (int ep = 0; ep < 2; ++ep)
+				p[s][ep] = br.get(1);
+	}
+	else if (mi.pbits == 1) {
+		for (int s = 0; s < mi.subsets; ++s)
+			p[s][0] = p[s][1] = br.get(1);
+	}
+
+	// Expand the endpoints to 8 bits. Modes without alpha are opaque
+	int e[3][2][4];
+	for (int s = 0; s < mi.subsets; ++s) {
+		for (int ep = 0; ep < 2; ++ep) {
+			for (int ch = 0; ch < 3; ++ch)
+				e[s][ep][ch] = dequantize(q[s][ep][ch], p[s][ep], mi.colorBits, mi.pbits != 0);
+			e[s][ep][3] = mi.alphaBits ? dequantize(q[s][ep][3], p[s][ep], mi.alphaBits, mi.pbits != 0) : 255;
+		}
+	}
+
+	uint8_t idx[16], idx2[16];
+	int colorIndexBits = mi.indexBits, alphaIndexBits = mi.indexBits;
+	if (mi.index2Bits) {
+		read_indices(br, idx, mi.indexBits, 1, 0);
+		read_indices(br, idx2, mi.index2Bits, 1, 0);
+		if (isb) {
+			std::swap(idx, idx2);
+			colorIndexBits = mi.index2Bits;
+		}
+		else {
+			alphaIndexBits = mi.index2Bits;
+		}
+	}
+	else {
+		read_indices(br, idx, mi.indexBits, mi.subsets, partition);
+		std::memcpy(idx2, idx, sizeof(idx2));
+	}
+
+	const int* wc = weights(colorIndexBits);
+	const int* wa = weights(alphaIndexBits);
+	for (int t = 0; t < 16; ++t) {
+		const int s = subset_of(mi.subsets, partition, t);
+		uint8_t* px = rgba + t * 4;
+		for (int ch = 0; ch < 3; ++ch)
+			px[ch] = static_cast<uint8_t>(interpolate(e[s][0][ch], e[s][1][ch], wc[idx[t]]));
+		px[3] = static_cast<uint8_t>(interpolate(e[s][0][3], e[s][1][3], wa[idx2[t]]));
+		if (rotation)
+			std::swap(px[rotation - 1], px[3]);
+	}
+}
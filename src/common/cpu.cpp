@@ -0,0 +1,115 @@
+#include "cpu.hpp"
+#include "strtools.hpp"
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CPU_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+using namespace cpu;
+
+static const char* s_levelNames[] = {"scalar", "sse2", "sse4.1", "avx2", "avx512"};
+
+#ifdef CPU_X86
+static void run_cpuid(unsigned leaf, unsigned sub, unsigned (&regs)[4]) {
+#ifdef _MSC_VER
+	int r[4];
+	__cpuidex(r, leaf, sub);
+	for (int i = 0; i < 4; ++i)
+		regs[i] = static_cast<unsigned>(r[i]);
+#else
+	__cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state the OS saves on context switches. Wide registers are useless if it doesn't save them!
+static unsigned long long read_xcr0() {
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned lo, hi;
+	__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+}
+
+static Level detect_level() {
+	unsigned regs[4];
+	run_cpuid(0, 0, regs);
+	const unsigned maxLeaf = regs[0];
+
+	run_cpuid(1, 0, regs);
+	const unsigned ecx1 = regs[2], edx1 = regs[3];
+
+	if (!(edx1 & (1u << 26)))
+		return Level::Scalar;
+	if (!(ecx1 & (1u << 19)))
+		return Level::SSE2;
+
+	// AVX needs OSXSAVE, and the OS needs to preserve XMM + YMM state
+	const bool osxsave = ecx1 & (1u << 27);
+	const unsigned long long xcr0 = osxsave ? read_xcr0() : 0;
+	if (!(ecx1 & (1u << 28)) || (xcr0 & 0x6) != 0x6 || maxLeaf < 7)
+		return Level::SSE41;
+
+	run_cpuid(7, 0, regs);
+	const unsigned ebx7 = regs[1];
+	const bool avx2 = ebx7 & (1u << 5);
+	const bool fma = ecx1 & (1u << 12);
+	if (!avx2 || !fma)
+		return Level::SSE41;
+
+	// AVX-512 F, BW and VL, plus opmask/ZMM state
+	const unsigned avx512Bits = (1u << 16) | (1u << 30) | (1u << 31);
+	if ((ebx7 & avx512Bits) != avx512Bits || (xcr0 & 0xE6) != 0xE6)
+		return Level::AVX2;
+
+	return Level::AVX512;
+}
+#else
+static Level detect_level() {
+	return Level::Scalar;
+}
+#endif
+
+static std::atomic<Level>& active_level() {
+	static std::atomic<Level> level{detected()};
+	return level;
+}
+
+Level cpu::detected() {
+	static const Level level = detect_level();
+	return level;
+}
+
+Level cpu::active() {
+	return active_level().load(std::memory_order_relaxed);
+}
+
+bool cpu::set_level(Level level) {
+	if (level > detected())
+		return false;
+	active_level().store(level, std::memory_order_relaxed);
+	return true;
+}
+
+bool cpu::parse_level(const char* str, Level& outLevel) {
+	for (int i = 0; i < static_cast<int>(sizeof(s_levelNames) / sizeof(s_levelNames[0])); ++i) {
+		if (!str::strcasecmp(str, s_levelNames[i])) {
+			outLevel = static_cast<Level>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* cpu::level_name(Level level) {
+	return s_levelNames[static_cast<int>(level)];
+}
@@ -0,0 +1,47 @@
+/**
+ * cpu.hpp - Runtime CPU feature detection
+ */
+#pragma once
+
+namespace cpu
+{
+
+	/**
+	 * Instruction set levels we have kernels for. Each level implies all of the ones below it
+	 */
+	enum class Level {
+		Scalar = 0,
+		SSE2,
+		SSE41,
+		AVX2,
+		AVX512, // F + BW + VL
+	};
+
+	/**
+	 * Best level supported by this CPU and OS
+	 */
+	Level detected();
+
+	/**
+	 * Level that kernels are currently dispatched to. Defaults to detected()
+	 */
+	Level active();
+
+	/**
+	 * Force kernels to a specific level. Should be called during startup, before any work is queued.
+	 * Returns false if the CPU doesn't support the requested level, in which case nothing changes
+	 */
+	bool set_level(Level level);
+
+	/**
+	 * Parse a level name, ie "avx2" or "sse4.1"
+	 * Returns false if the name isn't recognized
+	 */
+	bool parse_level(const char* str, Level& outLevel);
+
+	/**
+	 * Name of a level, as accepted by parse_level
+	 */
+	const char* level_name(Level level);
+
+} // namespace cpu
@@ -0,0 +1,115 @@
+#include "deflate.hpp"
+
+#if defined(VTEX2_HAVE_LIBDEFLATE)
+#include <libdeflate.h>
+#elif defined(VTEX2_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+#if defined(VTEX2_HAVE_LIBDEFLATE)
+
+// libdeflate compressors are tied to a level and expensive to create, so each thread keeps the last one it used
+namespace
+{
+	struct Compressor {
+		libdeflate_compressor* compressor = nullptr;
+		int level = 0;
+
+		~Compressor() {
+			if (compressor)
+				libdeflate_free_compressor(compressor);
+		}
+
+		libdeflate_compressor* get(int newLevel) {
+			if (compressor && level == newLevel)
+				return compressor;
+			if (compressor)
+				libdeflate_free_compressor(compressor);
+			compressor = libdeflate_alloc_compressor(newLevel);
+			level = newLevel;
+			return compressor;
+		}
+	};
+
+	struct Decompressor {
+		libdeflate_decompressor* decompressor = libdeflate_alloc_decompressor();
+
+		~Decompressor() {
+			if (decompressor)
+				libdeflate_free_decompressor(decompressor);
+		}
+	};
+} // namespace
+
+bool zstream::available() {
+	return true;
+}
+
+const char* zstream::backend() {
+	return "libdeflate";
+}
+
+bool zstream::compress(const std::uint8_t* src, std::size_t size, int level, std::vector<std::uint8_t>& out) {
+	static thread_local Compressor s_compressor;
+	auto* compressor = s_compressor.get(level < 0 ? 6 : level);
+	if (!compressor)
+		return false;
+
+	out.resize(libdeflate_zlib_compress_bound(compressor, size));
+	const auto written = libdeflate_zlib_compress(compressor, src, size, out.data(), out.size());
+	out.resize(written);
+	return written != 0;
+}
+
+bool zstream::decompress(const std::uint8_t* src, std::size_t size, std::uint8_t* dst, std::size_t dstSize) {
+	static thread_local Decompressor s_decompressor;
+	if (!s_decompressor.decompressor)
+		return false;
+	return libdeflate_zlib_decompress(s_decompressor.decompressor, src, size, dst, dstSize, nullptr) ==
+		   LIBDEFLATE_SUCCESS;
+}
+
+#elif defined(VTEX2_HAVE_ZLIB)
+
+bool zstream::available() {
+	return true;
+}
+
+const char* zstream::backend() {
+	return "zlib";
+}
+
+bool zstream::compress(const std::uint8_t* src, std::size_t size, int level, std::vector<std::uint8_t>& out) {
+	uLongf written = compressBound(static_cast<uLong>(size));
+	out.resize(written);
+	if (compress2(out.data(), &written, src, static_cast<uLong>(size), level < 0 ? Z_DEFAULT_COMPRESSION : level) !=
+		Z_OK)
+		return false;
+	out.resize(written);
+	return true;
+}
+
+bool zstream::decompress(const std::uint8_t* src, std::size_t size, std::uint8_t* dst, std::size_t dstSize) {
+	uLongf written = static_cast<uLongf>(dstSize);
+	return uncompress(dst, &written, src, static_cast<uLong>(size)) == Z_OK && written == dstSize;
+}
+
+#else
+
+bool zstream::available() {
+	return false;
+}
+
+const char* zstream::backend() {
+	return "none";
+}
+
+bool zstream::compress(const std::uint8_t*, std::size_t, int, std::vector<std::uint8_t>&) {
+	return false;
+}
+
+bool zstream::decompress(const std::uint8_t*, std::size_t, std::uint8_t*, std::size_t) {
+	return false;
+}
+
+#endif
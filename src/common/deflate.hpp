@@ -0,0 +1,39 @@
+/**
+ * deflate.hpp - zlib format DEFLATE streams, as stored in VTF 7.6 image data
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace zstream
+{
+
+	/**
+	 * True if vtex2 was built with a DEFLATE backend. If not, compress and decompress always fail and VTF 7.6
+	 * compression is left to VTFLib
+	 */
+	bool available();
+
+	/**
+	 * Name of the backend in use, ie "libdeflate" or "zlib", or "none"
+	 */
+	const char* backend();
+
+	/**
+	 * Compress a buffer into a single zlib stream. Safe to call from several threads at once
+	 * @param level 1-9, or -1 for the backend's default
+	 * @param out Replaced with the compressed stream
+	 * @returns false if compression failed
+	 */
+	bool compress(const std::uint8_t* src, std::size_t size, int level, std::vector<std::uint8_t>& out);
+
+	/**
+	 * Decompress a single zlib stream. Safe to call from several threads at once
+	 * @param dstSize Exact size of the decompressed data
+	 * @returns false if the stream is corrupt or doesn't decompress to exactly dstSize bytes
+	 */
+	bool decompress(const std::uint8_t* src, std::size_t size, std::uint8_t* dst, std::size_t dstSize);
+
+} // namespace zstream
@@ -0,0 +1,116 @@
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "hash.hpp"
+
+// XXH64 primes
+static constexpr std::uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static constexpr std::uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr std::uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+static constexpr std::uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static constexpr std::uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline std::uint64_t rotl(std::uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline std::uint64_t read64(const std::uint8_t* p) {
+	std::uint64_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline std::uint32_t read32(const std::uint8_t* p) {
+	std::uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline std::uint64_t round(std::uint64_t acc, std::uint64_t input) {
+	acc += input * PRIME2;
+	acc = rotl(acc, 31);
+	return acc * PRIME1;
+}
+
+static inline std::uint64_t merge_round(std::uint64_t acc, std::uint64_t val) {
+	acc ^= round(0, val);
+	return acc * PRIME1 + PRIME4;
+}
+
+std::uint64_t util::hash64(const void* data, std::size_t size, std::uint64_t seed) {
+	auto* p = static_cast<const std::uint8_t*>(data);
+	const auto* end = p + size;
+
+	std::uint64_t h;
+	if (size >= 32) {
+		const auto* limit = end - 32;
+		std::uint64_t v1 = seed + PRIME1 + PRIME2;
+		std::uint64_t v2 = seed + PRIME2;
+		std::uint64_t v3 = seed;
+		std::uint64_t v4 = seed - PRIME1;
+		do {
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = merge_round(h, v1);
+		h = merge_round(h, v2);
+		h = merge_round(h, v3);
+		h = merge_round(h, v4);
+	}
+	else {
+		h = seed + PRIME5;
+	}
+
+	h += size;
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= round(0, read64(p));
+		h = rotl(h, 27) * PRIME1 + PRIME4;
+	}
+	if (p + 4 <= end) {
+		h ^= std::uint64_t(read32(p)) * PRIME1;
+		h = rotl(h, 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	for (; p < end; ++p) {
+		h ^= (*p) * PRIME5;
+		h = rotl(h, 11) * PRIME1;
+	}
+
+	// Avalanche
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+bool util::hash_file(const std::string& path, std::uint64_t& outHash) {
+	std::ifstream stream(path, std::ios::in | std::ios::binary);
+	if (!stream.good())
+		return false;
+
+	constexpr std::size_t CHUNK_SIZE = 1 << 20;
+	std::vector<char> chunk(CHUNK_SIZE);
+
+	std::uint64_t h = 0;
+	while (stream) {
+		stream.read(chunk.data(), chunk.size());
+		const auto numRead = stream.gcount();
+		if (numRead <= 0)
+			break;
+		h = hash64(chunk.data(), numRead, h);
+	}
+
+	if (stream.bad())
+		return false;
+	outHash = h;
+	return true;
+}
@@ -0,0 +1,32 @@
+/**
+ * hash.hpp - Non-cryptographic hashing of buffers and files
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace util
+{
+
+	/**
+	 * 64-bit XXH64 hash of a buffer
+	 */
+	std::uint64_t hash64(const void* data, std::size_t size, std::uint64_t seed = 0);
+
+	/**
+	 * Hash a string, convenience wrapper around hash64
+	 */
+	inline std::uint64_t hash64(const std::string& str, std::uint64_t seed = 0) {
+		return hash64(str.data(), str.size(), seed);
+	}
+
+	/**
+	 * Hash the contents of a file. The file is read in chunks, each chunk's hash seeding the next,
+	 * so the result differs from hash64 over the whole file at once.
+	 * @return false if the file couldn't be read
+	 */
+	bool hash_file(const std::string& path, std::uint64_t& outHash);
+
+} // namespace util
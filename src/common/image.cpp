@@ -3,6 +3,7 @@
 #include "util.hpp"
 #include "strtools.hpp"
 #include "lwiconv.hpp"
+#include "kernels.hpp"
 
 #include <cstring>
 #include <cassert>
@@ -92,8 +93,27 @@ void Image::clear() {
 	m_data = nullptr;
 }
 
+// stb_image_write callback that appends to a std::vector<std::uint8_t>
+static void write_to_vector(void* context, void* data, int size) {
+	auto* out = static_cast<std::vector<std::uint8_t>*>(context);
+	out->insert(out->end(), static_cast<std::uint8_t*>(data), static_cast<std::uint8_t*>(data) + size);
+}
+
 bool Image::save(const char* file, FileFormat format) {
-	if (!file || !m_data || (format != Tga && format != Png && format != Jpeg && format != Bmp && format != Hdr))
+	std::vector<std::uint8_t> data;
+	if (!file || !save(format, data))
+		return false;
+
+	FILE* fp = fopen(file, "wb");
+	if (!fp)
+		return false;
+	const bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+	return fclose(fp) == 0 && ok;
+}
+
+bool Image::save(FileFormat format, std::vector<std::uint8_t>& out) {
+	out.clear();
+	if (!m_data || (format != Tga && format != Png && format != Jpeg && format != Bmp && format != Hdr))
 		return false;
 
 	bool bOk = false;
@@ -110,7 +130,7 @@ bool Image::save(const char* file, FileFormat format) {
 			}
 		}
 
-		bOk |= !!stbi_write_hdr(file, m_width, m_height, m_comps, (const float*)dataToUse);
+		bOk |= !!stbi_write_hdr_to_func(write_to_vector, &out, m_width, m_height, m_comps, (const float*)dataToUse);
 
 		if (dataIsOurs)
 			free(dataToUse);
@@ -130,16 +150,16 @@ bool Image::save(const char* file, FileFormat format) {
 
 		// Write the stuff out
 		if (format == Png) {
-			bOk = !!stbi_write_png(file, m_width, m_height, m_comps, dataToUse, 0);
+			bOk = !!stbi_write_png_to_func(write_to_vector, &out, m_width, m_height, m_comps, dataToUse, 0);
 		}
 		else if (format == Tga) {
-			bOk = !!stbi_write_tga(file, m_width, m_height, m_comps, dataToUse);
+			bOk = !!stbi_write_tga_to_func(write_to_vector, &out, m_width, m_height, m_comps, dataToUse);
 		}
 		else if (format == Jpeg) {
-			bOk = !!stbi_write_jpg(file, m_width, m_height, m_comps, dataToUse, 100);
+			bOk = !!stbi_write_jpg_to_func(write_to_vector, &out, m_width, m_height, m_comps, dataToUse, 100);
 		}
 		else if (format == Bmp) {
-			bOk = !!stbi_write_bmp(file, m_width, m_height, m_comps, dataToUse);
+			bOk = !!stbi_write_bmp_to_func(write_to_vector, &out, m_width, m_height, m_comps, dataToUse);
 		}
 
 		if (dataIsOurs)
@@ -278,7 +298,10 @@ bool imglib::convert_formats(
 
 bool Image::convert(ChannelType dstChanType, int channels, const lwiconv::PixelF& pdef) {
 	channels = channels <= 0 ? m_comps : channels;
-	void* dst = malloc(imglib::bytes_for_image(m_width, m_height, m_type, channels));
+	if (dstChanType == m_type && channels == m_comps)
+		return true;
+
+	void* dst = malloc(imglib::bytes_for_image(m_width, m_height, dstChanType, channels));
 
 	if (!convert_formats(m_data, dst, m_type, dstChanType, m_width, m_height, m_comps, channels, pixel_size(), channels * channel_size(dstChanType), pdef)) {
 		free(dst);
@@ -287,6 +310,8 @@ bool Image::convert(ChannelType dstChanType, int channels, const lwiconv::PixelF
 
 	free(m_data);
 	m_data = dst;
+	m_type = dstChanType;
+	m_comps = channels;
 	return true;
 }
 
@@ -301,12 +326,20 @@ constexpr uint8_t FULL_VAL<uint8_t> = UINT8_MAX;
 
 template <class T>
 static bool process_image_internal(void* indata, int comps, int w, int h, ProcFlags flags) {
+	const bool invertGreen = (flags & PROC_GL_TO_DX_NORM) && comps > 1;
+	const bool invertAlpha = (flags & PROC_INVERT_ALPHA) && comps > 3;
+
+	if (auto* k = kernels::active()) {
+		k->process[kernels::sample_type<T>](indata, size_t(w) * h, comps, invertGreen, invertAlpha);
+		return true;
+	}
+
 	T* data = static_cast<T*>(indata);
 	for (int i = 0; i < w * h * comps; i += comps) {
 		T* cur = data + i;
-		if (flags & PROC_GL_TO_DX_NORM)
+		if (invertGreen)
 			cur[1] = FULL_VAL<T> - cur[1]; // Invert green channel
-		if (flags & PROC_INVERT_ALPHA)
+		if (invertAlpha)
 			cur[3] = FULL_VAL<T> - cur[3];
 	}
 	return true;
@@ -386,6 +419,15 @@ static ImageInfo_t image_info(FILE* fp) {
 	return info;
 }
 
+bool imglib::image_info(const char* path, ImageInfo_t& outInfo) {
+	FILE* fp = fopen(path, "rb");
+	if (!fp)
+		return false;
+	outInfo = ::image_info(fp);
+	fclose(fp);
+	return outInfo.w > 0 && outInfo.h > 0;
+}
+
 size_t imglib::pixel_size(ChannelType type, int channels) {
 	return channels * channel_size(type);
 }
@@ -417,6 +459,47 @@ bool Image::swizzle(uint32_t mask) {
 	}
 }
 
+template <typename T>
+static bool swizzle_image_internal(void* data, int comps, int w, int h, uint32_t mask, int channels, const lwiconv::PixelF& pdef, void** outData) {
+	if (channels == comps)
+		return lwiconv::swizzle_convert(static_cast<T*>(data), static_cast<T*>(data), w, h, comps, comps, mask, pdef);
+
+	void* dst = malloc(size_t(w) * h * channels * sizeof(T));
+	if (!lwiconv::swizzle_convert(static_cast<const T*>(data), static_cast<T*>(dst), w, h, comps, channels, mask, pdef)) {
+		free(dst);
+		return false;
+	}
+	*outData = dst;
+	return true;
+}
+
+bool Image::swizzle(uint32_t mask, int channels, const lwiconv::PixelF& pdef) {
+	void* newData = nullptr;
+	bool ok = false;
+	switch (m_type) {
+	case ChannelType::UInt8:
+		ok = swizzle_image_internal<uint8_t>(m_data, m_comps, m_width, m_height, mask, channels, pdef, &newData);
+		break;
+	case ChannelType::UInt16:
+		ok = swizzle_image_internal<uint16_t>(m_data, m_comps, m_width, m_height, mask, channels, pdef, &newData);
+		break;
+	case ChannelType::Float:
+		ok = swizzle_image_internal<float>(m_data, m_comps, m_width, m_height, mask, channels, pdef, &newData);
+		break;
+	default:
+		return false;
+	}
+
+	if (ok && newData) {
+		if (m_owned)
+			free(m_data);
+		m_data = newData;
+		m_owned = true;
+		m_comps = channels;
+	}
+	return ok;
+}
+
 uint32_t imglib::swizzle_from_str(const char* str) {
 	uint32_t mask = 0;
 	for (int i = 0; i < lwiconv::MAX_CHANNELS; ++i, ++str) {
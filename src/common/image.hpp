@@ -3,8 +3,10 @@
  */
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
 #include <string>
+#include <vector>
 
 #include "lwiconv.hpp"
 
@@ -113,6 +115,12 @@ namespace imglib
 		 */
 		bool save(const char* path, FileFormat format);
 
+		/**
+		 * Encodes the image in the requested file format into memory, see above
+		 * @param out Replaced with the encoded file
+		 */
+		bool save(FileFormat format, std::vector<std::uint8_t>& out);
+
 		/**
 		 * Resize the image in-place
 		 * @param w New width
@@ -136,6 +144,14 @@ namespace imglib
 		 */
 		bool swizzle(uint32_t mask);
 
+		/**
+		 * Swizzle components and change the number of channels in a single pass
+		 * @param mask Swizzle mask. @see lwiconv::make_swizzle
+		 * @param channels New channel count
+		 * @param pdef Default value for channels that don't exist in the source image
+		 */
+		bool swizzle(uint32_t mask, int channels, const lwiconv::PixelF& pdef = {0,0,0,1});
+
 		/**
 		 * Returns the VTF format which matches up to the data we have internally here
 		 */
@@ -194,6 +210,12 @@ namespace imglib
 		bool m_owned = true;
 	};
 
+	/**
+	 * Reads the size and channel layout of an image file without decoding it
+	 * @returns false if the file couldn't be opened or isn't an image we can load
+	 */
+	bool image_info(const char* path, ImageInfo_t& outInfo);
+
 	/**
 	 * Helper to get an associated file type based on extension
 	 * Returns FileFormat::None if not
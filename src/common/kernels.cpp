@@ -0,0 +1,61 @@
+#include "kernels.hpp"
+
+using namespace kernels;
+
+const Table* kernels::active() {
+	switch (cpu::active()) {
+		case cpu::Level::AVX512:
+			return &avx512::table();
+		case cpu::Level::AVX2:
+			return &avx2::table();
+		case cpu::Level::SSE41:
+			return &sse41::table();
+		case cpu::Level::SSE2:
+			return &sse2::table();
+		default:
+			return nullptr;
+	}
+}
+
+template <typename Tin, typename Tout>
+bool lwiconv::detail::convert_simd(
+	const void* in, void* out, size_t count, int inC, int outC, int inStride, int outStride, const PixelF& defs) {
+	auto* table = kernels::active();
+	if (!table)
+		return false;
+	table->convert[sample_type<Tin>][sample_type<Tout>](in, out, count, inC, outC, inStride, outStride, defs);
+	return true;
+}
+
+template <typename T>
+bool lwiconv::detail::swizzle_simd(
+	const T* in, T* out, size_t count, int inC, int outC, uint32_t mask, const PixelF& defs) {
+	auto* table = kernels::active();
+	if (!table)
+		return false;
+	table->swizzle[sample_type<T>](in, out, count, inC, outC, mask, defs);
+	return true;
+}
+
+template bool lwiconv::detail::swizzle_simd<uint8_t>(
+	const uint8_t*, uint8_t*, size_t, int, int, uint32_t, const lwiconv::PixelF&);
+template bool lwiconv::detail::swizzle_simd<uint16_t>(
+	const uint16_t*, uint16_t*, size_t, int, int, uint32_t, const lwiconv::PixelF&);
+template bool lwiconv::detail::swizzle_simd<float>(
+	const float*, float*, size_t, int, int, uint32_t, const lwiconv::PixelF&);
+
+#define LWICONV_INSTANTIATE(Tin, Tout)                                                                                 \
+	template bool lwiconv::detail::convert_simd<Tin, Tout>(                                                            \
+		const void*, void*, size_t, int, int, int, int, const lwiconv::PixelF&);
+
+LWICONV_INSTANTIATE(uint8_t, uint8_t)
+LWICONV_INSTANTIATE(uint8_t, uint16_t)
+LWICONV_INSTANTIATE(uint8_t, float)
+LWICONV_INSTANTIATE(uint16_t, uint8_t)
+LWICONV_INSTANTIATE(uint16_t, uint16_t)
+LWICONV_INSTANTIATE(uint16_t, float)
+LWICONV_INSTANTIATE(float, uint8_t)
+LWICONV_INSTANTIATE(float, uint16_t)
+LWICONV_INSTANTIATE(float, float)
+
+#undef LWICONV_INSTANTIATE
@@ -0,0 +1,116 @@
+/**
+ * kernels.hpp - Runtime dispatched image kernels
+ *
+ * kernels_impl.hpp is compiled once per instruction set level (kernels_sse2.cpp, kernels_avx2.cpp, ...), each with
+ * its own compiler flags. The table matching cpu::active() is picked on every call, so the rest of com can stay
+ * built for the baseline ISA.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "cpu.hpp"
+#include "lwiconv.hpp"
+
+namespace kernels
+{
+
+	/**
+	 * Sample types, used to index the tables below
+	 */
+	enum SampleType {
+		SAMPLE_U8 = 0,
+		SAMPLE_U16,
+		SAMPLE_F32,
+
+		SAMPLE_TYPE_COUNT,
+	};
+
+	template <typename T>
+	inline constexpr int sample_type = -1;
+	template <>
+	inline constexpr int sample_type<uint8_t> = SAMPLE_U8;
+	template <>
+	inline constexpr int sample_type<uint16_t> = SAMPLE_U16;
+	template <>
+	inline constexpr int sample_type<float> = SAMPLE_F32;
+
+	/**
+	 * Same contract as lwiconv::convert_generic, with strides already resolved
+	 */
+	using ConvertFn = void (*)(
+		const void* in, void* out, size_t count, int inC, int outC, int inStride, int outStride,
+		const lwiconv::PixelF& defs);
+
+	/**
+	 * Same contract as lwiconv::swizzle_convert, with the arguments already validated
+	 */
+	using SwizzleFn = void (*)(
+		const void* in, void* out, size_t count, int inC, int outC, uint32_t mask, const lwiconv::PixelF& defs);
+
+	/**
+	 * Invert the green and/or alpha channels of a packed image, see imglib::Image::process
+	 */
+	using ProcessFn = void (*)(void* data, size_t count, int comps, bool invertGreen, bool invertAlpha);
+
+	/**
+	 * Copy a single channel between two 8-bit images of count pixels, see pack::pack_image
+	 */
+	using PackCopyFn =
+		void (*)(uint8_t* dst, int dstC, int dstChan, const uint8_t* src, int srcC, int srcChan, size_t count);
+
+	/**
+	 * Set a single channel of an 8-bit image to a constant
+	 */
+	using PackFillFn = void (*)(uint8_t* dst, int dstC, int dstChan, uint8_t value, size_t count);
+
+	/**
+	 * Vertical pass of the mipmap filter, see imglib::MipResampler. out[i] = sum of rows[t][i] * weights[t] over
+	 * count floats
+	 */
+	using MipRowsFn = void (*)(const float* const* rows, const float* weights, int taps, float* out, size_t count);
+
+	/**
+	 * Horizontal pass of the mipmap filter over a row of RGBA floats. Output pixel i is the sum of
+	 * in[index[i * taps + t]] * weights[i * taps + t]
+	 */
+	using MipColumnsFn =
+		void (*)(const float* in, float* out, size_t count, const int* index, const float* weights, int taps);
+
+	struct Table {
+		cpu::Level level;
+		ConvertFn convert[SAMPLE_TYPE_COUNT][SAMPLE_TYPE_COUNT]; // [in][out]
+		SwizzleFn swizzle[SAMPLE_TYPE_COUNT];
+		ProcessFn process[SAMPLE_TYPE_COUNT];
+		PackCopyFn pack_copy;
+		PackFillFn pack_fill;
+		MipRowsFn mip_rows;
+		MipColumnsFn mip_columns;
+	};
+
+	/**
+	 * Kernels for the active CPU level. Returns nullptr at cpu::Level::Scalar, in which case callers should use
+	 * their plain C++ implementation
+	 */
+	const Table* active();
+
+	// Per-level tables, each defined in its own translation unit
+	namespace sse2
+	{
+		const Table& table();
+	}
+	namespace sse41
+	{
+		const Table& table();
+	}
+	namespace avx2
+	{
+		const Table& table();
+	}
+	namespace avx512
+	{
+		const Table& table();
+	}
+
+} // namespace kernels
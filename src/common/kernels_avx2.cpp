@@ -0,0 +1,4 @@
+// AVX2 kernels, see kernels.hpp
+#define KERNELS_NS avx2
+#define KERNELS_LEVEL 3
+#include "kernels_impl.hpp"
@@ -0,0 +1,4 @@
+// AVX512 kernels, see kernels.hpp
+#define KERNELS_NS avx512
+#define KERNELS_LEVEL 4
+#include "kernels_impl.hpp"
@@ -0,0 +1,913 @@
+/**
+ * kernels_impl.hpp - Kernel implementations, see kernels.hpp
+ *
+ * This is included once by each kernels_<isa>.cpp, which defines:
+ *  KERNELS_NS    - Namespace to put the table in, ie avx2
+ *  KERNELS_LEVEL - Numeric cpu::Level the translation unit is compiled for
+ *
+ * Everything except table() has internal linkage. Functions from other headers should not be called from here,
+ * since their out-of-line copies could be built with instructions the CPU doesn't have, and the linker is free to
+ * pick those over the baseline ones.
+ */
+#include <cstring>
+#include <type_traits>
+
+#include "kernels.hpp"
+
+#if !defined(KERNELS_NS) || !defined(KERNELS_LEVEL)
+#error "KERNELS_NS and KERNELS_LEVEL must be defined before including kernels_impl.hpp"
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#if KERNELS_LEVEL >= 1
+#define KERNELS_HAS_SSE2 1
+#include <emmintrin.h>
+#endif
+#if KERNELS_LEVEL >= 2
+#define KERNELS_HAS_SSE41 1
+#include <smmintrin.h>
+#endif
+#if KERNELS_LEVEL >= 3
+#define KERNELS_HAS_AVX2 1
+#include <immintrin.h>
+#endif
+#if KERNELS_LEVEL >= 4
+#define KERNELS_HAS_AVX512 1
+#endif
+#endif
+
+using lwiconv::MAX_CHANNELS;
+using lwiconv::PixelF;
+
+namespace kernels::KERNELS_NS
+{
+	namespace
+	{
+
+		// Number of pixels converted per chunk when channels need to be shuffled around
+		constexpr size_t CHUNK_PIXELS = 256;
+
+		template <typename T>
+		constexpr float SAMPLE_MAX = 1.f;
+		template <>
+		constexpr float SAMPLE_MAX<uint8_t> = float(UINT8_MAX);
+		template <>
+		constexpr float SAMPLE_MAX<uint16_t> = float(UINT16_MAX);
+
+		inline size_t min_size(size_t a, size_t b) {
+			return a < b ? a : b;
+		}
+
+		// Scalar conversion, saturating like the vector code. Matches lwiconv::detail::tofloat/fromfloat for
+		// in-range values, and lwiconv::detail::convert_exact for integer pairs
+		template <typename Tin, typename Tout>
+		inline Tout convert_sample(Tin v) {
+			if constexpr (std::is_same_v<Tin, Tout>)
+				return v;
+			else if constexpr (std::is_same_v<Tin, uint8_t> && std::is_same_v<Tout, uint16_t>)
+				return uint16_t(v * 257u);
+			else if constexpr (std::is_same_v<Tin, uint16_t> && std::is_same_v<Tout, uint8_t>)
+				return uint8_t((v * 255u + 32895u) >> 16);
+			else {
+				float f = std::is_same_v<Tin, float> ? float(v) : float(v) / SAMPLE_MAX<Tin>;
+				if constexpr (std::is_same_v<Tout, float>)
+					return f;
+				else {
+					f *= SAMPLE_MAX<Tout>;
+					f = f > 0 ? f : 0; // Also catches NaN
+					f = f < SAMPLE_MAX<Tout> ? f : SAMPLE_MAX<Tout>;
+					return Tout(f);
+				}
+			}
+		}
+
+		//
+		// Generic vector helpers. AVX-512 builds use the 256-bit versions, those kernels are memory bound anyway.
+		//
+#if defined(KERNELS_HAS_AVX2)
+		constexpr size_t VEC_BYTES = 32;
+		using VecI = __m256i;
+		using VecF = __m256;
+
+		inline VecI load_i(const void* p) {
+			return _mm256_loadu_si256(static_cast<const __m256i*>(p));
+		}
+		inline void store_i(void* p, VecI v) {
+			_mm256_storeu_si256(static_cast<__m256i*>(p), v);
+		}
+		inline VecF load_f(const float* p) {
+			return _mm256_loadu_ps(p);
+		}
+		inline void store_f(float* p, VecF v) {
+			_mm256_storeu_ps(p, v);
+		}
+		inline VecI set1_u32(uint32_t v) {
+			return _mm256_set1_epi32(static_cast<int>(v));
+		}
+		inline VecI xor_i(VecI a, VecI b) {
+			return _mm256_xor_si256(a, b);
+		}
+		inline VecI and_i(VecI a, VecI b) {
+			return _mm256_and_si256(a, b);
+		}
+		inline VecI andnot_i(VecI a, VecI b) {
+			return _mm256_andnot_si256(a, b);
+		}
+		inline VecI or_i(VecI a, VecI b) {
+			return _mm256_or_si256(a, b);
+		}
+		inline VecI sll_u32(VecI v, int n) {
+			return _mm256_sll_epi32(v, _mm_cvtsi32_si128(n));
+		}
+		inline VecI srl_u32(VecI v, int n) {
+			return _mm256_srl_epi32(v, _mm_cvtsi32_si128(n));
+		}
+		inline VecF set1_f(float v) {
+			return _mm256_set1_ps(v);
+		}
+		inline VecF mul_add_f(VecF v, VecF m, VecF a) {
+			return _mm256_add_ps(_mm256_mul_ps(v, m), a);
+		}
+#elif defined(KERNELS_HAS_SSE2)
+		constexpr size_t VEC_BYTES = 16;
+		using VecI = __m128i;
+		using VecF = __m128;
+
+		inline VecI load_i(const void* p) {
+			return _mm_loadu_si128(static_cast<const __m128i*>(p));
+		}
+		inline void store_i(void* p, VecI v) {
+			_mm_storeu_si128(static_cast<__m128i*>(p), v);
+		}
+		inline VecF load_f(const float* p) {
+			return _mm_loadu_ps(p);
+		}
+		inline void store_f(float* p, VecF v) {
+			_mm_storeu_ps(p, v);
+		}
+		inline VecI set1_u32(uint32_t v) {
+			return _mm_set1_epi32(static_cast<int>(v));
+		}
+		inline VecI xor_i(VecI a, VecI b) {
+			return _mm_xor_si128(a, b);
+		}
+		inline VecI and_i(VecI a, VecI b) {
+			return _mm_and_si128(a, b);
+		}
+		inline VecI andnot_i(VecI a, VecI b) {
+			return _mm_andnot_si128(a, b);
+		}
+		inline VecI or_i(VecI a, VecI b) {
+			return _mm_or_si128(a, b);
+		}
+		inline VecI sll_u32(VecI v, int n) {
+			return _mm_sll_epi32(v, _mm_cvtsi32_si128(n));
+		}
+		inline VecI srl_u32(VecI v, int n) {
+			return _mm_srl_epi32(v, _mm_cvtsi32_si128(n));
+		}
+		inline VecF set1_f(float v) {
+			return _mm_set1_ps(v);
+		}
+		inline VecF mul_add_f(VecF v, VecF m, VecF a) {
+			return _mm_add_ps(_mm_mul_ps(v, m), a);
+		}
+#endif
+
+		//
+		// Sample conversion
+		//
+#ifdef KERNELS_HAS_SSE2
+		inline __m128 sse_norm(__m128i v, __m128 scale) {
+			return _mm_div_ps(_mm_cvtepi32_ps(v), scale);
+		}
+
+		inline __m128i sse_denorm(__m128 v, __m128 scale) {
+			v = _mm_mul_ps(v, scale);
+			v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), scale);
+			return _mm_cvttps_epi32(v);
+		}
+
+		// Pack two vectors of values in [0, 65535] into 16-bit
+		inline __m128i sse_pack_u16(__m128i a, __m128i b) {
+#ifdef KERNELS_HAS_SSE41
+			return _mm_packus_epi32(a, b);
+#else
+			// SSE2 has no unsigned 32 -> 16 pack, so bias into signed range and back
+			const __m128i bias32 = _mm_set1_epi32(0x8000);
+			const __m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+			return _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(a, bias32), _mm_sub_epi32(b, bias32)), bias16);
+#endif
+		}
+#endif
+
+#ifdef KERNELS_HAS_AVX2
+		inline __m256 avx_norm(__m256i v, __m256 scale) {
+			return _mm256_div_ps(_mm256_cvtepi32_ps(v), scale);
+		}
+
+		inline __m256i avx_denorm(__m256 v, __m256 scale) {
+			v = _mm256_mul_ps(v, scale);
+			v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), scale);
+			return _mm256_cvttps_epi32(v);
+		}
+#endif
+
+#ifdef KERNELS_HAS_AVX512
+		inline __m512 avx512_norm(__m512i v, __m512 scale) {
+			return _mm512_div_ps(_mm512_cvtepi32_ps(v), scale);
+		}
+
+		inline __m512i avx512_denorm(__m512 v, __m512 scale) {
+			v = _mm512_mul_ps(v, scale);
+			v = _mm512_min_ps(_mm512_max_ps(v, _mm512_setzero_ps()), scale);
+			return _mm512_cvttps_epi32(v);
+		}
+#endif
+
+		/**
+		 * Convert a flat run of samples. Channel layout doesn't matter here
+		 */
+		template <typename Tin, typename Tout>
+		void convert_samples(const Tin* in, Tout* out, size_t n) {
+			size_t i = 0;
+
+			if constexpr (std::is_same_v<Tin, Tout>) {
+				// The float round trip is an identity for every value of every type
+				std::memcpy(out, in, n * sizeof(Tin));
+				return;
+			}
+			else if constexpr (std::is_same_v<Tin, uint8_t> && std::is_same_v<Tout, float>) {
+#if defined(KERNELS_HAS_AVX512)
+				const __m512 scale = _mm512_set1_ps(SAMPLE_MAX<uint8_t>);
+				for (; i + 16 <= n; i += 16) {
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+					_mm512_storeu_ps(out + i, avx512_norm(_mm512_cvtepu8_epi32(v), scale));
+				}
+#elif defined(KERNELS_HAS_AVX2)
+				const __m256 scale = _mm256_set1_ps(SAMPLE_MAX<uint8_t>);
+				for (; i + 16 <= n; i += 16) {
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+					_mm256_storeu_ps(out + i, avx_norm(_mm256_cvtepu8_epi32(v), scale));
+					_mm256_storeu_ps(out + i + 8, avx_norm(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)), scale));
+				}
+#elif defined(KERNELS_HAS_SSE2)
+				const __m128 scale = _mm_set1_ps(SAMPLE_MAX<uint8_t>);
+				const __m128i zero = _mm_setzero_si128();
+				for (; i + 16 <= n; i += 16) {
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+					__m128i lo = _mm_unpacklo_epi8(v, zero);
+					__m128i hi = _mm_unpackhi_epi8(v, zero);
+					_mm_storeu_ps(out + i, sse_norm(_mm_unpacklo_epi16(lo, zero), scale));
+					_mm_storeu_ps(out + i + 4, sse_norm(_mm_unpackhi_epi16(lo, zero), scale));
+					_mm_storeu_ps(out + i + 8, sse_norm(_mm_unpacklo_epi16(hi, zero), scale));
+					_mm_storeu_ps(out + i + 12, sse_norm(_mm_unpackhi_epi16(hi, zero), scale));
+				}
+#endif
+			}
+			else if constexpr (std::is_same_v<Tin, uint16_t> && std::is_same_v<Tout, float>) {
+#if defined(KERNELS_HAS_AVX512)
+				const __m512 scale = _mm512_set1_ps(SAMPLE_MAX<uint16_t>);
+				for (; i + 16 <= n; i += 16) {
+					__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+					_mm512_storeu_ps(out + i, avx512_norm(_mm512_cvtepu16_epi32(v), scale));
+				}
+#elif defined(KERNELS_HAS_AVX2)
+				const __m256 scale = _mm256_set1_ps(SAMPLE_MAX<uint16_t>);
+				for (; i + 8 <= n; i += 8) {
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+					_mm256_storeu_ps(out + i, avx_norm(_mm256_cvtepu16_epi32(v), scale));
+				}
+#elif defined(KERNELS_HAS_SSE2)
+				const __m128 scale = _mm_set1_ps(SAMPLE_MAX<uint16_t>);
+				const __m128i zero = _mm_setzero_si128();
+				for (; i + 8 <= n; i += 8) {
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+					_mm_storeu_ps(out + i, sse_norm(_mm_unpacklo_epi16(v, zero), scale));
+					_mm_storeu_ps(out + i + 4, sse_norm(_mm_unpackhi_epi16(v, zero), scale));
+				}
+#endif
+			}
+			else if constexpr (std::is_same_v<Tin, float> && std::is_same_v<Tout, uint8_t>) {
+#if defined(KERNELS_HAS_AVX512)
+				const __m512 scale = _mm512_set1_ps(SAMPLE_MAX<uint8_t>);
+				for (; i + 16 <= n; i += 16) {
+					__m512i v = avx512_denorm(_mm512_loadu_ps(in + i), scale);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm512_cvtepi32_epi8(v));
+				}
+#elif defined(KERNELS_HAS_AVX2)
+				const __m256 scale = _mm256_set1_ps(SAMPLE_MAX<uint8_t>);
+				for (; i + 32 <= n; i += 32) {
+					__m256i a = avx_denorm(_mm256_loadu_ps(in + i), scale);
+					__m256i b = avx_denorm(_mm256_loadu_ps(in + i + 8), scale);
+					__m256i c = avx_denorm(_mm256_loadu_ps(in + i + 16), scale);
+					__m256i d = avx_denorm(_mm256_loadu_ps(in + i + 24), scale);
+					// Packs operate per 128-bit lane, so fix up the order afterwards
+					__m256i ab = _mm256_packs_epi32(a, b);
+					__m256i cd = _mm256_packs_epi32(c, d);
+					__m256i abcd = _mm256_packus_epi16(ab, cd);
+					abcd = _mm256_permutevar8x32_epi32(abcd, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), abcd);
+				}
+#elif defined(KERNELS_HAS_SSE2)
+				const __m128 scale = _mm_set1_ps(SAMPLE_MAX<uint8_t>);
+				for (; i + 16 <= n; i += 16) {
+					__m128i a = sse_denorm(_mm_loadu_ps(in + i), scale);
+					__m128i b = sse_denorm(_mm_loadu_ps(in + i + 4), scale);
+					__m128i c = sse_denorm(_mm_loadu_ps(in + i + 8), scale);
+					__m128i d = sse_denorm(_mm_loadu_ps(in + i + 12), scale);
+					__m128i v = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+				}
+#endif
+			}
+			else if constexpr (std::is_same_v<Tin, float> && std::is_same_v<Tout, uint16_t>) {
+#if defined(KERNELS_HAS_AVX512)
+				const __m512 scale = _mm512_set1_ps(SAMPLE_MAX<uint16_t>);
+				for (; i + 16 <= n; i += 16) {
+					__m512i v = avx512_denorm(_mm512_loadu_ps(in + i), scale);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm512_cvtepi32_epi16(v));
+				}
+#elif defined(KERNELS_HAS_AVX2)
+				const __m256 scale = _mm256_set1_ps(SAMPLE_MAX<uint16_t>);
+				for (; i + 16 <= n; i += 16) {
+					__m256i a = avx_denorm(_mm256_loadu_ps(in + i), scale);
+					__m256i b = avx_denorm(_mm256_loadu_ps(in + i + 8), scale);
+					__m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xD8);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), v);
+				}
+#elif defined(KERNELS_HAS_SSE2)
+				const __m128 scale = _mm_set1_ps(SAMPLE_MAX<uint16_t>);
+				for (; i + 8 <= n; i += 8) {
+					__m128i a = sse_denorm(_mm_loadu_ps(in + i), scale);
+					__m128i b = sse_denorm(_mm_loadu_ps(in + i + 4), scale);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), sse_pack_u16(a, b));
+				}
+#endif
+			}
+			else if constexpr (std::is_same_v<Tin, uint8_t> && std::is_same_v<Tout, uint16_t>) {
+				// x * 257 == (x << 8) | x, which is exact
+#if defined(KERNELS_HAS_AVX512)
+				const __m512i mul = _mm512_set1_epi16(257);
+				for (; i + 32 <= n; i += 32) {
+					__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+					_mm512_storeu_si512(out + i, _mm512_mullo_epi16(_mm512_cvtepu8_epi16(v), mul));
+				}
+#elif defined(KERNELS_HAS_AVX2)
+				const __m256i mul = _mm256_set1_epi16(257);
+				for (; i + 16 <= n; i += 16) {
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+					_mm256_storeu_si256(
+						reinterpret_cast<__m256i*>(out + i), _mm256_mullo_epi16(_mm256_cvtepu8_epi16(v), mul));
+				}
+#elif defined(KERNELS_HAS_SSE2)
+				const __m128i mul = _mm_set1_epi16(257);
+				const __m128i zero = _mm_setzero_si128();
+				for (; i + 16 <= n; i += 16) {
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), mul));
+					_mm_storeu_si128(
+						reinterpret_cast<__m128i*>(out + i + 8), _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), mul));
+				}
+#endif
+			}
+			else if constexpr (std::is_same_v<Tin, uint16_t> && std::is_same_v<Tout, uint8_t>) {
+				// round(x * 255 / 65535) == (x * 255 + 32895) >> 16, with x * 255 done as (x << 8) - x
+#if defined(KERNELS_HAS_AVX512)
+				const __m512i bias = _mm512_set1_epi32(32895);
+				for (; i + 16 <= n; i += 16) {
+					__m512i v = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i)));
+					v = _mm512_srli_epi32(_mm512_add_epi32(_mm512_sub_epi32(_mm512_slli_epi32(v, 8), v), bias), 16);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm512_cvtepi32_epi8(v));
+				}
+#elif defined(KERNELS_HAS_AVX2)
+				const __m256i bias = _mm256_set1_epi32(32895);
+				for (; i + 16 <= n; i += 16) {
+					__m256i a = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+					__m256i b = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8)));
+					a = _mm256_srli_epi32(_mm256_add_epi32(_mm256_sub_epi32(_mm256_slli_epi32(a, 8), a), bias), 16);
+					b = _mm256_srli_epi32(_mm256_add_epi32(_mm256_sub_epi32(_mm256_slli_epi32(b, 8), b), bias), 16);
+					// Packs operate per 128-bit lane, so fix up the order before the final narrowing
+					__m256i ab = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+					__m128i v = _mm_packus_epi16(_mm256_castsi256_si128(ab), _mm256_extracti128_si256(ab, 1));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+				}
+#elif defined(KERNELS_HAS_SSE2)
+				const __m128i bias = _mm_set1_epi32(32895);
+				const __m128i zero = _mm_setzero_si128();
+				auto narrow = [&](__m128i v) {
+					return _mm_srli_epi32(_mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(v, 8), v), bias), 16);
+				};
+				for (; i + 16 <= n; i += 16) {
+					__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+					__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8));
+					__m128i a = narrow(_mm_unpacklo_epi16(lo, zero));
+					__m128i b = narrow(_mm_unpackhi_epi16(lo, zero));
+					__m128i c = narrow(_mm_unpacklo_epi16(hi, zero));
+					__m128i d = narrow(_mm_unpackhi_epi16(hi, zero));
+					__m128i v = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+				}
+#endif
+			}
+
+			for (; i < n; ++i)
+				out[i] = convert_sample<Tin, Tout>(in[i]);
+		}
+
+#ifdef KERNELS_HAS_SSE41
+		/**
+		 * Packed RGB -> RGBA for 8 and 16-bit samples. Returns the number of pixels converted, the rest is left to
+		 * the caller
+		 */
+		template <typename T>
+		size_t expand_3_to_4(const T* in, T* out, size_t count, T alpha) {
+			constexpr size_t PX = 16 / (4 * sizeof(T)); // Output pixels per vector
+			__m128i shuf, fill;
+			if constexpr (sizeof(T) == 1) {
+				shuf = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+				fill = _mm_set1_epi32(static_cast<int>(uint32_t(alpha) << 24));
+			}
+			else {
+				shuf = _mm_setr_epi8(0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1);
+				fill = _mm_set1_epi64x(static_cast<long long>(uint64_t(alpha) << 48));
+			}
+
+			// Each load reads a full vector but only uses 3/4 of it, so stop before reading past the input
+			size_t i = 0;
+			for (; (count - i) * 3 * sizeof(T) >= 16; i += PX) {
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * 3));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 4), _mm_or_si128(_mm_shuffle_epi8(v, shuf), fill));
+			}
+			return i;
+		}
+
+		/**
+		 * Packed RGBA -> RGB for 8 and 16-bit samples. Returns the number of pixels converted
+		 */
+		template <typename T>
+		size_t contract_4_to_3(const T* in, T* out, size_t count) {
+			constexpr size_t PX = 16 / (4 * sizeof(T)); // Input pixels per vector
+			__m128i shuf;
+			if constexpr (sizeof(T) == 1)
+				shuf = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+			else
+				shuf = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, -1, -1, -1, -1);
+
+			// Each store writes a full vector, the last 1/4 of which is overwritten by the next pixels
+			size_t i = 0;
+			for (; (count - i) * 3 * sizeof(T) >= 16; i += PX) {
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * 4));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 3), _mm_shuffle_epi8(v, shuf));
+			}
+			return i;
+		}
+#endif
+
+		/**
+		 * Same-type channel add/drop. No conversion needed at all, just moving samples around
+		 */
+		template <typename T>
+		void copy_channels(
+			const uint8_t* pin, uint8_t* pout, size_t count, int inC, int outC, int inStride, int outStride,
+			const T (&defs)[MAX_CHANNELS]) {
+			size_t i = 0;
+
+#ifdef KERNELS_HAS_SSE41
+			if constexpr (sizeof(T) <= 2) {
+				const bool packed = inStride == int(inC * sizeof(T)) && outStride == int(outC * sizeof(T));
+				if (packed && inC == 3 && outC == 4)
+					i = expand_3_to_4(reinterpret_cast<const T*>(pin), reinterpret_cast<T*>(pout), count, defs[3]);
+				else if (packed && inC == 4 && outC == 3)
+					i = contract_4_to_3(reinterpret_cast<const T*>(pin), reinterpret_cast<T*>(pout), count);
+			}
+#endif
+
+			const int keep = inC < outC ? inC : outC;
+			for (; i < count; ++i) {
+				auto* src = reinterpret_cast<const T*>(pin + i * inStride);
+				auto* dst = reinterpret_cast<T*>(pout + i * outStride);
+				int c = 0;
+				for (; c < keep; ++c)
+					dst[c] = src[c];
+				for (; c < outC; ++c)
+					dst[c] = defs[c];
+			}
+		}
+
+		template <typename Tin, typename Tout>
+		void convert(
+			const void* in, void* out, size_t count, int inC, int outC, int inStride, int outStride,
+			const PixelF& defs) {
+			auto* pin = static_cast<const uint8_t*>(in);
+			auto* pout = static_cast<uint8_t*>(out);
+
+			const bool inPacked = inStride == int(inC * sizeof(Tin));
+			const bool outPacked = outStride == int(outC * sizeof(Tout));
+
+			// Fast path, nothing to shuffle around
+			if (inC == outC && inPacked && outPacked) {
+				convert_samples(reinterpret_cast<const Tin*>(pin), reinterpret_cast<Tout*>(pout), count * inC);
+				return;
+			}
+
+			// Channels that don't exist in the input get the default
+			Tout outDefs[MAX_CHANNELS];
+			for (int c = 0; c < MAX_CHANNELS; ++c)
+				outDefs[c] = convert_sample<float, Tout>(defs.d[c]);
+
+			if constexpr (std::is_same_v<Tin, Tout>) {
+				copy_channels<Tout>(pin, pout, count, inC, outC, inStride, outStride, outDefs);
+				return;
+			}
+
+			const int keep = inC < outC ? inC : outC;
+
+			// Gather into a packed chunk, convert it in one go, then scatter into the output layout
+			Tin gathered[CHUNK_PIXELS * MAX_CHANNELS];
+			Tout converted[CHUNK_PIXELS * MAX_CHANNELS];
+			for (size_t base = 0; base < count; base += CHUNK_PIXELS) {
+				const size_t num = min_size(CHUNK_PIXELS, count - base);
+
+				const Tin* src = reinterpret_cast<const Tin*>(pin + base * inStride);
+				if (!inPacked) {
+					for (size_t p = 0; p < num; ++p) {
+						auto* px = reinterpret_cast<const Tin*>(pin + (base + p) * inStride);
+						for (int c = 0; c < inC; ++c)
+							gathered[p * inC + c] = px[c];
+					}
+					src = gathered;
+				}
+
+				convert_samples(src, converted, num * inC);
+
+				for (size_t p = 0; p < num; ++p) {
+					auto* px = reinterpret_cast<Tout*>(pout + (base + p) * outStride);
+					int c = 0;
+					for (; c < keep; ++c)
+						px[c] = converted[p * inC + c];
+					for (; c < outC; ++c)
+						px[c] = outDefs[c];
+				}
+			}
+		}
+
+		//
+		// Swizzle
+		//
+#if defined(KERNELS_HAS_SSE41)
+		/**
+		 * Byte shuffle for any sample type and channel counts. Each 16-byte vector holds a whole number of pixels,
+		 * bytes past those are passed through unchanged so in-place swizzles don't clobber the next pixels.
+		 * Returns the number of pixels converted
+		 */
+		template <typename T>
+		size_t swizzle_pshufb(
+			const uint8_t* in, uint8_t* out, size_t count, int inC, int outC, const int (&src)[MAX_CHANNELS],
+			const T (&defs)[MAX_CHANNELS]) {
+			const size_t inPx = inC * sizeof(T);
+			const size_t outPx = outC * sizeof(T);
+			const size_t group = min_size(16 / inPx, 16 / outPx);
+
+			alignas(16) int8_t ctrl[16];
+			alignas(16) uint8_t fill[16];
+			for (int k = 0; k < 16; ++k) {
+				ctrl[k] = int8_t(k);
+				fill[k] = 0;
+			}
+			for (size_t p = 0; p < group; ++p) {
+				for (int c = 0; c < outC; ++c) {
+					for (size_t b = 0; b < sizeof(T); ++b) {
+						const size_t k = p * outPx + c * sizeof(T) + b;
+						if (src[c] < inC)
+							ctrl[k] = int8_t(p * inPx + src[c] * sizeof(T) + b);
+						else {
+							ctrl[k] = -1; // Zeroes the byte, fill has the default
+							fill[k] = reinterpret_cast<const uint8_t*>(&defs[src[c]])[b];
+						}
+					}
+				}
+			}
+
+			const __m128i shuf = _mm_load_si128(reinterpret_cast<const __m128i*>(ctrl));
+			const __m128i fillv = _mm_load_si128(reinterpret_cast<const __m128i*>(fill));
+			size_t i = 0;
+
+#if defined(KERNELS_HAS_AVX2)
+			// Shuffles only work within 128-bit lanes, which is fine as long as both sides have the same layout
+			if (inPx == outPx && group * inPx == 16) {
+#if defined(KERNELS_HAS_AVX512)
+				const __m512i shuf512 = _mm512_broadcast_i32x4(shuf);
+				const __m512i fill512 = _mm512_broadcast_i32x4(fillv);
+				for (; (count - i) * inPx >= 64; i += group * 4) {
+					__m512i v = _mm512_loadu_si512(in + i * inPx);
+					_mm512_storeu_si512(out + i * outPx, _mm512_or_si512(_mm512_shuffle_epi8(v, shuf512), fill512));
+				}
+#endif
+				const __m256i shuf256 = _mm256_broadcastsi128_si256(shuf);
+				const __m256i fill256 = _mm256_broadcastsi128_si256(fillv);
+				for (; (count - i) * inPx >= 32; i += group * 2) {
+					__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i * inPx));
+					_mm256_storeu_si256(
+						reinterpret_cast<__m256i*>(out + i * outPx), _mm256_or_si256(_mm256_shuffle_epi8(v, shuf256), fill256));
+				}
+			}
+#endif
+
+			for (; (count - i) * inPx >= 16 && (count - i) * outPx >= 16; i += group) {
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * inPx));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * outPx), _mm_or_si128(_mm_shuffle_epi8(v, shuf), fillv));
+			}
+			return i;
+		}
+#elif defined(KERNELS_HAS_SSE2)
+		template <uint32_t MASK>
+		constexpr int shuffle_imm() {
+			using lwiconv::detail::swizzle_source;
+			return swizzle_source(MASK, 0) | (swizzle_source(MASK, 1) << 2) | (swizzle_source(MASK, 2) << 4)
+				   | (swizzle_source(MASK, 3) << 6);
+		}
+
+		/**
+		 * 4 -> 4 channel swizzle of 16-bit or float samples with the mask as an immediate.
+		 * Returns the number of pixels converted
+		 */
+		template <typename T, uint32_t MASK>
+		size_t swizzle4_fixed(const T* in, T* out, size_t count) {
+			constexpr int IMM = shuffle_imm<MASK>();
+			size_t i = 0;
+			if constexpr (std::is_same_v<T, float>) {
+				for (; i < count; ++i) {
+					__m128 v = _mm_loadu_ps(in + i * 4);
+					_mm_storeu_ps(out + i * 4, _mm_shuffle_ps(v, v, IMM));
+				}
+			}
+			else {
+				for (; i + 2 <= count; i += 2) {
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * 4));
+					v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, IMM), IMM);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 4), v);
+				}
+			}
+			return i;
+		}
+
+		/**
+		 * 4 -> 4 channel swizzle of 8-bit samples, treating each pixel as a 32-bit int.
+		 * Returns the number of pixels converted
+		 */
+		size_t swizzle4_u8(const uint8_t* in, uint8_t* out, size_t count, const int (&src)[MAX_CHANNELS]) {
+			constexpr size_t VEC = VEC_BYTES / 4;
+			const VecI byteMask = set1_u32(0xFF);
+			size_t i = 0;
+			for (; i + VEC <= count; i += VEC) {
+				VecI v = load_i(in + i * 4);
+				VecI r = and_i(srl_u32(v, src[0] * 8), byteMask);
+				for (int c = 1; c < MAX_CHANNELS; ++c)
+					r = or_i(r, sll_u32(and_i(srl_u32(v, src[c] * 8), byteMask), c * 8));
+				store_i(out + i * 4, r);
+			}
+			return i;
+		}
+#endif
+
+		template <typename T>
+		void swizzle(const void* in, void* out, size_t count, int inC, int outC, uint32_t mask, const PixelF& defs) {
+			auto* pin = static_cast<const T*>(in);
+			auto* pout = static_cast<T*>(out);
+
+			int src[MAX_CHANNELS];
+			T outDefs[MAX_CHANNELS];
+			for (int c = 0; c < MAX_CHANNELS; ++c) {
+				src[c] = lwiconv::detail::swizzle_source(mask, c);
+				outDefs[c] = convert_sample<float, T>(defs.d[c]);
+			}
+
+			size_t i = 0;
+#if defined(KERNELS_HAS_SSE41)
+			i = swizzle_pshufb<T>(
+				reinterpret_cast<const uint8_t*>(pin), reinterpret_cast<uint8_t*>(pout), count, inC, outC, src, outDefs);
+#elif defined(KERNELS_HAS_SSE2)
+			if (inC == 4 && outC == 4) {
+				if constexpr (std::is_same_v<T, uint8_t>)
+					i = swizzle4_u8(pin, pout, count, src);
+				else {
+					switch (mask) {
+						case lwiconv::SWIZZLE_BGRA:
+							i = swizzle4_fixed<T, lwiconv::SWIZZLE_BGRA>(pin, pout, count);
+							break;
+						case lwiconv::SWIZZLE_ABGR:
+							i = swizzle4_fixed<T, lwiconv::SWIZZLE_ABGR>(pin, pout, count);
+							break;
+						case lwiconv::SWIZZLE_ARGB:
+							i = swizzle4_fixed<T, lwiconv::SWIZZLE_ARGB>(pin, pout, count);
+							break;
+						case lwiconv::SWIZZLE_GBAR:
+							i = swizzle4_fixed<T, lwiconv::SWIZZLE_GBAR>(pin, pout, count);
+							break;
+						case lwiconv::SWIZZLE_RRRA:
+							i = swizzle4_fixed<T, lwiconv::SWIZZLE_RRRA>(pin, pout, count);
+							break;
+						default:
+							break;
+					}
+				}
+			}
+#endif
+
+			for (; i < count; ++i) {
+				T pixel[MAX_CHANNELS];
+				for (int c = 0; c < MAX_CHANNELS; ++c)
+					pixel[c] = c < inC ? pin[i * inC + c] : outDefs[c];
+				for (int c = 0; c < outC; ++c)
+					pout[i * outC + c] = pixel[src[c]];
+			}
+		}
+
+		//
+		// Channel inversion
+		//
+		template <typename T>
+		void process(void* data, size_t count, int comps, bool invertGreen, bool invertAlpha) {
+			T* p = static_cast<T*>(data);
+			const bool flip[MAX_CHANNELS] = {false, invertGreen && comps > 1, false, invertAlpha && comps > 3};
+			const size_t total = count * comps;
+			size_t i = 0;
+
+#ifdef KERNELS_HAS_SSE2
+			// A block of comps vectors always holds a whole number of pixels, so the channel pattern repeats per block
+			constexpr size_t VEC = VEC_BYTES / sizeof(T);
+			const size_t block = comps * VEC;
+
+			if constexpr (std::is_same_v<T, float>) {
+				// Inverted channels become 1 - x, everything else x * 1 + 0
+				alignas(64) float mul[MAX_CHANNELS * VEC], add[MAX_CHANNELS * VEC];
+				for (size_t k = 0; k < block; ++k) {
+					mul[k] = flip[k % comps] ? -1.f : 1.f;
+					add[k] = flip[k % comps] ? 1.f : 0.f;
+				}
+
+				for (; i + block <= total; i += block) {
+					for (int v = 0; v < comps; ++v) {
+						float* cur = p + i + v * VEC;
+						store_f(cur, mul_add_f(load_f(cur), load_f(mul + v * VEC), load_f(add + v * VEC)));
+					}
+				}
+			}
+			else {
+				// For unsigned integers, MAX - x == x ^ MAX
+				alignas(64) T mask[MAX_CHANNELS * VEC];
+				for (size_t k = 0; k < block; ++k)
+					mask[k] = flip[k % comps] ? T(~T(0)) : T(0);
+
+				for (; i + block <= total; i += block) {
+					for (int v = 0; v < comps; ++v) {
+						T* cur = p + i + v * VEC;
+						store_i(cur, xor_i(load_i(cur), load_i(mask + v * VEC)));
+					}
+				}
+			}
+#endif
+
+			for (; i < total; ++i) {
+				if (!flip[i % comps])
+					continue;
+				if constexpr (std::is_same_v<T, float>)
+					p[i] = 1.f - p[i];
+				else
+					p[i] = T(~p[i]);
+			}
+		}
+
+		//
+		// Channel packing
+		//
+		void pack_copy(uint8_t* dst, int dstC, int dstChan, const uint8_t* src, int srcC, int srcChan, size_t count) {
+			size_t i = 0;
+
+#ifdef KERNELS_HAS_SSE2
+			// RGBA -> RGBA is by far the most common case. Treat each pixel as a 32-bit int and shift the channel
+			// into place
+			if (dstC == 4 && srcC == 4) {
+				constexpr size_t VEC = VEC_BYTES / 4;
+				const int shift = (dstChan - srcChan) * 8;
+				const VecI mask = set1_u32(0xFFu << (dstChan * 8));
+				for (; i + VEC <= count; i += VEC) {
+					VecI v = load_i(src + i * 4);
+					v = shift >= 0 ? sll_u32(v, shift) : srl_u32(v, -shift);
+					store_i(dst + i * 4, or_i(andnot_i(mask, load_i(dst + i * 4)), and_i(v, mask)));
+				}
+			}
+#endif
+
+			for (; i < count; ++i)
+				dst[i * dstC + dstChan] = src[i * srcC + srcChan];
+		}
+
+		void pack_fill(uint8_t* dst, int dstC, int dstChan, uint8_t value, size_t count) {
+			size_t i = 0;
+
+#ifdef KERNELS_HAS_SSE2
+			if (dstC == 4) {
+				constexpr size_t VEC = VEC_BYTES / 4;
+				const VecI mask = set1_u32(0xFFu << (dstChan * 8));
+				const VecI fill = set1_u32(uint32_t(value) << (dstChan * 8));
+				for (; i + VEC <= count; i += VEC)
+					store_i(dst + i * 4, or_i(andnot_i(mask, load_i(dst + i * 4)), fill));
+			}
+#endif
+
+			for (; i < count; ++i)
+				dst[i * dstC + dstChan] = value;
+		}
+
+		//
+		// Mipmap filtering
+		//
+		void mip_rows(const float* const* rows, const float* weights, int taps, float* out, size_t count) {
+			size_t i = 0;
+
+#ifdef KERNELS_HAS_SSE2
+			constexpr size_t VEC = VEC_BYTES / 4;
+			for (; i + VEC <= count; i += VEC) {
+				VecF acc = set1_f(0.f);
+				for (int t = 0; t < taps; ++t)
+					acc = mul_add_f(load_f(rows[t] + i), set1_f(weights[t]), acc);
+				store_f(out + i, acc);
+			}
+#endif
+
+			for (; i < count; ++i) {
+				float acc = 0.f;
+				for (int t = 0; t < taps; ++t)
+					acc = rows[t][i] * weights[t] + acc;
+				out[i] = acc;
+			}
+		}
+
+		void mip_columns(const float* in, float* out, size_t count, const int* index, const float* weights, int taps) {
+			size_t i = 0;
+
+#ifdef KERNELS_HAS_AVX2
+			// Two pixels per vector, one in each lane
+			for (; i + 2 <= count; i += 2) {
+				const int* idx1 = index + taps;
+				const float* w1 = weights + taps;
+				__m256 acc = _mm256_setzero_ps();
+				for (int t = 0; t < taps; ++t) {
+					const __m256 px = _mm256_insertf128_ps(
+						_mm256_castps128_ps256(_mm_loadu_ps(in + index[t] * 4)), _mm_loadu_ps(in + idx1[t] * 4), 1);
+					const __m256 w =
+						_mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(weights[t])), _mm_set1_ps(w1[t]), 1);
+					acc = _mm256_add_ps(_mm256_mul_ps(px, w), acc);
+				}
+				_mm256_storeu_ps(out + i * 4, acc);
+				index += taps * 2;
+				weights += taps * 2;
+			}
+#endif
+
+#ifdef KERNELS_HAS_SSE2
+			for (; i < count; ++i) {
+				__m128 acc = _mm_setzero_ps();
+				for (int t = 0; t < taps; ++t)
+					acc = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + index[t] * 4), _mm_set1_ps(weights[t])), acc);
+				_mm_storeu_ps(out + i * 4, acc);
+				index += taps;
+				weights += taps;
+			}
+#endif
+
+			for (; i < count; ++i) {
+				float acc[4] = {};
+				for (int t = 0; t < taps; ++t)
+					for (int c = 0; c < 4; ++c)
+						acc[c] = in[index[t] * 4 + c] * weights[t] + acc[c];
+				for (int c = 0; c < 4; ++c)
+					out[i * 4 + c] = acc[c];
+				index += taps;
+				weights += taps;
+			}
+		}
+
+	} // namespace
+
+	const Table& table() {
+		static const Table s_table = {
+			static_cast<cpu::Level>(KERNELS_LEVEL),
+			{
+				{convert<uint8_t, uint8_t>, convert<uint8_t, uint16_t>, convert<uint8_t, float>},
+				{convert<uint16_t, uint8_t>, convert<uint16_t, uint16_t>, convert<uint16_t, float>},
+				{convert<float, uint8_t>, convert<float, uint16_t>, convert<float, float>},
+			},
+			{swizzle<uint8_t>, swizzle<uint16_t>, swizzle<float>},
+			{process<uint8_t>, process<uint16_t>, process<float>},
+			pack_copy,
+			pack_fill,
+			mip_rows,
+			mip_columns,
+		};
+		return s_table;
+	}
+
+} // namespace kernels::KERNELS_NS
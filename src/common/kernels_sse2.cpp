@@ -0,0 +1,4 @@
+// SSE2 kernels, see kernels.hpp
+#define KERNELS_NS sse2
+#define KERNELS_LEVEL 1
+#include "kernels_impl.hpp"
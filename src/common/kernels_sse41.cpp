@@ -0,0 +1,4 @@
+// SSE41 kernels, see kernels.hpp
+#define KERNELS_NS sse41
+#define KERNELS_LEVEL 2
+#include "kernels_impl.hpp"
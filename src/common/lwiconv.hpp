@@ -1,12 +1,14 @@
 /**
  * lwiconv: Lightweight Image Conversion library.
- * Not designed to be particularly fast, just simple.
+ * Designed to be simple first. Conversions are routed through the runtime dispatched kernels in kernels.hpp,
+ * with the generic per-pixel path as a fallback.
  */
 #pragma once
 
 #include <cstdint>
 #include <cstddef>
 #include <cassert>
+#include <type_traits>
 
 namespace lwiconv
 {
@@ -51,47 +53,162 @@ template<> inline float fromfloat<float>(float p) {
 	return p;
 }
 
-template <typename T, int COMPS>
-inline PixelF pixel_from_data(const T* pin, const PixelF& defs) {
-	if constexpr (COMPS == 1)
-		return {{tofloat(*pin), defs.d[1], defs.d[2], defs.d[3]}};
-	else if constexpr (COMPS == 2)
-		return {{tofloat(*pin), tofloat(pin[1]), defs.d[2], defs.d[3]}};
-	else if constexpr (COMPS == 3)
-		return {{tofloat(*pin), tofloat(pin[1]), tofloat(pin[2]), defs.d[3]}};
-	else if constexpr (COMPS == 4)
-		return {{tofloat(*pin), tofloat(pin[1]), tofloat(pin[2]), tofloat(pin[3])}};
+/**
+ * True if Tin -> Tout can be converted exactly with integer math, so it never needs to go through float
+ */
+template <typename Tin, typename Tout>
+inline constexpr bool is_exact_pair = std::is_same_v<Tin, Tout>
+	|| (std::is_same_v<Tin, uint8_t> && std::is_same_v<Tout, uint16_t>)
+	|| (std::is_same_v<Tin, uint16_t> && std::is_same_v<Tout, uint8_t>);
+
+/**
+ * Integer conversion for the pairs in is_exact_pair. Widening is exact (x * 257),
+ * narrowing rounds to nearest: round(x * 255 / 65535)
+ */
+template <typename Tin, typename Tout>
+inline Tout convert_exact(Tin v) {
+	static_assert(is_exact_pair<Tin, Tout>);
+	if constexpr (std::is_same_v<Tin, Tout>)
+		return v;
+	else if constexpr (std::is_same_v<Tout, uint16_t>)
+		return uint16_t(v * 257u);
+	else
+		return uint8_t((v * 255u + 32895u) >> 16);
 }
 
-template <typename T, int COMPS>
-inline void pixel_to_data(T* pout, const PixelF& p) {
-	static_assert(COMPS <= MAX_CHANNELS && COMPS > 0);
-	if constexpr (COMPS == 1) {
-		pout[0] = fromfloat<T>(p.d[0]);
-	}
-	else if constexpr (COMPS == 2) {
-		pout[0] = fromfloat<T>(p.d[0]);
-		pout[1] = fromfloat<T>(p.d[1]);
+/**
+ * Convert a single sample
+ */
+template <typename Tin, typename Tout>
+inline Tout convert_sample(Tin v) {
+	if constexpr (is_exact_pair<Tin, Tout>)
+		return convert_exact<Tin, Tout>(v);
+	else
+		return fromfloat<Tout>(tofloat<Tin>(v));
+}
+
+/**
+ * Convert one row of pixels. Everything that decides the per-pixel work is a template parameter,
+ * so the inner loop is fully unrolled and can be auto-vectorized when PACKED is set
+ */
+template <typename Tin, typename Tout, int IN_C, int OUT_C, bool PACKED>
+inline void convert_row(const uint8_t* in, uint8_t* out, int w, int inStride, int outStride, const Tout (&defs)[MAX_CHANNELS]) {
+	if constexpr (PACKED) {
+		inStride = IN_C * sizeof(Tin);
+		outStride = OUT_C * sizeof(Tout);
 	}
-	else if constexpr (COMPS == 3) {
-		pout[0] = fromfloat<T>(p.d[0]);
-		pout[1] = fromfloat<T>(p.d[1]);
-		pout[2] = fromfloat<T>(p.d[2]);
+
+	for (int x = 0; x < w; ++x) {
+		auto* src = reinterpret_cast<const Tin*>(in + size_t(x) * inStride);
+		auto* dst = reinterpret_cast<Tout*>(out + size_t(x) * outStride);
+		for (int c = 0; c < OUT_C; ++c)
+			dst[c] = c < IN_C ? convert_sample<Tin, Tout>(src[c]) : defs[c];
 	}
-	else if constexpr (COMPS == 4) {
-		pout[0] = fromfloat<T>(p.d[0]);
-		pout[1] = fromfloat<T>(p.d[1]);
-		pout[2] = fromfloat<T>(p.d[2]);
-		pout[3] = fromfloat<T>(p.d[3]);
+}
+
+template <typename Tin, typename Tout, int IN_C, int OUT_C>
+static void convert_rect(const uint8_t* in, uint8_t* out, int w, int h, int inStride, int outStride, ptrdiff_t inPitch, ptrdiff_t outPitch, const PixelF& channelDefaults) {
+	Tout defs[MAX_CHANNELS];
+	for (int c = 0; c < MAX_CHANNELS; ++c)
+		defs[c] = fromfloat<Tout>(channelDefaults.d[c]);
+
+	const bool packed = inStride == int(IN_C * sizeof(Tin)) && outStride == int(OUT_C * sizeof(Tout));
+	for (int y = 0; y < h; ++y, in += inPitch, out += outPitch) {
+		if (packed)
+			convert_row<Tin, Tout, IN_C, OUT_C, true>(in, out, w, inStride, outStride, defs);
+		else
+			convert_row<Tin, Tout, IN_C, OUT_C, false>(in, out, w, inStride, outStride, defs);
 	}
 }
 
+template <typename Tin, typename Tout>
+using ConvertRectFn = void (*)(const uint8_t*, uint8_t*, int, int, int, int, ptrdiff_t, ptrdiff_t, const PixelF&);
+
+/**
+ * Every convert_rect specialization for Tin -> Tout, indexed by [inC-1][outC-1]
+ */
+template <typename Tin, typename Tout>
+static constexpr ConvertRectFn<Tin, Tout> convert_rect_table[MAX_CHANNELS][MAX_CHANNELS] = {
+	{convert_rect<Tin, Tout, 1, 1>, convert_rect<Tin, Tout, 1, 2>, convert_rect<Tin, Tout, 1, 3>, convert_rect<Tin, Tout, 1, 4>},
+	{convert_rect<Tin, Tout, 2, 1>, convert_rect<Tin, Tout, 2, 2>, convert_rect<Tin, Tout, 2, 3>, convert_rect<Tin, Tout, 2, 4>},
+	{convert_rect<Tin, Tout, 3, 1>, convert_rect<Tin, Tout, 3, 2>, convert_rect<Tin, Tout, 3, 3>, convert_rect<Tin, Tout, 3, 4>},
+	{convert_rect<Tin, Tout, 4, 1>, convert_rect<Tin, Tout, 4, 2>, convert_rect<Tin, Tout, 4, 3>, convert_rect<Tin, Tout, 4, 4>},
+};
+
+/**
+ * Vectorized implementation of convert_generic, defined in kernels.cpp for every combination of uint8_t,
+ * uint16_t and float. Strides must already be resolved. Returns false if no kernels are active for this CPU
+ */
+template <typename Tin, typename Tout>
+bool convert_simd(const void* in, void* out, size_t count, int inC, int outC, int inStride, int outStride, const PixelF& defs);
+
+}
+
+/**
+ * \brief Plain C++ implementation of convert_generic_rect, used when no vector kernels are active
+ * Parameters are the same as convert_generic_rect
+ */
+template <typename Tin, typename Tout>
+static void convert_generic_scalar(const void* in, void* out, int w, int h, int inC, int outC, int inStride = -1, int outStride = -1,
+	ptrdiff_t inRowPitch = -1, ptrdiff_t outRowPitch = -1, const PixelF& channelDefaults = {0,0,0,0}) {
+	assert(inC > 0 && inC <= MAX_CHANNELS && outC > 0 && outC <= MAX_CHANNELS);
+
+	// Compute stride and pitch if not provided
+	if (inStride <= 0)
+		inStride = inC * sizeof(Tin);
+	if (outStride <= 0)
+		outStride = outC * sizeof(Tout);
+	if (inRowPitch <= 0)
+		inRowPitch = ptrdiff_t(w) * inStride;
+	if (outRowPitch <= 0)
+		outRowPitch = ptrdiff_t(w) * outStride;
+
+	detail::convert_rect_table<Tin, Tout>[inC-1][outC-1](
+		static_cast<const uint8_t*>(in), static_cast<uint8_t*>(out), w, h, inStride, outStride, inRowPitch, outRowPitch, channelDefaults);
+}
+
+/**
+ * \brief Convert a rectangle of pixels from one color format to another
+ * Same as convert_generic, but rows don't need to be contiguous, so this can work on a region of a larger image.
+ * Same-type channel changes and uint8_t <-> uint16_t never touch float, see detail::convert_exact.
+ * \param inRowPitch Bytes between the start of two input rows. If set <= 0, it will be computed for you based on w and inStride
+ * \param outRowPitch Bytes between the start of two output rows. If set <= 0, it will be computed for you based on w and outStride
+ */
+template <typename Tin, typename Tout>
+static void convert_generic_rect(const void* in, void* out, int w, int h, int inC, int outC, int inStride, int outStride,
+	ptrdiff_t inRowPitch, ptrdiff_t outRowPitch, const PixelF& channelDefaults = {0,0,0,0}) {
+	// Compute stride and pitch if not provided
+	if (inStride <= 0)
+		inStride = inC * sizeof(Tin);
+	if (outStride <= 0)
+		outStride = outC * sizeof(Tout);
+	if (inRowPitch <= 0)
+		inRowPitch = ptrdiff_t(w) * inStride;
+	if (outRowPitch <= 0)
+		outRowPitch = ptrdiff_t(w) * outStride;
+
+	// Contiguous rows can be done in one go
+	if (inRowPitch == ptrdiff_t(w) * inStride && outRowPitch == ptrdiff_t(w) * outStride) {
+		if (detail::convert_simd<Tin, Tout>(in, out, size_t(w) * h, inC, outC, inStride, outStride, channelDefaults))
+			return;
+	}
+	else if (h > 0 && detail::convert_simd<Tin, Tout>(in, out, w, inC, outC, inStride, outStride, channelDefaults)) {
+		for (int y = 1; y < h; ++y) {
+			detail::convert_simd<Tin, Tout>(
+				static_cast<const uint8_t*>(in) + y * inRowPitch, static_cast<uint8_t*>(out) + y * outRowPitch,
+				w, inC, outC, inStride, outStride, channelDefaults);
+		}
+		return;
+	}
+
+	convert_generic_scalar<Tin, Tout>(in, out, w, h, inC, outC, inStride, outStride, inRowPitch, outRowPitch, channelDefaults);
 }
 
 /**
  * \brief Convert buffer from one color format to another
  * The input and output buffers are assumed to be the same dimensions.
  * in and out must not overlap.
+ * Same-type channel changes and uint8_t <-> uint16_t never touch float, see detail::convert_exact.
  * \param in Pointer to the input buffer
  * \param out Pointer to the output buffer
  * \param w Width of the image
@@ -105,39 +222,7 @@ inline void pixel_to_data(T* pout, const PixelF& p) {
  */
 template <typename Tin, typename Tout>
 static void convert_generic(const void* in, void* out, int w, int h, int inC, int outC, int inStride = -1, int outStride = -1, const PixelF& channelDefaults = {0,0,0,0}) {
-	const Tin* pin = static_cast<const Tin*>(in);
-	Tout* pout = static_cast<Tout*>(out);
-
-	// Compute stride if not provided
-	if (inStride <= 0)
-		inStride = inC * sizeof(Tin);
-	if (outStride <= 0)
-		outStride = outC * sizeof(Tout);
-
-	using fnInConv = PixelF (*)(const Tin*, const PixelF&);
-	constexpr fnInConv inConvFuncs[MAX_CHANNELS] = {
-		detail::pixel_from_data<Tin, 1>,
-		detail::pixel_from_data<Tin, 2>,
-		detail::pixel_from_data<Tin, 3>,
-		detail::pixel_from_data<Tin, 4>,
-	};
-	const fnInConv inConv = inConvFuncs[inC-1];
-
-	using fnOutConv = void (*)(Tout*, const PixelF&);
-	constexpr fnOutConv outConvFuncs[MAX_CHANNELS] = {
-		detail::pixel_to_data<Tout, 1>,
-		detail::pixel_to_data<Tout, 2>,
-		detail::pixel_to_data<Tout, 3>,
-		detail::pixel_to_data<Tout, 4>,
-	};
-	const fnOutConv outConv = outConvFuncs[outC-1];
-
-	const size_t target = w * h;
-	const size_t isb = inStride / sizeof(Tin);
-	const size_t osb = outStride / sizeof(Tout);
-
-	for (size_t i = 0; i < target; ++i, pin += isb, pout += osb)
-		outConv(pout, inConv(pin, channelDefaults));
+	convert_generic_rect<Tin, Tout>(in, out, w, h, inC, outC, inStride, outStride, -1, -1, channelDefaults);
 }
 
 constexpr uint32_t NO_SWIZZLE = 0x00010203;
@@ -151,51 +236,150 @@ static inline constexpr uint32_t make_swizzle(int a, int b, int c, int d) {
 	return (a & 0xFF) << 24 | (b & 0xFF) << 16 | (c & 0xFF) << 8 | (d & 0xFF);
 }
 
+// Swizzles we see all the time, these get specialized kernels
+constexpr uint32_t SWIZZLE_BGRA = make_swizzle(2, 1, 0, 3); // RGBA <-> BGRA
+constexpr uint32_t SWIZZLE_ABGR = make_swizzle(3, 2, 1, 0);
+constexpr uint32_t SWIZZLE_ARGB = make_swizzle(3, 0, 1, 2); // RGBA -> ARGB
+constexpr uint32_t SWIZZLE_GBAR = make_swizzle(1, 2, 3, 0); // ARGB -> RGBA
+constexpr uint32_t SWIZZLE_RRRA = make_swizzle(0, 0, 0, 3);
+
 namespace detail {
 
-static inline PixelF swizzle_one(const PixelF& pixel, uint32_t mask) {
-	return { pixel.d[(mask >> 24) & 0xFF], pixel.d[(mask >> 16) & 0xFF], pixel.d[(mask >> 8) & 0xFF], pixel.d[mask & 0xFF] };
+/**
+ * Source channel for output channel c of a swizzle mask
+ */
+static inline constexpr int swizzle_source(uint32_t mask, int c) {
+	return (mask >> ((MAX_CHANNELS - 1 - c) * 8)) & 0xFF;
+}
+
+/**
+ * Swizzle count pixels. Sources past IN_C read from defs instead.
+ * in and out may be the same buffer if IN_C == OUT_C
+ */
+template <typename T, int IN_C, int OUT_C>
+static void swizzle_pixels(const T* in, T* out, size_t count, uint32_t mask, const T (&defs)[MAX_CHANNELS]) {
+	int src[MAX_CHANNELS];
+	for (int c = 0; c < MAX_CHANNELS; ++c)
+		src[c] = swizzle_source(mask, c);
+
+	for (size_t i = 0; i < count; ++i, in += IN_C, out += OUT_C) {
+		T pixel[MAX_CHANNELS];
+		for (int c = 0; c < MAX_CHANNELS; ++c)
+			pixel[c] = c < IN_C ? in[c] : defs[c];
+		for (int c = 0; c < OUT_C; ++c)
+			out[c] = pixel[src[c]];
+	}
+}
+
+/**
+ * Same as swizzle_pixels for 4 -> 4 channels, with the mask known at compile time
+ */
+template <typename T, uint32_t MASK>
+static void swizzle_pixels_fixed(const T* in, T* out, size_t count) {
+	constexpr int s0 = swizzle_source(MASK, 0), s1 = swizzle_source(MASK, 1);
+	constexpr int s2 = swizzle_source(MASK, 2), s3 = swizzle_source(MASK, 3);
+	static_assert(s0 < MAX_CHANNELS && s1 < MAX_CHANNELS && s2 < MAX_CHANNELS && s3 < MAX_CHANNELS);
+
+	for (size_t i = 0; i < count; ++i, in += 4, out += 4) {
+		const T r = in[s0], g = in[s1], b = in[s2], a = in[s3];
+		out[0] = r;
+		out[1] = g;
+		out[2] = b;
+		out[3] = a;
+	}
 }
-	
+
+template <typename T>
+using SwizzleFn = void (*)(const T*, T*, size_t, uint32_t, const T (&)[MAX_CHANNELS]);
+
+/**
+ * Every swizzle_pixels specialization, indexed by [inC-1][outC-1]
+ */
+template <typename T>
+static constexpr SwizzleFn<T> swizzle_table[MAX_CHANNELS][MAX_CHANNELS] = {
+	{swizzle_pixels<T, 1, 1>, swizzle_pixels<T, 1, 2>, swizzle_pixels<T, 1, 3>, swizzle_pixels<T, 1, 4>},
+	{swizzle_pixels<T, 2, 1>, swizzle_pixels<T, 2, 2>, swizzle_pixels<T, 2, 3>, swizzle_pixels<T, 2, 4>},
+	{swizzle_pixels<T, 3, 1>, swizzle_pixels<T, 3, 2>, swizzle_pixels<T, 3, 3>, swizzle_pixels<T, 3, 4>},
+	{swizzle_pixels<T, 4, 1>, swizzle_pixels<T, 4, 2>, swizzle_pixels<T, 4, 3>, swizzle_pixels<T, 4, 4>},
+};
+
+/**
+ * Vectorized implementation of swizzle_convert, defined in kernels.cpp for uint8_t, uint16_t and float.
+ * Returns false if no kernels are active for this CPU
+ */
+template <typename T>
+bool swizzle_simd(const T* in, T* out, size_t count, int inC, int outC, uint32_t mask, const PixelF& defs);
+
 }
 
+/**
+ * \brief Swizzle the channels of an image, and change the number of channels at the same time
+ * Channels that aren't in the input read as channelDefaults, so swizzling RGB -> RGBA with "rgba" adds an alpha channel,
+ * and "aaar" would turn it into white with the red channel in alpha.
+ * \param in Input pixels, tightly packed
+ * \param out Output pixels, tightly packed. May be the same as in if inC == outC
+ * \param swizzle Swizzle mask, see make_swizzle
+ * \return false if the channel counts or the mask are out of range
+ */
 template<typename T>
-static bool swizzle(T* image, int w, int h, int comps, uint32_t swizzle) {	
-	assert(comps <= MAX_CHANNELS && comps > 0);
-	if (comps <= 0 || comps > MAX_CHANNELS)
+static bool swizzle_convert(const T* in, T* out, int w, int h, int inC, int outC, uint32_t swizzle, const PixelF& channelDefaults = {0,0,0,1}) {
+	assert(inC <= MAX_CHANNELS && inC > 0 && outC <= MAX_CHANNELS && outC > 0);
+	if (inC <= 0 || inC > MAX_CHANNELS || outC <= 0 || outC > MAX_CHANNELS)
+		return false;
+	if (in == out && inC != outC)
 		return false;
 
 	// Check that swizzle is in bounds too
-	for (int i = 0; i < comps; ++i)
-		if (((swizzle >> (i*8)) & 0xFF) > comps)
+	for (int c = 0; c < outC; ++c)
+		if (detail::swizzle_source(swizzle, c) >= MAX_CHANNELS)
 			return false;
-	
-	using fnInConv = PixelF (*)(const T*, const PixelF&);
-	constexpr fnInConv inConvFuncs[MAX_CHANNELS] = {
-		detail::pixel_from_data<T, 1>,
-		detail::pixel_from_data<T, 2>,
-		detail::pixel_from_data<T, 3>,
-		detail::pixel_from_data<T, 4>,
-	};
-	const fnInConv inConv = inConvFuncs[comps-1];
-
-	using fnOutConv = void (*)(T*, const PixelF&);
-	constexpr fnOutConv outConvFuncs[MAX_CHANNELS] = {
-		detail::pixel_to_data<T, 1>,
-		detail::pixel_to_data<T, 2>,
-		detail::pixel_to_data<T, 3>,
-		detail::pixel_to_data<T, 4>,
-	};
-	const fnOutConv outConv = outConvFuncs[comps-1];
-
-	const size_t stride = comps * sizeof(T);
-	for (int m = 0; m < w*h; ++m, image += stride) {
-		outConv(image, detail::swizzle_one(
-			inConv(image, {0,0,0,0}), swizzle
-		));
+
+	const size_t count = size_t(w) * h;
+	if (detail::swizzle_simd<T>(in, out, count, inC, outC, swizzle, channelDefaults))
+		return true;
+
+	if (inC == 4 && outC == 4) {
+		switch (swizzle) {
+		case NO_SWIZZLE:
+			if (in != out)
+				detail::swizzle_pixels_fixed<T, NO_SWIZZLE>(in, out, count);
+			return true;
+		case SWIZZLE_BGRA:
+			detail::swizzle_pixels_fixed<T, SWIZZLE_BGRA>(in, out, count);
+			return true;
+		case SWIZZLE_ABGR:
+			detail::swizzle_pixels_fixed<T, SWIZZLE_ABGR>(in, out, count);
+			return true;
+		case SWIZZLE_ARGB:
+			detail::swizzle_pixels_fixed<T, SWIZZLE_ARGB>(in, out, count);
+			return true;
+		case SWIZZLE_GBAR:
+			detail::swizzle_pixels_fixed<T, SWIZZLE_GBAR>(in, out, count);
+			return true;
+		case SWIZZLE_RRRA:
+			detail::swizzle_pixels_fixed<T, SWIZZLE_RRRA>(in, out, count);
+			return true;
+		default:
+			break;
+		}
 	}
-	
+
+	T defs[MAX_CHANNELS];
+	for (int c = 0; c < MAX_CHANNELS; ++c)
+		defs[c] = detail::fromfloat<T>(channelDefaults.d[c]);
+	detail::swizzle_table<T>[inC-1][outC-1](in, out, count, swizzle, defs);
 	return true;
 }
 
+/**
+ * \brief Swizzle the channels of an image in place
+ * Sources past comps read as 0
+ * \param swizzle Swizzle mask, see make_swizzle
+ * \return false if comps or the mask are out of range
+ */
+template<typename T>
+static bool swizzle(T* image, int w, int h, int comps, uint32_t swizzle) {
+	return swizzle_convert<T>(image, image, w, h, comps, comps, swizzle, {0,0,0,0});
+}
+
 } // lwiconv
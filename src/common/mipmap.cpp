@@ -0,0 +1,456 @@
+#include "mipmap.hpp"
+#include "kernels.hpp"
+#include "strtools.hpp"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <memory>
+
+using namespace imglib;
+
+static const char* s_filterNames[] = {"box", "kaiser", "catrom"};
+
+bool imglib::parse_mip_filter(const char* str, MipFilter& outFilter) {
+	for (int i = 0; i < static_cast<int>(sizeof(s_filterNames) / sizeof(s_filterNames[0])); ++i) {
+		if (!str::strcasecmp(str, s_filterNames[i])) {
+			outFilter = static_cast<MipFilter>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+namespace
+{
+	// Output rows per band. Small enough to keep the source rows of a band in cache
+	constexpr int BAND_ROWS = 8;
+
+	//
+	// Filter kernels, x is in output texels
+	//
+
+	float box(float x) {
+		return (x >= -0.5f && x < 0.5f) ? 1.f : 0.f;
+	}
+
+	float catmull_rom(float x) {
+		x = std::fabs(x);
+		if (x < 1.f)
+			return (1.5f * x - 2.5f) * x * x + 1.f;
+		if (x < 2.f)
+			return ((-0.5f * x + 2.5f) * x - 4.f) * x + 2.f;
+		return 0.f;
+	}
+
+	// Zeroth order modified Bessel function of the first kind
+	float bessel_i0(float x) {
+		float sum = 1.f, term = 1.f;
+		for (int k = 1; k < 32; ++k) {
+			term *= (x / (2.f * k)) * (x / (2.f * k));
+			sum += term;
+			if (term < sum * 1e-7f)
+				break;
+		}
+		return sum;
+	}
+
+	constexpr float KAISER_WIDTH = 3.f;
+	constexpr float KAISER_ALPHA = 4.f;
+
+	float kaiser(float x) {
+		if (std::fabs(x) >= KAISER_WIDTH)
+			return 0.f;
+		constexpr float pi = 3.14159265358979f;
+		const float sinc = x == 0.f ? 1.f : std::sin(pi * x) / (pi * x);
+		const float t = x / KAISER_WIDTH;
+		return sinc * bessel_i0(KAISER_ALPHA * std::sqrt(1.f - t * t)) / bessel_i0(KAISER_ALPHA);
+	}
+
+	struct FilterInfo {
+		float (*fn)(float);
+		float support;
+	};
+
+	constexpr FilterInfo s_filters[] = {
+		{box, 0.5f},
+		{kaiser, KAISER_WIDTH},
+		{catmull_rom, 2.f},
+	};
+
+	//
+	// sRGB transfer tables
+	//
+
+	// 8-bit value to linear float, for both sRGB and linear data
+	const float* decode_table(bool srgb) {
+		static const auto s_tables = []()
+		{
+			std::array<std::array<float, 256>, 2> tables;
+			for (int i = 0; i < 256; ++i) {
+				const float v = i / 255.f;
+				tables[0][i] = v;
+				tables[1][i] = v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+			}
+			return tables;
+		}();
+		return s_tables[srgb].data();
+	}
+
+	// Linear float, quantized to 16 bits, to 8-bit sRGB. 16 bits keeps the steep end near black exact
+	constexpr int ENCODE_STEPS = 65535;
+
+	const uint8_t* encode_srgb_table() {
+		static const auto s_table = []()
+		{
+			std::vector<uint8_t> table(ENCODE_STEPS + 1);
+			for (int i = 0; i <= ENCODE_STEPS; ++i) {
+				const float v = float(i) / ENCODE_STEPS;
+				const float s = v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.f / 2.4f) - 0.055f;
+				table[i] = uint8_t(std::clamp(s * 255.f + 0.5f, 0.f, 255.f));
+			}
+			return table;
+		}();
+		return s_table.data();
+	}
+
+	template <typename T, int MAX>
+	inline T quantize(float v) {
+		return T(std::clamp(v * MAX + 0.5f, 0.f, float(MAX)));
+	}
+
+	//
+	// Filter passes, plain C++ versions of kernels::MipRowsFn and kernels::MipColumnsFn
+	//
+
+	void filter_rows(const float* const* rows, const float* weights, int taps, float* out, size_t count) {
+		if (auto* table = kernels::active())
+			return table->mip_rows(rows, weights, taps, out, count);
+
+		for (size_t i = 0; i < count; ++i) {
+			float acc = 0.f;
+			for (int t = 0; t < taps; ++t)
+				acc = rows[t][i] * weights[t] + acc;
+			out[i] = acc;
+		}
+	}
+
+	void filter_columns(const float* in, float* out, size_t count, const int* index, const float* weights, int taps) {
+		if (auto* table = kernels::active())
+			return table->mip_columns(in, out, count, index, weights, taps);
+
+		for (size_t i = 0; i < count; ++i, index += taps, weights += taps) {
+			float acc[4] = {};
+			for (int t = 0; t < taps; ++t)
+				for (int c = 0; c < 4; ++c)
+					acc[c] = in[index[t] * 4 + c] * weights[t] + acc[c];
+			std::memcpy(out + i * 4, acc, sizeof(acc));
+		}
+	}
+} // namespace
+
+MipResampler::MipResampler(
+	ChannelType type, int channels, int srcW, int srcH, int dstW, int dstH, MipFilter filter, bool srgb)
+	: m_type(type),
+	  m_channels(channels),
+	  m_srcW(srcW),
+	  m_srcH(srcH),
+	  m_dstW(dstW),
+	  m_dstH(dstH),
+	  m_srgb(srgb && type == ChannelType::UInt8) {
+	m_x = make_axis(srcW, dstW, filter);
+	m_y = make_axis(srcH, dstH, filter);
+}
+
+//
+// Compute the weights for one axis. Every output texel gets the same number of taps, texels past the edge are
+// clamped to it
+//
+MipResampler::Axis MipResampler::make_axis(int srcSize, int dstSize, MipFilter filter) {
+	const auto& info = s_filters[static_cast<int>(filter)];
+	const float scale = float(srcSize) / float(dstSize);
+	const float radius = info.support * std::max(scale, 1.f);
+
+	// Source texel centers within radius of the output texel's center
+	const auto first_texel = [&](int i) { return int(std::ceil((i + 0.5f) * scale - radius - 0.5f)); };
+	const auto last_texel = [&](int i) { return int(std::floor((i + 0.5f) * scale + radius - 0.5f)); };
+
+	Axis axis;
+	for (int i = 0; i < dstSize; ++i)
+		axis.taps = std::max(axis.taps, last_texel(i) - first_texel(i) + 1);
+
+	axis.index.resize(size_t(dstSize) * axis.taps);
+	axis.weights.resize(size_t(dstSize) * axis.taps);
+	for (int i = 0; i < dstSize; ++i) {
+		const float center = (i + 0.5f) * scale;
+		const int first = first_texel(i);
+		int* index = &axis.index[size_t(i) * axis.taps];
+		float* weights = &axis.weights[size_t(i) * axis.taps];
+
+		float sum = 0.f;
+		for (int t = 0; t < axis.taps; ++t) {
+			const int j = first + t;
+			index[t] = std::clamp(j, 0, srcSize - 1);
+			weights[t] = j <= last_texel(i) ? info.fn((j + 0.5f - center) / std::max(scale, 1.f)) : 0.f;
+			sum += weights[t];
+		}
+
+		// Filters that go negative can in theory sum to nothing, fall back to the nearest texel then
+		if (std::fabs(sum) < 1e-6f) {
+			std::fill(weights, weights + axis.taps, 0.f);
+			weights[std::clamp(int(center) - first, 0, axis.taps - 1)] = 1.f;
+			continue;
+		}
+		for (int t = 0; t < axis.taps; ++t)
+			weights[t] /= sum;
+	}
+	return axis;
+}
+
+int MipResampler::band_count() const {
+	return (m_dstH + BAND_ROWS - 1) / BAND_ROWS;
+}
+
+void imglib::to_linear_row(const void* src, ChannelType type, int channels, bool srgb, int w, float* out) {
+	// Grey and grey + alpha images only differ in where the alpha comes from
+	const int alphaChannel = channels == 2 ? 1 : 3;
+	const auto expand = [&](auto* in, auto&& color, auto&& alpha)
+	{
+		for (int x = 0; x < w; ++x, in += channels, out += 4) {
+			if (channels < 3)
+				out[0] = out[1] = out[2] = color(in[0]);
+			else {
+				out[0] = color(in[0]);
+				out[1] = color(in[1]);
+				out[2] = color(in[2]);
+			}
+			out[3] = (channels == 2 || channels == 4) ? alpha(in[alphaChannel]) : 1.f;
+		}
+	};
+
+	switch (type) {
+		case ChannelType::UInt8: {
+			const float* color = decode_table(srgb);
+			const float* alpha = decode_table(false);
+			expand(
+				static_cast<const uint8_t*>(src), [color](uint8_t v) { return color[v]; },
+				[alpha](uint8_t v) { return alpha[v]; });
+			break;
+		}
+		case ChannelType::UInt16: {
+			const auto norm = [](uint16_t v) { return v / 65535.f; };
+			expand(static_cast<const uint16_t*>(src), norm, norm);
+			break;
+		}
+		case ChannelType::Float: {
+			if (channels == 4) {
+				std::memcpy(out, src, size_t(w) * 4 * sizeof(float));
+				break;
+			}
+			const auto same = [](float v) { return v; };
+			expand(static_cast<const float*>(src), same, same);
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+void imglib::from_linear_row(const float* in, ChannelType type, int channels, bool srgb, int w, void* dst) {
+	switch (type) {
+		case ChannelType::UInt8: {
+			uint8_t* out = static_cast<uint8_t*>(dst);
+			const uint8_t* encode = encode_srgb_table();
+			for (int x = 0; x < w; ++x, in += 4, out += channels) {
+				for (int c = 0; c < 3; ++c)
+					out[c] = srgb ? encode[quantize<int, ENCODE_STEPS>(in[c])] : quantize<uint8_t, 255>(in[c]);
+				if (channels == 4)
+					out[3] = quantize<uint8_t, 255>(in[3]);
+			}
+			break;
+		}
+		case ChannelType::UInt16: {
+			uint16_t* out = static_cast<uint16_t*>(dst);
+			for (int x = 0; x < w; ++x, in += 4, out += channels)
+				for (int c = 0; c < channels; ++c)
+					out[c] = quantize<uint16_t, 65535>(in[c]);
+			break;
+		}
+		case ChannelType::Float: {
+			float* out = static_cast<float*>(dst);
+			if (channels == 4) {
+				std::memcpy(out, in, size_t(w) * 4 * sizeof(float));
+				break;
+			}
+			for (int x = 0; x < w; ++x, in += 4, out += channels)
+				std::memcpy(out, in, 3 * sizeof(float));
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+void MipResampler::source_rows(int y, int& first, int& last) const {
+	const auto begin = m_y.index.begin() + size_t(y) * m_y.taps;
+	const auto [lo, hi] = std::minmax_element(begin, begin + m_y.taps);
+	first = *lo;
+	last = *hi;
+}
+
+void MipResampler::filter_row(int y, const float* const* rows, int first, float* out, float* scratch) const {
+	const size_t firstTap = size_t(y) * m_y.taps;
+	std::vector<const float*> tapRows(m_y.taps);
+	for (int t = 0; t < m_y.taps; ++t)
+		tapRows[t] = rows[m_y.index[firstTap + t] - first];
+
+	filter_rows(tapRows.data(), &m_y.weights[firstTap], m_y.taps, scratch, size_t(m_srcW) * 4);
+	filter_columns(scratch, out, m_dstW, m_x.index.data(), m_x.weights.data(), m_x.taps);
+}
+
+void MipResampler::resample_rows(int y0, int y1, const float* const* rows, int first, float* const* out) const {
+	const int bands = (y1 - y0 + BAND_ROWS - 1) / BAND_ROWS;
+	util::parallel_for(
+		bands,
+		[&](size_t band)
+		{
+			std::vector<float> scratch(size_t(m_srcW) * 4);
+			const int begin = y0 + static_cast<int>(band) * BAND_ROWS;
+			for (int y = begin; y < std::min(begin + BAND_ROWS, y1); ++y)
+				filter_row(y, rows, first, out[y - y0], scratch.data());
+		});
+}
+
+void MipResampler::resample_band(const void* src, void* dst, int band) const {
+	const int y0 = band * BAND_ROWS;
+	const int y1 = std::min(y0 + BAND_ROWS, m_dstH);
+	const size_t rowFloats = size_t(m_srcW) * 4;
+	const size_t srcPitch = size_t(m_srcW) * m_channels * channel_size(m_type);
+	const size_t dstPitch = size_t(m_dstW) * m_channels * channel_size(m_type);
+
+	// Linearize every source row the band touches once, up front
+	int lo, hi, unused;
+	source_rows(y0, lo, unused);
+	source_rows(y1 - 1, unused, hi);
+
+	std::vector<float> rows(size_t(hi - lo + 1) * rowFloats);
+	std::vector<const float*> rowPtrs(hi - lo + 1);
+	for (int y = lo; y <= hi; ++y) {
+		float* row = &rows[size_t(y - lo) * rowFloats];
+		to_linear_row(static_cast<const uint8_t*>(src) + srcPitch * y, m_type, m_channels, m_srgb, m_srcW, row);
+		rowPtrs[y - lo] = row;
+	}
+
+	std::vector<float> scratch(rowFloats), out(size_t(m_dstW) * 4);
+	for (int y = y0; y < y1; ++y) {
+		filter_row(y, rowPtrs.data(), lo, out.data(), scratch.data());
+		from_linear_row(out.data(), m_type, m_channels, m_srgb, m_dstW, static_cast<uint8_t*>(dst) + dstPitch * y);
+	}
+}
+
+void MipResampler::resample(const void* src, void* dst) const {
+	util::parallel_for(band_count(), [&](size_t band) { resample_band(src, dst, static_cast<int>(band)); });
+}
+
+//
+// Streaming
+//
+
+// Source rows read per step. Every other stage advances as far as the rows above it allow
+static constexpr int STREAM_STRIP_ROWS = 64;
+
+namespace
+{
+	struct Stage {
+		int width, height;
+		std::unique_ptr<MipResampler> resampler; // From the stage before, null for the source
+		int produced = 0;						 // Rows handed to the sink so far
+		int first = 0;							 // Row held in rows[0]
+		std::deque<std::vector<float>> rows;
+	};
+
+	std::vector<const float*> row_pointers(const Stage& stage) {
+		std::vector<const float*> ptrs;
+		ptrs.reserve(stage.rows.size());
+		for (const auto& row : stage.rows)
+			ptrs.push_back(row.data());
+		return ptrs;
+	}
+} // namespace
+
+void imglib::stream_mips(
+	const StageSizes& sizes, MipFilter filter, const StreamSourceFn& source, const StreamSinkFn& sink) {
+	std::vector<Stage> stages(sizes.size());
+	for (size_t s = 0; s < sizes.size(); ++s) {
+		stages[s].width = sizes[s].first;
+		stages[s].height = sizes[s].second;
+		if (s > 0) {
+			stages[s].resampler = std::make_unique<MipResampler>(
+				ChannelType::Float, 4, sizes[s - 1].first, sizes[s - 1].second, sizes[s].first, sizes[s].second,
+				filter, false);
+		}
+	}
+
+	while (stages.back().produced < stages.back().height) {
+		for (size_t s = 0; s < stages.size(); ++s) {
+			auto& stage = stages[s];
+			if (stage.produced == stage.height)
+				continue;
+
+			// How far this stage can get with the rows available above it
+			int end;
+			if (s == 0)
+				end = std::min(stage.produced + STREAM_STRIP_ROWS, stage.height);
+			else if (stages[s - 1].produced == stages[s - 1].height)
+				end = stage.height;
+			else {
+				for (end = stage.produced; end < stage.height; ++end) {
+					int first, last;
+					stage.resampler->source_rows(end, first, last);
+					if (last >= stages[s - 1].produced)
+						break;
+				}
+				if (end < stage.height)
+					end -= end % 4;
+			}
+			if (end <= stage.produced)
+				continue;
+
+			const int begin = stage.produced;
+			const size_t oldCount = stage.rows.size();
+			for (int y = begin; y < end; ++y)
+				stage.rows.emplace_back(size_t(stage.width) * 4);
+
+			std::vector<float*> out(end - begin);
+			for (int y = begin; y < end; ++y)
+				out[y - begin] = stage.rows[oldCount + (y - begin)].data();
+
+			if (s == 0)
+				util::parallel_for(end - begin, [&](size_t i) { source(begin + static_cast<int>(i), out[i]); });
+			else {
+				auto& above = stages[s - 1];
+				stage.resampler->resample_rows(begin, end, row_pointers(above).data(), above.first, out.data());
+
+				// Let go of the rows above that no later row of this stage reads
+				int keep = above.height, last;
+				if (end < stage.height)
+					stage.resampler->source_rows(end, keep, last);
+				for (; above.first < keep && !above.rows.empty(); ++above.first)
+					above.rows.pop_front();
+			}
+
+			sink(static_cast<int>(s), begin, end - begin, row_pointers(stage).data() + oldCount);
+			stage.produced = end;
+
+			// Nothing reads the last stage
+			if (s + 1 == stages.size()) {
+				stage.first = end;
+				stage.rows.clear();
+			}
+		}
+	}
+}
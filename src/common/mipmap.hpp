@@ -0,0 +1,129 @@
+/**
+ * mipmap.hpp - Mipmap generation
+ */
+#pragma once
+
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "image.hpp"
+
+namespace imglib
+{
+
+	/**
+	 * Filter used to build each mip from the one above it
+	 */
+	enum class MipFilter {
+		Box,		// Average of each 2x2 texel block. Fastest, but a little blurry
+		Kaiser,		// Kaiser windowed sinc. Sharpest, may ring slightly around hard edges
+		CatmullRom, // Catmull-Rom cubic
+	};
+
+	/**
+	 * Parse a filter name, ie "box". Returns false if the name isn't recognized
+	 */
+	bool parse_mip_filter(const char* str, MipFilter& outFilter);
+
+	/**
+	 * Convert a row of w texels to linear RGBA floats. Single channel images are treated as grey, two channel ones as
+	 * grey and alpha
+	 * @param srgb If true, 8-bit color channels are linearized
+	 */
+	void to_linear_row(const void* src, ChannelType type, int channels, bool srgb, int w, float* out);
+
+	/**
+	 * Convert a row of w linear RGBA floats back to the given type, which must have 3 or 4 channels
+	 * @param srgb If true, 8-bit color channels are sRGB encoded
+	 */
+	void from_linear_row(const float* in, ChannelType type, int channels, bool srgb, int w, void* dst);
+
+	/**
+	 * Downsamples images of one size to another with a separable filter. The weights are computed once on
+	 * construction, so a single resampler can be shared by every frame and face of a mip level, and by every thread
+	 * working on them.
+	 * Output rows are split into bands, which may be filtered in any order and in parallel
+	 */
+	class MipResampler {
+	public:
+		/**
+		 * @param type Channel type of both images
+		 * @param channels Channel count of both images, 3 or 4
+		 * @param srgb If true, 8-bit color channels are linearized before filtering and encoded again afterwards.
+		 * Alpha is always filtered as is, and 16-bit and float images are expected to be linear already
+		 */
+		MipResampler(
+			ChannelType type, int channels, int srcW, int srcH, int dstW, int dstH, MipFilter filter, bool srgb);
+
+		int band_count() const;
+
+		/**
+		 * Filter a single band of output rows
+		 */
+		void resample_band(const void* src, void* dst, int band) const;
+
+		/**
+		 * Filter the whole image, spreading bands over the thread pool
+		 */
+		void resample(const void* src, void* dst) const;
+
+		/**
+		 * Range of source rows output row y is filtered from. Both ends only ever grow with y
+		 */
+		void source_rows(int y, int& first, int& last) const;
+
+		/**
+		 * Filter output rows [y0, y1) from source rows that are already linear RGBA floats, spreading them over the
+		 * thread pool
+		 * @param rows rows[i] is source row first + i, and must cover source_rows() of every output row
+		 * @param out out[y - y0] receives output row y
+		 */
+		void resample_rows(int y0, int y1, const float* const* rows, int first, float* const* out) const;
+
+	private:
+		// Source texels and weights of every output texel along one axis
+		struct Axis {
+			int taps = 0;
+			std::vector<int> index;		// [dst * taps + tap]
+			std::vector<float> weights; // [dst * taps + tap]
+		};
+
+		static Axis make_axis(int srcSize, int dstSize, MipFilter filter);
+
+		// Filter a single row, scratch holds m_srcW RGBA floats
+		void filter_row(int y, const float* const* rows, int first, float* out, float* scratch) const;
+
+		ChannelType m_type;
+		int m_channels;
+		int m_srcW, m_srcH;
+		int m_dstW, m_dstH;
+		bool m_srgb;
+		Axis m_x, m_y;
+	};
+
+	/**
+	 * Sizes of each stage of stream_mips
+	 */
+	using StageSizes = std::vector<std::pair<int, int>>;
+
+	/**
+	 * Fills source row y with linear RGBA floats. Called from the thread pool
+	 */
+	using StreamSourceFn = std::function<void(int y, float* out)>;
+
+	/**
+	 * Receives rows [y0, y0 + count) of a stage as linear RGBA floats
+	 */
+	using StreamSinkFn = std::function<void(int stage, int y0, int count, const float* const* rows)>;
+
+	/**
+	 * Push an image through a chain of resamplers a strip of rows at a time. Stage 0 is the source, each following
+	 * stage is resampled from the one before it. Every stage only holds on to the rows the next one still needs, so
+	 * memory use depends on the image width rather than its size.
+	 * Rows are handed to sink in order within a stage, in runs that start on a multiple of 4 rows and, except for
+	 * the last run of a stage, are a multiple of 4 rows long. This keeps block rows together for compression
+	 */
+	void stream_mips(const StageSizes& sizes, MipFilter filter, const StreamSourceFn& source, const StreamSinkFn& sink);
+
+} // namespace imglib
@@ -1,6 +1,7 @@
 
 #include "pack.hpp"
 #include "util.hpp"
+#include "kernels.hpp"
 
 using namespace pack;
 
@@ -23,7 +24,7 @@ void pack_channel(uint8_t* dstData, int destChannels, ChannelPack_t* channels, i
 	}
 	if constexpr (N > 3) {
 		chan3 = &channels[3];
-		chan3const = chan3->constant * 256.f;
+		chan3const = chan3->constant * 255.f;
 	}
 
 	// This is pretty awful for performance. Not a lot of data locality and a lot of branching.
@@ -55,8 +56,20 @@ pack::pack_image(int destChannels, ChannelPack_t* channels, int numChannels, int
 		return nullptr;
 	}
 
-	// Allocate image
-	std::shared_ptr<imglib::Image> result = std::make_shared<imglib::Image>(imglib::ChannelType::UInt8, destChannels, w, h, false);
+	// Allocate image. Cleared so channels that aren't packed into are always black
+	std::shared_ptr<imglib::Image> result = std::make_shared<imglib::Image>(imglib::ChannelType::UInt8, destChannels, w, h, true);
+
+	// Vectorized path does one channel at a time
+	if (auto* k = kernels::active()) {
+		for (int i = 0; i < numChannels; ++i) {
+			auto& chan = channels[i];
+			if (chan.srcData)
+				k->pack_copy(result->data<uint8_t>(), destChannels, chan.dstChan, chan.srcData, chan.comps, chan.srcChan, size_t(w) * h);
+			else
+				k->pack_fill(result->data<uint8_t>(), destChannels, chan.dstChan, uint8_t(chan.constant * 255.f), size_t(w) * h);
+		}
+		return result;
+	}
 
 	if (numChannels == 1)
 		pack_channel<1>(result->data<uint8_t>(), destChannels, channels, w, h);
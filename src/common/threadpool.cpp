@@ -0,0 +1,200 @@
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace util;
+
+// Pool and worker index of the calling thread, if it's a pool worker
+static thread_local ThreadPool* t_pool = nullptr;
+static thread_local int t_index = -1;
+
+ThreadPool::ThreadPool(int numThreads) {
+	if (numThreads <= 0)
+		numThreads = hardware_threads();
+
+	for (int i = 0; i < numThreads; ++i)
+		m_local.push_back(std::make_unique<Queue>());
+
+	for (int i = 0; i < numThreads; ++i)
+		m_threads.emplace_back(&ThreadPool::worker_main, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard lock(m_sleepMutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+
+	for (auto& thread : m_threads)
+		thread.join();
+}
+
+void ThreadPool::submit(Task task) {
+	++m_outstanding;
+	{
+		std::lock_guard lock(m_sleepMutex);
+		++m_queued;
+	}
+
+	// Workers keep their own tasks local, everyone else goes through the shared queue
+	Queue& queue = (t_pool == this) ? *m_local[t_index] : m_shared;
+	{
+		std::lock_guard lock(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+	m_wake.notify_one();
+}
+
+void ThreadPool::wait() {
+	assert(t_pool != this && "ThreadPool::wait called from one of its own workers");
+
+	std::unique_lock lock(m_sleepMutex);
+	m_done.wait(
+		lock,
+		[this]
+		{
+			return m_outstanding.load() == 0;
+		});
+}
+
+ThreadPool* ThreadPool::current() {
+	return t_pool;
+}
+
+ThreadPool& ThreadPool::global() {
+	static ThreadPool pool;
+	return pool;
+}
+
+int ThreadPool::hardware_threads() {
+	return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+bool ThreadPool::try_pop(int index, Task& task) {
+	// Newest task from our own deque
+	if (index >= 0) {
+		Queue& own = *m_local[index];
+		std::lock_guard lock(own.mutex);
+		if (!own.tasks.empty()) {
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			--m_queued;
+			return true;
+		}
+	}
+
+	// Oldest task from the shared queue
+	{
+		std::lock_guard lock(m_shared.mutex);
+		if (!m_shared.tasks.empty()) {
+			task = std::move(m_shared.tasks.front());
+			m_shared.tasks.pop_front();
+			--m_queued;
+			return true;
+		}
+	}
+
+	// Steal the oldest task from somebody else
+	const int count = static_cast<int>(m_local.size());
+	for (int i = 1; i <= count; ++i) {
+		const int victim = (index + i) % count;
+		if (victim == index)
+			continue;
+		Queue& other = *m_local[victim];
+		std::lock_guard lock(other.mutex);
+		if (!other.tasks.empty()) {
+			task = std::move(other.tasks.front());
+			other.tasks.pop_front();
+			--m_queued;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::run_task(Task& task) {
+	task();
+	task = nullptr;
+
+	if (--m_outstanding == 0) {
+		std::lock_guard lock(m_sleepMutex);
+		m_done.notify_all();
+	}
+}
+
+void ThreadPool::worker_main(int index) {
+	t_pool = this;
+	t_index = index;
+
+	Task task;
+	while (true) {
+		if (try_pop(index, task)) {
+			run_task(task);
+			continue;
+		}
+
+		std::unique_lock lock(m_sleepMutex);
+		if (m_stop && m_queued.load() == 0)
+			return;
+
+		// A task may be counted but not pushed yet, in which case we'll just spin around again
+		m_wake.wait(
+			lock,
+			[this]
+			{
+				return m_stop || m_queued.load() > 0;
+			});
+	}
+}
+
+void util::parallel_for(std::size_t count, const std::function<void(std::size_t)>& fn) {
+	ThreadPool* pool = ThreadPool::current();
+	const bool isWorker = !!pool;
+	if (!pool)
+		pool = &ThreadPool::global();
+
+	// Nothing to gain from splitting this up
+	const std::size_t others = isWorker ? pool->size() - 1 : pool->size();
+	if (count <= 1 || others == 0) {
+		for (std::size_t i = 0; i < count; ++i)
+			fn(i);
+		return;
+	}
+
+	struct State {
+		std::atomic<std::size_t> next{0};
+		std::atomic<std::size_t> done{0};
+		std::mutex mutex;
+		std::condition_variable cv;
+	};
+	auto state = std::make_shared<State>();
+
+	// Helpers that start after all indices have been claimed exit without touching fn
+	auto body = [state, count, &fn]()
+	{
+		for (std::size_t i; (i = state->next++) < count;) {
+			fn(i);
+			if (++state->done == count) {
+				std::lock_guard lock(state->mutex);
+				state->cv.notify_all();
+			}
+		}
+	};
+
+	const std::size_t helpers = std::min(others, count - 1);
+	for (std::size_t i = 0; i < helpers; ++i)
+		pool->submit(body);
+
+	body();
+
+	std::unique_lock lock(state->mutex);
+	state->cv.wait(
+		lock,
+		[&]
+		{
+			return state->done.load() == count;
+		});
+}
@@ -0,0 +1,103 @@
+/**
+ * threadpool.hpp - Small work-stealing thread pool
+ */
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+namespace util
+{
+
+	/**
+	 * Work-stealing thread pool
+	 *
+	 * Tasks submitted from outside of the pool are placed on a shared FIFO queue. Tasks submitted by
+	 * a worker are pushed onto that worker's own deque. When a worker runs out of work it first pops its
+	 * own deque (newest first), then the shared queue, and finally steals the oldest task from another worker.
+	 */
+	class ThreadPool {
+	public:
+		using Task = std::function<void()>;
+
+		/**
+		 * @param numThreads Number of worker threads to spawn. If <= 0, one thread per hardware thread is used
+		 */
+		explicit ThreadPool(int numThreads = -1);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		/**
+		 * Queue a task for execution
+		 */
+		void submit(Task task);
+
+		/**
+		 * Block until every submitted task has finished.
+		 * Must not be called from one of this pool's own workers, as the calling task counts as unfinished and it
+		 * would wait forever. Use parallel_for to wait on work from inside of a task.
+		 */
+		void wait();
+
+		/**
+		 * Number of worker threads in this pool
+		 */
+		int size() const {
+			return static_cast<int>(m_threads.size());
+		}
+
+		/**
+		 * Returns the pool that owns the calling thread, or nullptr if it's not a pool worker
+		 */
+		static ThreadPool* current();
+
+		/**
+		 * Process-wide pool with one worker per hardware thread. Created on first use
+		 */
+		static ThreadPool& global();
+
+		/**
+		 * Number of hardware threads, always >= 1
+		 */
+		static int hardware_threads();
+
+	private:
+		struct Queue {
+			std::mutex mutex;
+			std::deque<Task> tasks;
+		};
+
+		void worker_main(int index);
+		bool try_pop(int index, Task& task);
+		void run_task(Task& task);
+
+		std::vector<std::thread> m_threads;
+		std::vector<std::unique_ptr<Queue>> m_local; // One per worker
+		Queue m_shared;
+
+		std::atomic<size_t> m_queued{0};	  // Tasks sitting in a queue
+		std::atomic<size_t> m_outstanding{0}; // Tasks queued or running
+		bool m_stop = false;
+
+		std::mutex m_sleepMutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_done;
+	};
+
+	/**
+	 * Run fn(i) for every i in [0, count)
+	 * Work is spread over the pool owning the calling thread, or the global pool when called from outside of one.
+	 * The calling thread takes part in the work, so this may safely be nested inside of pool tasks.
+	 */
+	void parallel_for(std::size_t count, const std::function<void(std::size_t)>& fn);
+
+} // namespace util
@@ -0,0 +1,336 @@
+#include "uring.hpp"
+
+#if defined(VTEX2_HAVE_IO_URING)
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Every file is written by three linked requests. The step goes in the low bits of user_data, the file's slot in the
+// rest
+enum Step {
+	STEP_WRITE,
+	STEP_CLOSE,
+	STEP_RENAME,
+	STEP_COUNT
+};
+
+// Largest write we hand to the kernel in one go. Bigger files go through the slow path, see RingWriter::write
+static constexpr std::size_t MAX_WRITE = 1u << 30;
+
+namespace
+{
+	struct File {
+		std::string path;
+		std::string tmpPath;
+		const std::uint8_t* data = nullptr;
+		std::size_t size = 0;
+		std::uint64_t tag = 0;
+		int fd = -1;
+		int results[STEP_COUNT] = {};
+		int pending = 0;
+	};
+
+	// Write everything, however many calls it takes
+	bool write_all(int fd, const std::uint8_t* data, std::size_t size, off_t offset) {
+		while (size > 0) {
+			const auto written = pwrite(fd, data, size, offset);
+			if (written < 0 && errno == EINTR)
+				continue;
+			if (written <= 0)
+				return false;
+			data += written;
+			size -= written;
+			offset += written;
+		}
+		return true;
+	}
+} // namespace
+
+struct util::RingWriter::Ring {
+	int fd = -1;
+	void* sqRing = MAP_FAILED;
+	void* cqRing = MAP_FAILED;
+	std::size_t sqRingSize = 0;
+	std::size_t cqRingSize = 0;
+	io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+	std::size_t sqesSize = 0;
+
+	unsigned* sqHead = nullptr;
+	unsigned* sqTail = nullptr;
+	unsigned* sqArray = nullptr;
+	unsigned sqMask = 0;
+	unsigned sqEntries = 0;
+	unsigned sqeTail = 0; // Requests prepared but not published to the kernel yet end here
+	unsigned toSubmit = 0;
+
+	unsigned* cqHead = nullptr;
+	unsigned* cqTail = nullptr;
+	unsigned cqMask = 0;
+	io_uring_cqe* cqes = nullptr;
+
+	std::vector<File> files;
+	std::vector<std::size_t> freeSlots;
+
+	~Ring() {
+		if (sqes != MAP_FAILED)
+			munmap(sqes, sqesSize);
+		if (cqRing != MAP_FAILED && cqRing != sqRing)
+			munmap(cqRing, cqRingSize);
+		if (sqRing != MAP_FAILED)
+			munmap(sqRing, sqRingSize);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	bool setup(unsigned entries) {
+		io_uring_params params;
+		std::memset(&params, 0, sizeof(params));
+		fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+		if (fd < 0)
+			return false;
+
+		// Kernels since 5.4 map both rings at once
+		sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (singleMmap)
+			sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+		sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (sqRing == MAP_FAILED)
+			return false;
+		cqRing = singleMmap ? sqRing
+							: mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+								   IORING_OFF_CQ_RING);
+		if (cqRing == MAP_FAILED)
+			return false;
+
+		sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		sqes = static_cast<io_uring_sqe*>(
+			mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+		if (sqes == MAP_FAILED)
+			return false;
+
+		auto* sq = static_cast<std::uint8_t*>(sqRing);
+		sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+		sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+		sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		sqEntries = params.sq_entries;
+		sqeTail = *sqTail;
+
+		auto* cq = static_cast<std::uint8_t*>(cqRing);
+		cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+		return true;
+	}
+
+	// Whether the kernel knows every request a file needs. Renames were the last to be added, in 5.11
+	bool supported() const {
+		std::vector<std::uint8_t> buffer(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+		auto* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+		if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+			return false;
+
+		for (int op : {IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_RENAMEAT}) {
+			if (op >= probe->ops_len || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+				return false;
+		}
+		return true;
+	}
+
+	io_uring_sqe* next_sqe(std::size_t slot, Step step) {
+		if (sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+			return nullptr;
+
+		const unsigned index = sqeTail++ & sqMask;
+		auto* sqe = &sqes[index];
+		std::memset(sqe, 0, sizeof(*sqe));
+		sqe->user_data = (std::uint64_t(slot) << 2) | step;
+		sqArray[index] = index;
+		++toSubmit;
+		return sqe;
+	}
+
+	// Publish everything prepared so far, and wait for minComplete completions
+	void enter(unsigned minComplete) {
+		__atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+		while (true) {
+			const auto submitted = syscall(
+				__NR_io_uring_enter, fd, toSubmit, minComplete, minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+			if (submitted < 0 && errno == EINTR)
+				continue;
+			// Anything not taken stays queued for the next call
+			if (submitted > 0)
+				toSubmit -= static_cast<unsigned>(submitted);
+			return;
+		}
+	}
+
+	// Sort out a file once all of its requests completed
+	bool finish(File& file) {
+		bool ok;
+		if (file.results[STEP_WRITE] >= 0 && std::size_t(file.results[STEP_WRITE]) < file.size) {
+			// A short write ends the chain early, the rest of the file is written the slow way
+			const bool renamed = file.results[STEP_RENAME] == 0;
+			const int fd = file.results[STEP_CLOSE] == -ECANCELED
+							   ? file.fd
+							   : open((renamed ? file.path : file.tmpPath).c_str(), O_WRONLY | O_CLOEXEC);
+			const auto offset = file.results[STEP_WRITE];
+			ok = fd >= 0 && write_all(fd, file.data + offset, file.size - offset, offset);
+			if (fd >= 0)
+				ok = close(fd) == 0 && ok;
+			ok = ok && (renamed || rename(file.tmpPath.c_str(), file.path.c_str()) == 0);
+		}
+		else {
+			ok = file.results[STEP_WRITE] >= 0 && file.results[STEP_CLOSE] == 0 && file.results[STEP_RENAME] == 0;
+			if (file.results[STEP_CLOSE] == -ECANCELED)
+				close(file.fd);
+		}
+
+		if (!ok)
+			unlink(file.tmpPath.c_str());
+		return ok;
+	}
+};
+
+util::RingWriter::RingWriter() = default;
+
+util::RingWriter::~RingWriter() {
+	// Files still in flight are written from buffers that may be gone once we return
+	if (m_ring) {
+		while (in_flight() > 0)
+			wait([](std::uint64_t, bool) {});
+	}
+}
+
+bool util::RingWriter::init(unsigned files) {
+	auto ring = std::make_unique<Ring>();
+	if (!files || !ring->setup(files * STEP_COUNT) || !ring->supported())
+		return false;
+
+	ring->files.resize(files);
+	for (std::size_t i = files; i > 0; --i)
+		ring->freeSlots.push_back(i - 1);
+	m_ring = std::move(ring);
+	return true;
+}
+
+bool util::RingWriter::write(const std::string& path, const std::uint8_t* data, std::size_t size, std::uint64_t tag) {
+	if (!m_ring || m_ring->freeSlots.empty() || size > MAX_WRITE)
+		return false;
+
+	const auto slot = m_ring->freeSlots.back();
+	auto& file = m_ring->files[slot];
+	file.path = path;
+	file.tmpPath = path + ".tmp";
+	file.data = data;
+	file.size = size;
+	file.tag = tag;
+
+	// Opening stays synchronous, it's the only request here that needs its result before the others can be sent
+	file.fd = open(file.tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (file.fd < 0)
+		return false;
+	m_ring->freeSlots.pop_back();
+
+	// There are always enough entries for every file in flight, see init
+	auto* writeSqe = m_ring->next_sqe(slot, STEP_WRITE);
+	writeSqe->opcode = IORING_OP_WRITE;
+	writeSqe->fd = file.fd;
+	writeSqe->addr = reinterpret_cast<std::uint64_t>(data);
+	writeSqe->len = static_cast<std::uint32_t>(size);
+	writeSqe->off = 0;
+	writeSqe->flags = IOSQE_IO_LINK;
+
+	auto* closeSqe = m_ring->next_sqe(slot, STEP_CLOSE);
+	closeSqe->opcode = IORING_OP_CLOSE;
+	closeSqe->fd = file.fd;
+	closeSqe->flags = IOSQE_IO_LINK;
+
+	auto* renameSqe = m_ring->next_sqe(slot, STEP_RENAME);
+	renameSqe->opcode = IORING_OP_RENAMEAT;
+	renameSqe->fd = AT_FDCWD;
+	renameSqe->addr = reinterpret_cast<std::uint64_t>(file.tmpPath.c_str());
+	renameSqe->len = static_cast<std::uint32_t>(AT_FDCWD);
+	renameSqe->addr2 = reinterpret_cast<std::uint64_t>(file.path.c_str());
+
+	file.pending = STEP_COUNT;
+	return true;
+}
+
+void util::RingWriter::wait(const Callback& done) {
+	if (!m_ring)
+		return;
+
+	auto& ring = *m_ring;
+	bool finished = false;
+	while (!finished && in_flight() > 0) {
+		ring.enter(1);
+
+		unsigned head = *ring.cqHead;
+		const unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			const auto& cqe = ring.cqes[head & ring.cqMask];
+			const auto slot = static_cast<std::size_t>(cqe.user_data >> 2);
+			auto& file = ring.files[slot];
+			file.results[cqe.user_data & 3] = cqe.res;
+			if (--file.pending > 0)
+				continue;
+
+			const bool ok = ring.finish(file);
+			ring.freeSlots.push_back(slot);
+			done(file.tag, ok);
+			finished = true;
+		}
+		__atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+	}
+}
+
+std::size_t util::RingWriter::in_flight() const {
+	return m_ring ? m_ring->files.size() - m_ring->freeSlots.size() : 0;
+}
+
+std::size_t util::RingWriter::capacity() const {
+	return m_ring ? m_ring->files.size() : 0;
+}
+
+#else
+
+struct util::RingWriter::Ring {};
+
+util::RingWriter::RingWriter() = default;
+
+util::RingWriter::~RingWriter() = default;
+
+bool util::RingWriter::init(unsigned) {
+	return false;
+}
+
+bool util::RingWriter::write(const std::string&, const std::uint8_t*, std::size_t, std::uint64_t) {
+	return false;
+}
+
+void util::RingWriter::wait(const Callback&) {
+}
+
+std::size_t util::RingWriter::in_flight() const {
+	return 0;
+}
+
+std::size_t util::RingWriter::capacity() const {
+	return 0;
+}
+
+#endif
@@ -0,0 +1,67 @@
+/**
+ * uring.hpp - Whole file writes through io_uring
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace util
+{
+
+	/**
+	 * Writes whole files through io_uring. Each file is opened under a temp name, then written, closed and renamed
+	 * over its destination by a single chain of linked requests, and the chains of many files go to the kernel in one
+	 * system call. Needs Linux 5.11 or later, init fails anywhere else. Not thread safe
+	 */
+	class RingWriter {
+	public:
+		/**
+		 * Called once a file is done, with the tag it was queued with and whether it was written
+		 */
+		using Callback = std::function<void(std::uint64_t tag, bool ok)>;
+
+		RingWriter();
+		~RingWriter();
+
+		RingWriter(const RingWriter&) = delete;
+		RingWriter& operator=(const RingWriter&) = delete;
+
+		/**
+		 * Set up the ring. Fails if io_uring is unavailable or doesn't support every request we need
+		 * @param files Number of files that can be in flight at once
+		 */
+		bool init(unsigned files);
+
+		/**
+		 * Queue a file to be written. The data must stay alive until its callback ran. Nothing is sent to the kernel
+		 * until the next call to wait
+		 * @returns false if the temp file couldn't be created, or there are too many files in flight already
+		 */
+		bool write(const std::string& path, const std::uint8_t* data, std::size_t size, std::uint64_t tag);
+
+		/**
+		 * Submit everything queued, then wait until at least one file is done, calling done for every file that
+		 * finished
+		 */
+		void wait(const Callback& done);
+
+		/**
+		 * Number of files queued or being written
+		 */
+		std::size_t in_flight() const;
+
+		/**
+		 * Maximum number of files in flight, as passed to init
+		 */
+		std::size_t capacity() const;
+
+	private:
+		struct Ring;
+		std::unique_ptr<Ring> m_ring;
+	};
+
+} // namespace util
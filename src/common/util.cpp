@@ -2,6 +2,24 @@
 
 #include "util.hpp"
 
+#include <filesystem>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace util
 {
 	const char* get_last_vtflib_error() {
@@ -13,4 +31,109 @@ namespace util
 
 		return "Unknown error";
 	}
+
+	MappedFile::~MappedFile() {
+		close();
+	}
+
+	bool MappedFile::open(const std::string& path) {
+		close();
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(
+			path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+			m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (m_mapping) {
+				m_data = static_cast<const std::uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+				if (m_data) {
+					m_size = static_cast<std::size_t>(size.QuadPart);
+					m_mapped = true;
+				}
+				else {
+					CloseHandle(m_mapping);
+					m_mapping = nullptr;
+				}
+			}
+		}
+		CloseHandle(file);
+#else
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+			void* data = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data != MAP_FAILED) {
+				// Everything we map gets parsed front to back
+				madvise(data, static_cast<std::size_t>(st.st_size), MADV_SEQUENTIAL);
+				m_data = static_cast<const std::uint8_t*>(data);
+				m_size = static_cast<std::size_t>(st.st_size);
+				m_mapped = true;
+			}
+		}
+		::close(fd);
+#endif
+
+		if (m_mapped)
+			return true;
+
+		// Pipes and the like have no size up front, so read until we run out
+		std::ifstream stream(path, std::ios::in | std::ios::binary);
+		if (!stream.good())
+			return false;
+
+		std::vector<char> contents((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+		if (stream.bad())
+			return false;
+
+		m_size = contents.size();
+		m_buffer = std::make_unique<std::uint8_t[]>(m_size);
+		std::memcpy(m_buffer.get(), contents.data(), m_size);
+		m_data = m_buffer.get();
+		return true;
+	}
+
+	bool write_file(const std::string& path, const void* data, std::size_t size) {
+		const auto tmpPath = path + ".tmp";
+
+		std::error_code ec;
+		{
+			std::ofstream stream(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+			stream.write(static_cast<const char*>(data), size);
+			stream.close();
+			if (!stream.good()) {
+				std::filesystem::remove(tmpPath, ec);
+				return false;
+			}
+		}
+
+		std::filesystem::rename(tmpPath, path, ec);
+		if (ec) {
+			std::filesystem::remove(tmpPath, ec);
+			return false;
+		}
+		return true;
+	}
+
+	void MappedFile::close() {
+		if (m_mapped) {
+#ifdef _WIN32
+			UnmapViewOfFile(m_data);
+			CloseHandle(m_mapping);
+			m_mapping = nullptr;
+#else
+			munmap(const_cast<std::uint8_t*>(m_data), m_size);
+#endif
+		}
+		m_buffer.reset();
+		m_data = nullptr;
+		m_size = 0;
+		m_mapped = false;
+	}
 } // namespace util
@@ -17,26 +17,56 @@ namespace util
 {
 
 	/**
-	 * Helper to quickly read a file off disk
+	 * Read-only view of a whole file. Regular files are memory mapped, so nothing is copied until the pages are
+	 * touched. Anything that can't be mapped, like a pipe, is read into memory instead
 	 */
-	static std::size_t read_file(const std::string& path, std::uint8_t*& outPtr) {
-		std::ifstream stream(path, std::ios::in | std::ios::binary);
-		outPtr = nullptr;
-		if (!stream.good())
-			return 0;
+	class MappedFile {
+	public:
+		MappedFile() = default;
+		~MappedFile();
 
-		stream.seekg(0, std::ios::end);
-		auto size = stream.tellg();
-		stream.seekg(0, std::ios::beg);
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
 
-		if (!size)
-			return 0;
+		/**
+		 * Open a file, closing any file that was open before
+		 * @returns false if the file couldn't be opened or read
+		 */
+		bool open(const std::string& path);
 
-		outPtr = new std::uint8_t[size];
-		stream.read((char*)outPtr, size);
+		void close();
 
-		return size;
-	}
+		const std::uint8_t* data() const {
+			return m_data;
+		}
+
+		std::size_t size() const {
+			return m_size;
+		}
+
+		/**
+		 * True if the data is mapped rather than read into memory
+		 */
+		bool mapped() const {
+			return m_mapped;
+		}
+
+	private:
+		const std::uint8_t* m_data = nullptr;
+		std::size_t m_size = 0;
+		bool m_mapped = false;
+		std::unique_ptr<std::uint8_t[]> m_buffer; // Only set if the file was read instead
+#ifdef _WIN32
+		void* m_mapping = nullptr;
+#endif
+	};
+
+	/**
+	 * Write a whole file under a temp name next to it, then move it over path, so an interrupted or failed write can't
+	 * leave a truncated file behind. The temp file is removed if anything fails
+	 * @returns false if the file couldn't be written or moved into place
+	 */
+	bool write_file(const std::string& path, const void* data, std::size_t size);
 
 	static inline bool strtoint(const std::string& str, int& out) {
 		auto [p, err] = std::from_chars(str.c_str(), str.c_str() + str.length(), out);
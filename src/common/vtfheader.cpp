@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+
+#include "vtfheader.hpp"
+
+using namespace VTFLib;
+
+// Layout of the on-disk header, see VTFFormat.h in VTFLib. Everything is little endian and tightly packed, so it's
+// read field by field rather than through a struct
+namespace offsets
+{
+	static constexpr int signature = 0;
+	static constexpr int version = 4;
+	static constexpr int headerSize = 12;
+	static constexpr int width = 16;
+	static constexpr int height = 18;
+	static constexpr int flags = 20;
+	static constexpr int frames = 24;
+	static constexpr int startFrame = 26;
+	static constexpr int reflectivity = 32;
+	static constexpr int bumpScale = 48;
+	static constexpr int format = 52;
+	static constexpr int mipCount = 56;
+	static constexpr int thumbnailFormat = 57;
+	static constexpr int thumbnailWidth = 61;
+	static constexpr int thumbnailHeight = 62;
+	static constexpr int depth = 63;	 // 7.2+
+	static constexpr int resourceCount = 68; // 7.3+
+	static constexpr int resources = 80;	 // 7.3+
+} // namespace offsets
+
+static constexpr int MIN_HEADER_SIZE = 64; // 7.0 and 7.1
+static constexpr std::uint32_t MAX_MINOR_VERSION = 6;
+static constexpr std::uint32_t MAX_RESOURCES = 32;
+static constexpr std::uint8_t RSRCF_HAS_NO_DATA_CHUNK = 0x02;
+
+template <typename T>
+static T read_field(const std::uint8_t* header, int offset) {
+	T v;
+	std::memcpy(&v, header + offset, sizeof(T));
+	return v;
+}
+
+std::uint32_t vtf::Header::image_size() const {
+	return CVTFFile::ComputeImageSize(width, height, depth, mipCount, format) * frameCount * faceCount;
+}
+
+const vtf::Header::Resource* vtf::Header::find_resource(std::uint32_t type) const {
+	for (auto& resource : resources)
+		if (resource.type == type)
+			return &resource;
+	return nullptr;
+}
+
+// Reads size bytes at offset into dst, returns false past the end of the file or on error
+using ReadFn = std::function<bool(std::uint64_t offset, void* dst, std::size_t size)>;
+
+//
+// Parse a header from anywhere bytes can be read from. Only the header, the resource dictionary and the start of
+// each resource's data chunk are read
+//
+static bool parse_header(const ReadFn& read, std::uint64_t fileSize, vtf::Header& outHeader, std::string& outError) {
+	using vtf::Header;
+
+	std::uint8_t header[offsets::resources] = {};
+	if (fileSize < MIN_HEADER_SIZE || !read(0, header, std::min<std::uint64_t>(fileSize, sizeof(header))) ||
+		std::memcmp(header + offsets::signature, "VTF\0", 4) != 0) {
+		outError = "File is not a VTF";
+		return false;
+	}
+
+	Header h;
+	h.fileSize = fileSize;
+	h.majorVersion = read_field<std::uint32_t>(header, offsets::version);
+	h.minorVersion = read_field<std::uint32_t>(header, offsets::version + 4);
+	if (h.majorVersion != 7 || h.minorVersion > MAX_MINOR_VERSION) {
+		outError = "Unsupported VTF version " + std::to_string(h.majorVersion) + "." + std::to_string(h.minorVersion);
+		return false;
+	}
+
+	const std::uint32_t needed = h.minorVersion >= 3 ? offsets::resources : h.minorVersion >= 2 ? 65 : MIN_HEADER_SIZE;
+	h.headerSize = read_field<std::uint32_t>(header, offsets::headerSize);
+	if (h.headerSize < needed || fileSize < needed) {
+		outError = "Truncated VTF header";
+		return false;
+	}
+
+	h.width = read_field<std::uint16_t>(header, offsets::width);
+	h.height = read_field<std::uint16_t>(header, offsets::height);
+	h.flags = read_field<std::uint32_t>(header, offsets::flags);
+	h.frameCount = read_field<std::uint16_t>(header, offsets::frames);
+	h.startFrame = read_field<std::uint16_t>(header, offsets::startFrame);
+	for (int i = 0; i < 3; ++i)
+		h.reflectivity[i] = read_field<float>(header, offsets::reflectivity + i * 4);
+	h.bumpScale = read_field<float>(header, offsets::bumpScale);
+	h.format = static_cast<VTFImageFormat>(read_field<std::int32_t>(header, offsets::format));
+	h.mipCount = header[offsets::mipCount];
+	h.thumbnailFormat = static_cast<VTFImageFormat>(read_field<std::int32_t>(header, offsets::thumbnailFormat));
+	h.thumbnailWidth = header[offsets::thumbnailWidth];
+	h.thumbnailHeight = header[offsets::thumbnailHeight];
+	if (h.minorVersion >= 2)
+		h.depth = read_field<std::uint16_t>(header, offsets::depth);
+
+	if (h.format < 0 || h.format >= IMAGE_FORMAT_COUNT || h.thumbnailFormat < IMAGE_FORMAT_NONE ||
+		h.thumbnailFormat >= IMAGE_FORMAT_COUNT) {
+		outError = "Invalid image format";
+		return false;
+	}
+
+	// Sphere maps were dropped in 7.5, but older files still store them unless the start frame is -1
+	if (h.flags & TEXTUREFLAGS_ENVMAP)
+		h.faceCount = (h.startFrame != 0xFFFF && h.minorVersion < 5) ? 7 : 6;
+
+	if (h.minorVersion >= 3) {
+		const auto count = read_field<std::uint32_t>(header, offsets::resourceCount);
+		if (count > MAX_RESOURCES || offsets::resources + count * 8ull > fileSize) {
+			outError = "Invalid resource dictionary";
+			return false;
+		}
+
+		h.resources.resize(count);
+		for (std::uint32_t i = 0; i < count; ++i) {
+			auto& resource = h.resources[i];
+			std::uint8_t entry[8];
+			if (!read(offsets::resources + i * 8ull, entry, sizeof(entry))) {
+				outError = "Could not read file";
+				return false;
+			}
+			resource.type = read_field<std::uint32_t>(entry, 0); // Includes the flags, like VTFLib's resource IDs
+			resource.flags = entry[3];
+			resource.data = read_field<std::uint32_t>(entry, 4);
+			resource.size = sizeof(std::uint32_t);
+		}
+
+		for (auto& resource : h.resources) {
+			if (resource.type == VTF_LEGACY_RSRC_LOW_RES_IMAGE) {
+				resource.size = 0;
+				if (h.thumbnailFormat != IMAGE_FORMAT_NONE)
+					resource.size =
+						CVTFFile::ComputeImageSize(h.thumbnailWidth, h.thumbnailHeight, 1, h.thumbnailFormat);
+				continue;
+			}
+			if (resource.type == VTF_LEGACY_RSRC_IMAGE) {
+				resource.size = h.image_size();
+				continue;
+			}
+			if (resource.flags & RSRCF_HAS_NO_DATA_CHUNK)
+				continue;
+
+			// Data chunks start with their size. The aux compression info follows it with the compression level
+			std::uint8_t chunk[8] = {};
+			const auto chunkSize = resource.type == VTF_RSRC_AUX_COMPRESSION_INFO ? 8 : 4;
+			if (resource.data + std::uint64_t(chunkSize) > fileSize) {
+				outError = "Resource " + std::to_string(resource.type) + " is past the end of the file";
+				return false;
+			}
+			if (!read(resource.data, chunk, chunkSize)) {
+				outError = "Could not read file";
+				return false;
+			}
+			resource.size = read_field<std::uint32_t>(chunk, 0);
+			if (resource.type == VTF_RSRC_AUX_COMPRESSION_INFO && h.minorVersion >= 6 && resource.size >= 4)
+				h.auxCompressionLevel = read_field<std::int32_t>(chunk, 4);
+		}
+	}
+
+	outHeader = std::move(h);
+	return true;
+}
+
+bool vtf::read_header(const std::string& path, Header& outHeader, std::string& outError) {
+	std::ifstream stream(path, std::ios::in | std::ios::binary);
+	if (!stream.good()) {
+		outError = "Could not open file";
+		return false;
+	}
+
+	stream.seekg(0, std::ios::end);
+	const auto fileSize = static_cast<std::uint64_t>(stream.tellg());
+
+	return parse_header(
+		[&](std::uint64_t offset, void* dst, std::size_t size)
+		{
+			stream.seekg(offset);
+			stream.read(static_cast<char*>(dst), size);
+			return stream.good();
+		},
+		fileSize, outHeader, outError);
+}
+
+bool vtf::read_header(const void* data, std::size_t size, Header& outHeader, std::string& outError) {
+	return parse_header(
+		[&](std::uint64_t offset, void* dst, std::size_t count)
+		{
+			if (offset + count > size)
+				return false;
+			std::memcpy(dst, static_cast<const std::uint8_t*>(data) + offset, count);
+			return true;
+		},
+		size, outHeader, outError);
+}
+
+template <typename T>
+static void write_field(std::fstream& stream, int offset, T v) {
+	stream.seekp(offset);
+	stream.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+bool vtf::write_header(const std::string& path, const Header& header, std::string& outError) {
+	std::fstream stream(path, std::ios::in | std::ios::out | std::ios::binary);
+	if (!stream.good()) {
+		outError = "Could not open file";
+		return false;
+	}
+
+	// Make sure this is still the file the header came from, at least as far as the layout goes
+	std::uint8_t current[offsets::reflectivity] = {};
+	stream.read(reinterpret_cast<char*>(current), sizeof(current));
+	if (!stream.good() || std::memcmp(current + offsets::signature, "VTF\0", 4) != 0 ||
+		read_field<std::uint32_t>(current, offsets::version + 4) != header.minorVersion) {
+		outError = "File is not the VTF the header was read from";
+		return false;
+	}
+	// Either of these would change the face count
+	const auto flags = read_field<std::uint32_t>(current, offsets::flags);
+	if ((flags ^ header.flags) & TEXTUREFLAGS_ENVMAP) {
+		outError = "Can't change the environment map flag without rebuilding the file";
+		return false;
+	}
+	const bool sphereMap = read_field<std::uint16_t>(current, offsets::startFrame) != 0xFFFF;
+	if ((flags & TEXTUREFLAGS_ENVMAP) && header.minorVersion < 5 && sphereMap != (header.startFrame != 0xFFFF)) {
+		outError = "Can't add or remove the sphere map of an environment map without rebuilding the file";
+		return false;
+	}
+
+	write_field<std::uint32_t>(stream, offsets::flags, header.flags);
+	write_field<std::uint16_t>(stream, offsets::startFrame, static_cast<std::uint16_t>(header.startFrame));
+	for (int i = 0; i < 3; ++i)
+		write_field<float>(stream, offsets::reflectivity + i * 4, header.reflectivity[i]);
+	write_field<float>(stream, offsets::bumpScale, header.bumpScale);
+
+	if (!stream.flush()) {
+		outError = "Could not write file";
+		return false;
+	}
+	return true;
+}
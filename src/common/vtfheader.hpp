@@ -0,0 +1,83 @@
+/**
+ * vtfheader.hpp - Reads VTF headers without loading any image data
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "VTFLib.h"
+
+namespace vtf
+{
+
+	/**
+	 * Everything stored in a VTF's header and resource dictionary. Values match what CVTFFile reports for the same
+	 * file once fully loaded
+	 */
+	struct Header {
+		struct Resource {
+			std::uint32_t type;	 // ie VTF_RSRC_CRC, flags in the top byte
+			std::uint8_t flags;
+			std::uint32_t data;	 // Offset of the resource's data, or the data itself if it has no data chunk
+			std::uint32_t size;	 // Size in bytes, as reported by CVTFFile::GetResourceData
+		};
+
+		std::uint32_t majorVersion = 0;
+		std::uint32_t minorVersion = 0;
+		std::uint32_t headerSize = 0;
+		std::uint32_t width = 0;
+		std::uint32_t height = 0;
+		std::uint32_t depth = 1;
+		std::uint32_t flags = 0;
+		std::uint32_t frameCount = 0;
+		std::uint32_t startFrame = 0;
+		std::uint32_t faceCount = 1;
+		std::uint32_t mipCount = 0;
+		float reflectivity[3] = {};
+		float bumpScale = 0;
+		VTFImageFormat format = IMAGE_FORMAT_NONE;
+		VTFImageFormat thumbnailFormat = IMAGE_FORMAT_NONE;
+		std::uint32_t thumbnailWidth = 0;
+		std::uint32_t thumbnailHeight = 0;
+		int auxCompressionLevel = 0; // 7.6 only, 0 if the image data isn't compressed
+		std::uint64_t fileSize = 0;
+		std::vector<Resource> resources; // 7.3 and later only
+
+		/**
+		 * Size of the uncompressed image data, as reported by CVTFFile::GetSize
+		 */
+		std::uint32_t image_size() const;
+
+		/**
+		 * @returns nullptr if there's no resource of this type
+		 */
+		const Resource* find_resource(std::uint32_t type) const;
+	};
+
+	/**
+	 * Read the header and resource dictionary of a VTF. Only the first few hundred bytes of the file are read, plus
+	 * the size and aux compression info of each resource
+	 * @param outError Set to a description of the problem if the file couldn't be read or isn't a valid VTF
+	 * @returns true if the header was read
+	 */
+	bool read_header(const std::string& path, Header& outHeader, std::string& outError);
+
+	/**
+	 * Read the header and resource dictionary of a VTF that's already in memory, see above
+	 */
+	bool read_header(const void* data, std::size_t size, Header& outHeader, std::string& outError);
+
+	/**
+	 * Patch the header of an existing VTF in place. Only fields stored at a fixed offset that don't affect the layout
+	 * of the rest of the file are written: flags, start frame, reflectivity and bump scale. Everything else in header
+	 * is ignored. Toggling TEXTUREFLAGS_ENVMAP changes the face count, so it's refused
+	 * @param header Header as returned by read_header for the same file, with the fields above changed
+	 * @param outError Set to a description of the problem if the file couldn't be written
+	 * @returns true if the header was written
+	 */
+	bool write_header(const std::string& path, const Header& header, std::string& outError);
+
+} // namespace vtf
@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "vtfio.hpp"
+#include "deflate.hpp"
+#include "threadpool.hpp"
+#include "vtfheader.hpp"
+
+#include "VTFLib.h"
+
+using namespace VTFLib;
+
+static constexpr std::uint8_t RSRCF_HAS_NO_DATA_CHUNK = 0x02;
+static constexpr std::uint32_t RESOURCE_DICTIONARY = 80;
+
+//
+// A single DEFLATE stream of a 7.6 file, which holds every slice of one mip of one face of one frame. Streams are
+// stored smallest mip first, like uncompressed image data, and their compressed sizes are listed in the aux
+// compression info resource after the compression level
+//
+struct Subresource {
+	std::size_t offset; // Uncompressed
+	std::size_t size;	// Uncompressed
+	std::uint32_t auxIndex;
+};
+
+static std::vector<Subresource> subresources(const vtf::Header& header) {
+	std::vector<Subresource> subs;
+	std::size_t offset = 0;
+	for (int mip = int(header.mipCount) - 1; mip >= 0; --mip) {
+		const std::size_t size =
+			CVTFFile::ComputeMipmapSize(header.width, header.height, header.depth, mip, header.format);
+		for (std::uint32_t frame = 0; frame < header.frameCount; ++frame) {
+			for (std::uint32_t face = 0; face < header.faceCount; ++face) {
+				subs.push_back({offset, size, (mip * header.frameCount + frame) * header.faceCount + face});
+				offset += size;
+			}
+		}
+	}
+	return subs;
+}
+
+//
+// Whether the image data is deflated in a way we know how to handle. Levels outside of what zlib accepts may mean
+// another compression method, those are left to VTFLib
+//
+static bool is_deflated(const vtf::Header& header) {
+	if (header.majorVersion != 7 || header.minorVersion < 6 || header.auxCompressionLevel == 0 ||
+		header.auxCompressionLevel < -1 || header.auxCompressionLevel > 9)
+		return false;
+
+	const auto* axc = header.find_resource(VTF_RSRC_AUX_COMPRESSION_INFO);
+	const std::size_t count = std::size_t(header.mipCount) * header.frameCount * header.faceCount;
+	return axc && header.find_resource(VTF_LEGACY_RSRC_IMAGE) && axc->size == 4 + 4 * count;
+}
+
+//
+// Copy a 7.3+ file, swapping out the image data and aux compression info chunks. The other resources keep their
+// order and are moved along with them. If there's no aux compression info yet and auxInfo isn't empty, it's added to
+// the dictionary in front of the image data. auxInfo includes the size at the start of the chunk
+//
+static bool rebuild(
+	const std::uint8_t* data, std::size_t size, const vtf::Header& header, const std::vector<std::uint8_t>& image,
+	const std::vector<std::uint8_t>& auxInfo, std::vector<std::uint8_t>& out) {
+	if (header.headerSize < RESOURCE_DICTIONARY + header.resources.size() * 8 || header.headerSize > size)
+		return false;
+
+	// Dictionary entries as they are in the file, with the offsets patched below
+	auto resources = header.resources;
+	std::vector<std::array<std::uint32_t, 2>> entries(resources.size());
+	std::memcpy(entries.data(), data + RESOURCE_DICTIONARY, entries.size() * 8);
+
+	if (!header.find_resource(VTF_RSRC_AUX_COMPRESSION_INFO) && !auxInfo.empty()) {
+		const auto image = std::find_if(
+			resources.begin(), resources.end(), [](const auto& r) { return r.type == VTF_LEGACY_RSRC_IMAGE; });
+		if (image == resources.end())
+			return false;
+		const auto at = std::size_t(image - resources.begin());
+		resources.insert(image, {VTF_RSRC_AUX_COMPRESSION_INFO, 0, image->data, 0});
+		entries.insert(entries.begin() + at, {VTF_RSRC_AUX_COMPRESSION_INFO, 0});
+	}
+
+	// Anything between the dictionary and the first chunk is kept as is
+	const auto grownBy = static_cast<std::uint32_t>((resources.size() - header.resources.size()) * 8);
+	const auto headerSize = header.headerSize + grownBy;
+	const auto resourceCount = static_cast<std::uint32_t>(resources.size());
+	out.assign(data, data + RESOURCE_DICTIONARY);
+	out.resize(RESOURCE_DICTIONARY + entries.size() * 8);
+	out.insert(out.end(), data + RESOURCE_DICTIONARY + header.resources.size() * 8, data + header.headerSize);
+	std::memcpy(out.data() + 12, &headerSize, sizeof(headerSize));
+	std::memcpy(out.data() + 68, &resourceCount, sizeof(resourceCount));
+
+	// Chunks are written in the order they were in before
+	std::vector<std::size_t> order(resources.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(
+		order.begin(), order.end(),
+		[&](std::size_t a, std::size_t b) { return resources[a].data < resources[b].data; });
+
+	for (auto i : order) {
+		const auto& resource = resources[i];
+		if (!(resource.flags & RSRCF_HAS_NO_DATA_CHUNK)) {
+			entries[i][1] = static_cast<std::uint32_t>(out.size());
+
+			if (resource.type == VTF_LEGACY_RSRC_IMAGE)
+				out.insert(out.end(), image.begin(), image.end());
+			else if (resource.type == VTF_RSRC_AUX_COMPRESSION_INFO)
+				out.insert(out.end(), auxInfo.begin(), auxInfo.end());
+			else {
+				// Only the thumbnail is stored without its size in front
+				const std::size_t length = resource.size + (resource.type == VTF_LEGACY_RSRC_LOW_RES_IMAGE ? 0 : 4);
+				if (std::size_t(resource.data) + length > size)
+					return false;
+				out.insert(out.end(), data + resource.data, data + resource.data + length);
+			}
+		}
+	}
+	std::memcpy(out.data() + RESOURCE_DICTIONARY, entries.data(), entries.size() * 8);
+	return true;
+}
+
+//
+// Aux compression info chunk, with the size of the chunk in front
+//
+static std::vector<std::uint8_t> aux_info(int level, const std::vector<std::uint32_t>& sizes) {
+	std::vector<std::uint32_t> words(sizes.size() + 2);
+	words[0] = static_cast<std::uint32_t>(4 + 4 * sizes.size());
+	std::memcpy(&words[1], &level, sizeof(level));
+	std::copy(sizes.begin(), sizes.end(), words.begin() + 2);
+
+	std::vector<std::uint8_t> chunk(words.size() * 4);
+	std::memcpy(chunk.data(), words.data(), chunk.size());
+	return chunk;
+}
+
+//
+// Inflate every stream of a deflated file, producing the same file with uncompressed image data
+//
+static bool inflate(
+	const std::uint8_t* data, std::size_t size, const vtf::Header& header, std::vector<std::uint8_t>& out) {
+	const auto subs = subresources(header);
+	const auto* axc = header.find_resource(VTF_RSRC_AUX_COMPRESSION_INFO);
+	if (std::size_t(axc->data) + 8 + 4 * subs.size() > size)
+		return false;
+
+	// Streams follow each other in the same order as the uncompressed data
+	std::vector<std::size_t> compressedOffsets(subs.size());
+	std::size_t offset = header.find_resource(VTF_LEGACY_RSRC_IMAGE)->data;
+	for (std::size_t i = 0; i < subs.size(); ++i) {
+		std::uint32_t compressedSize;
+		std::memcpy(&compressedSize, data + axc->data + 8 + 4 * subs[i].auxIndex, sizeof(compressedSize));
+		compressedOffsets[i] = offset;
+		offset += compressedSize;
+	}
+	if (offset > size)
+		return false;
+
+	std::vector<std::uint8_t> image(header.image_size());
+	std::atomic<bool> ok{true};
+	util::parallel_for(
+		subs.size(),
+		[&](std::size_t i)
+		{
+			const std::size_t end = i + 1 < subs.size() ? compressedOffsets[i + 1] : offset;
+			if (!zstream::decompress(
+					data + compressedOffsets[i], end - compressedOffsets[i], image.data() + subs[i].offset,
+					subs[i].size))
+				ok = false;
+		});
+
+	return ok && rebuild(data, size, header, image, aux_info(0, {}), out);
+}
+
+bool vtf::load(CVTFFile* file, const void* data, std::size_t size) {
+	// Anything that isn't deflated the way we expect goes straight to VTFLib, which has the final say on whether it's
+	// valid
+	vtf::Header header;
+	std::string error;
+	if (!zstream::available() || !read_header(data, size, header, error) || !is_deflated(header))
+		return file->Load(data, static_cast<vlUInt>(size), vlFalse);
+
+	std::vector<std::uint8_t> inflated;
+	if (!inflate(static_cast<const std::uint8_t*>(data), size, header, inflated))
+		return file->Load(data, static_cast<vlUInt>(size), vlFalse);
+
+	if (!file->Load(inflated.data(), static_cast<vlUInt>(inflated.size()), vlFalse))
+		return false;
+	file->SetAuxCompressionLevel(header.auxCompressionLevel);
+	return true;
+}
+
+bool vtf::save(CVTFFile* file, std::vector<std::uint8_t>& out) {
+	// Big enough for the uncompressed file: header, every resource and the image data
+	std::size_t bound = RESOURCE_DICTIONARY + 8 * 32 +
+						std::size_t(CVTFFile::ComputeImageSize(
+							file->GetWidth(), file->GetHeight(), file->GetDepth(), file->GetMipmapCount(),
+							file->GetFormat())) *
+							file->GetFrameCount() * file->GetFaceCount();
+	if (file->GetHasThumbnail())
+		bound += CVTFFile::ComputeImageSize(
+			file->GetThumbnailWidth(), file->GetThumbnailHeight(), 1, file->GetThumbnailFormat());
+	for (vlUInt i = 0; file->GetSupportsResources() && i < file->GetResourceCount(); ++i) {
+		vlUInt resourceSize = 0;
+		file->GetResourceData(file->GetResourceType(i), resourceSize);
+		bound += 4 + resourceSize;
+	}
+
+	const int level = file->GetAuxCompressionLevel();
+	const bool deflate = zstream::available() && file->GetMajorVersion() == 7 && file->GetMinorVersion() >= 6 &&
+						 level != 0 && level >= -1 && level <= 9;
+
+	// Let VTFLib lay out the file without compressing anything, then deflate its image data ourselves
+	std::vector<std::uint8_t> raw(bound);
+	vlUInt written = 0;
+	if (deflate)
+		file->SetAuxCompressionLevel(0);
+	const bool saved = file->Save(raw.data(), static_cast<vlUInt>(raw.size()), written);
+	if (deflate)
+		file->SetAuxCompressionLevel(level);
+	if (!saved)
+		return false;
+
+	if (!deflate) {
+		raw.resize(written);
+		out = std::move(raw);
+		return true;
+	}
+
+	vtf::Header header;
+	std::string error;
+	if (!read_header(raw.data(), written, header, error) || !header.find_resource(VTF_LEGACY_RSRC_IMAGE)) {
+		// Not laid out the way we expect, VTFLib can compress it itself
+		vlUInt size = 0;
+		out.resize(bound);
+		if (!file->Save(out.data(), static_cast<vlUInt>(out.size()), size))
+			return false;
+		out.resize(size);
+		return true;
+	}
+
+	const auto subs = subresources(header);
+	const auto imageOffset = header.find_resource(VTF_LEGACY_RSRC_IMAGE)->data;
+	if (std::size_t(imageOffset) + header.image_size() > written)
+		return false;
+	const std::uint8_t* image = raw.data() + imageOffset;
+
+	std::vector<std::vector<std::uint8_t>> streams(subs.size());
+	std::atomic<bool> ok{true};
+	util::parallel_for(
+		subs.size(),
+		[&](std::size_t i)
+		{
+			if (!zstream::compress(image + subs[i].offset, subs[i].size, level, streams[i]))
+				ok = false;
+		});
+	if (!ok)
+		return false;
+
+	std::vector<std::uint8_t> compressed;
+	std::vector<std::uint32_t> sizes(subs.size());
+	for (std::size_t i = 0; i < subs.size(); ++i) {
+		compressed.insert(compressed.end(), streams[i].begin(), streams[i].end());
+		sizes[subs[i].auxIndex] = static_cast<std::uint32_t>(streams[i].size());
+	}
+
+	return rebuild(raw.data(), written, header, compressed, aux_info(level, sizes), out);
+}
+
+bool vtf::save(CVTFFile* file, const std::string& path) {
+	const int level = file->GetAuxCompressionLevel();
+	if (!zstream::available() || file->GetMajorVersion() != 7 || file->GetMinorVersion() < 6 || level == 0)
+		return file->Save(path.c_str());
+
+	std::vector<std::uint8_t> out;
+	if (!save(file, out))
+		return false;
+
+	std::ofstream stream(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	stream.write(reinterpret_cast<const char*>(out.data()), out.size());
+	return stream.good();
+}
@@ -0,0 +1,40 @@
+/**
+ * vtfio.hpp - Loading and saving VTFs, with the DEFLATE streams of 7.6 files handled across the thread pool
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace VTFLib
+{
+	class CVTFFile;
+}
+
+namespace vtf
+{
+
+	/**
+	 * Load a VTF from memory, like CVTFFile::Load. The image data of DEFLATE compressed 7.6 files is inflated before
+	 * VTFLib sees it, one mip, frame and face per job. file keeps the compression level, so saving it again compresses
+	 * it the same way. Anything else, or if vtex2 was built without a DEFLATE backend, is loaded by VTFLib alone
+	 * @returns false if VTFLib couldn't load the file
+	 */
+	bool load(VTFLib::CVTFFile* file, const void* data, std::size_t size);
+
+	/**
+	 * Save a VTF, like CVTFFile::Save. If file is 7.6 and has a compression level set, VTFLib saves it uncompressed to
+	 * memory and every mip, frame and face is then deflated as a separate job. Otherwise VTFLib saves it as usual
+	 * @returns false if the file couldn't be written
+	 */
+	bool save(VTFLib::CVTFFile* file, const std::string& path);
+
+	/**
+	 * Save a VTF to memory, see above
+	 * @param out Replaced with the contents of the file
+	 */
+	bool save(VTFLib::CVTFFile* file, std::vector<std::uint8_t>& out);
+
+} // namespace vtf
@@ -1,9 +1,15 @@
 
 #include "vtftools.hpp"
 #include "image.hpp"
+#include "threadpool.hpp"
 
 #include "VTFLib.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
 #undef min
 #undef max
 
@@ -55,4 +61,465 @@ bool vtf::resize(const CVTFFile* srcFile, int newWidth, int newHeight, CVTFFile*
 	}
 
 	return true;
-}
\ No newline at end of file
+}
+
+bool vtf::bcn_format(VTFImageFormat format, bcn::Format& outFormat) {
+	switch (format) {
+		case IMAGE_FORMAT_DXT1:
+			outFormat = bcn::Format::BC1;
+			return true;
+		case IMAGE_FORMAT_DXT1_ONEBITALPHA:
+			outFormat = bcn::Format::BC1A;
+			return true;
+		case IMAGE_FORMAT_DXT3:
+			outFormat = bcn::Format::BC2;
+			return true;
+		case IMAGE_FORMAT_DXT5:
+			outFormat = bcn::Format::BC3;
+			return true;
+		case IMAGE_FORMAT_ATI1N:
+			outFormat = bcn::Format::BC4;
+			return true;
+		case IMAGE_FORMAT_ATI2N:
+			outFormat = bcn::Format::BC5;
+			return true;
+		case IMAGE_FORMAT_BC7:
+			outFormat = bcn::Format::BC7;
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool vtf::decode(const vlByte* src, vlByte* dst, int w, int h, VTFImageFormat srcFormat, VTFImageFormat dstFormat) {
+	bcn::Format bcFormat;
+	if (!bcn_format(srcFormat, bcFormat) || (dstFormat != IMAGE_FORMAT_RGBA8888 && dstFormat != IMAGE_FORMAT_RGB888))
+		return CVTFFile::Convert(const_cast<vlByte*>(src), dst, w, h, srcFormat, dstFormat);
+
+	const int channels = dstFormat == IMAGE_FORMAT_RGBA8888 ? 4 : 3;
+	bcn::decode_image(bcFormat, src, w, h, dst, size_t(w) * channels, channels);
+	return true;
+}
+
+//
+// Carry over everything that isn't image data
+//
+static void copy_properties(const CVTFFile* srcFile, CVTFFile* file) {
+	file->SetVersion(srcFile->GetMajorVersion(), srcFile->GetMinorVersion());
+	file->SetFlags(srcFile->GetFlags());
+	file->SetStartFrame(srcFile->GetStartFrame());
+	file->SetBumpmapScale(srcFile->GetBumpmapScale());
+
+	vlSingle r, g, b;
+	srcFile->GetReflectivity(r, g, b);
+	file->SetReflectivity(r, g, b);
+
+	if (srcFile->GetHasThumbnail())
+		file->SetThumbnailData(srcFile->GetThumbnailData());
+
+	file->SetAuxCompressionLevel(srcFile->GetAuxCompressionLevel());
+
+	if (srcFile->GetSupportsResources()) {
+		for (vlUInt i = 0; i < srcFile->GetResourceCount(); ++i) {
+			const auto type = srcFile->GetResourceType(i);
+			if (type == VTF_LEGACY_RSRC_IMAGE || type == VTF_LEGACY_RSRC_LOW_RES_IMAGE ||
+				type == VTF_RSRC_AUX_COMPRESSION_INFO)
+				continue;
+			vlUInt size = 0;
+			auto* data = srcFile->GetResourceData(type, size);
+			file->SetResourceData(type, size, data);
+		}
+	}
+}
+
+bool vtf::compress(const CVTFFile* srcFile, VTFImageFormat format, bcn::Quality quality, CVTFFile* file) {
+	bcn::Format bcFormat;
+	if (srcFile->GetFormat() != IMAGE_FORMAT_RGBA8888 || !bcn_format(format, bcFormat))
+		return false;
+
+	const vlUInt width = srcFile->GetWidth();
+	const vlUInt height = srcFile->GetHeight();
+	const vlUInt depth = srcFile->GetDepth();
+	const vlUInt frameCount = srcFile->GetFrameCount();
+	const vlUInt faceCount = srcFile->GetFaceCount();
+	const vlUInt mipCount = srcFile->GetMipmapCount();
+
+	if (!file->Init(width, height, frameCount, faceCount, depth, format, srcFile->GetHasThumbnail(), mipCount))
+		return false;
+	copy_properties(srcFile, file);
+
+	// Gather every surface, numbering their block rows consecutively
+	struct Surface {
+		const vlByte* src;
+		vlByte* dst;
+		int width, height;
+		size_t firstRow;
+	};
+	std::vector<Surface> surfaces;
+	size_t rowCount = 0, mip0Rows = 0;
+
+	for (vlUInt uiMip = 0; uiMip < mipCount; ++uiMip) {
+		vlUInt mipWidth, mipHeight, mipDepth;
+		CVTFFile::ComputeMipmapDimensions(width, height, depth, uiMip, mipWidth, mipHeight, mipDepth);
+		for (vlUInt uiFrame = 0; uiFrame < frameCount; ++uiFrame) {
+			for (vlUInt uiFace = 0; uiFace < faceCount; ++uiFace) {
+				for (vlUInt uiSlice = 0; uiSlice < mipDepth; ++uiSlice) {
+					surfaces.push_back(
+						{srcFile->GetData(uiFrame, uiFace, uiSlice, uiMip), file->GetData(uiFrame, uiFace, uiSlice, uiMip),
+						 static_cast<int>(mipWidth), static_cast<int>(mipHeight), rowCount});
+					rowCount += (mipHeight + 3) / 4;
+				}
+			}
+		}
+		if (uiMip == 0)
+			mip0Rows = rowCount;
+	}
+
+	// One job per block row, so a single large mip can't hold up the whole file
+	const auto encode_rows = [&](size_t begin, size_t end, const bcn::Bc7Stats* hint, bcn::Bc7Stats* stats)
+	{
+		util::parallel_for(
+			end - begin,
+			[&](size_t job)
+			{
+				const size_t row = begin + job;
+				const auto& surf = *(std::upper_bound(
+										 surfaces.begin(), surfaces.end(), row,
+										 [](size_t r, const Surface& s) { return r < s.firstRow; }) -
+									 1);
+				const size_t blockRow = row - surf.firstRow;
+				const size_t rowSize = size_t((surf.width + 3) / 4) * bcn::block_size(bcFormat);
+				bcn::encode_row(
+					bcFormat, surf.src, surf.width, surf.height, static_cast<int>(blockRow),
+					surf.dst + blockRow * rowSize, quality, hint, stats);
+			});
+	};
+
+	if (bcFormat == bcn::Format::BC7 && mipCount > 1) {
+		// Mip 0 is encoded first and records which modes and partitions it used. The smaller mips look much the
+		// same, so they only search what paid off there
+		bcn::Bc7Stats stats;
+		encode_rows(0, mip0Rows, nullptr, &stats);
+		encode_rows(mip0Rows, rowCount, &stats, nullptr);
+	}
+	else
+		encode_rows(0, rowCount, nullptr, nullptr);
+
+	return true;
+}
+
+bool vtf::transcode(
+	const CVTFFile* srcFile, VTFImageFormat format, bcn::Quality quality, vlUInt firstMip, vlUInt mipCount,
+	CVTFFile* file) {
+	const VTFImageFormat srcFormat = srcFile->GetFormat();
+	const vlUInt frameCount = srcFile->GetFrameCount();
+	const vlUInt faceCount = srcFile->GetFaceCount();
+	if (mipCount < 1 || firstMip + mipCount > srcFile->GetMipmapCount())
+		return false;
+
+	// Source mip firstMip becomes the new mip 0. Mip sizes are halved with a shift, so the chain below it lines up
+	vlUInt width, height, depth;
+	CVTFFile::ComputeMipmapDimensions(
+		srcFile->GetWidth(), srcFile->GetHeight(), srcFile->GetDepth(), firstMip, width, height, depth);
+
+	if (!file->Init(width, height, frameCount, faceCount, depth, format, srcFile->GetHasThumbnail(), mipCount))
+		return false;
+	copy_properties(srcFile, file);
+
+	bcn::Format srcBc, dstBc;
+	const bool srcNative = bcn_format(srcFormat, srcBc);
+	const bool dstNative = bcn_format(format, dstBc);
+
+	// Every surface is cut into strips of 4 rows, which is a single block row for compressed formats
+	struct Surface {
+		const vlByte* src;
+		vlByte* dst;
+		int width, height;
+		size_t firstStrip;
+	};
+	std::vector<Surface> surfaces;
+	size_t stripCount = 0, mip0Strips = 0;
+
+	for (vlUInt uiMip = 0; uiMip < mipCount; ++uiMip) {
+		vlUInt mipWidth, mipHeight, mipDepth;
+		CVTFFile::ComputeMipmapDimensions(width, height, depth, uiMip, mipWidth, mipHeight, mipDepth);
+		for (vlUInt uiFrame = 0; uiFrame < frameCount; ++uiFrame) {
+			for (vlUInt uiFace = 0; uiFace < faceCount; ++uiFace) {
+				for (vlUInt uiSlice = 0; uiSlice < mipDepth; ++uiSlice) {
+					surfaces.push_back(
+						{srcFile->GetData(uiFrame, uiFace, uiSlice, firstMip + uiMip),
+						 file->GetData(uiFrame, uiFace, uiSlice, uiMip), static_cast<int>(mipWidth),
+						 static_cast<int>(mipHeight), stripCount});
+					stripCount += (mipHeight + 3) / 4;
+				}
+			}
+		}
+		if (uiMip == 0)
+			mip0Strips = stripCount;
+	}
+
+	// Each strip is decoded to RGBA8888 just before it's encoded again, so only a few rows per thread ever exist
+	// uncompressed. Uncompressed formats convert straight to each other to keep their precision
+	std::atomic<bool> ok{true};
+	const auto transcode_strips = [&](size_t begin, size_t end, const bcn::Bc7Stats* hint, bcn::Bc7Stats* stats)
+	{
+		util::parallel_for(
+			end - begin,
+			[&](size_t job)
+			{
+				const size_t strip = begin + job;
+				const auto& surf = *(std::upper_bound(
+										 surfaces.begin(), surfaces.end(), strip,
+										 [](size_t i, const Surface& s) { return i < s.firstStrip; }) -
+									 1);
+				const int y0 = static_cast<int>(strip - surf.firstStrip) * 4;
+				const int rows = std::min(4, surf.height - y0);
+				auto* src = const_cast<vlByte*>(surf.src) + CVTFFile::ComputeImageSize(surf.width, y0, 1, srcFormat);
+				auto* dst = surf.dst + CVTFFile::ComputeImageSize(surf.width, y0, 1, format);
+
+				if (srcFormat == format) {
+					std::memcpy(dst, src, CVTFFile::ComputeImageSize(surf.width, rows, 1, format));
+					return;
+				}
+				if (!srcNative && !dstNative) {
+					if (!CVTFFile::Convert(src, dst, surf.width, rows, srcFormat, format))
+						ok = false;
+					return;
+				}
+
+				std::vector<vlByte> rgba(size_t(surf.width) * 4 * 4);
+				if (srcNative)
+					bcn::decode_row(srcBc, src, surf.width, rows, 0, rgba.data(), size_t(surf.width) * 4, 4);
+				else if (!CVTFFile::Convert(src, rgba.data(), surf.width, rows, srcFormat, IMAGE_FORMAT_RGBA8888)) {
+					ok = false;
+					return;
+				}
+
+				if (dstNative)
+					bcn::encode_row(dstBc, rgba.data(), surf.width, rows, 0, dst, quality, hint, stats);
+				else if (!CVTFFile::Convert(rgba.data(), dst, surf.width, rows, IMAGE_FORMAT_RGBA8888, format))
+					ok = false;
+			});
+	};
+
+	if (dstNative && dstBc == bcn::Format::BC7 && srcFormat != format && mipCount > 1) {
+		// Same as compress, mip 0 narrows the search for the rest of the chain
+		bcn::Bc7Stats stats;
+		transcode_strips(0, mip0Strips, nullptr, &stats);
+		transcode_strips(mip0Strips, stripCount, &stats, nullptr);
+	}
+	else
+		transcode_strips(0, stripCount, nullptr, nullptr);
+
+	return ok;
+}
+
+//
+// Map our mip filters to VTFLib's, for the formats we leave to it
+//
+static VTFMipmapFilter vtflib_filter(imglib::MipFilter filter) {
+	switch (filter) {
+		case imglib::MipFilter::Box:
+			return MIPMAP_FILTER_BOX;
+		case imglib::MipFilter::Kaiser:
+			return MIPMAP_FILTER_KAISER;
+		default:
+			return MIPMAP_FILTER_CATROM;
+	}
+}
+
+bool vtf::generate_mipmaps(CVTFFile* file, imglib::MipFilter filter, bool srgb) {
+	imglib::ChannelType type = imglib::ChannelType::None;
+	int channels = 4;
+	switch (file->GetFormat()) {
+		case IMAGE_FORMAT_RGBA8888:
+			type = imglib::ChannelType::UInt8;
+			break;
+		case IMAGE_FORMAT_RGB888:
+			type = imglib::ChannelType::UInt8;
+			channels = 3;
+			break;
+		case IMAGE_FORMAT_RGBA16161616:
+			type = imglib::ChannelType::UInt16;
+			break;
+		case IMAGE_FORMAT_RGBA32323232F:
+			type = imglib::ChannelType::Float;
+			break;
+		default:
+			break;
+	}
+
+	// The slice count of volume textures shrinks along with the mips, which needs a 3D filter
+	if (type == imglib::ChannelType::None || file->GetDepth() > 1)
+		return file->GenerateMipmaps(vtflib_filter(filter), srgb);
+
+	const vlUInt width = file->GetWidth();
+	const vlUInt height = file->GetHeight();
+	const vlUInt frameCount = file->GetFrameCount();
+	const vlUInt faceCount = file->GetFaceCount();
+
+	// Each mip depends on the one before it, so only the surfaces within a mip can be filtered together
+	std::vector<std::pair<const vlByte*, vlByte*>> surfaces(size_t(frameCount) * faceCount);
+	for (vlUInt uiMip = 1; uiMip < file->GetMipmapCount(); ++uiMip) {
+		vlUInt srcWidth, srcHeight, dstWidth, dstHeight, depth;
+		CVTFFile::ComputeMipmapDimensions(width, height, 1, uiMip - 1, srcWidth, srcHeight, depth);
+		CVTFFile::ComputeMipmapDimensions(width, height, 1, uiMip, dstWidth, dstHeight, depth);
+
+		for (vlUInt uiFrame = 0; uiFrame < frameCount; ++uiFrame)
+			for (vlUInt uiFace = 0; uiFace < faceCount; ++uiFace)
+				surfaces[uiFrame * faceCount + uiFace] = {
+					file->GetData(uiFrame, uiFace, 0, uiMip - 1), file->GetData(uiFrame, uiFace, 0, uiMip)};
+
+		const imglib::MipResampler resampler(
+			type, channels, static_cast<int>(srcWidth), static_cast<int>(srcHeight), static_cast<int>(dstWidth),
+			static_cast<int>(dstHeight), filter, srgb);
+		const size_t bandCount = resampler.band_count();
+
+		util::parallel_for(
+			surfaces.size() * bandCount,
+			[&](size_t job)
+			{
+				const auto& surf = surfaces[job / bandCount];
+				resampler.resample_band(surf.first, surf.second, static_cast<int>(job % bandCount));
+			});
+	}
+	return true;
+}
+
+//
+// VTF format holding RGBA data of a channel type
+//
+static VTFImageFormat rgba_format(imglib::ChannelType type) {
+	switch (type) {
+		case imglib::ChannelType::UInt16:
+			return IMAGE_FORMAT_RGBA16161616;
+		case imglib::ChannelType::Float:
+			return IMAGE_FORMAT_RGBA32323232F;
+		default:
+			return IMAGE_FORMAT_RGBA8888;
+	}
+}
+
+bool vtf::stream_image(
+	const imglib::Image& image, imglib::ChannelType procType, imglib::MipFilter filter, bool srgb,
+	bcn::Quality quality, bool thumbnail, CVTFFile* file) {
+	const VTFImageFormat format = file->GetFormat();
+	const vlUInt width = file->GetWidth();
+	const vlUInt height = file->GetHeight();
+	const vlUInt mipCount = file->GetMipmapCount();
+	thumbnail = thumbnail && file->GetHasThumbnail();
+
+	bcn::Format bcFormat;
+	const bool native = bcn_format(format, bcFormat);
+	if (native)
+		procType = imglib::ChannelType::UInt8;
+	const VTFImageFormat procFormat = rgba_format(procType);
+
+	// Filtering happens in linear space when 8-bit sRGB goes in and comes back out, anything else is passed through
+	// as is
+	srgb = srgb && image.type() == imglib::ChannelType::UInt8 && procType == imglib::ChannelType::UInt8;
+
+	// The source is only a stage of its own if it needs resizing
+	imglib::StageSizes sizes;
+	if (image.width() != int(width) || image.height() != int(height))
+		sizes.push_back({image.width(), image.height()});
+	const int firstMip = static_cast<int>(sizes.size());
+
+	for (vlUInt uiMip = 0; uiMip < mipCount; ++uiMip) {
+		vlUInt mipWidth, mipHeight, mipDepth;
+		CVTFFile::ComputeMipmapDimensions(width, height, 1, uiMip, mipWidth, mipHeight, mipDepth);
+		sizes.push_back({int(mipWidth), int(mipHeight)});
+	}
+
+	// The thumbnail is filtered from the smallest stage at least as large as it. If the mips stop short of that,
+	// keep halving past the last mip just for the thumbnail
+	const int thumbWidth = thumbnail ? int(file->GetThumbnailWidth()) : 0;
+	const int thumbHeight = thumbnail ? int(file->GetThumbnailHeight()) : 0;
+	if (thumbnail) {
+		while (sizes.back().first / 2 >= thumbWidth && sizes.back().second / 2 >= thumbHeight)
+			sizes.push_back({sizes.back().first / 2, sizes.back().second / 2});
+	}
+	int thumbStage = firstMip;
+	for (int s = firstMip; s < int(sizes.size()); ++s)
+		if (sizes[s].first >= thumbWidth && sizes[s].second >= thumbHeight)
+			thumbStage = s;
+	std::vector<float> thumbSource;
+
+	const size_t srcPitch = size_t(image.width()) * image.pixel_size();
+	bool ok = true;
+
+	imglib::stream_mips(
+		sizes, filter,
+		[&](int y, float* out)
+		{
+			imglib::to_linear_row(
+				image.data<uint8_t>() + srcPitch * y, image.type(), image.channels(), srgb, image.width(), out);
+		},
+		[&](int stage, int y0, int count, const float* const* rows)
+		{
+			const int w = sizes[stage].first;
+			if (thumbnail && stage == thumbStage) {
+				thumbSource.resize(size_t(w) * sizes[stage].second * 4);
+				for (int i = 0; i < count; ++i)
+					std::copy(rows[i], rows[i] + size_t(w) * 4, thumbSource.begin() + size_t(y0 + i) * w * 4);
+			}
+
+			const int mip = stage - firstMip;
+			if (mip < 0 || mip >= int(mipCount) || !ok)
+				return;
+			vlByte* dst = file->GetData(0, 0, 0, mip);
+
+			// Block rows go straight to the encoder
+			if (native) {
+				const size_t rowSize = size_t((w + 3) / 4) * bcn::block_size(bcFormat);
+				util::parallel_for(
+					(count + 3) / 4,
+					[&](size_t blockRow)
+					{
+						const int first = static_cast<int>(blockRow) * 4;
+						const int blockRows = std::min(4, count - first);
+						std::vector<uint8_t> rgba(size_t(w) * 4 * 4);
+						for (int i = 0; i < blockRows; ++i)
+							imglib::from_linear_row(
+								rows[first + i], imglib::ChannelType::UInt8, 4, srgb, w, &rgba[size_t(i) * w * 4]);
+						bcn::encode_row(
+							bcFormat, rgba.data(), w, blockRows, 0, dst + (y0 / 4 + blockRow) * rowSize, quality);
+					});
+				return;
+			}
+
+			// Everything else takes a trip through VTFLib
+			const size_t pitch = size_t(w) * imglib::pixel_size(procType, 4);
+			std::vector<vlByte> strip(pitch * count);
+			util::parallel_for(
+				count,
+				[&](size_t i) { imglib::from_linear_row(rows[i], procType, 4, srgb, w, &strip[pitch * i]); });
+			if (!CVTFFile::Convert(
+					strip.data(), dst + CVTFFile::ComputeImageSize(w, y0, 1, format), w, count, procFormat, format))
+				ok = false;
+		});
+
+	if (!ok)
+		return false;
+
+	if (thumbnail) {
+		const int srcWidth = sizes[thumbStage].first, srcHeight = sizes[thumbStage].second;
+		std::vector<float> linear(size_t(thumbWidth) * thumbHeight * 4);
+		imglib::MipResampler(
+			imglib::ChannelType::Float, 4, srcWidth, srcHeight, thumbWidth, thumbHeight, filter, false)
+			.resample(thumbSource.data(), linear.data());
+
+		std::vector<vlByte> rgba(linear.size());
+		for (int y = 0; y < thumbHeight; ++y)
+			imglib::from_linear_row(
+				&linear[size_t(y) * thumbWidth * 4], imglib::ChannelType::UInt8, 4, srgb, thumbWidth,
+				&rgba[size_t(y) * thumbWidth * 4]);
+
+		std::vector<vlByte> thumb(CVTFFile::ComputeImageSize(thumbWidth, thumbHeight, 1, file->GetThumbnailFormat()));
+		if (!CVTFFile::Convert(
+				rgba.data(), thumb.data(), thumbWidth, thumbHeight, IMAGE_FORMAT_RGBA8888, file->GetThumbnailFormat()))
+			return false;
+		file->SetThumbnailData(thumb.data());
+	}
+	return true;
+}
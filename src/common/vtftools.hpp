@@ -1,6 +1,10 @@
 
 #pragma once
 
+#include "VTFLib.h"
+#include "bcn.hpp"
+#include "mipmap.hpp"
+
 namespace VTFLib
 {
 	class CVTFFile;
@@ -17,4 +21,75 @@ namespace vtf
 	 * @returns true if the resize passed
 	 */
 	bool resize(const VTFLib::CVTFFile* srcFile, int newWidth, int newHeight, VTFLib::CVTFFile* file);
+
+	/**
+	 * Get the block compression format matching a VTF image format
+	 * @returns false if the format can't be encoded by bcn
+	 */
+	bool bcn_format(VTFImageFormat format, bcn::Format& outFormat);
+
+	/**
+	 * Convert a single image to another format, like CVTFFile::Convert. Block compressed images decoded to RGBA8888
+	 * or RGB888 skip VTFLib, and large ones have their block rows decoded across the thread pool
+	 * @returns true if the conversion passed
+	 */
+	bool decode(const vlByte* src, vlByte* dst, int w, int h, VTFImageFormat srcFormat, VTFImageFormat dstFormat);
+
+	/**
+	 * Block compress every frame, face, slice and mip of a VTF, writing the blocks straight into file's image data.
+	 * Block rows of all surfaces are spread over the thread pool together.
+	 * file is re-initialized with the new format, and gets srcFile's flags, properties, thumbnail and resources.
+	 * @param srcFile RGBA8888 file to compress
+	 * @param format Target format, see bcn_format
+	 * @param quality Encoder preset
+	 * @param file File to write data to
+	 * @returns true if the compression passed
+	 */
+	bool compress(
+		const VTFLib::CVTFFile* srcFile, VTFImageFormat format, bcn::Quality quality, VTFLib::CVTFFile* file);
+
+	/**
+	 * Re-encode the existing mips of a VTF in another format, without regenerating any of them. Rows of each surface
+	 * are decoded a block row at a time and handed straight to the encoder, across the thread pool. Surfaces that
+	 * are already in the target format are copied as they are.
+	 * file is re-initialized like with compress.
+	 * @param srcFile File to draw data from, any format
+	 * @param format Target format. Formats without a native block encoder go through CVTFFile::Convert
+	 * @param quality Block encoder preset
+	 * @param firstMip Source mip that becomes mip 0 of file, which takes on its size. Larger mips are dropped
+	 * @param mipCount Number of mips to keep, at most srcFile's mip count minus firstMip. Smaller mips past this are
+	 * dropped
+	 * @param file File to write data to
+	 * @returns true if every surface was converted
+	 */
+	bool transcode(
+		const VTFLib::CVTFFile* srcFile, VTFImageFormat format, bcn::Quality quality, vlUInt firstMip, vlUInt mipCount,
+		VTFLib::CVTFFile* file);
+
+	/**
+	 * Generate every mip of a VTF, each one from the mip above it. Frames, faces and bands of rows are spread over
+	 * the thread pool. Formats imglib::MipResampler can't handle, and volume textures, are left to VTFLib
+	 * @param filter Downsampling filter
+	 * @param srgb Filter 8-bit color in linear space
+	 * @returns true if the mips were generated
+	 */
+	bool generate_mipmaps(VTFLib::CVTFFile* file, imglib::MipFilter filter, bool srgb);
+
+	/**
+	 * Fill every mip of file from an image, a strip of rows at a time. Each strip is resized to file's size, filtered
+	 * into the smaller mips and converted or block compressed to file's format before the next one is read, so the
+	 * full size image never exists in any other format. See imglib::stream_mips
+	 * @param image Source image, any size
+	 * @param procType Channel type strips are converted to before VTFLib converts them to file's format. Unused for
+	 * formats with a native block encoder
+	 * @param filter Resize and mip filter
+	 * @param srgb Filter 8-bit color in linear space
+	 * @param quality Block encoder preset
+	 * @param thumbnail If true, also fill in file's thumbnail
+	 * @param file Initialized VTF to fill, with a single frame, face and slice
+	 * @returns true if every mip was filled
+	 */
+	bool stream_image(
+		const imglib::Image& image, imglib::ChannelType procType, imglib::MipFilter filter, bool srgb,
+		bcn::Quality quality, bool thumbnail, VTFLib::CVTFFile* file);
 } // namespace vtf
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include "document.hpp"
 #include "common/util.hpp"
 #include "common/enums.hpp"
+#include "common/vtfio.hpp"
 
 using namespace vtfview;
 
@@ -48,7 +49,7 @@ bool Document::save(const std::string& path) {
 			return false;
 	}
 
-	if (!file_->Save(path.empty() ? path_.c_str() : path.c_str())) {
+	if (!vtf::save(file_, path.empty() ? path_ : path)) {
 		return false;
 	}
 
@@ -57,13 +58,11 @@ bool Document::save(const std::string& path) {
 }
 
 bool Document::load_file(const char* path) {
-	std::uint8_t* buffer;
-	auto numRead = util::read_file(path, buffer);
-	if (!numRead)
+	util::MappedFile data;
+	if (!data.open(path) || !data.size())
 		return false;
 
-	bool ok = load_file_internal(buffer, numRead);
-	delete[] buffer;
+	bool ok = load_file_internal(data.data(), data.size());
 
 	path_ = path;
 	emit vtfFileChanged(path_, file_);
@@ -100,7 +99,7 @@ void Document::unload_file() {
 bool Document::load_file_internal(const void* data, size_t size) {
 	auto* oldFile = file_;
 	file_ = new VTFLib::CVTFFile();
-	if (!file_->Load(data, size)) {
+	if (!vtf::load(file_, data, size)) {
 		delete file_;
 		file_ = oldFile;
 		return false;
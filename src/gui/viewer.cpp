@@ -5,6 +5,7 @@
 #include "common/enums.hpp"
 #include "common/image.hpp"
 #include "common/util.hpp"
+#include "common/vtftools.hpp"
 #include "fmt/format.h"
 
 #include <QApplication>
@@ -473,7 +474,7 @@ bool ViewerMainWindow::export_file(const char* path)
 	else {
 		// comps = 3;
 		imageData = static_cast<vlByte*>(malloc(w * h * comps * sizeof(uint8_t)));
-		ok = VTFLib::CVTFFile::Convert(
+		ok = vtf::decode(
 			file_->GetData(0, 0, 0, viewer_->get_mip()), imageData, w, h, file_->GetFormat(),
 			comps == 3 ? IMAGE_FORMAT_RGB888 : IMAGE_FORMAT_RGBA8888);
 	}
@@ -735,7 +736,7 @@ void ImageViewWidget::paintEvent(QPaintEvent* event) {
 		// This buffer needs to persist- QImage does not own the mem you give it
 		imgBuf_ = static_cast<vlByte*>(malloc(size));
 
-		bool ok = CVTFFile::Convert(
+		bool ok = vtf::decode(
 			file_->GetData(frame_, face_, 0, mip_), (vlByte*)imgBuf_, imageWidth, imageHeight, file_->GetFormat(),
 			format);
 		if (!ok) {
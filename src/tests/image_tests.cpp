@@ -2,13 +2,182 @@
 #include <cstdint>
 #include <cstddef>
 #include <climits>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <type_traits>
+#include <limits>
 
 #include "gtest/gtest.h"
 
+#include "cli/convert_cache.hpp"
+
 #include "common/lwiconv.hpp"
+#include "common/cpu.hpp"
+#include "common/kernels.hpp"
+#include "common/bcn.hpp"
+#include "common/mipmap.hpp"
+#include "common/deflate.hpp"
+#include "common/hash.hpp"
+#include "common/threadpool.hpp"
+#include "common/vtfheader.hpp"
+#include "common/vtfio.hpp"
 
 using namespace lwiconv;
 
+static std::vector<uint8_t> readFile(const std::string& path) {
+	std::ifstream stream(path, std::ios::in | std::ios::binary);
+	return std::vector<uint8_t>(std::istreambuf_iterator<char>(stream), {});
+}
+
+// Read a file from the tests directory
+static std::vector<uint8_t> readTestFile(const char* name) {
+	return readFile(std::string(VTEX2_TEST_DATA) + "/" + name);
+}
+
+static void writeFile(const std::string& path, const std::vector<uint8_t>& data) {
+	std::ofstream stream(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	stream.write(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+// Write data to a file in the temp directory, returning its path
+static std::string writeTempFile(const char* name, const std::vector<uint8_t>& data) {
+	const auto path = (std::filesystem::temp_directory_path() / name).string();
+	writeFile(path, data);
+	return path;
+}
+
+// Check that two VTFs hold the same image data, thumbnail and resources
+static void expectSameVTF(const VTFLib::CVTFFile& a, const VTFLib::CVTFFile& b) {
+	ASSERT_EQ(a.GetWidth(), b.GetWidth());
+	ASSERT_EQ(a.GetHeight(), b.GetHeight());
+	ASSERT_EQ(a.GetDepth(), b.GetDepth());
+	ASSERT_EQ(a.GetFormat(), b.GetFormat());
+	ASSERT_EQ(a.GetMipmapCount(), b.GetMipmapCount());
+	ASSERT_EQ(a.GetFrameCount(), b.GetFrameCount());
+	ASSERT_EQ(a.GetFaceCount(), b.GetFaceCount());
+	ASSERT_EQ(a.GetFlags(), b.GetFlags());
+
+	for (vlUInt mip = 0; mip < a.GetMipmapCount(); ++mip) {
+		const auto size =
+			VTFLib::CVTFFile::ComputeMipmapSize(a.GetWidth(), a.GetHeight(), a.GetDepth(), mip, a.GetFormat());
+		for (vlUInt frame = 0; frame < a.GetFrameCount(); ++frame)
+			for (vlUInt face = 0; face < a.GetFaceCount(); ++face)
+				ASSERT_EQ(std::memcmp(a.GetData(frame, face, 0, mip), b.GetData(frame, face, 0, mip), size), 0)
+					<< "mip " << mip << " frame " << frame << " face " << face;
+	}
+
+	ASSERT_EQ(a.GetHasThumbnail(), b.GetHasThumbnail());
+	if (a.GetHasThumbnail()) {
+		const auto size = VTFLib::CVTFFile::ComputeImageSize(
+			a.GetThumbnailWidth(), a.GetThumbnailHeight(), 1, a.GetThumbnailFormat());
+		ASSERT_EQ(std::memcmp(a.GetThumbnailData(), b.GetThumbnailData(), size), 0);
+	}
+
+	// The image, thumbnail and aux compression info are covered above or differ by design
+	for (vlUInt i = 0; a.GetSupportsResources() && i < a.GetResourceCount(); ++i) {
+		const auto type = a.GetResourceType(i);
+		if (type == VTF_LEGACY_RSRC_IMAGE || type == VTF_LEGACY_RSRC_LOW_RES_IMAGE ||
+			type == VTF_RSRC_AUX_COMPRESSION_INFO)
+			continue;
+		ASSERT_TRUE(b.GetHasResource(type)) << "resource " << type;
+		vlUInt sizeA = 0, sizeB = 0;
+		const auto* dataA = static_cast<const uint8_t*>(a.GetResourceData(type, sizeA));
+		const auto* dataB = static_cast<const uint8_t*>(b.GetResourceData(type, sizeB));
+		ASSERT_EQ(sizeA, sizeB) << "resource " << type;
+		ASSERT_TRUE(sizeA == 0 || std::memcmp(dataA, dataB, sizeA) == 0) << "resource " << type;
+	}
+}
+
+// Check that a deflated file lists one stream per mip, frame and face in its aux compression info, smallest mip
+// first, and that each of them inflates to the matching image data of file
+static void expectStreams(const std::vector<uint8_t>& data, const VTFLib::CVTFFile& file, int level) {
+	vtf::Header header;
+	std::string error;
+	ASSERT_TRUE(vtf::read_header(data.data(), data.size(), header, error)) << error;
+	ASSERT_EQ(header.auxCompressionLevel, level);
+
+	const auto* axc = header.find_resource(VTF_RSRC_AUX_COMPRESSION_INFO);
+	const auto* image = header.find_resource(VTF_LEGACY_RSRC_IMAGE);
+	ASSERT_TRUE(axc && image);
+	const std::size_t count = std::size_t(header.mipCount) * header.frameCount * header.faceCount;
+	ASSERT_EQ(axc->size, 4 + 4 * count);
+
+	std::size_t offset = image->data;
+	for (int mip = int(header.mipCount) - 1; mip >= 0; --mip) {
+		const auto size = VTFLib::CVTFFile::ComputeMipmapSize(
+			header.width, header.height, header.depth, mip, header.format);
+		for (std::uint32_t frame = 0; frame < header.frameCount; ++frame) {
+			for (std::uint32_t face = 0; face < header.faceCount; ++face) {
+				std::uint32_t compressedSize;
+				const auto index = (mip * header.frameCount + frame) * header.faceCount + face;
+				std::memcpy(&compressedSize, data.data() + axc->data + 8 + 4 * index, sizeof(compressedSize));
+				ASSERT_LE(offset + compressedSize, data.size());
+
+				std::vector<uint8_t> inflated(size);
+				ASSERT_TRUE(zstream::decompress(data.data() + offset, compressedSize, inflated.data(), size));
+				ASSERT_EQ(std::memcmp(inflated.data(), file.GetData(frame, face, 0, mip), size), 0)
+					<< "mip " << mip << " frame " << frame << " face " << face;
+				offset += compressedSize;
+			}
+		}
+	}
+}
+
+// Check that read_header agrees with VTFLib on a file in memory
+static void expectHeaderMatchesVTFLib(const std::vector<uint8_t>& data) {
+	vtf::Header header;
+	std::string error;
+	ASSERT_TRUE(vtf::read_header(data.data(), data.size(), header, error)) << error;
+
+	VTFLib::CVTFFile file;
+	ASSERT_TRUE(file.Load(data.data(), static_cast<vlUInt>(data.size()), vlFalse));
+	ASSERT_EQ(header.majorVersion, file.GetMajorVersion());
+	ASSERT_EQ(header.minorVersion, file.GetMinorVersion());
+	ASSERT_EQ(header.width, file.GetWidth());
+	ASSERT_EQ(header.height, file.GetHeight());
+	ASSERT_EQ(header.depth, file.GetDepth());
+	ASSERT_EQ(header.flags, file.GetFlags());
+	ASSERT_EQ(header.frameCount, file.GetFrameCount());
+	ASSERT_EQ(header.startFrame, file.GetStartFrame());
+	ASSERT_EQ(header.faceCount, file.GetFaceCount());
+	ASSERT_EQ(header.mipCount, file.GetMipmapCount());
+	ASSERT_EQ(header.format, file.GetFormat());
+	ASSERT_EQ(header.bumpScale, file.GetBumpmapScale());
+	ASSERT_EQ(header.image_size(), file.GetSize());
+	ASSERT_EQ(header.auxCompressionLevel, file.GetMinorVersion() >= 6 ? file.GetAuxCompressionLevel() : 0);
+
+	vlSingle r, g, b;
+	file.GetReflectivity(r, g, b);
+	ASSERT_EQ(header.reflectivity[0], r);
+	ASSERT_EQ(header.reflectivity[1], g);
+	ASSERT_EQ(header.reflectivity[2], b);
+
+	ASSERT_EQ(header.thumbnailFormat != IMAGE_FORMAT_NONE, !!file.GetHasThumbnail());
+	if (file.GetHasThumbnail()) {
+		ASSERT_EQ(header.thumbnailFormat, file.GetThumbnailFormat());
+		ASSERT_EQ(header.thumbnailWidth, file.GetThumbnailWidth());
+		ASSERT_EQ(header.thumbnailHeight, file.GetThumbnailHeight());
+	}
+
+	if (header.minorVersion < 3)
+		return;
+	ASSERT_EQ(header.resources.size(), file.GetResourceCount());
+	for (vlUInt i = 0; i < file.GetResourceCount(); ++i) {
+		const auto type = file.GetResourceType(i);
+		const auto* resource = header.find_resource(type);
+		ASSERT_NE(resource, nullptr) << "resource " << type;
+		vlUInt size = 0;
+		file.GetResourceData(type, size);
+		ASSERT_EQ(resource->size, size) << "resource " << type;
+	}
+}
+
 template<typename T>
 static void fillPattern(T* buf, const T (&pattern)[MAX_CHANNELS], int w, int h, int channels) {
 	for (int i = 0; i < w * h; ++i) {
@@ -127,3 +296,862 @@ TEST(ImageTests, BasicSwizzle)
 	ASSERT_EQ(img[2], 2);
 	ASSERT_EQ(img[3], 1);
 }
+
+template<typename T>
+static T randomSample(uint32_t& state) {
+	state = state * 1664525u + 1013904223u;
+	if constexpr (std::is_same_v<T, float>)
+		return (state >> 8) / float(1 << 24);
+	else
+		return T(state >> 16);
+}
+
+// Compare the vectorized path against the scalar reference for a bunch of layouts
+template<typename Tin, typename Tout>
+static void runSimdTest() {
+	uint32_t state = 1234;
+	const PixelF defs = {0.25f, 0.5f, 0.75f, 1.f};
+
+	for (int w : {1, 7, 33, 97}) {
+		for (int inC = 1; inC <= MAX_CHANNELS; ++inC) {
+			for (int outC = 1; outC <= MAX_CHANNELS; ++outC) {
+				for (int pad : {0, 1}) {
+					const int h = 3;
+					const int inPixel = inC + pad;
+					std::vector<Tin> in(w * h * inPixel);
+					for (auto& v : in)
+						v = randomSample<Tin>(state);
+
+					std::vector<Tout> expected(w * h * outC), actual(w * h * outC);
+					const int inStride = inPixel * sizeof(Tin);
+					convert_generic_scalar<Tin, Tout>(in.data(), expected.data(), w, h, inC, outC, inStride, -1, -1, -1, defs);
+					convert_generic<Tin, Tout>(in.data(), actual.data(), w, h, inC, outC, inStride, -1, defs);
+
+					for (size_t i = 0; i < expected.size(); ++i)
+						ASSERT_EQ(expected[i], actual[i]) << "w=" << w << " inC=" << inC << " outC=" << outC << " pad=" << pad << " i=" << i;
+				}
+			}
+		}
+	}
+}
+
+// Run fn once at every kernel level this CPU supports
+template<typename F>
+static void forEachLevel(F&& fn) {
+	const cpu::Level best = cpu::detected();
+	for (int l = 0; l <= int(best); ++l) {
+		ASSERT_TRUE(cpu::set_level(cpu::Level(l)));
+		fn();
+	}
+	cpu::set_level(best);
+}
+
+TEST(ImageTests, SimdMatchesScalar)
+{
+	forEachLevel([]{
+		runSimdTest<uint8_t, uint8_t>();
+		runSimdTest<uint8_t, uint16_t>();
+		runSimdTest<uint8_t, float>();
+		runSimdTest<uint16_t, uint8_t>();
+		runSimdTest<uint16_t, uint16_t>();
+		runSimdTest<uint16_t, float>();
+		runSimdTest<float, uint8_t>();
+		runSimdTest<float, uint16_t>();
+		runSimdTest<float, float>();
+	});
+}
+
+// Convert a region out of the middle of a larger image
+TEST(ImageTests, ConvertRect)
+{
+	const int w = 37, h = 9, x0 = 5, y0 = 2, rw = 19, rh = 5;
+	std::vector<uint8_t> in(w * h * 4);
+	for (size_t i = 0; i < in.size(); ++i)
+		in[i] = uint8_t(i * 31);
+
+	forEachLevel([&]{
+		std::vector<uint16_t> out(rw * rh * 3);
+		convert_generic_rect<uint8_t, uint16_t>(in.data() + (y0 * w + x0) * 4, out.data(), rw, rh, 4, 3, -1, -1, w * 4, -1);
+		for (int y = 0; y < rh; ++y)
+			for (int x = 0; x < rw; ++x)
+				for (int c = 0; c < 3; ++c)
+					ASSERT_EQ(out[(y * rw + x) * 3 + c], in[((y0 + y) * w + x0 + x) * 4 + c] * 257);
+	});
+}
+
+TEST(ImageTests, SwizzleMultiplePixels)
+{
+	uint16_t img[3 * 5];
+	for (int i = 0; i < 15; ++i)
+		img[i] = uint16_t(i);
+	ASSERT_TRUE(swizzle<uint16_t>(img, 5, 1, 3, make_swizzle(2, 1, 0, 3)));
+	for (int p = 0; p < 5; ++p) {
+		ASSERT_EQ(img[p * 3 + 0], p * 3 + 2);
+		ASSERT_EQ(img[p * 3 + 1], p * 3 + 1);
+		ASSERT_EQ(img[p * 3 + 2], p * 3 + 0);
+	}
+}
+
+template<typename T>
+static void runSwizzleTest() {
+	uint32_t state = 99;
+	const PixelF defs = {0.25f, 0.5f, 0.75f, 1.f};
+	T tdefs[MAX_CHANNELS];
+	for (int c = 0; c < MAX_CHANNELS; ++c)
+		tdefs[c] = detail::fromfloat<T>(defs.d[c]);
+
+	const uint32_t masks[] = {NO_SWIZZLE, SWIZZLE_BGRA, SWIZZLE_ABGR, SWIZZLE_ARGB, SWIZZLE_GBAR, SWIZZLE_RRRA, make_swizzle(3, 3, 1, 0)};
+	for (int w : {1, 5, 67}) {
+		for (int inC = 1; inC <= MAX_CHANNELS; ++inC) {
+			for (int outC = 1; outC <= MAX_CHANNELS; ++outC) {
+				for (uint32_t mask : masks) {
+					std::vector<T> in(w * 3 * inC);
+					for (auto& v : in)
+						v = randomSample<T>(state);
+
+					std::vector<T> expected(w * 3 * outC), actual(w * 3 * outC);
+					detail::swizzle_table<T>[inC - 1][outC - 1](in.data(), expected.data(), w * 3, mask, tdefs);
+					ASSERT_TRUE(swizzle_convert<T>(in.data(), actual.data(), w, 3, inC, outC, mask, defs));
+					ASSERT_EQ(expected, actual) << "w=" << w << " inC=" << inC << " outC=" << outC << " mask=" << mask;
+
+					// In place
+					if (inC == outC) {
+						ASSERT_TRUE(swizzle_convert<T>(in.data(), in.data(), w, 3, inC, outC, mask, defs));
+						ASSERT_EQ(expected, in) << "in place, w=" << w << " inC=" << inC << " mask=" << mask;
+					}
+				}
+			}
+		}
+	}
+}
+
+TEST(ImageTests, SwizzleKernels)
+{
+	forEachLevel([]{
+		runSwizzleTest<uint8_t>();
+		runSwizzleTest<uint16_t>();
+		runSwizzleTest<float>();
+	});
+}
+
+// Integer conversions must be exact (widening) or correctly rounded (narrowing) for every value
+TEST(ImageTests, ExactIntegerConversions)
+{
+	forEachLevel([]{
+		std::vector<uint16_t> wide(65536);
+		std::vector<uint8_t> narrow(65536);
+		for (int i = 0; i < 65536; ++i)
+			wide[i] = uint16_t(i);
+		convert_generic<uint16_t, uint8_t>(wide.data(), narrow.data(), 256, 256, 1, 1);
+		for (int i = 0; i < 65536; ++i)
+			ASSERT_EQ(narrow[i], uint8_t(i * 255.0 / 65535.0 + 0.5)) << i;
+
+		for (int i = 0; i < 256; ++i)
+			narrow[i] = uint8_t(i);
+		convert_generic<uint8_t, uint16_t>(narrow.data(), wide.data(), 256, 1, 1, 1);
+		for (int i = 0; i < 256; ++i)
+			ASSERT_EQ(wide[i], i * 257) << i;
+	});
+
+	runTest<uint8_t, uint8_t>(33, 7, 3, 4, {1, 2, 3, 0}, {1, 2, 3, 0xFF});
+	runTest<uint8_t, uint8_t>(33, 7, 4, 3, {1, 2, 3, 4}, {1, 2, 3, 0});
+	runTest<uint16_t, uint16_t>(33, 7, 3, 4, {1000, 2000, 3000, 0}, {1000, 2000, 3000, 0xFFFF});
+	runTest<uint16_t, uint16_t>(33, 7, 4, 3, {1000, 2000, 3000, 4000}, {1000, 2000, 3000, 0});
+}
+
+template<typename T>
+static void runProcessTest() {
+	uint32_t state = 4321;
+	const T full = std::is_same_v<T, float> ? T(1) : std::numeric_limits<T>::max();
+	for (int comps = 1; comps <= MAX_CHANNELS; ++comps) {
+		const size_t count = 101;
+		std::vector<T> expected(count * comps);
+		for (auto& v : expected)
+			v = randomSample<T>(state);
+		std::vector<T> actual = expected;
+
+		for (size_t i = 0; i < expected.size(); i += comps) {
+			if (comps > 1)
+				expected[i + 1] = T(full - expected[i + 1]);
+			if (comps > 3)
+				expected[i + 3] = T(full - expected[i + 3]);
+		}
+
+		kernels::active()->process[kernels::sample_type<T>](actual.data(), count, comps, true, true);
+		ASSERT_EQ(expected, actual) << "comps=" << comps;
+	}
+}
+
+TEST(ImageTests, ProcessKernels)
+{
+	forEachLevel([]{
+		if (!kernels::active())
+			return;
+		runProcessTest<uint8_t>();
+		runProcessTest<uint16_t>();
+		runProcessTest<float>();
+	});
+}
+
+// Decode the color half of a BC1/BC3 block, enough to check the encoder against
+static void decodeColorBlock(const uint8_t* block, uint8_t (&out)[16][4]) {
+	const int c0 = block[0] | (block[1] << 8), c1 = block[2] | (block[3] << 8);
+	int pal[4][4];
+	for (int i = 0; i < 2; ++i) {
+		const int c = i ? c1 : c0;
+		pal[i][0] = ((c >> 11) << 3) | (c >> 13);
+		pal[i][1] = (((c >> 5) & 63) << 2) | ((c >> 9) & 3);
+		pal[i][2] = ((c & 31) << 3) | ((c >> 2) & 7);
+		pal[i][3] = 255;
+	}
+	for (int j = 0; j < 3; ++j) {
+		pal[2][j] = c0 > c1 ? (2 * pal[0][j] + pal[1][j] + 1) / 3 : (pal[0][j] + pal[1][j]) / 2;
+		pal[3][j] = c0 > c1 ? (pal[0][j] + 2 * pal[1][j] + 1) / 3 : 0;
+	}
+	pal[2][3] = 255;
+	pal[3][3] = c0 > c1 ? 255 : 0;
+
+	for (int i = 0; i < 16; ++i) {
+		const int idx = (block[4 + i / 4] >> ((i % 4) * 2)) & 3;
+		for (int j = 0; j < 4; ++j)
+			out[i][j] = pal[idx][j];
+	}
+}
+
+// Decode a BC7 mode 6 block, which is all the fast preset writes
+static void decodeBc7Mode6Block(const uint8_t* block, uint8_t (&out)[16][4]) {
+	int pos = 0;
+	const auto bits = [&](int count)
+	{
+		int v = 0;
+		for (int i = 0; i < count; ++i, ++pos)
+			v |= ((block[pos / 8] >> (pos % 8)) & 1) << i;
+		return v;
+	};
+
+	ASSERT_EQ(bits(7), 0x40);
+	int ep[2][4];
+	for (int c = 0; c < 4; ++c)
+		for (int e = 0; e < 2; ++e)
+			ep[e][c] = bits(7) << 1;
+	for (int e = 0; e < 2; ++e) {
+		const int p = bits(1);
+		for (int c = 0; c < 4; ++c)
+			ep[e][c] |= p;
+	}
+
+	static constexpr int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+	for (int i = 0; i < 16; ++i) {
+		const int w = weights[bits(i == 0 ? 3 : 4)];
+		for (int c = 0; c < 4; ++c)
+			out[i][c] = uint8_t(((64 - w) * ep[0][c] + w * ep[1][c] + 32) >> 6);
+	}
+}
+
+TEST(ImageTests, BlockCompression)
+{
+	// Smooth gradient, every preset should get close
+	uint8_t rgba[64];
+	for (int i = 0; i < 16; ++i) {
+		rgba[i * 4 + 0] = uint8_t(60 + i * 4);
+		rgba[i * 4 + 1] = uint8_t(200 - i * 3);
+		rgba[i * 4 + 2] = uint8_t(100 + i);
+		rgba[i * 4 + 3] = (i & 1) ? 255 : 0;
+	}
+
+	for (auto quality : {bcn::Quality::Fast, bcn::Quality::Normal, bcn::Quality::High}) {
+		uint8_t block[16], decoded[16][4];
+
+		bcn::encode_block(bcn::Format::BC1, rgba, block, quality);
+		decodeColorBlock(block, decoded);
+		for (int i = 0; i < 16; ++i) {
+			for (int j = 0; j < 3; ++j)
+				ASSERT_NEAR(decoded[i][j], rgba[i * 4 + j], 12) << "quality=" << bcn::quality_name(quality);
+			ASSERT_EQ(decoded[i][3], 255);
+		}
+
+		// One bit alpha keeps transparent texels transparent
+		bcn::encode_block(bcn::Format::BC1A, rgba, block, quality);
+		decodeColorBlock(block, decoded);
+		for (int i = 0; i < 16; ++i)
+			ASSERT_EQ(decoded[i][3], rgba[i * 4 + 3]) << "quality=" << bcn::quality_name(quality);
+
+		// Single channel blocks of one value should store that value exactly
+		uint8_t flat[64];
+		for (int i = 0; i < 64; ++i)
+			flat[i] = 77;
+		bcn::encode_block(bcn::Format::BC4, flat, block, quality);
+		ASSERT_EQ(block[0], 77);
+		ASSERT_EQ(block[1], 77);
+	}
+}
+
+TEST(ImageTests, BlockCompressionBC7)
+{
+	uint8_t rgba[64];
+	for (int i = 0; i < 16; ++i) {
+		rgba[i * 4 + 0] = uint8_t(60 + i * 4);
+		rgba[i * 4 + 1] = uint8_t(200 - i * 3);
+		rgba[i * 4 + 2] = uint8_t(100 + i);
+		rgba[i * 4 + 3] = uint8_t(255 - i * 8);
+	}
+
+	uint8_t block[16], decoded[16][4];
+	bcn::encode_block(bcn::Format::BC7, rgba, block, bcn::Quality::Fast);
+	decodeBc7Mode6Block(block, decoded);
+	for (int i = 0; i < 16; ++i)
+		for (int j = 0; j < 4; ++j)
+			ASSERT_NEAR(decoded[i][j], rgba[i * 4 + j], 4);
+
+	// Solid blocks land within one step, a p-bit is shared by every channel of an endpoint so can't always match
+	for (int i = 0; i < 16; ++i) {
+		rgba[i * 4 + 0] = 77;
+		rgba[i * 4 + 1] = 140;
+		rgba[i * 4 + 2] = 201;
+		rgba[i * 4 + 3] = 255;
+	}
+	bcn::encode_block(bcn::Format::BC7, rgba, block, bcn::Quality::Fast);
+	decodeBc7Mode6Block(block, decoded);
+	for (int i = 0; i < 16; ++i)
+		for (int j = 0; j < 4; ++j)
+			ASSERT_NEAR(decoded[i][j], rgba[i * 4 + j], 1);
+}
+
+TEST(ImageTests, BlockDecoding)
+{
+	// Gradient color with a hard edge down the middle and varying alpha, so BC7 has a reason to try every mode
+	uint8_t rgba[64];
+	for (int i = 0; i < 16; ++i) {
+		const bool right = (i % 4) >= 2;
+		rgba[i * 4 + 0] = uint8_t(right ? 200 - i * 2 : 40 + i * 3);
+		rgba[i * 4 + 1] = uint8_t(right ? 30 + i : 180 - i * 4);
+		rgba[i * 4 + 2] = uint8_t(90 + i * 5);
+		rgba[i * 4 + 3] = uint8_t(255 - i * 12);
+	}
+
+	uint8_t block[16], decoded[64], reference[16][4];
+
+	// Must agree exactly with the reference decoders above
+	bcn::encode_block(bcn::Format::BC1, rgba, block, bcn::Quality::Normal);
+	bcn::decode_block(bcn::Format::BC1, block, decoded);
+	decodeColorBlock(block, reference);
+	ASSERT_EQ(std::memcmp(decoded, reference, sizeof(decoded)), 0);
+
+	bcn::encode_block(bcn::Format::BC7, rgba, block, bcn::Quality::Fast);
+	bcn::decode_block(bcn::Format::BC7, block, decoded);
+	decodeBc7Mode6Block(block, reference);
+	ASSERT_EQ(std::memcmp(decoded, reference, sizeof(decoded)), 0);
+
+	// BC2 and BC3 color blocks decode like BC1, alpha and single channels land within half a palette step of the
+	// source
+	struct {
+		bcn::Format format;
+		int firstChannel, lastChannel;
+		int tolerance;
+	} cases[] = {
+		{bcn::Format::BC2, 3, 3, 9},
+		{bcn::Format::BC3, 3, 3, 14},
+		{bcn::Format::BC4, 0, 0, 14},
+		{bcn::Format::BC5, 0, 1, 14},
+		{bcn::Format::BC7, 0, 3, 10},
+	};
+	for (auto& c : cases) {
+		for (auto quality : {bcn::Quality::Fast, bcn::Quality::Normal, bcn::Quality::High}) {
+			// Fast BC7 is mode 6 only, which can't follow the edge. It's checked exactly above
+			if (c.format == bcn::Format::BC7 && quality == bcn::Quality::Fast)
+				continue;
+			bcn::encode_block(c.format, rgba, block, quality);
+			bcn::decode_block(c.format, block, decoded);
+			for (int i = 0; i < 16; ++i)
+				for (int j = c.firstChannel; j <= c.lastChannel; ++j)
+					ASSERT_NEAR(decoded[i * 4 + j], rgba[i * 4 + j], c.tolerance)
+						<< "format=" << int(c.format) << " quality=" << bcn::quality_name(quality);
+
+			if (c.format == bcn::Format::BC2 || c.format == bcn::Format::BC3) {
+				decodeColorBlock(block + 8, reference);
+				for (int i = 0; i < 16; ++i)
+					for (int j = 0; j < 3; ++j)
+						ASSERT_EQ(decoded[i * 4 + j], reference[i][j]);
+			}
+		}
+	}
+
+	// Whole images go straight into the destination stride, partial blocks are clipped
+	constexpr int w = 6, h = 5, stride = w * 3 + 5;
+	uint8_t image[w * h * 4];
+	for (int i = 0; i < w * h; ++i) {
+		image[i * 4 + 0] = uint8_t(60 + i * 2);
+		image[i * 4 + 1] = uint8_t(200 - i * 2);
+		image[i * 4 + 2] = 128;
+		image[i * 4 + 3] = 255;
+	}
+	std::vector<uint8_t> blocks(bcn::image_size(bcn::Format::BC1, w, h));
+	bcn::encode_image(bcn::Format::BC1, image, w, h, blocks.data(), bcn::Quality::High);
+
+	std::vector<uint8_t> rgb(stride * h, 0xCD);
+	bcn::decode_image(bcn::Format::BC1, blocks.data(), w, h, rgb.data(), stride, 3);
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x)
+			for (int j = 0; j < 3; ++j)
+				ASSERT_NEAR(rgb[y * stride + x * 3 + j], image[(y * w + x) * 4 + j], 16);
+		for (int x = w * 3; x < stride; ++x)
+			ASSERT_EQ(rgb[y * stride + x], 0xCD);
+	}
+}
+
+TEST(ImageTests, MipFilters)
+{
+	forEachLevel([]{
+		// 2x2 boxes of a known average
+		uint8_t src[4 * 4 * 4], dst[2 * 2 * 4];
+		for (int y = 0; y < 4; ++y) {
+			for (int x = 0; x < 4; ++x) {
+				uint8_t* px = src + (y * 4 + x) * 4;
+				px[0] = uint8_t((x / 2) * 100 + (x & 1) * 10);
+				px[1] = uint8_t((y / 2) * 100 + (y & 1) * 20);
+				px[2] = 50;
+				px[3] = (x + y) & 1 ? 0 : 255;
+			}
+		}
+
+		imglib::MipResampler(imglib::ChannelType::UInt8, 4, 4, 4, 2, 2, imglib::MipFilter::Box, false).resample(src, dst);
+		for (int y = 0; y < 2; ++y) {
+			for (int x = 0; x < 2; ++x) {
+				const uint8_t* px = dst + (y * 2 + x) * 4;
+				ASSERT_EQ(px[0], x * 100 + 5);
+				ASSERT_EQ(px[1], y * 100 + 10);
+				ASSERT_EQ(px[2], 50);
+				ASSERT_EQ(px[3], 128);
+			}
+		}
+
+		// Black and white average to half the light in sRGB, not half the value. Alpha stays linear
+		for (int i = 0; i < 16; ++i) {
+			src[i * 4 + 0] = src[i * 4 + 1] = src[i * 4 + 2] = (i & 1) ? 255 : 0;
+			src[i * 4 + 3] = (i & 1) ? 255 : 0;
+		}
+		imglib::MipResampler(imglib::ChannelType::UInt8, 4, 4, 4, 2, 2, imglib::MipFilter::Box, true).resample(src, dst);
+		for (int i = 0; i < 4; ++i) {
+			ASSERT_EQ(dst[i * 4 + 0], 188);
+			ASSERT_EQ(dst[i * 4 + 3], 128);
+		}
+
+		// Every filter keeps a flat image flat, including odd sizes and 1 texel wide edges
+		for (auto filter : {imglib::MipFilter::Box, imglib::MipFilter::Kaiser, imglib::MipFilter::CatmullRom}) {
+			std::vector<uint16_t> flat(37 * 5 * 4, 12345), out(18 * 2 * 4);
+			imglib::MipResampler(imglib::ChannelType::UInt16, 4, 37, 5, 18, 2, filter, false).resample(flat.data(), out.data());
+			for (auto v : out)
+				ASSERT_NEAR(v, 12345, 1);
+
+			std::vector<float> line(1 * 9 * 3, 0.25f), lineOut(1 * 4 * 3);
+			imglib::MipResampler(imglib::ChannelType::Float, 3, 1, 9, 1, 4, filter, false).resample(line.data(), lineOut.data());
+			for (auto v : lineOut)
+				ASSERT_NEAR(v, 0.25f, 1e-5f);
+		}
+	});
+}
+
+TEST(ImageTests, MipStreamMatchesWholeImage)
+{
+	// Resize then mip an odd sized image, both at once and streamed
+	const imglib::StageSizes sizes = {{300, 177}, {256, 128}, {128, 64}, {64, 32}, {32, 16}, {16, 8}, {8, 4}, {4, 2}};
+	std::vector<std::vector<float>> whole(sizes.size());
+	whole[0].resize(size_t(300) * 177 * 4);
+	for (size_t i = 0; i < whole[0].size(); ++i)
+		whole[0][i] = float((i * 2654435761u) >> 24) / 255.f;
+
+	for (size_t s = 1; s < sizes.size(); ++s) {
+		whole[s].resize(size_t(sizes[s].first) * sizes[s].second * 4);
+		imglib::MipResampler(
+			imglib::ChannelType::Float, 4, sizes[s - 1].first, sizes[s - 1].second, sizes[s].first, sizes[s].second,
+			imglib::MipFilter::Kaiser, false)
+			.resample(whole[s - 1].data(), whole[s].data());
+	}
+
+	std::vector<int> next(sizes.size(), 0);
+	imglib::stream_mips(
+		sizes, imglib::MipFilter::Kaiser,
+		[&](int y, float* out) { std::memcpy(out, &whole[0][size_t(y) * 300 * 4], 300 * 4 * sizeof(float)); },
+		[&](int stage, int y0, int count, const float* const* rows)
+		{
+			const int w = sizes[stage].first;
+			ASSERT_EQ(y0, next[stage]);
+			ASSERT_EQ(y0 % 4, 0);
+			ASSERT_TRUE(count % 4 == 0 || y0 + count == sizes[stage].second);
+			next[stage] += count;
+
+			for (int i = 0; i < count; ++i)
+				for (int x = 0; x < w * 4; ++x)
+					ASSERT_EQ(rows[i][x], whole[stage][size_t(y0 + i) * w * 4 + x]);
+		});
+
+	for (size_t s = 0; s < sizes.size(); ++s)
+		ASSERT_EQ(next[s], sizes[s].second);
+}
+
+TEST(ImageTests, DeflateRoundTrip)
+{
+	if (!zstream::available())
+		GTEST_SKIP() << "Built without a DEFLATE backend";
+
+	std::vector<uint8_t> data(100000);
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = uint8_t((i / 7) * 31);
+
+	std::vector<uint8_t> compressed;
+	ASSERT_TRUE(zstream::compress(data.data(), data.size(), 6, compressed));
+	ASSERT_LT(compressed.size(), data.size());
+
+	std::vector<uint8_t> out(data.size());
+	ASSERT_TRUE(zstream::decompress(compressed.data(), compressed.size(), out.data(), out.size()));
+	ASSERT_EQ(out, data);
+
+	// Streams that don't inflate to exactly the expected size are rejected
+	std::vector<uint8_t> small(data.size() - 1);
+	ASSERT_FALSE(zstream::decompress(compressed.data(), compressed.size(), small.data(), small.size()));
+}
+
+TEST(ImageTests, HeaderClearFlags)
+{
+	const auto original = readTestFile("deflatecat.vtf");
+	ASSERT_FALSE(original.empty());
+	const auto path = writeTempFile("vtex2_clear_flags.vtf", original);
+
+	// Set a couple of flags, then clear one of them again
+	vtf::Header header;
+	std::string error;
+	ASSERT_TRUE(vtf::read_header(path, header, error)) << error;
+	header.flags |= TEXTUREFLAGS_SRGB | TEXTUREFLAGS_CLAMPS;
+	ASSERT_TRUE(vtf::write_header(path, header, error)) << error;
+
+	ASSERT_TRUE(vtf::read_header(path, header, error)) << error;
+	ASSERT_EQ(header.flags & (TEXTUREFLAGS_SRGB | TEXTUREFLAGS_CLAMPS), TEXTUREFLAGS_SRGB | TEXTUREFLAGS_CLAMPS);
+	header.flags &= ~std::uint32_t(TEXTUREFLAGS_SRGB);
+	ASSERT_TRUE(vtf::write_header(path, header, error)) << error;
+
+	ASSERT_TRUE(vtf::read_header(path, header, error)) << error;
+	ASSERT_EQ(header.flags & TEXTUREFLAGS_SRGB, 0u);
+	ASSERT_EQ(header.flags & TEXTUREFLAGS_CLAMPS, std::uint32_t(TEXTUREFLAGS_CLAMPS));
+
+	std::filesystem::remove(path);
+}
+
+TEST(ImageTests, ThreadPool)
+{
+	util::ThreadPool pool(4);
+	ASSERT_EQ(pool.size(), 4);
+
+	// Tasks submitted from outside, each submitting more from inside of the pool
+	std::atomic<int> ran{0};
+	for (int i = 0; i < 100; ++i) {
+		pool.submit(
+			[&]
+			{
+				ASSERT_EQ(util::ThreadPool::current(), &pool);
+				++ran;
+				for (int j = 0; j < 10; ++j)
+					util::ThreadPool::current()->submit(
+						[&]
+						{
+							++ran;
+						});
+			});
+	}
+	pool.wait();
+	ASSERT_EQ(ran.load(), 1100);
+	ASSERT_EQ(util::ThreadPool::current(), nullptr);
+
+	// parallel_for is how tasks wait on more work, nested inside of the pool's own tasks
+	std::vector<std::atomic<int>> hits(64 * 64);
+	for (int i = 0; i < 64; ++i) {
+		pool.submit(
+			[&, i]
+			{
+				util::parallel_for(
+					64,
+					[&](std::size_t j)
+					{
+						++hits[i * 64 + j];
+					});
+			});
+	}
+	pool.wait();
+	for (auto& hit : hits)
+		ASSERT_EQ(hit.load(), 1);
+
+	// The pool can be waited on again once it ran dry
+	pool.wait();
+}
+
+TEST(ImageTests, VTFDeflateRoundTrip)
+{
+	if (!zstream::available())
+		GTEST_SKIP() << "Built without a DEFLATE backend";
+
+	const auto original = readTestFile("deflatecat.vtf");
+	ASSERT_FALSE(original.empty());
+	VTFLib::CVTFFile source;
+	ASSERT_TRUE(vtf::load(&source, original.data(), original.size()));
+
+	// Deflate a 7.6 file that already has aux compression info
+	source.SetAuxCompressionLevel(6);
+	std::vector<uint8_t> deflated;
+	ASSERT_TRUE(vtf::save(&source, deflated));
+	expectStreams(deflated, source, 6);
+
+	// Both our loader and VTFLib's have to read it back the same
+	VTFLib::CVTFFile loaded;
+	ASSERT_TRUE(vtf::load(&loaded, deflated.data(), deflated.size()));
+	ASSERT_EQ(loaded.GetAuxCompressionLevel(), 6);
+	expectSameVTF(source, loaded);
+
+	VTFLib::CVTFFile vtflibLoaded;
+	ASSERT_TRUE(vtflibLoaded.Load(deflated.data(), static_cast<vlUInt>(deflated.size()), vlFalse));
+	expectSameVTF(source, vtflibLoaded);
+
+	// Saving what was loaded deflates it again
+	std::vector<uint8_t> resaved;
+	ASSERT_TRUE(vtf::save(&loaded, resaved));
+	expectStreams(resaved, source, 6);
+
+	// Upgrading a 7.5 file, like recompress does. If VTFLib didn't write the aux compression info for it, vtf::save
+	// has to add it to the resource dictionary
+	source.SetAuxCompressionLevel(0);
+	ASSERT_TRUE(source.SetVersion(7, 5));
+	std::vector<uint8_t> old;
+	ASSERT_TRUE(vtf::save(&source, old));
+	vtf::Header oldHeader;
+	std::string error;
+	ASSERT_TRUE(vtf::read_header(old.data(), old.size(), oldHeader, error)) << error;
+	ASSERT_EQ(oldHeader.minorVersion, 5u);
+
+	VTFLib::CVTFFile upgraded;
+	ASSERT_TRUE(vtf::load(&upgraded, old.data(), old.size()));
+	ASSERT_TRUE(upgraded.SetVersion(7, 6));
+	ASSERT_TRUE(upgraded.SetAuxCompressionLevel(9));
+	std::vector<uint8_t> upgradedData;
+	ASSERT_TRUE(vtf::save(&upgraded, upgradedData));
+	expectStreams(upgradedData, upgraded, 9);
+
+	VTFLib::CVTFFile upgradedLoaded, upgradedVtflibLoaded;
+	ASSERT_TRUE(vtf::load(&upgradedLoaded, upgradedData.data(), upgradedData.size()));
+	ASSERT_TRUE(
+		upgradedVtflibLoaded.Load(upgradedData.data(), static_cast<vlUInt>(upgradedData.size()), vlFalse));
+	expectSameVTF(source, upgradedLoaded);
+	expectSameVTF(source, upgradedVtflibLoaded);
+}
+
+TEST(ImageTests, HeaderMatchesVTFLib)
+{
+	const auto original = readTestFile("deflatecat.vtf");
+	ASSERT_FALSE(original.empty());
+	expectHeaderMatchesVTFLib(original);
+
+	// Reading from a file and from memory give the same result
+	vtf::Header fromFile, fromMemory;
+	std::string error;
+	const auto path = writeTempFile("vtex2_read_header.vtf", original);
+	ASSERT_TRUE(vtf::read_header(path, fromFile, error)) << error;
+	ASSERT_TRUE(vtf::read_header(original.data(), original.size(), fromMemory, error)) << error;
+	ASSERT_EQ(fromFile.width, fromMemory.width);
+	ASSERT_EQ(fromFile.flags, fromMemory.flags);
+	ASSERT_EQ(fromFile.fileSize, original.size());
+	ASSERT_EQ(fromFile.resources.size(), fromMemory.resources.size());
+	std::filesystem::remove(path);
+
+	// Environment maps of every version, which store a sphere map before 7.5 unless the start frame is -1. From 7.3
+	// on they have a key value resource too
+	for (vlUInt minor = 1; minor <= 6; ++minor) {
+		for (bool sphereMap : {true, false}) {
+			VTFLib::CVTFFile file;
+			ASSERT_TRUE(file.Init(32, 16, 1, 6, 1, IMAGE_FORMAT_RGBA8888, vlTrue, -1));
+			ASSERT_TRUE(file.SetVersion(7, minor));
+			if (minor >= 3) {
+				char kvd[] = "\"test\" { \"a\" \"b\" }";
+				file.SetResourceData(VTF_RSRC_KEY_VALUE_DATA, sizeof(kvd), kvd);
+			}
+
+			std::vector<uint8_t> data(1024 * 1024);
+			vlUInt size = 0;
+			ASSERT_TRUE(file.Save(data.data(), static_cast<vlUInt>(data.size()), size));
+			data.resize(size);
+
+			// A start frame of -1 drops the sphere map, leaving the file with more data than it needs
+			if (!sphereMap)
+				data[26] = data[27] = 0xFF;
+			SCOPED_TRACE("7." + std::to_string(minor) + (sphereMap ? " with sphere map" : ""));
+			expectHeaderMatchesVTFLib(data);
+		}
+	}
+}
+
+TEST(ImageTests, HeaderRejectsInvalid)
+{
+	const auto original = readTestFile("deflatecat.vtf");
+	ASSERT_FALSE(original.empty());
+
+	// Anything that isn't a complete VTF header is refused
+	vtf::Header header;
+	std::string error;
+	auto truncated = original;
+	truncated.resize(40);
+	ASSERT_FALSE(vtf::read_header(truncated.data(), truncated.size(), header, error));
+	auto badVersion = original;
+	badVersion[8] = 9;
+	ASSERT_FALSE(vtf::read_header(badVersion.data(), badVersion.size(), header, error));
+	auto badSignature = original;
+	badSignature[0] = 'X';
+	ASSERT_FALSE(vtf::read_header(badSignature.data(), badSignature.size(), header, error));
+
+	// As are resources that point past the end of the file
+	auto badResource = original;
+	const std::uint32_t pastEnd = static_cast<std::uint32_t>(original.size());
+	for (std::size_t i = 80; i < 80 + 8 * 5; i += 8) {
+		std::uint32_t type;
+		std::memcpy(&type, &badResource[i], sizeof(type));
+		if (type == VTF_RSRC_AUX_COMPRESSION_INFO)
+			std::memcpy(&badResource[i + 4], &pastEnd, sizeof(pastEnd));
+	}
+	ASSERT_FALSE(vtf::read_header(badResource.data(), badResource.size(), header, error));
+	ASSERT_TRUE(vtf::read_header(original.data(), original.size(), header, error)) << error;
+}
+
+TEST(ImageTests, HeaderWriteOnlyPatchesFields)
+{
+	const auto original = readTestFile("deflatecat.vtf");
+	ASSERT_FALSE(original.empty());
+	const auto path = writeTempFile("vtex2_write_header.vtf", original);
+
+	vtf::Header header;
+	std::string error;
+	ASSERT_TRUE(vtf::read_header(path, header, error)) << error;
+	header.flags |= TEXTUREFLAGS_NORMAL;
+	header.startFrame = 3;
+	header.bumpScale = 2.5f;
+	ASSERT_TRUE(vtf::write_header(path, header, error)) << error;
+
+	// Flags at 20, start frame at 26 and bump scale at 48 change, every other byte stays the same
+	const auto patched = readFile(path);
+	ASSERT_EQ(patched.size(), original.size());
+	for (std::size_t i = 0; i < original.size(); ++i) {
+		const bool field = (i >= 20 && i < 24) || (i >= 26 && i < 28) || (i >= 48 && i < 52);
+		if (!field)
+			ASSERT_EQ(patched[i], original[i]) << "byte " << i;
+	}
+
+	vtf::Header reread;
+	ASSERT_TRUE(vtf::read_header(path, reread, error)) << error;
+	ASSERT_EQ(reread.flags, header.flags);
+	ASSERT_EQ(reread.startFrame, 3u);
+	ASSERT_EQ(reread.bumpScale, 2.5f);
+
+	// Toggling the environment map flag would change the face count
+	auto envmap = reread;
+	envmap.flags |= TEXTUREFLAGS_ENVMAP;
+	ASSERT_FALSE(vtf::write_header(path, envmap, error));
+
+	// So would adding or removing the sphere map of a pre 7.5 environment map
+	auto old = original;
+	old[8] = 4;
+	const std::uint32_t envmapFlag = TEXTUREFLAGS_ENVMAP;
+	std::memcpy(&old[20], &envmapFlag, sizeof(envmapFlag));
+	writeTempFile("vtex2_write_header.vtf", old);
+	ASSERT_TRUE(vtf::read_header(path, header, error)) << error;
+	ASSERT_EQ(header.faceCount, 7u);
+	header.startFrame = 0xFFFF;
+	ASSERT_FALSE(vtf::write_header(path, header, error));
+
+	// A header read from another version of the file is refused
+	ASSERT_TRUE(vtf::read_header(path, header, error)) << error;
+	header.minorVersion = 5;
+	ASSERT_FALSE(vtf::write_header(path, header, error));
+
+	// Nothing was written by any of the refused calls
+	ASSERT_EQ(readFile(path), old);
+	std::filesystem::remove(path);
+}
+
+TEST(ImageTests, Hash64KnownAnswers)
+{
+	// Reference values from the XXH64 spec implementation
+	ASSERT_EQ(util::hash64(std::string("")), 0xEF46DB3751D8E999ull);
+	ASSERT_EQ(util::hash64(std::string("a")), 0xD24EC4F1A98C6E5Bull);
+	ASSERT_EQ(util::hash64(std::string("abc")), 0x44BC2CF5AD770999ull);
+	ASSERT_EQ(util::hash64(std::string("xxhash")), 0x32DD38952C4BC720ull);
+	ASSERT_EQ(util::hash64(std::string("xxhash"), 20141025), 0xB559B98D844E0635ull);
+	ASSERT_EQ(util::hash64(std::string("Nobody inspects the spammish repetition")), 0xFBCEA83C8A378BF1ull);
+
+	// Three stripes, then 15 bytes to go through the 8, 4 and 1 byte tails
+	std::string bytes;
+	for (int i = 0; i < 111; ++i)
+		bytes += char(i * 37);
+	ASSERT_EQ(util::hash64(bytes), 0x2B2853FAA05DF03Eull);
+	ASSERT_EQ(util::hash64(bytes.data(), bytes.size(), 7), 0xB15DD8DE9705F3D0ull);
+
+	// Files hash the same every time, and differently once changed
+	std::vector<uint8_t> data(3 * 1024 * 1024);
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = uint8_t(i * 2654435761u >> 13);
+	const auto path = writeTempFile("vtex2_hash.bin", data);
+	std::uint64_t a = 0, b = 0, c = 0;
+	ASSERT_TRUE(util::hash_file(path, a));
+	ASSERT_TRUE(util::hash_file(path, b));
+	ASSERT_EQ(a, b);
+	data.back() ^= 1;
+	writeTempFile("vtex2_hash.bin", data);
+	ASSERT_TRUE(util::hash_file(path, c));
+	ASSERT_NE(a, c);
+	std::filesystem::remove(path);
+
+	ASSERT_FALSE(util::hash_file(path, a));
+}
+
+TEST(ImageTests, ConvertCacheRoundTrip)
+{
+	const auto dir = std::filesystem::temp_directory_path() / "vtex2_cache_test";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	const auto manifest = dir / "cache.txt";
+	const auto src = (dir / "source file.png").string();
+	const auto out = (dir / "out.vtf").string();
+	writeFile(src, {1, 2, 3, 4});
+	writeFile(out, {5, 6, 7});
+
+	// Nothing is up to date in a new manifest
+	vtex2::ConvertCache cache;
+	ASSERT_TRUE(cache.load(manifest));
+	std::uint64_t sourceHash = 0;
+	ASSERT_FALSE(cache.is_up_to_date(src, out, 42, sourceHash));
+	ASSERT_EQ(sourceHash, util::hash64(std::string("\x01\x02\x03\x04")));
+	cache.update(src, out, 42, sourceHash);
+	ASSERT_TRUE(cache.save());
+
+	// Reloading it gives the same answers
+	vtex2::ConvertCache reloaded;
+	ASSERT_TRUE(reloaded.load(manifest));
+	ASSERT_TRUE(reloaded.is_up_to_date(src, out, 42, sourceHash));
+	ASSERT_FALSE(reloaded.is_up_to_date(src, out, 43, sourceHash));
+	ASSERT_FALSE(reloaded.is_up_to_date(src, (dir / "other.vtf").string(), 42, sourceHash));
+
+	// Changing the output or the source makes it out of date. Rewrites keep the size, and move the modification time
+	// along in case the file system is too coarse to notice
+	const auto touch = [](const std::string& path, const std::vector<uint8_t>& data)
+	{
+		const auto time = std::filesystem::last_write_time(path);
+		writeFile(path, data);
+		std::filesystem::last_write_time(path, time + std::chrono::seconds(1));
+	};
+	touch(out, {5, 6, 8});
+	ASSERT_FALSE(reloaded.is_up_to_date(src, out, 42, sourceHash));
+	touch(out, {5, 6, 7});
+	ASSERT_TRUE(reloaded.is_up_to_date(src, out, 42, sourceHash));
+	touch(src, {1, 2, 3, 5});
+	ASSERT_FALSE(reloaded.is_up_to_date(src, out, 42, sourceHash));
+
+	// Manifests from other versions are ignored
+	writeFile(manifest.string(), {'x', '\n'});
+	ASSERT_TRUE(reloaded.load(manifest));
+	ASSERT_FALSE(reloaded.is_up_to_date(src, out, 42, sourceHash));
+
+	std::filesystem::remove_all(dir);
+}
@@ -0,0 +1,8 @@
+#!/usr/bin/env bash
+set -e
+cd "$(dirname "$0")"
+
+echo "Convert JPEG -> DXT1, 1024x1024 -> DXT1, 256x256 (top two mips dropped)"
+../build/vtex2 convert -f dxt1 --width 1024 --height 1024 -o convert-drop-mips.vtf funny-cat-2.jpg
+../build/vtex2 convert -f dxt1 --width 256 --height 256 -o convert-drop-mips.vtf convert-drop-mips.vtf
+../build/vtfview convert-drop-mips.vtf